@@ -0,0 +1,338 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include "gss-server.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GSS_AES_X86 1
+#include <immintrin.h>
+#endif
+
+
+static const guint8 gss_aes_sbox[256] = {
+  0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5,
+  0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+  0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0,
+  0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+  0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc,
+  0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+  0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a,
+  0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+  0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0,
+  0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+  0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b,
+  0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+  0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85,
+  0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+  0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5,
+  0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+  0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17,
+  0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+  0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88,
+  0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+  0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c,
+  0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+  0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9,
+  0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+  0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6,
+  0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+  0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e,
+  0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+  0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94,
+  0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+  0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68,
+  0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+/* Lookup tables combining SubBytes and MixColumns for one byte of a
+ * column, one table per row; built from the S-box on first use. */
+static guint32 gss_aes_te[4][256];
+
+static void (*gss_aes_cbc_blocks) (GssAesCbc * cbc, guint8 * dest,
+    const guint8 * src, gsize n_blocks);
+
+#define GSS_AES_XTIME(x) ((guint8) (((x) << 1) ^ (((x) & 0x80) ? 0x1b : 0)))
+#define GSS_AES_ROR8(x) (((x) >> 8) | ((x) << 24))
+
+static void
+gss_aes_init_tables (void)
+{
+  int i;
+
+  for (i = 0; i < 256; i++) {
+    guint8 s = gss_aes_sbox[i];
+    guint8 s2 = GSS_AES_XTIME (s);
+    guint8 s3 = s2 ^ s;
+    guint32 t;
+
+    t = ((guint32) s2 << 24) | ((guint32) s << 16) | ((guint32) s << 8) | s3;
+    gss_aes_te[0][i] = t;
+    gss_aes_te[1][i] = t = GSS_AES_ROR8 (t);
+    gss_aes_te[2][i] = t = GSS_AES_ROR8 (t);
+    gss_aes_te[3][i] = GSS_AES_ROR8 (t);
+  }
+}
+
+static guint32
+gss_aes_sub_word (guint32 w)
+{
+  return ((guint32) gss_aes_sbox[w >> 24] << 24) |
+      ((guint32) gss_aes_sbox[(w >> 16) & 0xff] << 16) |
+      ((guint32) gss_aes_sbox[(w >> 8) & 0xff] << 8) |
+      gss_aes_sbox[w & 0xff];
+}
+
+static void
+gss_aes_cbc_blocks_c (GssAesCbc * cbc, guint8 * dest, const guint8 * src,
+    gsize n_blocks)
+{
+  const guint32 *rk = cbc->round_keys;
+  guint32 c0, c1, c2, c3;
+  gsize i;
+  int r;
+
+  c0 = GST_READ_UINT32_BE (cbc->iv);
+  c1 = GST_READ_UINT32_BE (cbc->iv + 4);
+  c2 = GST_READ_UINT32_BE (cbc->iv + 8);
+  c3 = GST_READ_UINT32_BE (cbc->iv + 12);
+
+  for (i = 0; i < n_blocks; i++) {
+    guint32 s0, s1, s2, s3;
+    guint32 t0, t1, t2, t3;
+
+    s0 = GST_READ_UINT32_BE (src) ^ c0 ^ rk[0];
+    s1 = GST_READ_UINT32_BE (src + 4) ^ c1 ^ rk[1];
+    s2 = GST_READ_UINT32_BE (src + 8) ^ c2 ^ rk[2];
+    s3 = GST_READ_UINT32_BE (src + 12) ^ c3 ^ rk[3];
+
+    for (r = 1; r < 10; r++) {
+      t0 = gss_aes_te[0][s0 >> 24] ^ gss_aes_te[1][(s1 >> 16) & 0xff] ^
+          gss_aes_te[2][(s2 >> 8) & 0xff] ^ gss_aes_te[3][s3 & 0xff] ^
+          rk[4 * r];
+      t1 = gss_aes_te[0][s1 >> 24] ^ gss_aes_te[1][(s2 >> 16) & 0xff] ^
+          gss_aes_te[2][(s3 >> 8) & 0xff] ^ gss_aes_te[3][s0 & 0xff] ^
+          rk[4 * r + 1];
+      t2 = gss_aes_te[0][s2 >> 24] ^ gss_aes_te[1][(s3 >> 16) & 0xff] ^
+          gss_aes_te[2][(s0 >> 8) & 0xff] ^ gss_aes_te[3][s1 & 0xff] ^
+          rk[4 * r + 2];
+      t3 = gss_aes_te[0][s3 >> 24] ^ gss_aes_te[1][(s0 >> 16) & 0xff] ^
+          gss_aes_te[2][(s1 >> 8) & 0xff] ^ gss_aes_te[3][s2 & 0xff] ^
+          rk[4 * r + 3];
+      s0 = t0;
+      s1 = t1;
+      s2 = t2;
+      s3 = t3;
+    }
+
+    /* last round has no MixColumns */
+    c0 = (((guint32) gss_aes_sbox[s0 >> 24] << 24) |
+        ((guint32) gss_aes_sbox[(s1 >> 16) & 0xff] << 16) |
+        ((guint32) gss_aes_sbox[(s2 >> 8) & 0xff] << 8) |
+        gss_aes_sbox[s3 & 0xff]) ^ rk[40];
+    c1 = (((guint32) gss_aes_sbox[s1 >> 24] << 24) |
+        ((guint32) gss_aes_sbox[(s2 >> 16) & 0xff] << 16) |
+        ((guint32) gss_aes_sbox[(s3 >> 8) & 0xff] << 8) |
+        gss_aes_sbox[s0 & 0xff]) ^ rk[41];
+    c2 = (((guint32) gss_aes_sbox[s2 >> 24] << 24) |
+        ((guint32) gss_aes_sbox[(s3 >> 16) & 0xff] << 16) |
+        ((guint32) gss_aes_sbox[(s0 >> 8) & 0xff] << 8) |
+        gss_aes_sbox[s1 & 0xff]) ^ rk[42];
+    c3 = (((guint32) gss_aes_sbox[s3 >> 24] << 24) |
+        ((guint32) gss_aes_sbox[(s0 >> 16) & 0xff] << 16) |
+        ((guint32) gss_aes_sbox[(s1 >> 8) & 0xff] << 8) |
+        gss_aes_sbox[s2 & 0xff]) ^ rk[43];
+
+    GST_WRITE_UINT32_BE (dest, c0);
+    GST_WRITE_UINT32_BE (dest + 4, c1);
+    GST_WRITE_UINT32_BE (dest + 8, c2);
+    GST_WRITE_UINT32_BE (dest + 12, c3);
+
+    src += GSS_AES_BLOCK_SIZE;
+    dest += GSS_AES_BLOCK_SIZE;
+  }
+
+  GST_WRITE_UINT32_BE (cbc->iv, c0);
+  GST_WRITE_UINT32_BE (cbc->iv + 4, c1);
+  GST_WRITE_UINT32_BE (cbc->iv + 8, c2);
+  GST_WRITE_UINT32_BE (cbc->iv + 12, c3);
+}
+
+#ifdef GSS_AES_X86
+/* CBC encryption is inherently serial, so this runs at the latency of
+ * the AESENC instruction, still an order of magnitude faster than the
+ * table lookups. */
+__attribute__ ((target ("aes,sse2")))
+static void
+gss_aes_cbc_blocks_aesni (GssAesCbc * cbc, guint8 * dest, const guint8 * src,
+    gsize n_blocks)
+{
+  __m128i k[11];
+  __m128i c;
+  gsize i;
+  int r;
+
+  for (r = 0; r < 11; r++) {
+    k[r] = _mm_loadu_si128 ((const __m128i *) (cbc->round_key_bytes + 16 * r));
+  }
+  c = _mm_loadu_si128 ((const __m128i *) cbc->iv);
+
+  for (i = 0; i < n_blocks; i++) {
+    c = _mm_xor_si128 (c, _mm_loadu_si128 ((const __m128i *) src));
+    c = _mm_xor_si128 (c, k[0]);
+    c = _mm_aesenc_si128 (c, k[1]);
+    c = _mm_aesenc_si128 (c, k[2]);
+    c = _mm_aesenc_si128 (c, k[3]);
+    c = _mm_aesenc_si128 (c, k[4]);
+    c = _mm_aesenc_si128 (c, k[5]);
+    c = _mm_aesenc_si128 (c, k[6]);
+    c = _mm_aesenc_si128 (c, k[7]);
+    c = _mm_aesenc_si128 (c, k[8]);
+    c = _mm_aesenc_si128 (c, k[9]);
+    c = _mm_aesenclast_si128 (c, k[10]);
+    _mm_storeu_si128 ((__m128i *) dest, c);
+
+    src += GSS_AES_BLOCK_SIZE;
+    dest += GSS_AES_BLOCK_SIZE;
+  }
+
+  _mm_storeu_si128 ((__m128i *) cbc->iv, c);
+}
+#endif
+
+static gboolean
+gss_aes_have_aesni (void)
+{
+#ifdef GSS_AES_X86
+  __builtin_cpu_init ();
+  return __builtin_cpu_supports ("aes");
+#else
+  return FALSE;
+#endif
+}
+
+/* Selects the AES-NI implementation, if the CPU has it, or the portable
+ * one.  Returns TRUE if AES-NI is used.  Mostly for benchmarking, the
+ * best one is picked by default. */
+gboolean
+gss_aes_set_accelerated (gboolean enable)
+{
+  if (gss_aes_te[0][0] == 0) {
+    gss_aes_init_tables ();
+  }
+#ifdef GSS_AES_X86
+  if (enable && gss_aes_have_aesni ()) {
+    gss_aes_cbc_blocks = gss_aes_cbc_blocks_aesni;
+    return TRUE;
+  }
+#endif
+  gss_aes_cbc_blocks = gss_aes_cbc_blocks_c;
+  return FALSE;
+}
+
+void
+gss_aes_cbc_init (GssAesCbc * cbc, const guint8 * key, const guint8 * iv)
+{
+  static const guint8 rcon[10] = {
+    0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36
+  };
+  guint32 *w = cbc->round_keys;
+  int i;
+
+  if (G_UNLIKELY (gss_aes_cbc_blocks == NULL)) {
+    gss_aes_set_accelerated (TRUE);
+  }
+
+  for (i = 0; i < 4; i++) {
+    w[i] = GST_READ_UINT32_BE (key + 4 * i);
+  }
+  for (i = 4; i < 44; i++) {
+    guint32 t = w[i - 1];
+
+    if (i % 4 == 0) {
+      t = gss_aes_sub_word ((t << 8) | (t >> 24)) ^
+          ((guint32) rcon[i / 4 - 1] << 24);
+    }
+    w[i] = w[i - 4] ^ t;
+  }
+  for (i = 0; i < 44; i++) {
+    GST_WRITE_UINT32_BE (cbc->round_key_bytes + 4 * i, w[i]);
+  }
+
+  memcpy (cbc->iv, iv, GSS_AES_BLOCK_SIZE);
+  cbc->n_partial = 0;
+}
+
+/* Encrypts size bytes from src to dest, which must have room for size
+ * plus GSS_AES_BLOCK_SIZE - 1 bytes.  Returns the number of bytes
+ * written, always a multiple of the block size. */
+gsize
+gss_aes_cbc_encrypt (GssAesCbc * cbc, guint8 * dest, const guint8 * src,
+    gsize size)
+{
+  gsize written = 0;
+  gsize n;
+
+  if (cbc->n_partial > 0) {
+    n = MIN (size, (gsize) (GSS_AES_BLOCK_SIZE - cbc->n_partial));
+    memcpy (cbc->partial + cbc->n_partial, src, n);
+    cbc->n_partial += n;
+    src += n;
+    size -= n;
+    if (cbc->n_partial < GSS_AES_BLOCK_SIZE)
+      return 0;
+
+    gss_aes_cbc_blocks (cbc, dest, cbc->partial, 1);
+    cbc->n_partial = 0;
+    dest += GSS_AES_BLOCK_SIZE;
+    written += GSS_AES_BLOCK_SIZE;
+  }
+
+  n = size / GSS_AES_BLOCK_SIZE;
+  if (n > 0) {
+    gss_aes_cbc_blocks (cbc, dest, src, n);
+    n *= GSS_AES_BLOCK_SIZE;
+    src += n;
+    size -= n;
+    written += n;
+  }
+
+  memcpy (cbc->partial, src, size);
+  cbc->n_partial = size;
+
+  return written;
+}
+
+/* Pads and encrypts the remaining data, writing exactly one block. */
+gsize
+gss_aes_cbc_finish (GssAesCbc * cbc, guint8 * dest)
+{
+  int pad = GSS_AES_BLOCK_SIZE - cbc->n_partial;
+
+  memset (cbc->partial + cbc->n_partial, pad, pad);
+  gss_aes_cbc_blocks (cbc, dest, cbc->partial, 1);
+  cbc->n_partial = 0;
+
+  return GSS_AES_BLOCK_SIZE;
+}
@@ -0,0 +1,53 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+
+#ifndef _GSS_AES_H
+#define _GSS_AES_H
+
+#include "gss-config.h"
+#include "gss-types.h"
+
+G_BEGIN_DECLS
+
+#define GSS_AES_BLOCK_SIZE 16
+
+/* AES-128 in CBC mode with PKCS#7 padding, as used by HLS.  Data can be
+ * fed in pieces of any size; the last incomplete block is kept until
+ * more data arrives or gss_aes_cbc_finish() pads it. */
+struct _GssAesCbc {
+  guint32 round_keys[44];
+  guint8 round_key_bytes[176]; /* same, in the layout AES-NI wants */
+  guint8 iv[GSS_AES_BLOCK_SIZE]; /* last ciphertext block */
+  guint8 partial[GSS_AES_BLOCK_SIZE];
+  int n_partial;
+};
+
+void gss_aes_cbc_init (GssAesCbc *cbc, const guint8 *key, const guint8 *iv);
+gsize gss_aes_cbc_encrypt (GssAesCbc *cbc, guint8 *dest, const guint8 *src,
+    gsize size);
+gsize gss_aes_cbc_finish (GssAesCbc *cbc, guint8 *dest);
+gboolean gss_aes_set_accelerated (gboolean enable);
+
+G_END_DECLS
+
+#endif
+
@@ -0,0 +1,269 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+
+#include "config.h"
+
+#include "gss-server.h"
+
+#include <sys/mman.h>
+#include <string.h>
+
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+/* in front of each block, keeps the data cache line aligned */
+typedef union _GssBufferPoolBlock GssBufferPoolBlock;
+union _GssBufferPoolBlock
+{
+  struct
+  {
+    GssBufferPool *pool;
+    gpointer next;              /* on the free list */
+    gsize size;                 /* of the allocation */
+    int bin;                    /* -1 if too large for any */
+    gboolean mapped;
+  } h;
+  guint8 pad[64];
+};
+
+#if GLIB_CHECK_VERSION(2,32,0)
+#define POOL_LOCK(pool) g_mutex_lock (&(pool)->lock)
+#define POOL_UNLOCK(pool) g_mutex_unlock (&(pool)->lock)
+#else
+#define POOL_LOCK(pool) g_mutex_lock ((pool)->lock)
+#define POOL_UNLOCK(pool) g_mutex_unlock ((pool)->lock)
+#endif
+
+
+GssBufferPool *
+gss_buffer_pool_new (gsize max_free)
+{
+  GssBufferPool *pool;
+  int i;
+
+  pool = g_new0 (GssBufferPool, 1);
+#if GLIB_CHECK_VERSION(2,32,0)
+  g_mutex_init (&pool->lock);
+#else
+  pool->lock = g_mutex_new ();
+#endif
+  pool->max_free = max_free;
+  for (i = 0; i < GSS_BUFFER_POOL_N_BINS; i++) {
+    pool->bins[i].size = (gsize) 1 << (GSS_BUFFER_POOL_MIN_SHIFT + i);
+  }
+
+  return pool;
+}
+
+static GssBufferPoolBlock *
+gss_buffer_pool_system_alloc (GssBufferPool * pool, gsize size)
+{
+  GssBufferPoolBlock *block = NULL;
+  gboolean mapped = FALSE;
+
+#ifdef MAP_HUGETLB
+  if (pool->huge_pages && size >= HUGE_PAGE_SIZE) {
+    gsize huge_size;
+    void *p = MAP_FAILED;
+
+    /* huge page mappings, and unmapping them, need whole huge pages.
+     * A block is a power of two plus its header, so rounding it up would
+     * nearly double it; only do that for blocks too large for any bin,
+     * where the rounding costs little, and rely on transparent huge
+     * pages otherwise. */
+    huge_size = (size + HUGE_PAGE_SIZE - 1) & ~((gsize) HUGE_PAGE_SIZE - 1);
+    if (huge_size - size <= size / 8) {
+      size = huge_size;
+      p = mmap (NULL, size, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    }
+    if (p == MAP_FAILED) {
+      /* no huge pages reserved, ask for transparent ones instead */
+      p = mmap (NULL, size, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+      if (p != MAP_FAILED) {
+        madvise (p, size, MADV_HUGEPAGE);
+      }
+#endif
+    }
+    if (p != MAP_FAILED) {
+      block = (GssBufferPoolBlock *) p;
+      mapped = TRUE;
+    }
+  }
+#endif
+  if (block == NULL) {
+    block = g_malloc (size);
+  }
+  block->h.pool = pool;
+  block->h.size = size;
+  block->h.mapped = mapped;
+
+  return block;
+}
+
+static void
+gss_buffer_pool_system_free (GssBufferPoolBlock * block)
+{
+  if (block->h.mapped) {
+    munmap (block, block->h.size);
+  } else {
+    g_free (block);
+  }
+}
+
+void
+gss_buffer_pool_free (GssBufferPool * pool)
+{
+  int i;
+
+  for (i = 0; i < GSS_BUFFER_POOL_N_BINS; i++) {
+    GssBufferPoolBin *bin = &pool->bins[i];
+
+    if (bin->n_used > 0) {
+      /* the pool has to outlive them */
+      GST_WARNING ("%u blocks of %" G_GSIZE_FORMAT " bytes still in use, "
+          "leaking pool", bin->n_used, bin->size);
+      return;
+    }
+    while (bin->free_list) {
+      GssBufferPoolBlock *block = bin->free_list;
+
+      bin->free_list = block->h.next;
+      gss_buffer_pool_system_free (block);
+    }
+  }
+#if GLIB_CHECK_VERSION(2,32,0)
+  g_mutex_clear (&pool->lock);
+#else
+  g_mutex_free (pool->lock);
+#endif
+  g_free (pool);
+}
+
+/* Only applies to blocks allocated from the system after this */
+void
+gss_buffer_pool_set_huge_pages (GssBufferPool * pool, gboolean huge_pages)
+{
+  POOL_LOCK (pool);
+  pool->huge_pages = huge_pages;
+  POOL_UNLOCK (pool);
+}
+
+/* Returns at least size bytes, to be released with
+ * gss_buffer_pool_release() */
+gpointer
+gss_buffer_pool_alloc (GssBufferPool * pool, gsize size)
+{
+  GssBufferPoolBlock *block;
+  GssBufferPoolBin *bin;
+  int i;
+
+  /* the header is in front of the block, not part of its size, so a
+   * request of exactly a power of two fits that bin */
+  for (i = 0; i < GSS_BUFFER_POOL_N_BINS; i++) {
+    if (pool->bins[i].size >= size)
+      break;
+  }
+
+  if (i == GSS_BUFFER_POOL_N_BINS) {
+    block = gss_buffer_pool_system_alloc (pool,
+        sizeof (GssBufferPoolBlock) + size);
+    block->h.bin = -1;
+    POOL_LOCK (pool);
+    pool->n_large++;
+    POOL_UNLOCK (pool);
+    return block + 1;
+  }
+
+  bin = &pool->bins[i];
+  POOL_LOCK (pool);
+  block = bin->free_list;
+  if (block) {
+    bin->free_list = block->h.next;
+    bin->n_free--;
+    pool->free_size -= bin->size;
+  } else {
+    bin->n_system++;
+  }
+  bin->n_allocs++;
+  bin->n_used++;
+  bin->max_used = MAX (bin->max_used, bin->n_used);
+  POOL_UNLOCK (pool);
+
+  if (block == NULL) {
+    block = gss_buffer_pool_system_alloc (pool,
+        sizeof (GssBufferPoolBlock) + bin->size);
+    block->h.bin = i;
+  }
+
+  return block + 1;
+}
+
+void
+gss_buffer_pool_release (gpointer data)
+{
+  GssBufferPoolBlock *block = (GssBufferPoolBlock *) data - 1;
+  GssBufferPool *pool = block->h.pool;
+  GssBufferPoolBin *bin;
+
+  if (block->h.bin < 0) {
+    gss_buffer_pool_system_free (block);
+    return;
+  }
+
+  bin = &pool->bins[block->h.bin];
+  POOL_LOCK (pool);
+  bin->n_used--;
+  if (pool->free_size + bin->size <= pool->max_free) {
+    block->h.next = bin->free_list;
+    bin->free_list = block;
+    bin->n_free++;
+    pool->free_size += bin->size;
+    block = NULL;
+  }
+  POOL_UNLOCK (pool);
+
+  if (block) {
+    gss_buffer_pool_system_free (block);
+  }
+}
+
+/* Wraps a block from the pool, which goes back when the last reference
+ * to the SoupBuffer is gone */
+SoupBuffer *
+gss_buffer_pool_soup_buffer_new (gpointer data, gsize size)
+{
+  return soup_buffer_new_with_owner (data, size, data,
+      gss_buffer_pool_release);
+}
+
+/* Copies the bins for a consistent view of the statistics */
+void
+gss_buffer_pool_get_stats (GssBufferPool * pool, GssBufferPoolBin * bins,
+    guint64 * n_large)
+{
+  POOL_LOCK (pool);
+  memcpy (bins, pool->bins, sizeof (pool->bins));
+  *n_large = pool->n_large;
+  POOL_UNLOCK (pool);
+}
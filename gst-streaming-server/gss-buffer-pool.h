@@ -0,0 +1,81 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef _GSS_BUFFER_POOL_H
+#define _GSS_BUFFER_POOL_H
+
+#include <libsoup/soup.h>
+#include "gss-config.h"
+#include "gss-types.h"
+
+G_BEGIN_DECLS
+
+/* Size classed pool for the memory of encrypted HLS segments, VOD chunks
+ * and pushed media.  Blocks are powers of two from 4 kB to 16 MB, plus a
+ * small header kept outside that size, and go onto a free list when they
+ * are released, so a server in steady state stops calling the system
+ * allocator and the heap doesn't fragment the way it does with blocks of
+ * every size coming and going.  Requests for more than the largest class
+ * bypass the pool.  With huge pages enabled, blocks of 2 MB and more are
+ * backed by huge pages, transparent ones for the pooled classes.  Blocks
+ * may be allocated and released from any thread. */
+
+#define GSS_BUFFER_POOL_MIN_SHIFT 12
+#define GSS_BUFFER_POOL_N_BINS 13
+
+typedef struct _GssBufferPoolBin GssBufferPoolBin;
+struct _GssBufferPoolBin {
+  gsize size; /* of its blocks, not counting the header */
+  gpointer free_list;
+  guint n_free;
+  guint n_used;
+  guint max_used;
+  guint64 n_allocs;
+  guint64 n_system; /* allocations that missed the free list */
+};
+
+struct _GssBufferPool {
+#if GLIB_CHECK_VERSION(2,32,0)
+  GMutex lock;
+#else
+  GMutex *lock;
+#endif
+  gboolean huge_pages;
+  gsize max_free; /* bytes kept on the free lists */
+  gsize free_size;
+  GssBufferPoolBin bins[GSS_BUFFER_POOL_N_BINS];
+  guint64 n_large; /* allocations too large for any bin */
+};
+
+GssBufferPool * gss_buffer_pool_new (gsize max_free);
+void gss_buffer_pool_free (GssBufferPool *pool);
+void gss_buffer_pool_set_huge_pages (GssBufferPool *pool,
+    gboolean huge_pages);
+gpointer gss_buffer_pool_alloc (GssBufferPool *pool, gsize size);
+void gss_buffer_pool_release (gpointer data);
+SoupBuffer * gss_buffer_pool_soup_buffer_new (gpointer data, gsize size);
+void gss_buffer_pool_get_stats (GssBufferPool *pool,
+    GssBufferPoolBin *bins, guint64 *n_large);
+
+G_END_DECLS
+
+#endif
+
@@ -399,6 +399,54 @@ gss_config_handle_post_hash (GObject * object, GssTransaction * t,
 }
 
 
+/* occupancy of the segment cache and buffer pool */
+static void
+gss_server_append_memory_stats (GssServer * server, GString * s)
+{
+  GssSegmentCache *cache = server->segment_cache;
+  GssBufferPoolBin bins[GSS_BUFFER_POOL_N_BINS];
+  guint64 n_large;
+  int i;
+
+  GSS_A ("<h2>Memory</h2>\n");
+  GSS_P ("<p>Segments: %" G_GUINT64_FORMAT " kB (peak %" G_GUINT64_FORMAT
+      " kB), %" G_GUINT64_FORMAT " evicted</p>\n", cache->used / 1024,
+      cache->max_used / 1024, cache->n_evicted);
+
+  gss_buffer_pool_get_stats (server->buffer_pool, bins, &n_large);
+  GSS_A ("<table class='table table-striped table-bordered "
+      "table-condensed'>\n");
+  GSS_A ("<thead>\n");
+  GSS_A ("<tr>\n");
+  GSS_A ("<th>Block</th>\n");
+  GSS_A ("<th>In use</th>\n");
+  GSS_A ("<th>Peak</th>\n");
+  GSS_A ("<th>Free</th>\n");
+  GSS_A ("<th>Allocations</th>\n");
+  GSS_A ("<th>From system</th>\n");
+  GSS_A ("</tr>\n");
+  GSS_A ("</thead>\n");
+  GSS_A ("<tbody>\n");
+  for (i = 0; i < GSS_BUFFER_POOL_N_BINS; i++) {
+    if (bins[i].n_allocs == 0)
+      continue;
+    GSS_A ("<tr>\n");
+    GSS_P ("<td>%" G_GSIZE_FORMAT " kB</td>\n", bins[i].size / 1024);
+    GSS_P ("<td>%u</td>\n", bins[i].n_used);
+    GSS_P ("<td>%u</td>\n", bins[i].max_used);
+    GSS_P ("<td>%u</td>\n", bins[i].n_free);
+    GSS_P ("<td>%" G_GUINT64_FORMAT "</td>\n", bins[i].n_allocs);
+    GSS_P ("<td>%" G_GUINT64_FORMAT "</td>\n", bins[i].n_system);
+    GSS_A ("</tr>\n");
+  }
+  GSS_A ("<tr>\n");
+  GSS_P ("<td colspan='6'>%" G_GUINT64_FORMAT " allocations too large for "
+      "the pool</td>\n", n_large);
+  GSS_A ("</tr>\n");
+  GSS_A ("</tbody>\n");
+  GSS_A ("</table>\n");
+}
+
 static void
 gss_server_get_resource (GssTransaction * t)
 {
@@ -413,6 +461,8 @@ gss_server_get_resource (GssTransaction * t)
 
   gss_config_append_config_block (G_OBJECT (server), t, FALSE);
 
+  gss_server_append_memory_stats (server, s);
+
   gss_html_footer (t);
 }
 
@@ -671,6 +721,18 @@ gss_config_file_get_resource (GssTransaction * t)
   gss_config_append_config_file (s);
 }
 
+/* fd, client address, stream, seconds connected and bytes sent */
+static void
+gss_server_connections_resource (GssTransaction * t)
+{
+  GssServer *server = GSS_SERVER (t->resource->priv);
+  GString *s = g_string_new ("");
+
+  t->s = s;
+
+  gss_server_append_connections (server, s);
+}
+
 static xmlNodePtr
 get_child_node_by_name (xmlNodePtr root, const char *name)
 {
@@ -816,6 +878,7 @@ gss_config_load_config_file (void)
   char *contents;
   gsize size;
   gboolean ret;
+  GList *g;
 
   ret = g_file_get_contents (CONFIG_FILE, &contents, &size, NULL);
   if (!ret) {
@@ -833,6 +896,11 @@ gss_config_load_config_file (void)
   //load_config (root, "hardware", "admin.hardware");
   load_config (root, "server", "admin.server");
   load_config (root, "user", "admin.user");
+  for (g = config_list; g; g = g_list_next (g)) {
+    if (GSS_IS_DELIVERY_PROFILE (g->data)) {
+      load_config (root, "deliveryprofile", GSS_OBJECT_NAME (g->data));
+    }
+  }
 
   xmlFreeDoc (doc);
 }
@@ -854,4 +922,7 @@ gss_config_add_server_resources (GssServer * server)
 
   gss_server_add_resource (server, "/admin/config_file", GSS_RESOURCE_ADMIN,
       GSS_TEXT_PLAIN, gss_config_file_get_resource, NULL, NULL, NULL);
+
+  gss_server_add_resource (server, "/admin/connections", GSS_RESOURCE_ADMIN,
+      GSS_TEXT_PLAIN, gss_server_connections_resource, NULL, NULL, server);
 }
@@ -0,0 +1,686 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+
+#include "config.h"
+
+#include "gss-server.h"
+
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#ifdef HAVE_LINUX_SOCKIOS_H
+#include <linux/sockios.h>
+#endif
+
+#if GLIB_CHECK_VERSION(2,32,0)
+#define CONNECTIONS_LOCK(server) g_mutex_lock (&(server)->connections_lock)
+#define CONNECTIONS_UNLOCK(server) \
+  g_mutex_unlock (&(server)->connections_lock)
+#else
+#define CONNECTIONS_LOCK(server) g_mutex_lock ((server)->connections_lock)
+#define CONNECTIONS_UNLOCK(server) g_mutex_unlock ((server)->connections_lock)
+#endif
+
+
+GssConnection *
+gss_connection_new (GssStream * stream, int fd, SoupSocket * socket,
+    const char *client_address)
+{
+  GssConnection *connection;
+
+  connection = g_new0 (GssConnection, 1);
+  connection->stream = stream;
+  connection->fd = fd;
+  connection->socket = socket;
+  connection->client_address = g_strdup (client_address);
+  connection->start_time = g_get_real_time ();
+
+  return connection;
+}
+
+void
+gss_connection_free (GssConnection * connection)
+{
+  if (connection->switch_to) {
+    g_object_unref (connection->switch_to);
+  }
+  g_free (connection->client_address);
+  g_free (connection);
+}
+
+/* Asks the sink, or the fan-out, how much it has sent so far */
+void
+gss_connection_update_stats (GssConnection * connection)
+{
+  GstElement *sink = connection->stream->sink;
+#if GST_CHECK_VERSION(1,0,0)
+  GstStructure *stats = NULL;
+#else
+  GValueArray *stats = NULL;
+#endif
+
+  if (connection->stream->fanout) {
+    connection->bytes_sent = gss_fanout_get_bytes_sent
+        (connection->stream->fanout, connection->fd);
+    return;
+  }
+  if (sink == NULL)
+    return;
+
+  g_signal_emit_by_name (sink, "get-stats", connection->fd, &stats);
+  if (stats == NULL)
+    return;
+
+#if GST_CHECK_VERSION(1,0,0)
+  gst_structure_get (stats, "bytes-sent", G_TYPE_UINT64,
+      &connection->bytes_sent, NULL);
+  gst_structure_free (stats);
+#else
+  if (stats->n_values > 0) {
+    connection->bytes_sent = g_value_get_uint64 (&stats->values[0]);
+  }
+  g_value_array_free (stats);
+#endif
+}
+
+void
+gss_server_add_connection (GssServer * server, GssConnection * connection)
+{
+  GssConnection *old;
+
+  connection->server = server;
+
+  CONNECTIONS_LOCK (server);
+  old = g_hash_table_lookup (server->connections,
+      GINT_TO_POINTER (connection->fd));
+  g_hash_table_replace (server->connections, GINT_TO_POINTER (connection->fd),
+      connection);
+  CONNECTIONS_UNLOCK (server);
+
+  if (old) {
+    /* the fd was closed and reused without the sink telling us */
+    GST_WARNING ("fd %d registered twice", connection->fd);
+    gss_connection_free (old);
+  }
+}
+
+/* Unregisters a connection, which the caller then owns */
+GssConnection *
+gss_server_steal_connection (GssServer * server, int fd)
+{
+  GssConnection *connection;
+
+  CONNECTIONS_LOCK (server);
+  connection = g_hash_table_lookup (server->connections, GINT_TO_POINTER (fd));
+  if (connection) {
+    g_hash_table_remove (server->connections, GINT_TO_POINTER (fd));
+  }
+  CONNECTIONS_UNLOCK (server);
+
+  return connection;
+}
+
+/* TRUE for a registered HTTP client, as opposed to pipes and sockets
+ * that other parts of the server hand to the sink */
+gboolean
+gss_server_is_http_connection (GssServer * server, int fd)
+{
+  GssConnection *connection;
+  gboolean ret;
+
+  CONNECTIONS_LOCK (server);
+  connection = g_hash_table_lookup (server->connections, GINT_TO_POINTER (fd));
+  ret = (connection && connection->socket != NULL);
+  CONNECTIONS_UNLOCK (server);
+
+  return ret;
+}
+
+/* fds of the connections of a stream, or of all if stream is NULL.
+ * Free the list with g_list_free (). */
+GList *
+gss_server_get_connection_fds (GssServer * server, GssStream * stream)
+{
+  GHashTableIter iter;
+  gpointer key, value;
+  GList *fds = NULL;
+
+  CONNECTIONS_LOCK (server);
+  g_hash_table_iter_init (&iter, server->connections);
+  while (g_hash_table_iter_next (&iter, &key, &value)) {
+    GssConnection *connection = value;
+
+    if (stream == NULL || connection->stream == stream) {
+      fds = g_list_prepend (fds, key);
+    }
+  }
+  CONNECTIONS_UNLOCK (server);
+
+  return fds;
+}
+
+/* Has the sink, or the fan-out, drop the connection, which then goes
+ * through the usual removal */
+void
+gss_server_kill_connection (GssServer * server, int fd)
+{
+  GssStream *stream = NULL;
+  GssConnection *connection;
+
+  CONNECTIONS_LOCK (server);
+  connection = g_hash_table_lookup (server->connections, GINT_TO_POINTER (fd));
+  if (connection) {
+    stream = g_object_ref (connection->stream);
+  }
+  CONNECTIONS_UNLOCK (server);
+
+  if (stream == NULL)
+    return;
+
+  GST_DEBUG ("removing fd %d", fd);
+  if (stream->fanout) {
+    gss_fanout_remove (stream->fanout, fd);
+  } else if (stream->sink) {
+    g_signal_emit_by_name (stream->sink, "remove", fd);
+  }
+  g_object_unref (stream);
+}
+
+/* Before the stream is detached from its program and server */
+void
+gss_server_remove_stream_connections (GssServer * server, GssStream * stream)
+{
+  GList *fds;
+  GList *g;
+
+  fds = gss_server_get_connection_fds (server, stream);
+  for (g = fds; g; g = g_list_next (g)) {
+    gss_server_kill_connection (server, GPOINTER_TO_INT (g->data));
+  }
+  g_list_free (fds);
+
+  /* connections of a stream without a sink */
+  for (g = gss_server_get_connection_fds (server, stream); g;
+      g = g_list_delete_link (g, g)) {
+    GssConnection *connection;
+
+    connection = gss_server_steal_connection (server,
+        GPOINTER_TO_INT (g->data));
+    if (connection) {
+      if (connection->socket) {
+        soup_socket_disconnect (connection->socket);
+      }
+      gss_connection_free (connection);
+    }
+  }
+}
+
+/* One line per connection.  The sink is asked for statistics without
+ * holding the registry lock, since it removes clients with its own lock
+ * held. */
+void
+gss_server_append_connections (GssServer * server, GString * s)
+{
+  GPtrArray *copies;
+  GHashTableIter iter;
+  gpointer value;
+  guint i;
+
+  copies = g_ptr_array_new ();
+  CONNECTIONS_LOCK (server);
+  g_hash_table_iter_init (&iter, server->connections);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    GssConnection *connection = value;
+    GssConnection *copy;
+
+    copy = gss_connection_new (g_object_ref (connection->stream),
+        connection->fd, NULL, connection->client_address);
+    copy->start_time = connection->start_time;
+    copy->callback = connection->callback;
+    g_ptr_array_add (copies, copy);
+  }
+  CONNECTIONS_UNLOCK (server);
+
+  for (i = 0; i < copies->len; i++) {
+    GssConnection *copy = g_ptr_array_index (copies, i);
+
+    gss_connection_update_stats (copy);
+    g_string_append_printf (s, "%d %s %s %" G_GINT64_FORMAT " %"
+        G_GUINT64_FORMAT "\n", copy->fd,
+        copy->client_address ? copy->client_address :
+        (copy->callback ? "internal" : "unknown"),
+        copy->stream->location ? copy->stream->location : "-",
+        (g_get_real_time () - copy->start_time) / G_USEC_PER_SEC,
+        copy->bytes_sent);
+    g_object_unref (copy->stream);
+    gss_connection_free (copy);
+  }
+  g_ptr_array_free (copies, TRUE);
+}
+
+void
+gss_server_free_connections (GssServer * server)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, server->connections);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    gss_connection_free ((GssConnection *) value);
+  }
+  g_hash_table_destroy (server->connections);
+  server->connections = NULL;
+}
+
+/* Bytes written to the socket that the kernel has not sent yet, or -1 if
+ * that is not known.  *full is TRUE if they take up much of the send
+ * buffer. */
+static int
+get_unsent_bytes (int fd, gboolean * full)
+{
+#ifdef SIOCOUTQNSD
+  int unsent;
+  int sndbuf;
+  socklen_t len = sizeof (sndbuf);
+
+  if (ioctl (fd, SIOCOUTQNSD, &unsent) == 0 &&
+      getsockopt (fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) == 0) {
+    /* SO_SNDBUF counts the kernel's overhead, about as much again */
+    *full = (unsent * 4 >= sndbuf);
+    return unsent;
+  }
+#endif
+  *full = FALSE;
+  return -1;
+}
+
+/* Sibling the client could keep up with: the highest bitrate below its
+ * throughput, else the lowest.  Only for MPEG-TS, which demuxers pick up
+ * again at the next PAT; other containers would get a second set of
+ * headers in the middle of the file. */
+static GssStream *
+find_lower_stream (GssStream * stream, int throughput)
+{
+  GssStream *best = NULL;
+  GList *g;
+
+  if (stream->type != GSS_STREAM_TYPE_M2TS_H264BASE_AAC &&
+      stream->type != GSS_STREAM_TYPE_M2TS_H264MAIN_AAC)
+    return NULL;
+
+  for (g = stream->program->streams; g; g = g_list_next (g)) {
+    GssStream *s = g->data;
+
+    if (s->type != stream->type || s->bitrate >= stream->bitrate ||
+        s->sink == NULL)
+      continue;
+
+    if (best == NULL) {
+      best = s;
+    } else if (s->bitrate <= throughput) {
+      if (best->bitrate > throughput || s->bitrate > best->bitrate)
+        best = s;
+    } else if (best->bitrate > throughput && s->bitrate < best->bitrate) {
+      best = s;
+    }
+  }
+
+  return best;
+}
+
+/* Takes a sample of a copy of a connection.  TRUE if the client has been
+ * behind for the server's slow-client-time, if that is set. */
+static gboolean
+sample_connection (GssServer * server, GssConnection * copy, gint64 now)
+{
+  GssStream *stream = copy->stream;
+  gint64 lag = 0;
+  gboolean full;
+  int unsent;
+
+  gss_connection_update_stats (copy);
+  if (copy->sample_time == 0 || copy->bytes_sent < copy->sample_bytes ||
+      now <= copy->sample_time) {
+    copy->sample_bytes = copy->bytes_sent;
+    copy->sample_time = now;
+    return FALSE;
+  }
+  copy->throughput = (copy->bytes_sent - copy->sample_bytes) * 8 *
+      G_USEC_PER_SEC / (now - copy->sample_time);
+  copy->sample_bytes = copy->bytes_sent;
+  copy->sample_time = now;
+
+  if (server->slow_client_time == 0)
+    return FALSE;
+
+  /* a client paced below the bitrate by max-rate or egress-rate falls
+   * behind because of the server, not its network, and switching or
+   * dropping it would only take away what it was given */
+  if (copy->pacing_rate > 0 && copy->pacing_rate * 8 < stream->bitrate) {
+    copy->slow_since = 0;
+    return FALSE;
+  }
+
+  if (stream->fanout) {
+    lag = gss_fanout_get_client_lag (stream->fanout, copy->fd);
+  }
+  unsent = get_unsent_bytes (copy->fd, &full);
+
+  if (lag <= GSS_CONNECTION_MAX_LAG &&
+      !(full && copy->throughput < stream->bitrate)) {
+    if (copy->slow_since) {
+      GST_DEBUG ("fd %d caught up, %d kbps", copy->fd,
+          copy->throughput / 1000);
+    }
+    copy->slow_since = 0;
+    return FALSE;
+  }
+
+  if (copy->slow_since == 0) {
+    GST_DEBUG ("fd %d (%s) falling behind on %s: %d of %d kbps, "
+        "%d bytes unsent, %" G_GINT64_FORMAT " ms late", copy->fd,
+        copy->client_address, stream->location, copy->throughput / 1000,
+        stream->bitrate / 1000, unsent, lag / 1000);
+    copy->slow_since = now;
+  }
+
+  return (now - copy->slow_since >=
+      (gint64) server->slow_client_time * G_USEC_PER_SEC);
+}
+
+/* Called once a second, measures the throughput of each client and acts
+ * on the slow ones.  Statistics are taken from copies, like in
+ * gss_server_append_connections (), and written back if the connection
+ * is still the same. */
+void
+gss_server_check_slow_clients (GssServer * server)
+{
+  GPtrArray *originals;
+  GPtrArray *copies;
+  GHashTableIter iter;
+  gpointer value;
+  gint64 now;
+  guint i;
+
+  originals = g_ptr_array_new ();
+  copies = g_ptr_array_new ();
+  CONNECTIONS_LOCK (server);
+  g_hash_table_iter_init (&iter, server->connections);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    GssConnection *connection = value;
+    GssConnection *copy;
+
+    if (connection->socket == NULL || connection->switch_to ||
+        connection->stream->program == NULL)
+      continue;
+
+    copy = gss_connection_new (g_object_ref (connection->stream),
+        connection->fd, NULL, connection->client_address);
+    copy->sample_bytes = connection->sample_bytes;
+    copy->sample_time = connection->sample_time;
+    copy->throughput = connection->throughput;
+    copy->slow_since = connection->slow_since;
+    copy->pacing_rate = connection->pacing_rate;
+    g_ptr_array_add (originals, connection);
+    g_ptr_array_add (copies, copy);
+  }
+  CONNECTIONS_UNLOCK (server);
+
+  now = g_get_monotonic_time ();
+  for (i = 0; i < copies->len; i++) {
+    GssConnection *copy = g_ptr_array_index (copies, i);
+    GssStream *stream = copy->stream;
+    GssStream *target = NULL;
+    GssConnection *connection;
+    gboolean slow;
+
+    slow = sample_connection (server, copy, now);
+    if (slow && server->enable_switching) {
+      target = find_lower_stream (stream, copy->throughput);
+    }
+
+    CONNECTIONS_LOCK (server);
+    connection = g_hash_table_lookup (server->connections,
+        GINT_TO_POINTER (copy->fd));
+    if (connection != g_ptr_array_index (originals, i) ||
+        connection->stream != stream || connection->switch_to) {
+      /* went away, or was moved, meanwhile */
+      slow = FALSE;
+    } else {
+      connection->sample_bytes = copy->sample_bytes;
+      connection->sample_time = copy->sample_time;
+      connection->throughput = copy->throughput;
+      connection->slow_since = copy->slow_since;
+      if (target) {
+        connection->switch_to = g_object_ref (target);
+      }
+    }
+    CONNECTIONS_UNLOCK (server);
+
+    if (slow) {
+      if (target) {
+        GST_INFO ("fd %d (%s) too slow for %s at %d kbps, moving it to %s",
+            copy->fd, copy->client_address, stream->location,
+            copy->throughput / 1000, target->location);
+        gss_metrics_add_switch (stream->metrics);
+        gss_metrics_add_switch (stream->program->metrics);
+        gss_metrics_add_switch (server->metrics);
+      } else {
+        GST_INFO ("fd %d (%s) too slow for %s at %d kbps, disconnecting",
+            copy->fd, copy->client_address, stream->location,
+            copy->throughput / 1000);
+        gss_metrics_add_stall (stream->metrics);
+        gss_metrics_add_stall (stream->program->metrics);
+        gss_metrics_add_stall (server->metrics);
+      }
+      gss_server_kill_connection (server, copy->fd);
+    }
+
+    g_object_unref (stream);
+    gss_connection_free (copy);
+  }
+  g_ptr_array_free (originals, TRUE);
+  g_ptr_array_free (copies, TRUE);
+}
+
+static gint
+compare_rates (gconstpointer a, gconstpointer b)
+{
+  gint64 rate_a = **(const gint64 **) a;
+  gint64 rate_b = **(const gint64 **) b;
+
+  return (rate_a > rate_b) - (rate_a < rate_b);
+}
+
+/* Lowers the rates so that they add up to no more than cap.  Each gets
+ * at most an equal share, and what the lower ones leave goes to the
+ * rest, like a token bucket the clients take turns at. */
+static void
+share_rate (GPtrArray * rates, gint64 cap)
+{
+  gint64 remaining = cap;
+  guint i;
+
+  g_ptr_array_sort (rates, compare_rates);
+  for (i = 0; i < rates->len; i++) {
+    gint64 *rate = g_ptr_array_index (rates, i);
+    gint64 share = remaining / (rates->len - i);
+
+    *rate = MIN (*rate, share);
+    remaining -= *rate;
+  }
+}
+
+#ifdef SO_MAX_PACING_RATE
+static gboolean
+is_tcp_socket (int fd)
+{
+  struct sockaddr_storage addr;
+  socklen_t len = sizeof (addr);
+  int type;
+  socklen_t type_len = sizeof (type);
+
+  if (getsockname (fd, (struct sockaddr *) &addr, &len) < 0 ||
+      (addr.ss_family != AF_INET && addr.ss_family != AF_INET6))
+    return FALSE;
+
+  return getsockopt (fd, SOL_SOCKET, SO_TYPE, &type, &type_len) == 0 &&
+      type == SOCK_STREAM;
+}
+#endif
+
+/* Paces the socket at rate bytes/sec, or not at all if rate is 0.  The
+ * fan-out's token bucket is what holds the client to the rate; the sink
+ * has no way to.  SO_MAX_PACING_RATE is set as well on TCP sockets, to
+ * spread the bucket's bursts out into packets, but the kernel only
+ * honours it with the fq qdisc or TCP's own pacing, which can't be told
+ * from here, so it is never relied on alone. */
+static void
+set_pacing_rate (GssConnection * connection, gint64 rate)
+{
+  GssFanout *fanout = connection->stream->fanout;
+
+  if (rate == connection->pacing_rate)
+    return;
+  connection->pacing_rate = rate;
+
+  if (fanout) {
+    gss_fanout_set_client_rate (fanout, connection->fd, MIN (rate, G_MAXINT));
+  } else {
+    GST_DEBUG ("fd %d cannot be paced", connection->fd);
+  }
+#ifdef SO_MAX_PACING_RATE
+  if (is_tcp_socket (connection->fd)) {
+    guint32 value = (rate == 0 || rate >= G_MAXUINT32) ? G_MAXUINT32 : rate;
+
+    if (setsockopt (connection->fd, SOL_SOCKET, SO_MAX_PACING_RATE, &value,
+            sizeof (value)) < 0) {
+      GST_DEBUG ("fd %d: SO_MAX_PACING_RATE: %s", connection->fd,
+          g_strerror (errno));
+    }
+  }
+#endif
+}
+
+/* Called once a second, after the throughput is measured.  Each client
+ * is paced to client-pacing percent of its stream's bitrate, and to its
+ * share of its program's max-rate and of the server's egress-rate.  The
+ * measured rates go in the metrics. */
+void
+gss_server_update_pacing (GssServer * server)
+{
+  GHashTableIter iter;
+  GPtrArray *connections;
+  GPtrArray *rates;
+  gpointer value;
+  gint64 *shares;
+  GList *g;
+  GList *s;
+  guint i;
+
+  server->metrics->egress_rate = 0;
+  for (g = server->programs; g; g = g_list_next (g)) {
+    GssProgram *program = g->data;
+
+    program->metrics->egress_rate = 0;
+    for (s = program->streams; s; s = g_list_next (s)) {
+      ((GssStream *) s->data)->metrics->egress_rate = 0;
+    }
+  }
+
+  connections = g_ptr_array_new ();
+  rates = g_ptr_array_new ();
+
+  CONNECTIONS_LOCK (server);
+  g_hash_table_iter_init (&iter, server->connections);
+  while (g_hash_table_iter_next (&iter, NULL, &value)) {
+    GssConnection *connection = value;
+
+    if (connection->socket && connection->stream->program) {
+      g_ptr_array_add (connections, connection);
+    }
+  }
+
+  shares = g_new (gint64, connections->len);
+  for (i = 0; i < connections->len; i++) {
+    GssConnection *connection = g_ptr_array_index (connections, i);
+    GssStream *stream = connection->stream;
+
+    stream->metrics->egress_rate += connection->throughput;
+    stream->program->metrics->egress_rate += connection->throughput;
+    server->metrics->egress_rate += connection->throughput;
+
+    shares[i] = G_MAXINT64;
+    if (server->client_pacing > 0) {
+      shares[i] = (gint64) stream->bitrate * server->client_pacing / 800;
+    }
+  }
+
+  for (g = server->programs; g; g = g_list_next (g)) {
+    GssProgram *program = g->data;
+
+    if (program->max_rate == 0)
+      continue;
+    g_ptr_array_set_size (rates, 0);
+    for (i = 0; i < connections->len; i++) {
+      GssConnection *connection = g_ptr_array_index (connections, i);
+
+      if (connection->stream->program == program) {
+        g_ptr_array_add (rates, &shares[i]);
+      }
+    }
+    share_rate (rates, (gint64) program->max_rate * 1000);
+  }
+
+  if (server->egress_rate > 0) {
+    g_ptr_array_set_size (rates, 0);
+    for (i = 0; i < connections->len; i++) {
+      g_ptr_array_add (rates, &shares[i]);
+    }
+    share_rate (rates, (gint64) server->egress_rate * 1000);
+  }
+
+  for (i = 0; i < connections->len; i++) {
+    set_pacing_rate (g_ptr_array_index (connections, i),
+        shares[i] == G_MAXINT64 ? 0 : MAX (shares[i], 1));
+  }
+  CONNECTIONS_UNLOCK (server);
+
+  g_free (shares);
+  g_ptr_array_free (rates, TRUE);
+  g_ptr_array_free (connections, TRUE);
+
+  server->metrics->max_egress_rate = MAX (server->metrics->max_egress_rate,
+      server->metrics->egress_rate);
+  for (g = server->programs; g; g = g_list_next (g)) {
+    GssProgram *program = g->data;
+
+    program->metrics->max_egress_rate =
+        MAX (program->metrics->max_egress_rate, program->metrics->egress_rate);
+    for (s = program->streams; s; s = g_list_next (s)) {
+      GssMetrics *metrics = ((GssStream *) s->data)->metrics;
+
+      metrics->max_egress_rate = MAX (metrics->max_egress_rate,
+          metrics->egress_rate);
+    }
+  }
+}
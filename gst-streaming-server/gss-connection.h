@@ -0,0 +1,94 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef _GSS_CONNECTION_H
+#define _GSS_CONNECTION_H
+
+#include <libsoup/soup.h>
+#include "gss-config.h"
+#include "gss-types.h"
+
+G_BEGIN_DECLS
+
+/* A socket handed to a stream's multifdsink, or its fan-out.  Connections
+ * are registered with the server by fd, from when the sink gets them
+ * until it lets go of them.  The registry may be used from any thread,
+ * since the sink removes clients from its own.
+ *
+ * Once a second, the server checks how each HTTP client keeps up: its
+ * throughput since the last check, how much of its socket's send buffer
+ * is still unsent, and with the fan-out, how far it is behind the most
+ * recent buffer.  A client that stays behind for the server's
+ * slow-client-time is moved to a lower bitrate stream of the program,
+ * and only disconnected if there is none.
+ *
+ * The server then paces each client, at a rate made from its stream's
+ * bitrate and its share of its program's and the server's rate limits,
+ * with the fan-out's token buckets, smoothed by SO_MAX_PACING_RATE on
+ * TCP sockets.  A client paced below its stream's bitrate that way is
+ * left out of the slow-client check. */
+#define GSS_CONNECTION_MAX_LAG (2 * G_USEC_PER_SEC)
+
+struct _GssConnection {
+  GssServer *server;
+  GssStream *stream;
+  int fd;
+  SoupSocket *socket; /* of HTTP clients, disconnected when removed */
+  char *client_address;
+  gint64 start_time; /* wall clock (us) */
+  guint64 bytes_sent; /* as of the last gss_connection_update_stats () */
+
+  /* slow-client detection, main loop only */
+  guint64 sample_bytes; /* bytes_sent at the last check */
+  gint64 sample_time; /* monotonic (us), 0 before the first check */
+  int throughput; /* bits/sec, since the last check */
+  gint64 slow_since; /* monotonic (us), 0 while it keeps up */
+  GssStream *switch_to; /* stream it moves to once the sink lets go */
+  gint64 pacing_rate; /* bytes/sec, 0 for unpaced, -1 to set it again */
+
+  /* called when removed, instead of disconnecting the socket */
+  void (*callback) (GssStream *stream, int fd, void *priv);
+  void *priv;
+};
+
+GssConnection * gss_connection_new (GssStream *stream, int fd,
+    SoupSocket *socket, const char *client_address);
+void gss_connection_free (GssConnection *connection);
+void gss_connection_update_stats (GssConnection *connection);
+
+void gss_server_add_connection (GssServer *server,
+    GssConnection *connection);
+GssConnection * gss_server_steal_connection (GssServer *server, int fd);
+gboolean gss_server_is_http_connection (GssServer *server, int fd);
+GList * gss_server_get_connection_fds (GssServer *server,
+    GssStream *stream);
+void gss_server_kill_connection (GssServer *server, int fd);
+void gss_server_remove_stream_connections (GssServer *server,
+    GssStream *stream);
+void gss_server_append_connections (GssServer *server, GString *s);
+void gss_server_check_slow_clients (GssServer *server);
+void gss_server_update_pacing (GssServer *server);
+void gss_server_free_connections (GssServer *server);
+
+G_END_DECLS
+
+#endif
+
@@ -0,0 +1,245 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include "gss-server.h"
+
+#include <string.h>
+
+
+/* MPEG-DASH for the HLS streams of a program.  The MPD is built from the
+ * same segment rings as the HLS playlists, so both protocols are served
+ * from one set of segments.  MPEG-TS streams use the MPEG-2 TS profile,
+ * fMP4 streams the ISO BMFF live profile. */
+
+#define GSS_DASH_TIMESCALE 90000
+
+static guint64
+gss_dash_time (GstClockTime t)
+{
+  return gst_util_uint64_scale (t, GSS_DASH_TIMESCALE, GST_SECOND);
+}
+
+static void
+gss_dash_append_duration (GString * s, const char *name, int seconds)
+{
+  g_string_append_printf (s, " %s=\"PT%dS\"", name, seconds);
+}
+
+static void
+gss_dash_append_date (GString * s, const char *name, gint64 time)
+{
+  GDateTime *datetime;
+  char *str;
+
+  datetime = g_date_time_new_from_unix_utc (time / G_USEC_PER_SEC);
+  str = g_date_time_format (datetime, "%Y-%m-%dT%H:%M:%SZ");
+  g_string_append_printf (s, " %s=\"%s\"", name, str);
+  g_free (str);
+  g_date_time_unref (datetime);
+}
+
+/* SegmentTimeline of the segments in the window.  Times are rounded
+ * from the running start time, so rounding errors don't add up, and
+ * runs of equal durations are merged. */
+static void
+gss_dash_append_timeline (GString * s, GssStream * stream, int first)
+{
+  guint64 run_t = 0;
+  guint64 run_d = 0;
+  int run_r = -1;
+  int i;
+
+  g_string_append (s, "        <SegmentTimeline>\n");
+  for (i = first; i < stream->n_chunks; i++) {
+    GssHLSSegment *segment = &stream->chunks[i % stream->max_chunks];
+    guint64 t = gss_dash_time (segment->start);
+    guint64 d = gss_dash_time (segment->start + segment->duration) - t;
+
+    if (run_r >= 0 && d == run_d && t == run_t + (run_r + 1) * run_d) {
+      run_r++;
+      continue;
+    }
+    if (run_r >= 0) {
+      g_string_append_printf (s, "          <S t=\"%" G_GUINT64_FORMAT
+          "\" d=\"%" G_GUINT64_FORMAT "\" r=\"%d\"/>\n", run_t, run_d, run_r);
+    }
+    run_t = t;
+    run_d = d;
+    run_r = 0;
+  }
+  if (run_r >= 0) {
+    g_string_append_printf (s, "          <S t=\"%" G_GUINT64_FORMAT
+        "\" d=\"%" G_GUINT64_FORMAT "\" r=\"%d\"/>\n", run_t, run_d, run_r);
+  }
+  g_string_append (s, "        </SegmentTimeline>\n");
+}
+
+/* First segment of the window, going back from the newest one */
+static int
+gss_dash_window_first (GssStream * stream, GstClockTime window)
+{
+  GstClockTime duration = 0;
+  int first;
+
+  for (first = stream->n_chunks; first > 0; first--) {
+    GssHLSSegment *segment = &stream->chunks[(first - 1) % stream->max_chunks];
+
+    if (first - 1 < stream->n_chunks - stream->max_chunks + 2 ||
+        !gss_hls_segment_is_available (stream, segment) ||
+        duration >= window)
+      break;
+    duration += segment->duration;
+  }
+
+  return first;
+}
+
+static void
+gss_dash_append_representation (GString * s, GssStream * stream,
+    GstClockTime window)
+{
+  GssServer *server = GSS_OBJECT_SERVER (stream->program);
+  int first;
+
+  first = gss_dash_window_first (stream, window);
+  if (first == stream->n_chunks)
+    return;
+
+  g_string_append_printf (s,
+      "      <Representation id=\"%dx%d-%dkbps\" bandwidth=\"%d\" "
+      "width=\"%d\" height=\"%d\" codecs=\"%s\">\n",
+      stream->width, stream->height, stream->bitrate / 1000, stream->bitrate,
+      stream->width, stream->height, stream->codecs);
+  g_string_append_printf (s, "        <SegmentTemplate timescale=\"%d\"",
+      GSS_DASH_TIMESCALE);
+  if (stream->hls.init_segment) {
+    g_string_append_printf (s, " initialization=\"%s%sinit%d.mp4\"",
+        server->base_url, stream->hls.segment_prefix,
+        stream->hls.init_version);
+  }
+  g_string_append_printf (s,
+      " media=\"%s%s$Number%%05d$.%s\" startNumber=\"%d\">\n",
+      server->base_url, stream->hls.segment_prefix,
+      stream->hls.init_segment ? "m4s" : "ts", first);
+  gss_dash_append_timeline (s, stream, first);
+  g_string_append (s, "        </SegmentTemplate>\n");
+  g_string_append (s, "      </Representation>\n");
+}
+
+/* Streams of one container format go into one AdaptationSet, which is
+ * left out if there are none. */
+static void
+gss_dash_append_adaptation_set (GString * s, GssProgram * program,
+    gboolean fmp4)
+{
+  GString *r;
+  GList *g;
+
+  r = g_string_new ("");
+  for (g = program->streams; g; g = g_list_next (g)) {
+    GssStream *stream = g->data;
+
+    if (!stream->is_hls || stream->bitrate == 0 || stream->n_chunks == 0)
+      continue;
+    if ((stream->type == GSS_STREAM_TYPE_FMP4_H264_AAC) != fmp4)
+      continue;
+    if (fmp4 && stream->hls.init_segment == NULL)
+      continue;
+    /* whole segment AES-128 is an HLS thing, DASH would need CENC */
+    if (stream->hls.encrypt)
+      continue;
+
+    gss_dash_append_representation (r, stream,
+        program->hls.window * GST_SECOND);
+  }
+
+  if (r->len > 0) {
+    g_string_append_printf (s, "    <AdaptationSet mimeType=\"%s\" "
+        "startWithSAP=\"1\">\n", fmp4 ? "video/mp4" : "video/mp2t");
+    g_string_append_len (s, r->str, r->len);
+    g_string_append (s, "    </AdaptationSet>\n");
+  }
+  g_string_free (r, TRUE);
+}
+
+static void
+gss_dash_handle_mpd (GssTransaction * t)
+{
+  GssProgram *program = (GssProgram *) t->resource->priv;
+  int target_duration = 1;
+  GString *s;
+  GList *g;
+
+  for (g = program->streams; g; g = g_list_next (g)) {
+    GssStream *stream = g->data;
+
+    if (stream->is_hls) {
+      target_duration = MAX (target_duration, stream->hls.target_duration);
+    }
+  }
+
+  s = g_string_new ("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+  g_string_append (s, "<MPD xmlns=\"urn:mpeg:dash:schema:mpd:2011\" "
+      "profiles=\"urn:mpeg:dash:profile:mp2t-simple:2011,"
+      "urn:mpeg:dash:profile:isoff-live:2011\" type=\"dynamic\"");
+  gss_dash_append_date (s, "availabilityStartTime", program->hls.start_time);
+  gss_dash_append_date (s, "publishTime", g_get_real_time ());
+  gss_dash_append_duration (s, "minimumUpdatePeriod", target_duration);
+  gss_dash_append_duration (s, "minBufferTime", target_duration);
+  gss_dash_append_duration (s, "timeShiftBufferDepth", program->hls.window);
+  gss_dash_append_duration (s, "suggestedPresentationDelay",
+      3 * target_duration);
+  g_string_append (s, ">\n");
+  g_string_append (s, "  <Period id=\"0\" start=\"PT0S\">\n");
+  gss_dash_append_adaptation_set (s, program, FALSE);
+  gss_dash_append_adaptation_set (s, program, TRUE);
+  g_string_append (s, "  </Period>\n");
+  g_string_append (s, "</MPD>\n");
+
+  soup_message_set_status (t->msg, SOUP_STATUS_OK);
+  if (program->hls.cache_playlists) {
+    char *cc = g_strdup_printf ("public, max-age=%d",
+        MAX (1, target_duration / 2));
+
+    soup_message_headers_replace (t->msg->response_headers,
+        "Cache-Control", cc);
+    g_free (cc);
+  } else {
+    soup_message_headers_replace (t->msg->response_headers,
+        "Cache-Control", "no-store");
+  }
+  soup_message_body_append (t->msg->response_body, SOUP_MEMORY_TAKE,
+      s->str, s->len);
+  g_string_free (s, FALSE);
+}
+
+void
+gss_program_add_dash (GssProgram * program)
+{
+  char *s;
+
+  s = g_strdup_printf ("/%s.mpd", GSS_OBJECT_NAME (program));
+  gss_server_add_resource (GSS_OBJECT_SERVER (program), s, 0,
+      "application/dash+xml", gss_dash_handle_mpd, NULL, NULL, program);
+  g_free (s);
+}
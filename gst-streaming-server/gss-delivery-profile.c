@@ -0,0 +1,377 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include "gss-server.h"
+#include "gss-delivery-profile.h"
+#include "gss-config.h"
+#include "gss-html.h"
+
+#include <string.h>
+
+enum
+{
+  PROP_0,
+  PROP_TIME_MIN,
+  PROP_UNITS_MAX,
+  PROP_UNITS_SOFT_MAX,
+  PROP_SYNC_METHOD,
+  PROP_BURST,
+  PROP_RECOVER_POLICY,
+  PROP_GOP_CACHE
+};
+
+/* the settings every pipeline used before profiles */
+#define DEFAULT_TIME_MIN 200
+#define DEFAULT_UNITS_MAX 20000
+#define DEFAULT_UNITS_SOFT_MAX 11000
+#define DEFAULT_SYNC_METHOD GSS_DELIVERY_SYNC_BURST_KEYFRAME
+#define DEFAULT_BURST 3000
+#define DEFAULT_RECOVER_POLICY GSS_DELIVERY_RECOVER_KEYFRAME
+#define DEFAULT_GOP_CACHE 1
+
+typedef struct _GssDeliveryPreset GssDeliveryPreset;
+struct _GssDeliveryPreset
+{
+  const char *name;
+  const char *title;
+  int time_min;
+  int units_max;
+  int units_soft_max;
+  GssDeliverySync sync_method;
+  int burst;
+  GssDeliveryRecover recover_policy;
+  int gop_cache;
+};
+
+static const GssDeliveryPreset presets[] = {
+  /* clients start at the most recent keyframe and are never far behind */
+  {"ultra-low-latency", "Ultra-Low Latency", 0, 4000, 2000,
+      GSS_DELIVERY_SYNC_LATEST_KEYFRAME, 0, GSS_DELIVERY_RECOVER_KEYFRAME, 1},
+  {"balanced", "Balanced", DEFAULT_TIME_MIN, DEFAULT_UNITS_MAX,
+        DEFAULT_UNITS_SOFT_MAX, DEFAULT_SYNC_METHOD, DEFAULT_BURST,
+      DEFAULT_RECOVER_POLICY, DEFAULT_GOP_CACHE},
+  /* a large burst fills player buffers, slow clients are kept longer */
+  {"resilient", "Resilient", 500, 60000, 30000,
+      GSS_DELIVERY_SYNC_BURST_KEYFRAME, 10000, GSS_DELIVERY_RECOVER_KEYFRAME,
+      2}
+};
+
+static const char *const preset_names[] = {
+  "ultra-low-latency", "balanced", "resilient", NULL
+};
+
+static void gss_delivery_profile_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gss_delivery_profile_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
+static void gss_delivery_profile_get_resource (GssTransaction * t);
+static void gss_delivery_profile_post_resource (GssTransaction * t);
+
+G_DEFINE_TYPE (GssDeliveryProfile, gss_delivery_profile, GSS_TYPE_OBJECT);
+
+GType
+gss_delivery_sync_get_type (void)
+{
+  static gsize id = 0;
+  static const GEnumValue values[] = {
+    {GSS_DELIVERY_SYNC_NEXT_KEYFRAME, "Wait for the next keyframe",
+        "next-keyframe"},
+    {GSS_DELIVERY_SYNC_LATEST_KEYFRAME, "Start at the most recent keyframe",
+        "latest-keyframe"},
+    {GSS_DELIVERY_SYNC_BURST_KEYFRAME, "Start at a keyframe in the burst",
+        "burst-keyframe"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&id)) {
+    GType tmp = g_enum_register_static ("GssDeliverySync", values);
+    g_once_init_leave (&id, tmp);
+  }
+
+  return (GType) id;
+}
+
+GType
+gss_delivery_recover_get_type (void)
+{
+  static gsize id = 0;
+  static const GEnumValue values[] = {
+    {GSS_DELIVERY_RECOVER_NONE, "Keep sending", "none"},
+    {GSS_DELIVERY_RECOVER_LATEST, "Skip to the most recent buffer",
+        "latest"},
+    {GSS_DELIVERY_RECOVER_SOFT_LIMIT, "Skip to the soft limit",
+        "soft-limit"},
+    {GSS_DELIVERY_RECOVER_KEYFRAME, "Skip to the most recent keyframe",
+        "keyframe"},
+    {0, NULL, NULL}
+  };
+
+  if (g_once_init_enter (&id)) {
+    GType tmp = g_enum_register_static ("GssDeliveryRecover", values);
+    g_once_init_leave (&id, tmp);
+  }
+
+  return (GType) id;
+}
+
+static void
+gss_delivery_profile_init (GssDeliveryProfile * profile)
+{
+  profile->time_min = DEFAULT_TIME_MIN;
+  profile->units_max = DEFAULT_UNITS_MAX;
+  profile->units_soft_max = DEFAULT_UNITS_SOFT_MAX;
+  profile->sync_method = DEFAULT_SYNC_METHOD;
+  profile->burst = DEFAULT_BURST;
+  profile->recover_policy = DEFAULT_RECOVER_POLICY;
+  profile->gop_cache = DEFAULT_GOP_CACHE;
+}
+
+static void
+gss_delivery_profile_class_init (GssDeliveryProfileClass * profile_class)
+{
+  G_OBJECT_CLASS (profile_class)->set_property =
+      gss_delivery_profile_set_property;
+  G_OBJECT_CLASS (profile_class)->get_property =
+      gss_delivery_profile_get_property;
+
+  g_object_class_install_property (G_OBJECT_CLASS (profile_class),
+      PROP_TIME_MIN, g_param_spec_int ("time-min", "Minimum Queue",
+          "[ms] Data queued before a client is sent anything",
+          0, 60000, DEFAULT_TIME_MIN,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (profile_class),
+      PROP_UNITS_MAX, g_param_spec_int ("units-max", "Maximum Lag",
+          "[ms] How far a client can fall behind before it is dropped",
+          0, 600000, DEFAULT_UNITS_MAX,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (profile_class),
+      PROP_UNITS_SOFT_MAX, g_param_spec_int ("units-soft-max",
+          "Recovery Lag", "[ms] How far a client can fall behind before "
+          "it is moved forward with the recover policy",
+          0, 600000, DEFAULT_UNITS_SOFT_MAX,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (profile_class),
+      PROP_SYNC_METHOD, g_param_spec_enum ("sync-method", "Sync Method",
+          "Where new clients start", GSS_TYPE_DELIVERY_SYNC,
+          DEFAULT_SYNC_METHOD,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (profile_class),
+      PROP_BURST, g_param_spec_int ("burst", "Burst",
+          "[ms] Data new clients start back, with burst-keyframe",
+          0, 60000, DEFAULT_BURST,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (profile_class),
+      PROP_RECOVER_POLICY, g_param_spec_enum ("recover-policy",
+          "Recover Policy", "What happens to clients that fall behind",
+          GSS_TYPE_DELIVERY_RECOVER, DEFAULT_RECOVER_POLICY,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (profile_class),
+      PROP_GOP_CACHE, g_param_spec_int ("gop-cache", "GOP Cache",
+          "GOPs new clients get from the fan-out, counting the one in "
+          "progress, 0 to wait for the next keyframe",
+          0, GSS_FANOUT_MAX_GOPS, DEFAULT_GOP_CACHE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+}
+
+static void
+gss_delivery_profile_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GssDeliveryProfile *profile;
+
+  profile = GSS_DELIVERY_PROFILE (object);
+
+  switch (prop_id) {
+    case PROP_TIME_MIN:
+      profile->time_min = g_value_get_int (value);
+      break;
+    case PROP_UNITS_MAX:
+      profile->units_max = g_value_get_int (value);
+      break;
+    case PROP_UNITS_SOFT_MAX:
+      profile->units_soft_max = g_value_get_int (value);
+      break;
+    case PROP_SYNC_METHOD:
+      profile->sync_method = g_value_get_enum (value);
+      break;
+    case PROP_BURST:
+      profile->burst = g_value_get_int (value);
+      break;
+    case PROP_RECOVER_POLICY:
+      profile->recover_policy = g_value_get_enum (value);
+      break;
+    case PROP_GOP_CACHE:
+      profile->gop_cache = g_value_get_int (value);
+      break;
+    default:
+      g_assert_not_reached ();
+      break;
+  }
+}
+
+static void
+gss_delivery_profile_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GssDeliveryProfile *profile;
+
+  profile = GSS_DELIVERY_PROFILE (object);
+
+  switch (prop_id) {
+    case PROP_TIME_MIN:
+      g_value_set_int (value, profile->time_min);
+      break;
+    case PROP_UNITS_MAX:
+      g_value_set_int (value, profile->units_max);
+      break;
+    case PROP_UNITS_SOFT_MAX:
+      g_value_set_int (value, profile->units_soft_max);
+      break;
+    case PROP_SYNC_METHOD:
+      g_value_set_enum (value, profile->sync_method);
+      break;
+    case PROP_BURST:
+      g_value_set_int (value, profile->burst);
+      break;
+    case PROP_RECOVER_POLICY:
+      g_value_set_enum (value, profile->recover_policy);
+      break;
+    case PROP_GOP_CACHE:
+      g_value_set_int (value, profile->gop_cache);
+      break;
+    default:
+      g_assert_not_reached ();
+      break;
+  }
+}
+
+/* Returns a profile named after preset, with its settings, or NULL if
+ * there is no such preset */
+GssDeliveryProfile *
+gss_delivery_profile_new (const char *preset)
+{
+  const GssDeliveryPreset *p = NULL;
+  int i;
+
+  for (i = 0; i < G_N_ELEMENTS (presets); i++) {
+    if (strcmp (presets[i].name, preset) == 0) {
+      p = &presets[i];
+    }
+  }
+  if (p == NULL)
+    return NULL;
+
+  return g_object_new (GSS_TYPE_DELIVERY_PROFILE, "name", p->name,
+      "title", p->title, "time-min", p->time_min, "units-max", p->units_max,
+      "units-soft-max", p->units_soft_max, "sync-method", p->sync_method,
+      "burst", p->burst, "recover-policy", p->recover_policy,
+      "gop-cache", p->gop_cache, NULL);
+}
+
+/* NULL terminated */
+const char *const *
+gss_delivery_profile_get_presets (void)
+{
+  return preset_names;
+}
+
+static const char *
+get_enum_nick (GType type, int value)
+{
+  GEnumClass *enum_class = g_type_class_ref (type);
+  GEnumValue *enum_value = g_enum_get_value (enum_class, value);
+  const char *nick = enum_value ? enum_value->value_nick : NULL;
+
+  g_type_class_unref (enum_class);
+
+  return nick;
+}
+
+/* Sets the profile on a multifdsink, which has to have been created
+ * with gss_server_get_multifdsink_string()'s time units.  Clients that
+ * are already connected keep the position they have. */
+void
+gss_delivery_profile_apply (GssDeliveryProfile * profile, GstElement * sink)
+{
+  g_object_set (sink,
+      "time-min", (gint64) profile->time_min * GST_MSECOND,
+      "units-max", (gint64) profile->units_max * GST_MSECOND,
+      "units-soft-max", (gint64) profile->units_soft_max * GST_MSECOND,
+      "burst-value", (guint64) profile->burst * GST_MSECOND, NULL);
+  gst_util_set_object_arg (G_OBJECT (sink), "sync-method",
+      get_enum_nick (GSS_TYPE_DELIVERY_SYNC, profile->sync_method));
+  gst_util_set_object_arg (G_OBJECT (sink), "recover-policy",
+      get_enum_nick (GSS_TYPE_DELIVERY_RECOVER, profile->recover_policy));
+}
+
+void
+gss_delivery_profile_add_resources (GssDeliveryProfile * profile,
+    GssServer * server)
+{
+  GssResource *r;
+  char *location;
+  char *title;
+
+  location = g_strdup_printf ("/admin/delivery-%s",
+      GSS_OBJECT_NAME (profile));
+  r = gss_server_add_resource (server, location, GSS_RESOURCE_ADMIN,
+      GSS_TEXT_HTML, gss_delivery_profile_get_resource, NULL,
+      gss_delivery_profile_post_resource, profile);
+  title = g_strdup_printf ("Delivery: %s", GSS_OBJECT_TITLE (profile));
+  gss_server_add_admin_resource (server, r, title);
+  g_free (location);
+  g_free (title);
+}
+
+static void
+gss_delivery_profile_get_resource (GssTransaction * t)
+{
+  GssDeliveryProfile *profile = GSS_DELIVERY_PROFILE (t->resource->priv);
+  GString *s = g_string_new ("");
+
+  t->s = s;
+
+  gss_html_header (t);
+
+  GSS_P ("<h1>Delivery Profile: %s</h1>\n", GSS_OBJECT_SAFE_TITLE (profile));
+  GSS_P ("<p>Used by programs and streams with delivery-profile set to "
+      "'%s'.  Changes apply to running streams, clients that are already "
+      "connected keep their position.</p>\n", GSS_OBJECT_NAME (profile));
+
+  gss_config_append_config_block (G_OBJECT (profile), t, TRUE);
+
+  gss_html_footer (t);
+}
+
+static void
+gss_delivery_profile_post_resource (GssTransaction * t)
+{
+  GssDeliveryProfile *profile = GSS_DELIVERY_PROFILE (t->resource->priv);
+
+  if (gss_config_handle_post (G_OBJECT (profile), t)) {
+    gss_config_save_config_file ();
+    gss_transaction_redirect (t, "");
+  } else {
+    gss_transaction_error (t, "Configuration Error");
+  }
+}
@@ -0,0 +1,107 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef _GSS_DELIVERY_PROFILE_H
+#define _GSS_DELIVERY_PROFILE_H
+
+#include <gst/gst.h>
+#include "gss-config.h"
+#include "gss-types.h"
+#include "gss-object.h"
+
+G_BEGIN_DECLS
+
+#define GSS_TYPE_DELIVERY_PROFILE \
+  (gss_delivery_profile_get_type())
+#define GSS_DELIVERY_PROFILE(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST((obj),GSS_TYPE_DELIVERY_PROFILE,\
+      GssDeliveryProfile))
+#define GSS_DELIVERY_PROFILE_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST((klass),GSS_TYPE_DELIVERY_PROFILE,\
+      GssDeliveryProfileClass))
+#define GSS_IS_DELIVERY_PROFILE(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE((obj),GSS_TYPE_DELIVERY_PROFILE))
+#define GSS_IS_DELIVERY_PROFILE_CLASS(obj) \
+  (G_TYPE_CHECK_CLASS_TYPE((klass),GSS_TYPE_DELIVERY_PROFILE))
+#define GSS_TYPE_DELIVERY_SYNC \
+  (gss_delivery_sync_get_type())
+#define GSS_TYPE_DELIVERY_RECOVER \
+  (gss_delivery_recover_get_type())
+
+/* How live stream clients are served: the multifdsink settings that
+ * used to be one string for every pipeline, and the GOP cache of the
+ * fan-out.  The server has one profile for each preset, which programs
+ * and streams refer to by name.  Changing a profile applies to the
+ * sinks of the streams that use it right away. */
+
+#define GSS_DELIVERY_PROFILE_DEFAULT "balanced"
+
+/* nicks are the same as multifdsink's sync-method */
+typedef enum {
+  GSS_DELIVERY_SYNC_NEXT_KEYFRAME = 1,
+  GSS_DELIVERY_SYNC_LATEST_KEYFRAME = 2,
+  GSS_DELIVERY_SYNC_BURST_KEYFRAME = 4
+} GssDeliverySync;
+
+/* nicks are the same as multifdsink's recover-policy */
+typedef enum {
+  GSS_DELIVERY_RECOVER_NONE,
+  GSS_DELIVERY_RECOVER_LATEST,
+  GSS_DELIVERY_RECOVER_SOFT_LIMIT,
+  GSS_DELIVERY_RECOVER_KEYFRAME
+} GssDeliveryRecover;
+
+struct _GssDeliveryProfile {
+  GssObject object;
+
+  /* properties, times in ms */
+  int time_min; /* data queued before a client is sent anything */
+  int units_max; /* queued for a client before it is dropped */
+  int units_soft_max; /* before it is recovered */
+  GssDeliverySync sync_method;
+  int burst; /* data new clients start back, with burst-keyframe */
+  GssDeliveryRecover recover_policy;
+  int gop_cache; /* GOPs new fan-out clients start back */
+};
+
+typedef struct _GssDeliveryProfileClass GssDeliveryProfileClass;
+struct _GssDeliveryProfileClass {
+  GssObjectClass object_class;
+
+};
+
+
+GType gss_delivery_profile_get_type (void);
+GType gss_delivery_sync_get_type (void);
+GType gss_delivery_recover_get_type (void);
+
+GssDeliveryProfile * gss_delivery_profile_new (const char *preset);
+const char * const * gss_delivery_profile_get_presets (void);
+void gss_delivery_profile_apply (GssDeliveryProfile *profile,
+    GstElement *sink);
+void gss_delivery_profile_add_resources (GssDeliveryProfile *profile,
+    GssServer *server);
+
+
+G_END_DECLS
+
+#endif
+
@@ -0,0 +1,1902 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include "gss-server.h"
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H)
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <poll.h>
+#endif
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#endif
+
+#define RING_MASK (GSS_FANOUT_RING_SIZE - 1)
+#define MAX_EVENTS 256
+#define COMMAND_QUEUE_LENGTH 4096
+#define REMOVAL_QUEUE_LENGTH 4096
+
+/* io_uring submission queue and registered files, per shard */
+#define URING_ENTRIES 1024
+#define URING_FILES 16384
+
+/* most a zero-copy client is sent with one sendfile() */
+#define MAX_SENDFILE (1024 * 1024)
+/* the staging file gets new pages in chunks of this, a huge page */
+#define STAGE_CHUNK (2 * 1024 * 1024)
+
+/* a paced client waits until it can send this much, which its bucket
+ * always holds */
+#define PACE_MIN_SEND 8192
+#define PACE_MIN_BURST (64 * 1024)
+/* token bucket size, a quarter second at the rate */
+#define PACE_DEPTH(rate) MAX ((gint64) (rate) / 4, PACE_MIN_BURST)
+
+/* user_data of io_uring requests.  A client's send is the client
+ * pointer, and the poll linked in front of it the pointer | 1. */
+#define URING_EVENT 0
+#define URING_IGNORE 2
+
+/* in the unit of GssFanoutEntry.time */
+#define MAX_LAG_US ((gint64) (GSS_FANOUT_MAX_LAG / GST_USECOND))
+
+typedef enum
+{
+  FANOUT_ADD,
+  FANOUT_REMOVE,
+  FANOUT_SET_RATE,
+  FANOUT_FREE
+} FanoutCommandType;
+
+typedef struct _FanoutCommand FanoutCommand;
+struct _FanoutCommand
+{
+  FanoutCommandType type;
+  GssFanoutClient *client;
+  int rate; /* for FANOUT_SET_RATE */
+};
+
+/* stays untouched until the kernel completes the send */
+typedef struct _FanoutSend FanoutSend;
+struct _FanoutSend
+{
+  struct msghdr msg;
+  struct iovec iov[GSS_FANOUT_MAX_IOV];
+  gsize total;
+};
+
+static gpointer gss_fanout_thread (gpointer data);
+#ifdef HAVE_LINUX_IO_URING_H
+static gpointer gss_fanout_uring_thread (gpointer data);
+static void gss_fanout_uring_finish_headers (GssFanoutShard * shard);
+#endif
+static gboolean gss_fanout_removals_dispatch (gpointer data);
+static void gss_fanout_send_command (GssFanoutShard * shard,
+    FanoutCommandType type, GssFanoutClient * client, int rate);
+
+
+static gboolean
+gss_fanout_entry_init (GssFanoutEntry * entry, GstBuffer * buffer)
+{
+#if GST_CHECK_VERSION(1,0,0)
+  if (!gst_buffer_map (buffer, &entry->map, GST_MAP_READ))
+    return FALSE;
+  entry->data = entry->map.data;
+  entry->size = entry->map.size;
+  entry->header = GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_HEADER);
+#else
+  entry->data = GST_BUFFER_DATA (buffer);
+  entry->size = GST_BUFFER_SIZE (buffer);
+  entry->header = GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_IN_CAPS);
+#endif
+  entry->buffer = gst_buffer_ref (buffer);
+  entry->keyframe = !GST_BUFFER_FLAG_IS_SET (buffer,
+      GST_BUFFER_FLAG_DELTA_UNIT);
+  entry->time = g_get_monotonic_time ();
+  entry->file_offset = -1;
+  entry->file_size = 0;
+
+  return TRUE;
+}
+
+static void
+gss_fanout_entry_clear (GssFanoutEntry * entry)
+{
+#if GST_CHECK_VERSION(1,0,0)
+  gst_buffer_unmap (entry->buffer, &entry->map);
+#endif
+  gst_buffer_unref (entry->buffer);
+  entry->buffer = NULL;
+}
+
+static void
+gss_fanout_clear_headers (GArray * headers)
+{
+  guint i;
+
+  for (i = 0; i < headers->len; i++) {
+    gss_fanout_entry_clear (&g_array_index (headers, GssFanoutEntry, i));
+  }
+  g_array_set_size (headers, 0);
+}
+
+static void
+gss_fanout_shard_wakeup (GssFanoutShard * shard)
+{
+  eventfd_write (shard->event_fd, 1);
+}
+
+static void
+gss_fanout_shard_free (GssFanoutShard * shard)
+{
+  if (shard->commands)
+    gss_queue_free (shard->commands);
+  if (shard->removals)
+    gss_queue_free (shard->removals);
+  if (shard->uring)
+    gss_uring_free (shard->uring);
+  if (shard->free_files)
+    g_array_free (shard->free_files, TRUE);
+  if (shard->epoll_fd >= 0)
+    close (shard->epoll_fd);
+  if (shard->event_fd >= 0)
+    close (shard->event_fd);
+  gss_fanout_clear_headers (shard->headers);
+  g_array_free (shard->headers, TRUE);
+  g_ptr_array_free (shard->pending_removals, TRUE);
+  g_free (shard);
+}
+
+static gboolean
+gss_fanout_shard_setup_epoll (GssFanoutShard * shard)
+{
+  struct epoll_event event;
+
+  shard->epoll_fd = epoll_create (MAX_EVENTS);
+  if (shard->epoll_fd < 0) {
+    GST_ERROR ("failed to create epoll fd: %s", g_strerror (errno));
+    return FALSE;
+  }
+  memset (&event, 0, sizeof (event));
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  if (epoll_ctl (shard->epoll_fd, EPOLL_CTL_ADD, shard->event_fd,
+          &event) < 0) {
+    GST_ERROR ("epoll_ctl: %s", g_strerror (errno));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static GssFanoutShard *
+gss_fanout_shard_new (GssFanout * fanout, int index, gboolean io_uring)
+{
+  GssFanoutShard *shard;
+
+  shard = g_new0 (GssFanoutShard, 1);
+  shard->fanout = fanout;
+  shard->index = index;
+  shard->pace_wait = -1;
+  shard->headers = g_array_new (FALSE, FALSE, sizeof (GssFanoutEntry));
+  shard->pending_removals = g_ptr_array_new ();
+  shard->epoll_fd = -1;
+
+  shard->event_fd = eventfd (0, EFD_NONBLOCK);
+  if (shard->event_fd < 0) {
+    GST_ERROR ("failed to create event fd: %s", g_strerror (errno));
+    gss_fanout_shard_free (shard);
+    return NULL;
+  }
+
+#ifdef HAVE_LINUX_IO_URING_H
+  if (io_uring) {
+    /* falls back to epoll if the kernel does not let us */
+    shard->uring = gss_uring_new (URING_ENTRIES);
+  }
+  if (shard->uring) {
+    shard->free_files = g_array_new (FALSE, FALSE, sizeof (int));
+    if (!gss_uring_register_files (shard->uring, URING_FILES)) {
+      GST_INFO ("sending without registered files");
+    }
+  }
+#endif
+  if (shard->uring == NULL && !gss_fanout_shard_setup_epoll (shard)) {
+    gss_fanout_shard_free (shard);
+    return NULL;
+  }
+
+  shard->commands = gss_queue_new (COMMAND_QUEUE_LENGTH,
+      sizeof (FanoutCommand));
+  shard->removals = gss_queue_new (REMOVAL_QUEUE_LENGTH,
+      sizeof (GssFanoutClient *));
+  gss_queue_attach (shard->removals, NULL, G_PRIORITY_DEFAULT,
+      gss_fanout_removals_dispatch, shard);
+
+  return shard;
+}
+
+/* The staging file for zero-copy, -1 if there is none.  It is mapped
+ * only to punch holes in it, which needs MADV_REMOVE. */
+static int
+gss_fanout_stage_open (guint8 ** map)
+{
+#if defined(HAVE_SYS_SENDFILE_H) && defined(__NR_memfd_create) && \
+    defined(MADV_REMOVE)
+  void *p;
+  int fd;
+
+  fd = syscall (__NR_memfd_create, "gss-fanout", 0);
+  if (fd < 0) {
+    GST_WARNING ("memfd_create: %s", g_strerror (errno));
+    return -1;
+  }
+  fcntl (fd, F_SETFD, FD_CLOEXEC);
+
+  p = MAP_FAILED;
+  if (ftruncate (fd, GSS_FANOUT_STAGE_SIZE) < 0 ||
+      (p = mmap (NULL, GSS_FANOUT_STAGE_SIZE, PROT_READ | PROT_WRITE,
+              MAP_SHARED, fd, 0)) == MAP_FAILED ||
+      madvise (p, STAGE_CHUNK, MADV_REMOVE) < 0) {
+    GST_WARNING ("setting up staging file: %s", g_strerror (errno));
+    if (p != MAP_FAILED)
+      munmap (p, GSS_FANOUT_STAGE_SIZE);
+    close (fd);
+    return -1;
+  }
+  *map = p;
+
+  return fd;
+#else
+  GST_WARNING ("zero-copy needs memfd_create(), MADV_REMOVE and sendfile()");
+  return -1;
+#endif
+}
+
+static void
+gss_fanout_stage_close (GssFanout * fanout)
+{
+  if (fanout->stage_fd < 0)
+    return;
+
+#ifdef HAVE_SYS_SENDFILE_H
+  munmap (fanout->stage_map, GSS_FANOUT_STAGE_SIZE);
+#endif
+  close (fanout->stage_fd);
+  fanout->stage_fd = -1;
+}
+
+/* n_shards is the number of egress threads, or 0 for one per core.
+ * With GSS_FANOUT_FLAG_IO_URING, they send with io_uring if the kernel
+ * supports it, and with epoll and sendmsg() otherwise.  Zero-copy
+ * sends with sendfile() from the epoll engine.  Returns NULL if the
+ * threads could not be set up. */
+GssFanout *
+gss_fanout_new (int n_shards, GssFanoutFlags flags,
+    GssFanoutRemovedFunc removed, gpointer user_data)
+{
+  GssFanout *fanout;
+  gboolean io_uring;
+  int i;
+
+  if (n_shards <= 0) {
+    n_shards = MAX (sysconf (_SC_NPROCESSORS_ONLN), 1);
+  }
+
+  fanout = g_new0 (GssFanout, 1);
+  fanout->removed = removed;
+  fanout->user_data = user_data;
+  fanout->stage_fd = -1;
+  if (flags & GSS_FANOUT_FLAG_ZERO_COPY) {
+    fanout->stage_fd = gss_fanout_stage_open (&fanout->stage_map);
+  }
+  io_uring = (flags & GSS_FANOUT_FLAG_IO_URING) && fanout->stage_fd < 0;
+
+  fanout->ring = g_new0 (GssFanoutEntry, GSS_FANOUT_RING_SIZE);
+  fanout->clients = g_hash_table_new (g_direct_hash, g_direct_equal);
+  fanout->shards = g_new0 (GssFanoutShard *, n_shards);
+  for (i = 0; i < n_shards; i++) {
+    fanout->shards[i] = gss_fanout_shard_new (fanout, i, io_uring);
+    if (fanout->shards[i] == NULL) {
+      while (i-- > 0) {
+        gss_fanout_shard_free (fanout->shards[i]);
+      }
+      g_free (fanout->shards);
+      g_hash_table_destroy (fanout->clients);
+      g_free (fanout->ring);
+      gss_fanout_stage_close (fanout);
+      g_free (fanout);
+      return NULL;
+    }
+  }
+  fanout->n_shards = n_shards;
+
+  fanout->gop_cache = 1;
+  fanout->running = TRUE;
+  for (i = 0; i < n_shards; i++) {
+    GThreadFunc func = gss_fanout_thread;
+
+#ifdef HAVE_LINUX_IO_URING_H
+    if (fanout->shards[i]->uring) {
+      func = gss_fanout_uring_thread;
+    }
+#endif
+#if GLIB_CHECK_VERSION(2,32,0)
+    fanout->shards[i]->thread = g_thread_new ("gss-fanout", func,
+        fanout->shards[i]);
+#else
+    fanout->shards[i]->thread = g_thread_create (func, fanout->shards[i],
+        TRUE, NULL);
+#endif
+  }
+  GST_DEBUG ("fan-out with %d shards, %s%s", n_shards,
+      fanout->shards[0]->uring ? "io_uring" : "epoll",
+      fanout->stage_fd >= 0 ? ", zero-copy" : "");
+
+  return fanout;
+}
+
+/* Called from the main loop for clients a shard let go of.  Commands
+ * sent for the client before it was let go of may still be queued, so
+ * the shard frees it after them, unless it has stopped. */
+static void
+gss_fanout_finish_client (GssFanout * fanout, GssFanoutClient * client)
+{
+  if (!client->detached) {
+    g_hash_table_remove (fanout->clients, GINT_TO_POINTER (client->fd));
+    client->shard->n_clients--;
+    if (fanout->removed) {
+      fanout->removed (fanout, client->fd, client->status,
+          fanout->user_data);
+    }
+  }
+  if (g_atomic_int_get (&fanout->running)) {
+    gss_fanout_send_command (client->shard, FANOUT_FREE, client, 0);
+  } else {
+    g_free (client);
+  }
+}
+
+static gboolean
+gss_fanout_removals_dispatch (gpointer data)
+{
+  GssFanoutShard *shard = data;
+  GssFanoutClient *client;
+
+  while (gss_queue_pop (shard->removals, &client)) {
+    gss_fanout_finish_client (shard->fanout, client);
+  }
+
+  return TRUE;
+}
+
+/* Stops the shards.  Remaining clients are removed, and the removed
+ * callback is called for each before this returns, like when
+ * multifdsink stops. */
+void
+gss_fanout_free (GssFanout * fanout)
+{
+  GssFanoutClient *client;
+  guint seq;
+  int i;
+
+  g_atomic_int_set (&fanout->running, FALSE);
+  for (i = 0; i < fanout->n_shards; i++) {
+    gss_fanout_shard_wakeup (fanout->shards[i]);
+  }
+
+  for (i = 0; i < fanout->n_shards; i++) {
+    GssFanoutShard *shard = fanout->shards[i];
+    guint j;
+
+    g_thread_join (shard->thread);
+
+    /* the thread dropped all its clients on the way out */
+    while (gss_queue_pop (shard->removals, &client)) {
+      gss_fanout_finish_client (fanout, client);
+    }
+    for (j = 0; j < shard->pending_removals->len; j++) {
+      gss_fanout_finish_client (fanout,
+          g_ptr_array_index (shard->pending_removals, j));
+    }
+    g_ptr_array_set_size (shard->pending_removals, 0);
+    gss_fanout_shard_free (shard);
+  }
+  g_free (fanout->shards);
+
+  if (g_hash_table_size (fanout->clients) > 0) {
+    GST_WARNING ("%d clients left", g_hash_table_size (fanout->clients));
+  }
+  g_hash_table_destroy (fanout->clients);
+
+  for (seq = (guint) fanout->head; seq != (guint) fanout->tail; seq++) {
+    gss_fanout_entry_clear (&fanout->ring[seq & RING_MASK]);
+  }
+  g_free (fanout->ring);
+  gss_fanout_stage_close (fanout);
+  g_free (fanout);
+}
+
+/* Clears the entries that every shard has released */
+static void
+gss_fanout_release (GssFanout * fanout)
+{
+  guint head = (guint) fanout->head;
+  guint release = (guint) fanout->tail;
+  int i;
+
+  for (i = 0; i < fanout->n_shards; i++) {
+    guint seq = (guint) g_atomic_int_get (&fanout->shards[i]->release_seq);
+
+    if ((gint) (seq - release) < 0)
+      release = seq;
+  }
+  for (; head != release; head++) {
+    GssFanoutEntry *entry = &fanout->ring[head & RING_MASK];
+
+    fanout->stage_used -= entry->file_size;
+    gss_fanout_entry_clear (entry);
+  }
+  fanout->head = head;
+}
+
+/* Copies the entry to the staging file, if there is room that no entry
+ * in the ring uses.  Entries don't wrap around the end of the file, so
+ * that each is one range of it.
+ *
+ * Sockets that were sent a range with sendfile() hold references to its
+ * pages until the data is acknowledged, which can be long after the
+ * entries left the ring, so the pages are never written again.  Before
+ * the producer writes into a chunk on a new lap, the chunk is punched
+ * out of the file and gets new pages; the old ones stay with the sockets
+ * that still use them, and are freed once they let go. */
+static void
+gss_fanout_stage (GssFanout * fanout, GssFanoutEntry * entry)
+{
+  gsize pos = fanout->stage_pos;
+  gsize fresh = fanout->stage_fresh;
+  gsize skip = 0;
+  gsize end;
+
+  if (entry->size == 0 || entry->size > GSS_FANOUT_STAGE_SIZE / 4)
+    return;
+  if (pos + entry->size > GSS_FANOUT_STAGE_SIZE) {
+    skip = GSS_FANOUT_STAGE_SIZE - pos;
+    pos = 0;
+    fresh = 0;
+  }
+  /* the chunks it reaches into have to be free as a whole */
+  end = (pos + entry->size + STAGE_CHUNK - 1) & ~((gsize) STAGE_CHUNK - 1);
+  end = MAX (end, fresh);
+  if (fanout->stage_used + skip + (end - pos) > GSS_FANOUT_STAGE_SIZE)
+    return;
+
+#ifdef MADV_REMOVE
+  if (end > fresh &&
+      madvise (fanout->stage_map + fresh, end - fresh, MADV_REMOVE) < 0) {
+    GST_WARNING ("punching staging file: %s", g_strerror (errno));
+    return;
+  }
+#endif
+  if (pwrite (fanout->stage_fd, entry->data, entry->size,
+          pos) != (gssize) entry->size) {
+    GST_WARNING ("writing staging file: %s", g_strerror (errno));
+    return;
+  }
+  entry->file_offset = pos;
+  entry->file_size = skip + entry->size;
+  fanout->stage_used += entry->file_size;
+  fanout->stage_pos = pos + entry->size;
+  fanout->stage_fresh = end;
+}
+
+/* From the main loop, before it stops the pipeline, which waits for the
+ * producer.  Buffers that don't fit in the ring are dropped from then
+ * on instead of waiting for the shards. */
+void
+gss_fanout_set_flushing (GssFanout * fanout)
+{
+  g_atomic_int_set (&fanout->flushing, TRUE);
+}
+
+/* Producer side, from the streaming thread.  The buffer is kept until
+ * every client has sent it or it gets too old. */
+void
+gss_fanout_push (GssFanout * fanout, GstBuffer * buffer)
+{
+  guint tail = (guint) fanout->tail;
+  GssFanoutEntry *entry;
+  int i;
+
+  /* the shards release entries long before the ring is full, so this
+   * only waits if one of them is stuck */
+  gss_fanout_release (fanout);
+  while (tail - (guint) fanout->head >= GSS_FANOUT_RING_SIZE) {
+    if (!g_atomic_int_get (&fanout->running) ||
+        g_atomic_int_get (&fanout->flushing))
+      return;
+    g_usleep (1000);
+    gss_fanout_release (fanout);
+  }
+
+  entry = &fanout->ring[tail & RING_MASK];
+  if (!gss_fanout_entry_init (entry, buffer)) {
+    GST_ERROR ("failed map");
+    return;
+  }
+  fanout->bytes_in += entry->size;
+  if (fanout->stage_fd >= 0) {
+    gss_fanout_stage (fanout, entry);
+  }
+
+  fanout->push_time = entry->time;
+
+  /* publishes the entry, g_atomic_int_set() is a full barrier */
+  g_atomic_int_set (&fanout->tail, (gint) (tail + 1));
+  for (i = 0; i < fanout->n_shards; i++) {
+    gss_fanout_shard_wakeup (fanout->shards[i]);
+  }
+}
+
+static void
+gss_fanout_send_command (GssFanoutShard * shard, FanoutCommandType type,
+    GssFanoutClient * client, int rate)
+{
+  FanoutCommand command;
+
+  command.type = type;
+  command.client = client;
+  command.rate = rate;
+  while (!gss_queue_push (shard->commands, &command)) {
+    gss_fanout_shard_wakeup (shard);
+    g_usleep (1000);
+  }
+  gss_fanout_shard_wakeup (shard);
+}
+
+/* The fanout works on a duplicate of fd, so fd may be closed as soon as
+ * the removed callback is called for it.  The client goes to the shard
+ * with the fewest clients. */
+void
+gss_fanout_add (GssFanout * fanout, int fd)
+{
+  GssFanoutShard *shard;
+  GssFanoutClient *client;
+  int flags;
+  int i;
+
+  if (g_hash_table_lookup (fanout->clients, GINT_TO_POINTER (fd))) {
+    GST_WARNING ("fd %d added twice", fd);
+    return;
+  }
+
+  shard = fanout->shards[0];
+  for (i = 1; i < fanout->n_shards; i++) {
+    if (fanout->shards[i]->n_clients < shard->n_clients) {
+      shard = fanout->shards[i];
+    }
+  }
+
+  client = g_new0 (GssFanoutClient, 1);
+  client->shard = shard;
+  client->fd = fd;
+  client->sock = dup (fd);
+  client->is_socket = TRUE;
+  client->file = -1;
+  client->status = GSS_FANOUT_STATUS_OK;
+  client->link.data = client;
+  client->all_link.data = client;
+  client->add_time = g_get_monotonic_time ();
+  if (client->sock < 0) {
+    GST_ERROR ("dup: %s", g_strerror (errno));
+    g_free (client);
+    return;
+  }
+  flags = fcntl (client->sock, F_GETFL, 0);
+  fcntl (client->sock, F_SETFL, flags | O_NONBLOCK);
+
+  g_hash_table_insert (fanout->clients, GINT_TO_POINTER (fd), client);
+  shard->n_clients++;
+  gss_fanout_send_command (shard, FANOUT_ADD, client, 0);
+}
+
+/* Calls the removed callback right away, with GSS_FANOUT_STATUS_REMOVED,
+ * like multifdsink's remove signal */
+void
+gss_fanout_remove (GssFanout * fanout, int fd)
+{
+  GssFanoutClient *client;
+
+  client = g_hash_table_lookup (fanout->clients, GINT_TO_POINTER (fd));
+  if (client == NULL)
+    return;
+
+  g_hash_table_remove (fanout->clients, GINT_TO_POINTER (fd));
+  client->shard->n_clients--;
+  client->detached = TRUE;
+  if (fanout->removed) {
+    fanout->removed (fanout, fd, GSS_FANOUT_STATUS_REMOVED,
+        fanout->user_data);
+  }
+  gss_fanout_send_command (client->shard, FANOUT_REMOVE, client, 0);
+}
+
+void
+gss_fanout_clear (GssFanout * fanout)
+{
+  GList *fds;
+  GList *g;
+
+  fds = g_hash_table_get_keys (fanout->clients);
+  for (g = fds; g; g = g_list_next (g)) {
+    gss_fanout_remove (fanout, GPOINTER_TO_INT (g->data));
+  }
+  g_list_free (fds);
+}
+
+/* Number of GOPs, counting the one in progress, that clients added from
+ * now on start back from the live edge.  0 makes them wait for the next
+ * keyframe. */
+void
+gss_fanout_set_gop_cache (GssFanout * fanout, int n_gops)
+{
+  g_atomic_int_set (&fanout->gop_cache, CLAMP (n_gops, 0,
+          GSS_FANOUT_MAX_GOPS));
+}
+
+guint64
+gss_fanout_get_bytes_sent (GssFanout * fanout, int fd)
+{
+  GssFanoutClient *client;
+
+  client = g_hash_table_lookup (fanout->clients, GINT_TO_POINTER (fd));
+
+  return client ? client->bytes_sent : 0;
+}
+
+/* How far (in us) the client is behind the most recent ring entry, 0 if
+ * it is caught up or has not started yet.  Made from times the producer
+ * and the shard publish, so it doesn't touch what the shard works on. */
+gint64
+gss_fanout_get_client_lag (GssFanout * fanout, int fd)
+{
+  GssFanoutClient *client;
+  gint64 seq_time;
+  gint64 lag;
+
+  client = g_hash_table_lookup (fanout->clients, GINT_TO_POINTER (fd));
+  if (client == NULL)
+    return 0;
+
+  seq_time = client->seq_time;
+  if (seq_time == 0)
+    return 0;
+  lag = fanout->push_time - seq_time;
+
+  return MAX (lag, 0);
+}
+
+/* Paces the client at rate bytes/sec with a token bucket in the shard,
+ * or not at all if rate is 0.  The shard owns the bucket, so the rate
+ * goes to it as a command. */
+void
+gss_fanout_set_client_rate (GssFanout * fanout, int fd, int rate)
+{
+  GssFanoutClient *client;
+
+  client = g_hash_table_lookup (fanout->clients, GINT_TO_POINTER (fd));
+  if (client) {
+    gss_fanout_send_command (client->shard, FANOUT_SET_RATE, client, rate);
+  }
+}
+
+/* Totals over the shards */
+void
+gss_fanout_get_stats (GssFanout * fanout, guint64 * bytes_in,
+    guint64 * bytes_sent, guint64 * n_writes, gint64 * cpu_time)
+{
+  guint64 sent = 0;
+  guint64 writes = 0;
+  gint64 cpu = 0;
+  int i;
+
+  for (i = 0; i < fanout->n_shards; i++) {
+    sent += fanout->shards[i]->bytes_sent;
+    writes += fanout->shards[i]->n_writes;
+    cpu += fanout->shards[i]->cpu_time;
+  }
+
+  if (bytes_in)
+    *bytes_in = fanout->bytes_in;
+  if (bytes_sent)
+    *bytes_sent = sent;
+  if (n_writes)
+    *n_writes = writes;
+  if (cpu_time)
+    *cpu_time = cpu;
+}
+
+/* Time to first frame: from a client being added until it has been
+ * sent the headers and the keyframe buffer it starts at (us) */
+void
+gss_fanout_get_start_stats (GssFanout * fanout, guint64 * n_started,
+    gint64 * avg_time, gint64 * max_time)
+{
+  guint64 n = 0;
+  gint64 total = 0;
+  gint64 max = 0;
+  int i;
+
+  for (i = 0; i < fanout->n_shards; i++) {
+    n += fanout->shards[i]->n_started;
+    total += fanout->shards[i]->start_time;
+    max = MAX (max, fanout->shards[i]->max_start_time);
+  }
+
+  if (n_started)
+    *n_started = n;
+  if (avg_time)
+    *avg_time = n ? total / (gint64) n : 0;
+  if (max_time)
+    *max_time = max;
+}
+
+/* Clients that fell behind and were moved forward to a keyframe */
+guint64
+gss_fanout_get_n_recovered (GssFanout * fanout)
+{
+  guint64 n = 0;
+  int i;
+
+  for (i = 0; i < fanout->n_shards; i++) {
+    n += fanout->shards[i]->n_recovered;
+  }
+
+  return n;
+}
+
+
+/* Everything below runs in the shard threads */
+
+static void
+gss_fanout_client_move (GssFanoutClient * client, GQueue * queue)
+{
+  if (client->queue == queue)
+    return;
+  if (client->queue) {
+    g_queue_unlink (client->queue, &client->link);
+  }
+  client->queue = queue;
+  if (queue) {
+    g_queue_push_tail_link (queue, &client->link);
+  }
+}
+
+static gboolean
+gss_fanout_client_has_data (GssFanoutShard * shard,
+    GssFanoutClient * client)
+{
+  return !client->headers_done || client->seq != shard->scan_seq;
+}
+
+/* Puts a client that is not waiting for a keyframe where it belongs */
+static void
+gss_fanout_client_schedule (GssFanoutShard * shard,
+    GssFanoutClient * client)
+{
+  if (!client->writable) {
+    gss_fanout_client_move (client, NULL);
+  } else if (gss_fanout_client_has_data (shard, client)) {
+    gss_fanout_client_move (client, &shard->ready);
+  } else {
+    gss_fanout_client_move (client, &shard->idle);
+  }
+}
+
+/* Lets go of the socket and hands the client back to the main loop */
+static void
+gss_fanout_client_release (GssFanoutShard * shard, GssFanoutClient * client)
+{
+  if (shard->uring) {
+    if (client->file >= 0) {
+      gss_uring_update_file (shard->uring, client->file, -1);
+      g_array_append_val (shard->free_files, client->file);
+      client->file = -1;
+    }
+  } else {
+    epoll_ctl (shard->epoll_fd, EPOLL_CTL_DEL, client->sock, NULL);
+  }
+  close (client->sock);
+  client->sock = -1;
+  g_free (client->send);
+  client->send = NULL;
+  g_ptr_array_add (shard->pending_removals, client);
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+/* Asks the kernel to give up on the client's pending requests.  Tried
+ * again later if the submission queue is full. */
+static void
+gss_fanout_client_cancel (GssFanoutShard * shard, GssFanoutClient * client)
+{
+  struct io_uring_sqe *sqe;
+  int i;
+
+  if (client->cancelled || client->n_pending == 0)
+    return;
+  if (gss_uring_sq_space (shard->uring) < 2) {
+    gss_uring_submit (shard->uring, 0, -1);
+    shard->n_syscalls++;
+    if (gss_uring_sq_space (shard->uring) < 2)
+      return;
+  }
+
+  /* the send, and the poll in front of it if there is one */
+  for (i = 0; i < 2; i++) {
+    sqe = gss_uring_get_sqe (shard->uring);
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (guint64) (gsize) client | i;
+    sqe->user_data = URING_IGNORE;
+  }
+  client->cancelled = TRUE;
+}
+#endif
+
+static void
+gss_fanout_drop_client (GssFanoutShard * shard, GssFanoutClient * client,
+    GssFanoutStatus status)
+{
+  if (client->status != GSS_FANOUT_STATUS_OK)
+    return;
+
+  GST_DEBUG ("fd %d removed, status %d", client->fd, status);
+  client->status = status;
+  gss_fanout_client_move (client, NULL);
+  g_queue_unlink (&shard->active, &client->all_link);
+  if (client->n_pending > 0) {
+    /* the kernel may still use the socket and the ring entries */
+    g_queue_push_tail_link (&shard->draining, &client->all_link);
+#ifdef HAVE_LINUX_IO_URING_H
+    gss_fanout_client_cancel (shard, client);
+#endif
+    return;
+  }
+  gss_fanout_client_release (shard, client);
+}
+
+/* Puts the socket in the registered files, which saves looking it up
+ * for every send */
+static void
+gss_fanout_client_register (GssFanoutShard * shard, GssFanoutClient * client)
+{
+  GArray *free_files = shard->free_files;
+  int file;
+
+  if (free_files->len > 0) {
+    file = g_array_index (free_files, int, free_files->len - 1);
+    g_array_set_size (free_files, free_files->len - 1);
+  } else if (shard->n_files_used < shard->uring->n_files) {
+    file = shard->n_files_used++;
+  } else {
+    return;
+  }
+
+  if (gss_uring_update_file (shard->uring, file, client->sock)) {
+    client->file = file;
+  } else {
+    g_array_append_val (free_files, file);
+  }
+}
+
+static void
+gss_fanout_start_client (GssFanoutShard * shard, GssFanoutClient * client,
+    guint seq)
+{
+  client->seq = seq;
+  client->start_seq = seq;
+  client->headers_seq = shard->scan_seq;
+  gss_fanout_client_schedule (shard, client);
+}
+
+/* Starts gop_cache keyframes back, or as far back as there are, else at
+ * the next keyframe */
+static void
+gss_fanout_add_client (GssFanoutShard * shard, GssFanoutClient * client)
+{
+  int n_gops = g_atomic_int_get (&shard->fanout->gop_cache);
+  struct epoll_event event;
+
+  g_queue_push_tail_link (&shard->active, &client->all_link);
+  if (shard->uring) {
+    client->send = g_new0 (FanoutSend, 1);
+    gss_fanout_client_register (shard, client);
+    /* finds out when it sends */
+    client->writable = TRUE;
+  } else {
+    memset (&event, 0, sizeof (event));
+    event.events = EPOLLOUT | EPOLLET | EPOLLRDHUP;
+    event.data.ptr = client;
+    if (epoll_ctl (shard->epoll_fd, EPOLL_CTL_ADD, client->sock,
+            &event) < 0) {
+      GST_WARNING ("epoll_ctl: %s", g_strerror (errno));
+      gss_fanout_drop_client (shard, client, GSS_FANOUT_STATUS_ERROR);
+      return;
+    }
+    /* epoll reports it writable right away if it is */
+    client->writable = FALSE;
+  }
+
+  if (n_gops > 0 && shard->n_keyframes > 0) {
+    n_gops = MIN (n_gops, shard->n_keyframes);
+    gss_fanout_start_client (shard, client, shard->keyframes[n_gops - 1]);
+  } else {
+    gss_fanout_client_move (client, &shard->waiting);
+  }
+}
+
+/* The bucket is left alone while the client isn't paced, so it starts
+ * out full when it is */
+static void
+gss_fanout_client_set_rate (GssFanoutClient * client, int rate)
+{
+  if (rate > 0 && client->pace_rate <= 0) {
+    client->pace_tokens = PACE_DEPTH (rate);
+    client->pace_time = g_get_monotonic_time ();
+  }
+  client->pace_rate = rate;
+}
+
+static void
+gss_fanout_run_commands (GssFanoutShard * shard)
+{
+  FanoutCommand command;
+
+  while (gss_queue_pop (shard->commands, &command)) {
+    switch (command.type) {
+      case FANOUT_ADD:
+        gss_fanout_add_client (shard, command.client);
+        break;
+      case FANOUT_REMOVE:
+        /* may have been dropped already */
+        gss_fanout_drop_client (shard, command.client,
+            GSS_FANOUT_STATUS_REMOVED);
+        break;
+      case FANOUT_SET_RATE:
+        gss_fanout_client_set_rate (command.client, command.rate);
+        break;
+      case FANOUT_FREE:
+        g_free (command.client);
+        break;
+    }
+  }
+}
+
+/* Clients that have all of the previous headers get the new ones
+ * with the stream, but there is no good way to switch the ones in the
+ * middle of them. */
+static void
+gss_fanout_replace_headers (GssFanoutShard * shard)
+{
+  GList *g;
+  GList *next;
+
+#ifdef HAVE_LINUX_IO_URING_H
+  if (shard->uring) {
+    gss_fanout_uring_finish_headers (shard);
+  }
+#endif
+  for (g = shard->active.head; g; g = next) {
+    GssFanoutClient *client = g->data;
+
+    next = g->next;
+    if (!client->headers_done &&
+        (client->n_headers_sent > 0 || client->offset > 0)) {
+      gss_fanout_drop_client (shard, client, GSS_FANOUT_STATUS_ERROR);
+    }
+  }
+  gss_fanout_clear_headers (shard->headers);
+}
+
+/* Looks at new ring entries for headers and keyframes */
+static void
+gss_fanout_scan (GssFanoutShard * shard)
+{
+  GssFanout *fanout = shard->fanout;
+  guint tail = (guint) g_atomic_int_get (&fanout->tail);
+  GList *link;
+
+  if (shard->scan_seq == tail)
+    return;
+
+  for (; shard->scan_seq != tail; shard->scan_seq++) {
+    GssFanoutEntry *entry = &fanout->ring[shard->scan_seq & RING_MASK];
+
+    shard->scan_time = entry->time;
+    if (entry->header) {
+      GssFanoutEntry header;
+
+      /* a new run of headers replaces the previous set */
+      if (!shard->in_headers) {
+        gss_fanout_replace_headers (shard);
+        shard->in_headers = TRUE;
+      }
+      if (gss_fanout_entry_init (&header, entry->buffer)) {
+        g_array_append_val (shard->headers, header);
+      }
+      continue;
+    }
+
+    shard->in_headers = FALSE;
+    if (entry->keyframe) {
+      memmove (shard->keyframes + 1, shard->keyframes,
+          (GSS_FANOUT_MAX_GOPS - 1) * sizeof (guint));
+      shard->keyframes[0] = shard->scan_seq;
+      shard->n_keyframes = MIN (shard->n_keyframes + 1, GSS_FANOUT_MAX_GOPS);
+      while ((link = g_queue_peek_head_link (&shard->waiting))) {
+        gss_fanout_client_move (link->data, NULL);
+        gss_fanout_start_client (shard, link->data, shard->scan_seq);
+      }
+    }
+  }
+
+  /* caught up clients have something to send again */
+  while ((link = g_queue_peek_head_link (&shard->idle))) {
+    gss_fanout_client_move (link->data, &shard->ready);
+  }
+}
+
+/* Keeps the ring entries that pending sends point at */
+static guint
+gss_fanout_pending_release (GQueue * clients, guint release)
+{
+  GList *g;
+
+  for (g = clients->head; g; g = g->next) {
+    GssFanoutClient *client = g->data;
+
+    if (client->n_pending > 0 && (gint) (client->seq - release) < 0)
+      release = client->seq;
+  }
+
+  return release;
+}
+
+/* Publishes the time of the ring entry the client is at, or of the
+ * newest one it has looked at once it is caught up, for
+ * gss_fanout_get_client_lag() in the main loop */
+static void
+gss_fanout_client_publish_time (GssFanoutShard * shard,
+    GssFanoutClient * client)
+{
+  if (client->add_time != 0)
+    return;
+
+  if (client->seq == shard->scan_seq) {
+    client->seq_time = shard->scan_time;
+  } else {
+    client->seq_time = shard->fanout->ring[client->seq & RING_MASK].time;
+  }
+}
+
+/* Releases entries older than GSS_FANOUT_MAX_LAG, in batches, or when
+ * the ring is half full.  Clients that still need them are moved
+ * forward to the most recent keyframe. */
+static void
+gss_fanout_trim (GssFanoutShard * shard)
+{
+  GssFanout *fanout = shard->fanout;
+  guint release = (guint) shard->release_seq;
+  gint64 newest;
+  GList *g;
+  GList *next;
+
+  if (shard->scan_seq == release)
+    return;
+
+  newest = fanout->ring[(shard->scan_seq - 1) & RING_MASK].time;
+  if (shard->scan_seq - release <= GSS_FANOUT_RING_SIZE / 2 &&
+      newest - fanout->ring[release & RING_MASK].time <=
+      MAX_LAG_US + G_USEC_PER_SEC) {
+    return;
+  }
+
+  while (release != shard->scan_seq) {
+    GssFanoutEntry *entry = &fanout->ring[release & RING_MASK];
+
+    if (shard->scan_seq - release <= GSS_FANOUT_RING_SIZE / 2 &&
+        newest - entry->time <= MAX_LAG_US)
+      break;
+    release++;
+  }
+
+  while (shard->n_keyframes > 0 &&
+      (gint) (shard->keyframes[shard->n_keyframes - 1] - release) < 0) {
+    shard->n_keyframes--;
+  }
+
+  for (g = shard->active.head; g; g = next) {
+    GssFanoutClient *client = g->data;
+
+    next = g->next;
+    if (client->queue == &shard->waiting ||
+        (gint) (client->seq - release) >= 0)
+      continue;
+
+    if (client->n_pending > 0) {
+      /* dealt with once the kernel is done with its send */
+#ifdef HAVE_LINUX_IO_URING_H
+      gss_fanout_client_cancel (shard, client);
+#endif
+      continue;
+    }
+    if (client->offset > 0 && client->headers_done) {
+      /* cannot skip the rest of a buffer */
+      gss_fanout_drop_client (shard, client, GSS_FANOUT_STATUS_SLOW);
+    } else if (shard->n_keyframes > 0) {
+      shard->n_recovered++;
+      client->seq = shard->keyframes[0];
+      client->start_seq = client->seq;
+      client->headers_seq = shard->scan_seq;
+      gss_fanout_client_publish_time (shard, client);
+      gss_fanout_client_schedule (shard, client);
+    } else {
+      gss_fanout_client_move (client, &shard->waiting);
+    }
+  }
+
+  if (shard->uring) {
+    release = gss_fanout_pending_release (&shard->active, release);
+    release = gss_fanout_pending_release (&shard->draining, release);
+  }
+  /* the producer clears them once all shards are past them */
+  g_atomic_int_set (&shard->release_seq, (gint) release);
+}
+
+/* Bytes the client's token bucket lets it send now, G_MAXSIZE if it is
+ * not paced here */
+static gsize
+gss_fanout_client_allowance (GssFanoutClient * client, gint64 now)
+{
+  gint rate = client->pace_rate;
+  gint64 depth;
+  gint64 elapsed;
+
+  if (rate <= 0)
+    return G_MAXSIZE;
+
+  /* no longer than it takes to fill the bucket, which keeps the
+   * product in range */
+  depth = PACE_DEPTH (rate);
+  elapsed = CLAMP (now - client->pace_time, 0, depth * G_USEC_PER_SEC / rate);
+  client->pace_tokens = MIN (depth, client->pace_tokens +
+      elapsed * rate / G_USEC_PER_SEC);
+  client->pace_time = now;
+
+  return MAX (client->pace_tokens, 0);
+}
+
+/* FALSE if the client is out of tokens and was put aside until it has
+ * enough again */
+static gboolean
+gss_fanout_client_pace (GssFanoutShard * shard, GssFanoutClient * client,
+    gsize * limit)
+{
+  *limit = gss_fanout_client_allowance (client, g_get_monotonic_time ());
+  /* the write is charged by the rate read here, which a command may
+   * change before it completes */
+  client->pace_charge = (*limit != G_MAXSIZE);
+  if (*limit >= PACE_MIN_SEND)
+    return TRUE;
+
+  gss_fanout_client_move (client, &shard->paced);
+  return FALSE;
+}
+
+/* Fills in the iovecs for the client's next write, of up to limit
+ * bytes */
+static guint
+gss_fanout_client_fill (GssFanoutShard * shard, GssFanoutClient * client,
+    struct iovec *iov, gsize limit, gsize * total)
+{
+  GssFanout *fanout = shard->fanout;
+  gsize offset = client->offset;
+  guint n_iov = 0;
+  guint h;
+  guint seq;
+
+  *total = 0;
+
+  for (h = client->n_headers_sent; !client->headers_done &&
+      h < shard->headers->len && n_iov < GSS_FANOUT_MAX_IOV &&
+      *total < limit; h++) {
+    GssFanoutEntry *entry = &g_array_index (shard->headers, GssFanoutEntry,
+        h);
+
+    iov[n_iov].iov_base = (guint8 *) entry->data + offset;
+    iov[n_iov].iov_len = entry->size - offset;
+    *total += iov[n_iov].iov_len;
+    offset = 0;
+    n_iov++;
+  }
+  for (seq = client->seq; seq != shard->scan_seq &&
+      n_iov < GSS_FANOUT_MAX_IOV && *total < limit; seq++) {
+    GssFanoutEntry *entry = &fanout->ring[seq & RING_MASK];
+
+    if (entry->header && (gint) (seq - client->headers_seq) < 0)
+      continue;
+    iov[n_iov].iov_base = (guint8 *) entry->data + offset;
+    iov[n_iov].iov_len = entry->size - offset;
+    *total += iov[n_iov].iov_len;
+    offset = 0;
+    n_iov++;
+  }
+
+  if (*total > limit) {
+    iov[n_iov - 1].iov_len -= *total - limit;
+    *total = limit;
+  }
+
+  if (n_iov == 0) {
+    /* no headers, and only headers it already has */
+    client->headers_done = TRUE;
+    client->seq = seq;
+  }
+
+  return n_iov;
+}
+
+/* Moves the client past the len bytes that were sent */
+static void
+gss_fanout_client_advance (GssFanoutShard * shard, GssFanoutClient * client,
+    gsize len)
+{
+  GssFanout *fanout = shard->fanout;
+  gsize offset;
+
+  client->bytes_sent += len;
+  shard->bytes_sent += len;
+  if (client->pace_charge) {
+    client->pace_tokens -= len;
+  }
+
+  /* walk the same entries again, up to where the write stopped */
+  offset = client->offset + len;
+  while (!client->headers_done) {
+    GssFanoutEntry *entry;
+
+    if (client->n_headers_sent == shard->headers->len) {
+      client->headers_done = TRUE;
+      break;
+    }
+    entry = &g_array_index (shard->headers, GssFanoutEntry,
+        client->n_headers_sent);
+    if (offset < entry->size)
+      goto done;
+    offset -= entry->size;
+    client->n_headers_sent++;
+  }
+  while (client->seq != shard->scan_seq) {
+    GssFanoutEntry *entry = &fanout->ring[client->seq & RING_MASK];
+
+    if (!entry->header || (gint) (client->seq - client->headers_seq) >= 0) {
+      if (offset < entry->size)
+        break;
+      offset -= entry->size;
+    }
+    client->seq++;
+  }
+done:
+  client->offset = offset;
+
+  /* has the headers and the whole keyframe buffer it started at */
+  if (client->add_time != 0 && client->headers_done &&
+      (gint) (client->seq - client->start_seq) > 0) {
+    gint64 start_time = g_get_monotonic_time () - client->add_time;
+
+    GST_DEBUG ("fd %d got its first frame after %" G_GINT64_FORMAT " us",
+        client->fd, start_time);
+    shard->n_started++;
+    shard->start_time += start_time;
+    shard->max_start_time = MAX (shard->max_start_time, start_time);
+    client->add_time = 0;
+  }
+  gss_fanout_client_publish_time (shard, client);
+}
+
+/* Finds the run of staged ring entries the client sends next, which
+ * are one range of the staging file.  Returns its length, 0 if the
+ * client is not at a staged entry. */
+static gsize
+gss_fanout_client_get_staged (GssFanoutShard * shard,
+    GssFanoutClient * client, off_t * offset)
+{
+  GssFanout *fanout = shard->fanout;
+  GssFanoutEntry *entry = &fanout->ring[client->seq & RING_MASK];
+  gsize total;
+  guint seq;
+
+  /* headers are sent from the shard's copies */
+  if (!client->headers_done || client->seq == shard->scan_seq ||
+      entry->file_offset < 0 ||
+      (entry->header && (gint) (client->seq - client->headers_seq) < 0))
+    return 0;
+
+  *offset = entry->file_offset + client->offset;
+  total = entry->size - client->offset;
+  for (seq = client->seq + 1; seq != shard->scan_seq && total < MAX_SENDFILE;
+      seq++) {
+    GssFanoutEntry *next = &fanout->ring[seq & RING_MASK];
+
+    if (next->file_offset != entry->file_offset + (gint64) entry->size ||
+        (next->header && (gint) (seq - client->headers_seq) < 0))
+      break;
+    total += next->size;
+    entry = next;
+  }
+
+  return total;
+}
+
+/* Writes as much as one sendmsg() or sendfile() takes */
+static void
+gss_fanout_client_write (GssFanoutShard * shard, GssFanoutClient * client)
+{
+  struct iovec iov[GSS_FANOUT_MAX_IOV];
+  gsize total = 0;
+  gsize limit;
+  gssize len;
+  guint n_iov;
+  off_t offset;
+
+  if (!gss_fanout_client_pace (shard, client, &limit))
+    return;
+
+  if (shard->fanout->stage_fd >= 0) {
+    total = MIN (gss_fanout_client_get_staged (shard, client, &offset),
+        limit);
+  }
+  if (total > 0) {
+#ifdef HAVE_SYS_SENDFILE_H
+    len = sendfile (client->sock, shard->fanout->stage_fd, &offset, total);
+#else
+    len = -1;
+#endif
+  } else if ((n_iov = gss_fanout_client_fill (shard, client, iov, limit,
+              &total)) == 0) {
+    gss_fanout_client_schedule (shard, client);
+    return;
+  } else if (client->is_socket) {
+    struct msghdr msg;
+
+    memset (&msg, 0, sizeof (msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = n_iov;
+    len = sendmsg (client->sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    if (len < 0 && errno == ENOTSOCK) {
+      client->is_socket = FALSE;
+      len = writev (client->sock, iov, n_iov);
+    }
+  } else {
+    len = writev (client->sock, iov, n_iov);
+  }
+  shard->n_writes++;
+  shard->n_syscalls++;
+
+  if (len < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      client->writable = FALSE;
+      gss_fanout_client_move (client, NULL);
+    } else if (errno != EINTR) {
+      GST_DEBUG ("fd %d: %s", client->fd, g_strerror (errno));
+      gss_fanout_drop_client (shard, client, GSS_FANOUT_STATUS_ERROR);
+    }
+    return;
+  }
+  gss_fanout_client_advance (shard, client, len);
+
+  if ((gsize) len < total) {
+    /* the socket buffer is full, epoll tells when it drains */
+    client->writable = FALSE;
+  }
+  gss_fanout_client_schedule (shard, client);
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+/* Queues the client's next send, behind a poll for POLLOUT if its
+ * socket was full.  Needs two free submission entries. */
+static void
+gss_fanout_client_submit (GssFanoutShard * shard, GssFanoutClient * client)
+{
+  FanoutSend *send = client->send;
+  struct io_uring_sqe *sqe;
+  guint8 flags = 0;
+  gsize limit;
+  guint n_iov;
+  int fd = client->sock;
+
+  if (!gss_fanout_client_pace (shard, client, &limit))
+    return;
+
+  n_iov = gss_fanout_client_fill (shard, client, send->iov, limit,
+      &send->total);
+  if (n_iov == 0) {
+    gss_fanout_client_schedule (shard, client);
+    return;
+  }
+
+  if (client->file >= 0) {
+    fd = client->file;
+    flags = IOSQE_FIXED_FILE;
+  }
+
+  if (client->need_poll) {
+    /* the send starts as soon as the poll completes */
+    sqe = gss_uring_get_sqe (shard->uring);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->flags = flags | IOSQE_IO_LINK;
+    sqe->poll_events = POLLOUT;
+    sqe->user_data = (guint64) (gsize) client | 1;
+    client->n_pending++;
+    client->need_poll = FALSE;
+  }
+
+  sqe = gss_uring_get_sqe (shard->uring);
+  sqe->fd = fd;
+  sqe->flags = flags;
+  if (client->is_socket) {
+    memset (&send->msg, 0, sizeof (send->msg));
+    send->msg.msg_iov = send->iov;
+    send->msg.msg_iovlen = n_iov;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->addr = (guint64) (gsize) & send->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+  } else {
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->addr = (guint64) (gsize) send->iov;
+    sqe->len = n_iov;
+    sqe->off = (guint64) - 1;
+  }
+  sqe->user_data = (guint64) (gsize) client;
+  client->n_pending++;
+  shard->n_writes++;
+
+  /* nothing else for it until the send completes */
+  client->writable = FALSE;
+  gss_fanout_client_schedule (shard, client);
+}
+
+static void
+gss_fanout_uring_complete (GssFanoutShard * shard, guint64 user_data,
+    int res)
+{
+  GssFanoutClient *client;
+  eventfd_t value;
+
+  if (user_data == URING_EVENT) {
+    eventfd_read (shard->event_fd, &value);
+    shard->event_polled = FALSE;
+    return;
+  }
+  if (user_data == URING_IGNORE)
+    return;
+
+  client = (GssFanoutClient *) (gsize) (user_data & ~(guint64) 1);
+  client->n_pending--;
+
+  /* the poll in front of a send is reported by the send */
+  if (!(user_data & 1) && client->status == GSS_FANOUT_STATUS_OK) {
+    if (res >= 0) {
+      gss_fanout_client_advance (shard, client, res);
+      if ((gsize) res < ((FanoutSend *) client->send)->total) {
+        client->need_poll = TRUE;
+      }
+    } else if (res == -EAGAIN || res == -ECANCELED || res == -EINTR) {
+      client->need_poll = TRUE;
+    } else if (res == -ENOTSOCK) {
+      client->is_socket = FALSE;
+    } else {
+      GST_DEBUG ("fd %d: %s", client->fd, g_strerror (-res));
+      gss_fanout_drop_client (shard, client,
+          (res == -EPIPE || res == -ECONNRESET) ?
+          GSS_FANOUT_STATUS_CLOSED : GSS_FANOUT_STATUS_ERROR);
+      if (client->n_pending == 0)
+        return;
+    }
+  }
+
+  if (client->n_pending > 0)
+    return;
+  client->cancelled = FALSE;
+  if (client->status != GSS_FANOUT_STATUS_OK) {
+    g_queue_unlink (&shard->draining, &client->all_link);
+    gss_fanout_client_release (shard, client);
+  } else {
+    client->writable = TRUE;
+    gss_fanout_client_schedule (shard, client);
+  }
+}
+
+static void
+gss_fanout_uring_poll_event (GssFanoutShard * shard)
+{
+  struct io_uring_sqe *sqe;
+
+  sqe = gss_uring_get_sqe (shard->uring);
+  if (sqe == NULL)
+    return;
+  sqe->opcode = IORING_OP_POLL_ADD;
+  sqe->fd = shard->event_fd;
+  sqe->poll_events = POLLIN;
+  sqe->user_data = URING_EVENT;
+  shard->event_polled = TRUE;
+}
+
+/* Submits everything queued, waits up to timeout_ms for a completion,
+ * then handles the whole batch of completions */
+static void
+gss_fanout_uring_wait (GssFanoutShard * shard, int timeout_ms)
+{
+  struct io_uring_cqe *cqe;
+  GList *g;
+  int ret;
+
+  /* cancels that did not fit before */
+  for (g = shard->draining.head; g; g = g->next) {
+    gss_fanout_client_cancel (shard, g->data);
+  }
+  if (!shard->event_polled) {
+    gss_fanout_uring_poll_event (shard);
+  }
+
+  ret = gss_uring_submit (shard->uring, timeout_ms != 0, timeout_ms);
+  shard->n_syscalls++;
+  if (ret < 0 && ret != -EBUSY) {
+    GST_ERROR ("io_uring_enter: %s", g_strerror (-ret));
+    g_usleep (10000);
+  }
+
+  while ((cqe = gss_uring_peek_cqe (shard->uring))) {
+    guint64 user_data = cqe->user_data;
+    int res = cqe->res;
+
+    gss_uring_cqe_seen (shard->uring);
+    gss_fanout_uring_complete (shard, user_data, res);
+  }
+}
+
+/* Sends that have some of the headers in them need to be over before
+ * the headers change */
+static void
+gss_fanout_uring_finish_headers (GssFanoutShard * shard)
+{
+  gboolean pending;
+  GList *g;
+
+  do {
+    pending = !g_queue_is_empty (&shard->draining);
+    for (g = shard->active.head; g; g = g->next) {
+      GssFanoutClient *client = g->data;
+
+      if (!client->headers_done && client->n_pending > 0) {
+        gss_fanout_client_cancel (shard, client);
+        pending = TRUE;
+      }
+    }
+    if (pending) {
+      gss_fanout_uring_wait (shard, 10);
+    }
+  } while (pending && g_atomic_int_get (&shard->fanout->running));
+}
+#endif
+
+/* One pass over the clients that were ready when it started, so that
+ * clients with a lot to send don't hold up the rest */
+static void
+gss_fanout_serve (GssFanoutShard * shard)
+{
+  guint n = g_queue_get_length (&shard->ready);
+  GList *link;
+
+  while (n-- > 0 && (link = g_queue_peek_head_link (&shard->ready))) {
+    GssFanoutClient *client = link->data;
+
+#ifdef HAVE_LINUX_IO_URING_H
+    if (shard->uring && gss_uring_sq_space (shard->uring) < 2) {
+      /* the rest after these went in */
+      gss_uring_submit (shard->uring, 0, -1);
+      shard->n_syscalls++;
+      if (gss_uring_sq_space (shard->uring) < 2)
+        break;
+    }
+#endif
+
+    /* to the back of the line if it still has more to send */
+    g_queue_unlink (&shard->ready, link);
+    client->queue = NULL;
+#ifdef HAVE_LINUX_IO_URING_H
+    if (shard->uring) {
+      gss_fanout_client_submit (shard, client);
+      continue;
+    }
+#endif
+    gss_fanout_client_write (shard, client);
+  }
+}
+
+static void
+gss_fanout_flush_removals (GssFanoutShard * shard)
+{
+  guint i;
+
+  for (i = 0; i < shard->pending_removals->len; i++) {
+    if (!gss_queue_push (shard->removals,
+            &g_ptr_array_index (shard->pending_removals, i)))
+      break;
+  }
+  g_ptr_array_remove_range (shard->pending_removals, 0, i);
+}
+
+/* Paced clients that have enough tokens again go back in line, and
+ * pace_wait is set to when the next one does */
+static void
+gss_fanout_unpace (GssFanoutShard * shard)
+{
+  gint64 now = g_get_monotonic_time ();
+  GList *g;
+  GList *next;
+
+  shard->pace_wait = -1;
+  for (g = shard->paced.head; g; g = next) {
+    GssFanoutClient *client = g->data;
+    gint rate = client->pace_rate;
+
+    next = g->next;
+    if (gss_fanout_client_allowance (client, now) >= PACE_MIN_SEND) {
+      gss_fanout_client_move (client, NULL);
+      gss_fanout_client_schedule (shard, client);
+    } else if (rate > 0) {
+      gint64 wait = (PACE_MIN_SEND - client->pace_tokens) *
+          G_USEC_PER_SEC / rate;
+
+      if (shard->pace_wait < 0 || wait < shard->pace_wait)
+        shard->pace_wait = wait;
+    }
+  }
+}
+
+/* How long the shard can wait for something to happen, in ms */
+static int
+gss_fanout_get_timeout (GssFanoutShard * shard)
+{
+  if (!g_queue_is_empty (&shard->ready))
+    return 0;
+  if (shard->pending_removals->len > 0)
+    return 10;
+  if (shard->pace_wait >= 0)
+    return MIN (1000, shard->pace_wait / 1000 + 1);
+  return 1000;
+}
+
+/* The work done after waking up, for either way of waiting */
+static void
+gss_fanout_iterate (GssFanoutShard * shard)
+{
+  struct timespec ts;
+
+  gss_fanout_run_commands (shard);
+  gss_fanout_scan (shard);
+  gss_fanout_trim (shard);
+  gss_fanout_serve (shard);
+  /* after serve, which puts aside the clients that ran out */
+  gss_fanout_unpace (shard);
+  gss_fanout_flush_removals (shard);
+
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+  shard->cpu_time = (gint64) ts.tv_sec * GST_SECOND + ts.tv_nsec;
+}
+
+static gpointer
+gss_fanout_thread (gpointer data)
+{
+  GssFanoutShard *shard = data;
+  GssFanout *fanout = shard->fanout;
+  struct epoll_event events[MAX_EVENTS];
+  GList *link;
+
+  while (g_atomic_int_get (&fanout->running)) {
+    int n;
+    int i;
+
+    n = epoll_wait (shard->epoll_fd, events, MAX_EVENTS,
+        gss_fanout_get_timeout (shard));
+    shard->n_syscalls++;
+    if (n < 0) {
+      if (errno != EINTR) {
+        GST_ERROR ("epoll_wait: %s", g_strerror (errno));
+        g_usleep (10000);
+      }
+      n = 0;
+    }
+
+    /* in the order epoll reported them */
+    for (i = 0; i < n; i++) {
+      GssFanoutClient *client = events[i].data.ptr;
+      eventfd_t value;
+
+      if (client == NULL) {
+        eventfd_read (shard->event_fd, &value);
+        continue;
+      }
+      if (client->status != GSS_FANOUT_STATUS_OK)
+        continue;
+      if (events[i].events & EPOLLERR) {
+        gss_fanout_drop_client (shard, client, GSS_FANOUT_STATUS_ERROR);
+      } else if (events[i].events & (EPOLLHUP | EPOLLRDHUP)) {
+        gss_fanout_drop_client (shard, client, GSS_FANOUT_STATUS_CLOSED);
+      } else if (events[i].events & EPOLLOUT) {
+        client->writable = TRUE;
+        if (client->queue != &shard->waiting) {
+          gss_fanout_client_schedule (shard, client);
+        }
+      }
+    }
+
+    gss_fanout_iterate (shard);
+  }
+
+  /* hands every client back */
+  gss_fanout_run_commands (shard);
+  while ((link = g_queue_peek_head_link (&shard->active))) {
+    gss_fanout_drop_client (shard, link->data, GSS_FANOUT_STATUS_REMOVED);
+  }
+
+  return NULL;
+}
+
+#ifdef HAVE_LINUX_IO_URING_H
+static gpointer
+gss_fanout_uring_thread (gpointer data)
+{
+  GssFanoutShard *shard = data;
+  GssFanout *fanout = shard->fanout;
+  GList *link;
+  int i;
+
+  while (g_atomic_int_get (&fanout->running)) {
+    gss_fanout_uring_wait (shard, gss_fanout_get_timeout (shard));
+    gss_fanout_iterate (shard);
+  }
+
+  /* hands every client back, once the kernel is done with it */
+  gss_fanout_run_commands (shard);
+  while ((link = g_queue_peek_head_link (&shard->active))) {
+    gss_fanout_drop_client (shard, link->data, GSS_FANOUT_STATUS_REMOVED);
+  }
+  for (i = 0; i < 100 && !g_queue_is_empty (&shard->draining); i++) {
+    gss_fanout_uring_wait (shard, 10);
+  }
+  /* closing the ring cancels whatever is left */
+  while ((link = g_queue_pop_head_link (&shard->draining))) {
+    gss_fanout_client_release (shard, link->data);
+  }
+
+  return NULL;
+}
+#endif
+
+#else
+
+GssFanout *
+gss_fanout_new (int n_shards, GssFanoutFlags flags,
+    GssFanoutRemovedFunc removed, gpointer user_data)
+{
+  GST_WARNING ("fan-out needs epoll");
+  return NULL;
+}
+
+void
+gss_fanout_free (GssFanout * fanout)
+{
+}
+
+void
+gss_fanout_push (GssFanout * fanout, GstBuffer * buffer)
+{
+}
+
+void
+gss_fanout_set_flushing (GssFanout * fanout)
+{
+}
+
+void
+gss_fanout_add (GssFanout * fanout, int fd)
+{
+}
+
+void
+gss_fanout_remove (GssFanout * fanout, int fd)
+{
+}
+
+void
+gss_fanout_clear (GssFanout * fanout)
+{
+}
+
+void
+gss_fanout_set_gop_cache (GssFanout * fanout, int n_gops)
+{
+}
+
+guint64
+gss_fanout_get_bytes_sent (GssFanout * fanout, int fd)
+{
+  return 0;
+}
+
+gint64
+gss_fanout_get_client_lag (GssFanout * fanout, int fd)
+{
+  return 0;
+}
+
+void
+gss_fanout_set_client_rate (GssFanout * fanout, int fd, int rate)
+{
+}
+
+void
+gss_fanout_get_stats (GssFanout * fanout, guint64 * bytes_in,
+    guint64 * bytes_sent, guint64 * n_writes, gint64 * cpu_time)
+{
+}
+
+void
+gss_fanout_get_start_stats (GssFanout * fanout, guint64 * n_started,
+    gint64 * avg_time, gint64 * max_time)
+{
+}
+
+guint64
+gss_fanout_get_n_recovered (GssFanout * fanout)
+{
+  return 0;
+}
+
+#endif
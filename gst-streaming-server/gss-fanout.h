@@ -0,0 +1,246 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef _GSS_FANOUT_H
+#define _GSS_FANOUT_H
+
+#include <gst/gst.h>
+#include "gss-config.h"
+#include "gss-types.h"
+
+G_BEGIN_DECLS
+
+/* Delivers a stream to many sockets, instead of multifdsink.  Buffers
+ * from the muxer go into a ring, each one mapped once and shared by
+ * all clients.  Clients are spread over shards, each an egress thread
+ * with its own epoll set, which writes to them with sendmsg(), as many
+ * ring entries per call as fit in GSS_FANOUT_MAX_IOV.  A shard waits
+ * in epoll for sockets that become writable and serves them in the
+ * order they are reported.  Entries leave the ring once every shard is
+ * done with them.
+ *
+ * Where the kernel has io_uring, a shard can instead queue the sends of
+ * all its clients and submit them with one system call, without epoll.
+ * Sockets are registered with the ring, and a send that would block
+ * goes out again behind a linked poll for POLLOUT, so the kernel sends
+ * as soon as there is room.
+ *
+ * With GSS_FANOUT_FLAG_ZERO_COPY, the producer also copies each buffer
+ * once into a staging memfd of GSS_FANOUT_STAGE_SIZE, used as a ring,
+ * and clients are sent runs of staged entries with sendfile(), which
+ * gives the socket references to the pages instead of copying them.
+ * Space in the staging file is reused once the entries in it leave the
+ * ring, but on new pages: the old ones are punched out of the file and
+ * stay with the sockets that have not sent them yet.  Entries that did
+ * not fit are sent with sendmsg().
+ *
+ * Each shard remembers the last GSS_FANOUT_MAX_GOPS keyframes still in
+ * the ring, which makes the ring a GOP cache: new clients get the stream
+ * headers, then the last gop_cache GOPs, counting the one in progress,
+ * in the same writes, and are at the live edge after that.  With a
+ * gop_cache of 0 they wait for the next keyframe.  Clients that fall
+ * more than GSS_FANOUT_MAX_LAG behind are moved forward to the most
+ * recent keyframe, or removed if they are in the middle of a buffer.
+ * Clients are added and removed from the main loop, and the removed
+ * callback is called there once the fanout has let go of the fd, with
+ * the same status as multifdsink's client-removed signal.  The main loop
+ * only hands commands to a shard, which owns the client from then on and
+ * frees it after the last of them.
+ *
+ * Clients can be paced with gss_fanout_set_client_rate(), a command
+ * like the others, so the shard's token bucket is only touched from
+ * the shard.  Each write is limited to what the client's
+ * token bucket holds, and a client that runs out is put aside until it
+ * has enough for a few kilobytes again. */
+
+#define GSS_FANOUT_RING_SIZE 16384
+#define GSS_FANOUT_MAX_IOV 64
+#define GSS_FANOUT_MAX_GOPS 8
+#define GSS_FANOUT_MAX_LAG (20 * GST_SECOND)
+#define GSS_FANOUT_STAGE_SIZE (64 * 1024 * 1024)
+
+typedef enum {
+  GSS_FANOUT_FLAG_IO_URING = (1 << 0),
+  GSS_FANOUT_FLAG_ZERO_COPY = (1 << 1)
+} GssFanoutFlags;
+
+/* same values as multifdsink's GstClientStatus */
+typedef enum {
+  GSS_FANOUT_STATUS_OK,
+  GSS_FANOUT_STATUS_CLOSED,
+  GSS_FANOUT_STATUS_REMOVED,
+  GSS_FANOUT_STATUS_SLOW,
+  GSS_FANOUT_STATUS_ERROR
+} GssFanoutStatus;
+
+typedef struct _GssFanoutEntry GssFanoutEntry;
+typedef struct _GssFanoutClient GssFanoutClient;
+typedef struct _GssFanoutShard GssFanoutShard;
+
+typedef void (*GssFanoutRemovedFunc) (GssFanout *fanout, int fd,
+    GssFanoutStatus status, gpointer user_data);
+
+struct _GssFanoutEntry {
+  GstBuffer *buffer;
+#if GST_CHECK_VERSION(1,0,0)
+  GstMapInfo map;
+#endif
+  const guint8 *data;
+  gsize size;
+  gint64 time; /* monotonic (us), when it was pushed */
+  gboolean keyframe;
+  gboolean header;
+  gint64 file_offset; /* in the staging file, or -1 */
+  gsize file_size; /* space it takes there, with what was skipped */
+};
+
+struct _GssFanoutClient {
+  GssFanoutShard *shard;
+  int fd; /* as added */
+  int sock; /* dup of fd, owned by the shard */
+  gboolean is_socket; /* FALSE for pipes, written with writev() */
+  guint seq; /* next ring entry to send */
+  gsize offset; /* bytes of it, or of the next header, already sent */
+  guint n_headers_sent;
+  gboolean headers_done;
+  guint headers_seq; /* header entries before this are in the header set */
+  gboolean writable;
+  GssFanoutStatus status;
+  GQueue *queue; /* waiting, idle or ready list it is in, or NULL */
+  GList link; /* in that list */
+  GList all_link; /* in the active list */
+  gboolean detached; /* removed from the main loop side already */
+  guint64 bytes_sent; /* written by the shard */
+  gint64 add_time; /* monotonic (us), 0 once it has its first frame */
+  guint start_seq; /* keyframe it started at */
+  /* monotonic (us) ring time of where it is, 0 before its first frame;
+   * published by the shard for the main loop */
+  volatile gint64 seq_time;
+
+  /* token bucket, shard only */
+  int pace_rate; /* bytes/sec, 0 if not paced */
+  gint64 pace_tokens; /* bytes it may send */
+  gint64 pace_time; /* monotonic (us), when they were last added */
+  gboolean pace_charge; /* the write in progress takes tokens */
+
+  /* io_uring */
+  int file; /* index in the shard's registered files, or -1 */
+  gpointer send; /* the send being submitted, with its iovecs */
+  int n_pending; /* requests the kernel has not completed */
+  gboolean need_poll; /* the socket was full, wait for POLLOUT */
+  gboolean cancelled; /* the pending requests are being cancelled */
+};
+
+/* An egress thread and the clients it serves */
+struct _GssFanoutShard {
+  GssFanout *fanout;
+  int index;
+  int epoll_fd;
+  int event_fd; /* wakes up the thread */
+  GThread *thread;
+  GssQueue *commands; /* main loop to shard */
+  GssQueue *removals; /* shard to main loop */
+  GssUring *uring; /* sends with io_uring instead of epoll, or NULL */
+  int n_clients; /* main loop only */
+
+  /* shard thread only */
+  GQueue active; /* clients being served */
+  GQueue waiting; /* for a keyframe */
+  GQueue idle; /* writable, but caught up */
+  GQueue ready;
+  GQueue paced; /* ready, but out of tokens */
+  gint64 pace_wait; /* us until one of them has enough, or -1 */
+  GPtrArray *pending_removals; /* that did not fit in removals */
+  GArray *headers; /* GssFanoutEntry */
+  gboolean in_headers;
+  guint scan_seq; /* ring entries before this have been looked at */
+  gint64 scan_time; /* of the last of them */
+  guint keyframes[GSS_FANOUT_MAX_GOPS]; /* in the ring, most recent first */
+  int n_keyframes;
+  volatile gint release_seq; /* ring entries before this are not needed */
+
+  /* io_uring */
+  gboolean event_polled; /* a poll for event_fd is submitted */
+  GQueue draining; /* dropped clients with requests still pending */
+  GArray *free_files; /* unused indexes in the registered files */
+  int n_files_used;
+
+  /* statistics */
+  guint64 bytes_sent;
+  guint64 n_writes;
+  guint64 n_syscalls; /* waits, sends and submissions */
+  guint64 n_recovered; /* lagging clients moved to a keyframe */
+  guint64 n_started; /* clients that got their first frame */
+  gint64 start_time; /* total time from being added until then (us) */
+  gint64 max_start_time;
+  gint64 cpu_time; /* of the thread (ns) */
+};
+
+struct _GssFanout {
+  GssFanoutRemovedFunc removed;
+  gpointer user_data;
+
+  /* the producer writes both, entries up to the oldest release_seq of
+   * the shards are cleared when it pushes */
+  GssFanoutEntry *ring;
+  volatile gint head;
+  volatile gint tail;
+  volatile gint64 push_time; /* of the newest entry */
+
+  /* staging file, written by the producer */
+  int stage_fd; /* -1 if not zero-copy */
+  gsize stage_pos; /* where the next entry goes */
+  gsize stage_used; /* by entries in the ring */
+  gsize stage_fresh; /* chunks up to here have new pages on this lap */
+  guint8 *stage_map; /* of the whole file, to punch holes in it */
+
+  volatile gint running;
+  volatile gint flushing; /* the producer no longer waits for room */
+  volatile gint gop_cache; /* GOPs new clients start back */
+  int n_shards;
+  GssFanoutShard **shards;
+  GHashTable *clients; /* fd to GssFanoutClient, main loop only */
+
+  guint64 bytes_in;
+};
+
+GssFanout * gss_fanout_new (int n_shards, GssFanoutFlags flags,
+    GssFanoutRemovedFunc removed, gpointer user_data);
+void gss_fanout_free (GssFanout *fanout);
+void gss_fanout_push (GssFanout *fanout, GstBuffer *buffer);
+void gss_fanout_set_flushing (GssFanout *fanout);
+void gss_fanout_add (GssFanout *fanout, int fd);
+void gss_fanout_remove (GssFanout *fanout, int fd);
+void gss_fanout_clear (GssFanout *fanout);
+void gss_fanout_set_gop_cache (GssFanout *fanout, int n_gops);
+guint64 gss_fanout_get_bytes_sent (GssFanout *fanout, int fd);
+gint64 gss_fanout_get_client_lag (GssFanout *fanout, int fd);
+void gss_fanout_set_client_rate (GssFanout *fanout, int fd, int rate);
+void gss_fanout_get_stats (GssFanout *fanout, guint64 *bytes_in,
+    guint64 *bytes_sent, guint64 *n_writes, gint64 *cpu_time);
+void gss_fanout_get_start_stats (GssFanout *fanout, guint64 *n_started,
+    gint64 *avg_time, gint64 *max_time);
+guint64 gss_fanout_get_n_recovered (GssFanout *fanout);
+
+G_END_DECLS
+
+#endif
+
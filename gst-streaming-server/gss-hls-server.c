@@ -24,6 +24,9 @@
 #include "gss-server.h"
 #include "gss-utils.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 
 
 enum
@@ -34,9 +37,12 @@ enum
 
 static void gss_hls_handle_m3u8 (GssTransaction * t);
 static void gss_hls_handle_stream_m3u8 (GssTransaction * t);
-static void gss_hls_handle_ts_chunk (GssTransaction * t);
+static void gss_hls_handle_iframes_m3u8 (GssTransaction * t);
+static void gss_hls_handle_segment (GssTransaction * t);
+static void gss_hls_handle_key (GssTransaction * t);
 
-void gss_program_add_hls_chunk (GssStream * stream, SoupBuffer * buf);
+void gss_program_add_hls_chunk (GssStream * stream, GList * buffers,
+    gsize size, GstClockTime duration, GssHLSKey * key);
 
 #if GST_CHECK_VERSION(1,0,0)
 static GstPadProbeReturn sink_probe_callback (GstPad * pad,
@@ -47,6 +53,679 @@ sink_data_probe_callback (GstPad * pad, GstMiniObject * mo, gpointer user_data);
 #endif
 
 static void gss_hls_update_variant (GssProgram * program);
+static gboolean gss_hls_queue_dispatch (gpointer data);
+static void gss_hls_update_index (GssStream * stream);
+static gboolean gss_hls_playlist_has (GssStream * stream, int msn,
+    int part_index);
+
+/* LL-HLS parts are listed for this many of the most recent segments */
+#define GSS_HLS_PART_SEGMENTS 3
+
+/* segments and parts on their way from the streaming thread */
+#define GSS_HLS_QUEUE_LENGTH 256
+
+/* Queue item, a segment or part cut by the streaming thread */
+typedef struct _ChunkCallback ChunkCallback;
+struct _ChunkCallback
+{
+  GssStream *stream;
+  GList *buffers;
+  gsize n;
+  GstClockTime duration;
+
+  /* LL-HLS */
+  gboolean is_part;
+  gboolean independent;
+  gboolean ends_segment;
+  GstClockTime segment_duration;
+
+  /* encrypted segment, in a block from the buffer pool, instead of
+   * buffers */
+  SoupBuffer *encrypted;
+  int key_period;
+  guint8 key[16];
+
+  /* fMP4 initialization segment, instead of media */
+  SoupBuffer *init;
+
+  /* GssHLSIFrame, for the segment this completes */
+  GArray *iframes;
+
+  gint64 queued_time;
+};
+
+typedef struct _GssHLSWaiter GssHLSWaiter;
+struct _GssHLSWaiter
+{
+  GssStream *stream;
+  GssHLSPart *part;             /* NULL for blocking playlist reloads */
+  GssTransaction *t;
+  int msn;
+  int part_index;
+  guint timeout_id;
+  gulong finished_id;
+};
+
+/* Without DVR, only the in-memory segments are kept around.  With DVR,
+ * there is a slot for each segment the window can hold at the minimum
+ * segment duration, and segments that leave the in-memory set are
+ * copied into a segment store in the archive directory, which is sized
+ * to hold twice the window at the nominal bitrate. */
+static void
+gss_hls_stream_alloc_segments (GssStream * stream)
+{
+  GssProgram *program = stream->program;
+
+  stream->hls.cache = GSS_OBJECT_SERVER (program)->segment_cache;
+  stream->hls.pool = GSS_OBJECT_SERVER (program)->buffer_pool;
+  stream->max_chunks = GSS_STREAM_HLS_CHUNKS;
+  if (program->hls.dvr) {
+    guint64 size;
+    char *name;
+
+    size = (guint64) (program->hls.window + GSS_STREAM_HLS_CHUNKS) *
+        stream->bitrate / 8 * 2;
+    size = MAX (size, 16 * 1024 * 1024);
+
+    name = g_strdup_printf ("%s-%dx%d-%dkbps%s", GSS_OBJECT_NAME (program),
+        stream->width, stream->height, stream->bitrate / 1000,
+        gss_stream_type_get_mod (stream->type));
+    stream->hls.store =
+        gss_segment_store_new (GSS_OBJECT_SERVER (program)->archive_dir, name,
+        size);
+    g_free (name);
+
+    if (stream->hls.store) {
+      stream->max_chunks = ((guint64) program->hls.window * GST_SECOND +
+          GSS_STREAM_HLS_MIN_DURATION - 1) / GSS_STREAM_HLS_MIN_DURATION +
+          GSS_STREAM_HLS_CHUNKS;
+    } else {
+      GST_WARNING ("stream %s: no segment store, DVR disabled",
+          GSS_OBJECT_NAME (stream));
+    }
+  }
+
+  stream->chunks = g_new0 (GssHLSSegment, stream->max_chunks);
+}
+
+/* Drops the in-memory copy of a segment, and its share of the segment
+ * cache */
+static void
+gss_hls_segment_free_buffers (GssStream * stream, GssHLSSegment * segment)
+{
+  gss_segment_cache_remove (stream->hls.cache, segment);
+  g_list_free_full (segment->buffers, (GDestroyNotify) soup_buffer_free);
+  segment->buffers = NULL;
+}
+
+static void
+gss_hls_segment_spill (GssStream * stream, GssHLSSegment * segment)
+{
+  if (segment->buffers == NULL)
+    return;
+
+  if (!gss_segment_store_write (stream->hls.store, segment->buffers,
+          segment->size, &segment->store_offset)) {
+    /* stays in memory until it is evicted */
+    GST_WARNING ("stream %s: segment %d too large for segment store, "
+        "or its place is still being sent", GSS_OBJECT_NAME (stream),
+        segment->index);
+    return;
+  }
+
+  gss_hls_segment_free_buffers (stream, segment);
+}
+
+/* Frees the buffers of a segment that has left the live window, to make
+ * room for others.  With DVR it stays available from the segment store,
+ * if it fits. */
+void
+gss_hls_segment_evict (GssStream * stream, GssHLSSegment * segment)
+{
+  if (stream->hls.store) {
+    gss_hls_segment_spill (stream, segment);
+  }
+  gss_hls_segment_free_buffers (stream, segment);
+}
+
+/* Segments and parts never change once they are published, so caches
+ * can keep them for as long as the program allows.  max_age of 0 means
+ * the response must not be cached at all. */
+static void
+gss_hls_set_cache_control (SoupMessage * msg, int max_age, gboolean immutable)
+{
+  char *s;
+
+  if (max_age <= 0) {
+    soup_message_headers_replace (msg->response_headers,
+        "Cache-Control", "no-store");
+    return;
+  }
+
+  s = g_strdup_printf ("public, max-age=%d%s", max_age,
+      immutable ? ", immutable" : "");
+  soup_message_headers_replace (msg->response_headers, "Cache-Control", s);
+  g_free (s);
+}
+
+/* Media playlists may be cached for half a target duration, so that a
+ * CDN collapses the reloads of all clients into about one request per
+ * segment.  A response to a blocking reload already contains the
+ * segment or part it asked for, so it stays valid much longer. */
+static int
+gss_hls_playlist_max_age (GssStream * stream, gboolean blocking)
+{
+  if (!stream->program->hls.cache_playlists)
+    return 0;
+  if (blocking)
+    return 6 * stream->hls.target_duration;
+  if (stream->hls.part_target)
+    return 1;
+  return MAX (1, stream->hls.target_duration / 2);
+}
+
+static char *
+gss_hls_segment_etag (GssHLSSegment * segment)
+{
+  return g_strdup_printf ("\"%08x-%d\"", segment->stream->hls.epoch,
+      segment->index);
+}
+
+static char *
+gss_hls_part_etag (GssHLSPart * part)
+{
+  return g_strdup_printf ("\"%08x-%d.%d\"", part->stream->hls.epoch,
+      part->msn, part->index);
+}
+
+static const char *
+gss_hls_segment_ext (GssStream * stream)
+{
+  return (stream->type == GSS_STREAM_TYPE_FMP4_H264_AAC) ? "m4s" : "ts";
+}
+
+/* Byte ranges can't be decrypted on their own, and fMP4 fragments would
+ * need the moof of the sync sample as well. */
+static gboolean
+gss_hls_has_iframes (GssStream * stream)
+{
+  return stream->type != GSS_STREAM_TYPE_FMP4_H264_AAC && !stream->hls.encrypt;
+}
+
+/* until the next I-frame, or the end of the segment */
+static GstClockTime
+gss_hls_iframe_duration (GssHLSSegment * segment, guint i)
+{
+  GssHLSIFrame *iframe = &g_array_index (segment->iframes, GssHLSIFrame, i);
+  GstClockTime end = segment->duration;
+
+  if (i + 1 < segment->iframes->len) {
+    end = g_array_index (segment->iframes, GssHLSIFrame, i + 1).time;
+  }
+  return (end > iframe->time) ? end - iframe->time : 0;
+}
+
+/* Appends buffer, with suffix inserted at each of the n offsets ends,
+ * which are counted from base.  Only the suffixes are copied. */
+static void
+gss_hls_append_with_suffix (SoupMessageBody * body, SoupBuffer * buffer,
+    const guint64 * ends, guint n, guint64 base, const char *suffix)
+{
+  gsize pos = 0;
+  guint i;
+
+  for (i = 0; i < n; i++) {
+    gsize end = ends[i] - base;
+    SoupBuffer *sub;
+
+    sub = soup_buffer_new_subbuffer (buffer, pos, end - pos);
+    soup_message_body_append_buffer (body, sub);
+    soup_buffer_free (sub);
+    soup_message_body_append (body, SOUP_MEMORY_COPY, suffix,
+        strlen (suffix));
+    pos = end;
+  }
+  if (pos == 0) {
+    soup_message_body_append_buffer (body, buffer);
+  } else if (pos < buffer->length) {
+    SoupBuffer *sub;
+
+    sub = soup_buffer_new_subbuffer (buffer, pos, buffer->length - pos);
+    soup_message_body_append_buffer (body, sub);
+    soup_buffer_free (sub);
+  }
+}
+
+static void
+gss_hls_respond_playlist (GssStream * stream, GssTransaction * t,
+    gboolean blocking)
+{
+  SoupMessage *msg = t->msg;
+  gboolean personalize;
+  char *etag;
+
+  if (stream->hls.index_header == NULL || stream->hls.need_index_update) {
+    gss_hls_update_index (stream);
+  }
+
+  personalize = stream->hls.encrypt && t->session;
+  if (personalize) {
+    /* key URIs are personalized, see below, and so is the ETag */
+    soup_message_headers_replace (msg->response_headers,
+        "Cache-Control", "private, no-cache");
+    etag = g_strdup_printf ("\"%08x-%d-%08x\"", stream->hls.epoch,
+        stream->hls.index_version, g_str_hash (t->session->session_id));
+  } else {
+    gss_hls_set_cache_control (msg,
+        gss_hls_playlist_max_age (stream, blocking), FALSE);
+    etag = g_strdup_printf ("\"%08x-%d\"", stream->hls.epoch,
+        stream->hls.index_version);
+  }
+  if (gss_transaction_check_etag (t, etag)) {
+    g_free (etag);
+    return;
+  }
+  g_free (etag);
+
+  soup_message_set_status (msg, SOUP_STATUS_OK);
+
+  if (personalize) {
+    guint64 header_key_end = stream->hls.header_key_end;
+    char *suffix;
+
+    /* Players don't pass on the query of the playlist URI, so keys
+     * can only be fetched by a logged in user if the session is part
+     * of their URIs.  The session is added where the key URIs end,
+     * and the rest is shared.  There are no parts, and so no key URIs
+     * in the tail, when encrypting. */
+    suffix = g_strdup_printf ("?session_id=%s", t->session->session_id);
+    gss_hls_append_with_suffix (msg->response_body,
+        stream->hls.index_header, &header_key_end,
+        stream->hls.header_key_end >= 0 ? 1 : 0, 0, suffix);
+    gss_hls_append_with_suffix (msg->response_body,
+        gss_playlist_get_buffer (stream->hls.playlist),
+        (guint64 *) stream->hls.key_ends->data, stream->hls.key_ends->len,
+        stream->hls.playlist_dropped, suffix);
+    soup_message_body_append_buffer (msg->response_body,
+        stream->hls.index_tail);
+    g_free (suffix);
+    return;
+  }
+
+  soup_message_body_append_buffer (msg->response_body,
+      stream->hls.index_header);
+  soup_message_body_append_buffer (msg->response_body,
+      gss_playlist_get_buffer (stream->hls.playlist));
+  soup_message_body_append_buffer (msg->response_body,
+      stream->hls.index_tail);
+}
+
+static void
+gss_hls_waiter_remove (GssHLSWaiter * waiter)
+{
+  if (waiter->part) {
+    waiter->part->waiters = g_list_remove (waiter->part->waiters, waiter);
+  } else {
+    waiter->stream->hls.waiters =
+        g_list_remove (waiter->stream->hls.waiters, waiter);
+  }
+  if (waiter->timeout_id) {
+    g_source_remove (waiter->timeout_id);
+  }
+  g_signal_handler_disconnect (waiter->t->msg, waiter->finished_id);
+}
+
+/* Answers a blocked request.  If available is FALSE, the thing it was
+ * waiting for is never going to show up. */
+static void
+gss_hls_waiter_release (GssHLSWaiter * waiter, gboolean available)
+{
+  SoupMessage *msg = waiter->t->msg;
+
+  gss_hls_waiter_remove (waiter);
+
+  if (waiter->part) {
+    if (available && waiter->part->buffers) {
+      char *etag = gss_hls_part_etag (waiter->part);
+
+      gss_hls_set_cache_control (msg,
+          waiter->stream->program->hls.segment_max_age, TRUE);
+      soup_message_headers_replace (msg->response_headers, "ETag", etag);
+      g_free (etag);
+      gss_transaction_send_buffers (waiter->t, waiter->part->buffers);
+    } else {
+      soup_message_set_status (msg, SOUP_STATUS_NOT_FOUND);
+    }
+  } else {
+    if (available) {
+      /* after a timeout, the playlist does not have what the client
+       * asked for and must not be cached as if it did */
+      gss_hls_respond_playlist (waiter->stream, waiter->t,
+          gss_hls_playlist_has (waiter->stream, waiter->msn,
+              waiter->part_index));
+    } else {
+      soup_message_set_status (msg, SOUP_STATUS_NOT_FOUND);
+    }
+  }
+
+  gss_transaction_resume (waiter->t);
+  g_free (waiter);
+}
+
+static gboolean
+gss_hls_waiter_timeout (gpointer priv)
+{
+  GssHLSWaiter *waiter = (GssHLSWaiter *) priv;
+
+  waiter->timeout_id = 0;
+  gss_hls_waiter_release (waiter, TRUE);
+
+  return FALSE;
+}
+
+static void
+gss_hls_waiter_finished (SoupMessage * msg, gpointer priv)
+{
+  GssHLSWaiter *waiter = (GssHLSWaiter *) priv;
+
+  /* client went away while blocked */
+  gss_hls_waiter_remove (waiter);
+  g_free (waiter->t);
+  g_free (waiter);
+}
+
+/* Holds the request open until gss_hls_waiter_release(), or until three
+ * target durations have passed, as recommended for blocking requests. */
+static void
+gss_hls_waiter_add (GssStream * stream, GssHLSPart * part, GssTransaction * t,
+    int msn, int part_index)
+{
+  GssHLSWaiter *waiter;
+
+  waiter = g_new0 (GssHLSWaiter, 1);
+  waiter->stream = stream;
+  waiter->part = part;
+  waiter->msn = msn;
+  waiter->part_index = part_index;
+  waiter->t = gss_transaction_pause (t);
+  waiter->finished_id = g_signal_connect (t->msg, "finished",
+      G_CALLBACK (gss_hls_waiter_finished), waiter);
+  waiter->timeout_id = g_timeout_add (3 * 1000 * stream->hls.target_duration,
+      gss_hls_waiter_timeout, waiter);
+
+  if (part) {
+    part->waiters = g_list_append (part->waiters, waiter);
+  } else {
+    stream->hls.waiters = g_list_append (stream->hls.waiters, waiter);
+  }
+}
+
+/* TRUE if the playlist contains part part_index of segment msn, or the
+ * complete segment if part_index is -1 */
+static gboolean
+gss_hls_playlist_has (GssStream * stream, int msn, int part_index)
+{
+  if (stream->n_chunks > msn)
+    return TRUE;
+  if (part_index >= 0 && stream->n_chunks == msn && stream->hls.parts &&
+      (int) stream->hls.parts->len > part_index)
+    return TRUE;
+  return FALSE;
+}
+
+static void
+gss_hls_wake_waiters (GssStream * stream)
+{
+  GList *g, *next;
+
+  for (g = stream->hls.waiters; g; g = next) {
+    GssHLSWaiter *waiter = (GssHLSWaiter *) g->data;
+
+    next = g_list_next (g);
+    if (gss_hls_playlist_has (stream, waiter->msn, waiter->part_index)) {
+      gss_hls_waiter_release (waiter, TRUE);
+    }
+  }
+}
+
+/* Creates the next part of the segment being collected.  It can be
+ * requested right away, since it is advertised as preload hint;
+ * requests for it block until the data arrives. */
+static GssHLSPart *
+gss_hls_part_new (GssStream * stream)
+{
+  GssHLSPart *part;
+
+  part = g_new0 (GssHLSPart, 1);
+  part->stream = stream;
+  part->msn = stream->n_chunks;
+  part->index = stream->hls.parts ? stream->hls.parts->len : 0;
+
+  return part;
+}
+
+static void
+gss_hls_part_free (GssHLSPart * part)
+{
+  while (part->waiters) {
+    gss_hls_waiter_release ((GssHLSWaiter *) part->waiters->data, FALSE);
+  }
+  g_list_free_full (part->buffers, (GDestroyNotify) soup_buffer_free);
+  g_free (part);
+}
+
+static void
+gss_hls_parts_free (GPtrArray * parts)
+{
+  guint i;
+
+  if (parts == NULL)
+    return;
+
+  for (i = 0; i < parts->len; i++) {
+    gss_hls_part_free ((GssHLSPart *) g_ptr_array_index (parts, i));
+  }
+  g_ptr_array_free (parts, TRUE);
+}
+
+static void
+gss_hls_key_unref (GssHLSKey * key)
+{
+  key->refcount--;
+  if (key->refcount > 0)
+    return;
+
+  if (key->stream->program) {
+    gss_server_remove_resource (GSS_OBJECT_SERVER (key->stream->program),
+        key->location);
+  }
+  g_free (key->location);
+  g_free (key);
+}
+
+/* Returns the key for a rotation period, publishing it if it is new.
+ * Keys are only served over HTTPS, to clients with a session. */
+static GssHLSKey *
+gss_hls_key_get (GssStream * stream, int period, const guint8 * data)
+{
+  GssHLSKey *key = stream->hls.key;
+
+  if (key && key->period == period)
+    return key;
+
+  if (key) {
+    gss_hls_key_unref (key);
+  }
+
+  key = g_new0 (GssHLSKey, 1);
+  key->stream = stream;
+  key->refcount = 1;
+  key->period = period;
+  key->first_msn = stream->n_chunks;
+  memcpy (key->data, data, sizeof (key->data));
+  key->location = g_strdup_printf ("%s%05d.key", stream->hls.segment_prefix,
+      period);
+
+  gss_server_add_resource (GSS_OBJECT_SERVER (stream->program),
+      key->location, GSS_RESOURCE_USER | GSS_RESOURCE_HTTPS_ONLY,
+      "application/octet-stream", gss_hls_handle_key, NULL, NULL, key);
+
+  stream->hls.key = key;
+  return key;
+}
+
+static void
+gss_hls_segment_clear (GssStream * stream, GssHLSSegment * segment)
+{
+  if (!segment->published)
+    return;
+
+  segment->published = FALSE;
+  gss_hls_segment_free_buffers (stream, segment);
+  gss_hls_parts_free (segment->parts);
+  segment->parts = NULL;
+  if (segment->key) {
+    gss_hls_key_unref (segment->key);
+    segment->key = NULL;
+  }
+  if (segment->iframes) {
+    g_array_free (segment->iframes, TRUE);
+    segment->iframes = NULL;
+  }
+}
+
+/* For segments and parts that are never published */
+static void
+gss_hls_chunk_callback_clear (ChunkCallback * chunk_callback)
+{
+  g_list_free_full (chunk_callback->buffers,
+      (GDestroyNotify) gst_mini_object_unref);
+  if (chunk_callback->encrypted) {
+    soup_buffer_free (chunk_callback->encrypted);
+  }
+  if (chunk_callback->init) {
+    soup_buffer_free (chunk_callback->init);
+  }
+  if (chunk_callback->iframes) {
+    g_array_free (chunk_callback->iframes, TRUE);
+  }
+}
+
+void
+gss_stream_free_hls (GssStream * stream)
+{
+  int i;
+
+  if (stream->hls.queue) {
+    ChunkCallback chunk_callback;
+
+    while (gss_queue_pop (stream->hls.queue, &chunk_callback)) {
+      gss_hls_chunk_callback_clear (&chunk_callback);
+    }
+    gss_queue_free (stream->hls.queue);
+    stream->hls.queue = NULL;
+  }
+
+  while (stream->hls.waiters) {
+    gss_hls_waiter_release ((GssHLSWaiter *) stream->hls.waiters->data,
+        FALSE);
+  }
+
+  for (i = 0; i < stream->max_chunks; i++) {
+    gss_hls_segment_clear (stream, &stream->chunks[i]);
+  }
+  g_free (stream->chunks);
+  stream->chunks = NULL;
+  stream->max_chunks = 0;
+
+  if (stream->hls.segment_prefix) {
+    if (stream->program) {
+      gss_server_remove_resource (GSS_OBJECT_SERVER (stream->program),
+          stream->hls.segment_prefix);
+    }
+    g_free (stream->hls.segment_prefix);
+    stream->hls.segment_prefix = NULL;
+  }
+
+  gss_hls_parts_free (stream->hls.parts);
+  stream->hls.parts = NULL;
+  if (stream->hls.next_part) {
+    gss_hls_part_free (stream->hls.next_part);
+    stream->hls.next_part = NULL;
+  }
+
+  if (stream->hls.key) {
+    gss_hls_key_unref (stream->hls.key);
+    stream->hls.key = NULL;
+  }
+
+  if (stream->hls.init_segment) {
+    soup_buffer_free (stream->hls.init_segment);
+    stream->hls.init_segment = NULL;
+  }
+
+  if (stream->hls.iframes) {
+    g_array_free (stream->hls.iframes, TRUE);
+    stream->hls.iframes = NULL;
+  }
+  if (stream->hls.segment_iframes) {
+    g_array_free (stream->hls.segment_iframes, TRUE);
+    stream->hls.segment_iframes = NULL;
+  }
+
+  if (stream->hls.store) {
+    gss_segment_store_unref (stream->hls.store);
+    stream->hls.store = NULL;
+  }
+
+  if (stream->hls.index_header) {
+    soup_buffer_free (stream->hls.index_header);
+    stream->hls.index_header = NULL;
+  }
+  if (stream->hls.index_tail) {
+    soup_buffer_free (stream->hls.index_tail);
+    stream->hls.index_tail = NULL;
+  }
+  if (stream->hls.playlist) {
+    gss_playlist_free (stream->hls.playlist);
+    stream->hls.playlist = NULL;
+  }
+  if (stream->hls.iframe_header) {
+    soup_buffer_free (stream->hls.iframe_header);
+    stream->hls.iframe_header = NULL;
+  }
+  if (stream->hls.iframe_playlist) {
+    gss_playlist_free (stream->hls.iframe_playlist);
+    stream->hls.iframe_playlist = NULL;
+  }
+  if (stream->hls.key_ends) {
+    g_array_free (stream->hls.key_ends, TRUE);
+    stream->hls.key_ends = NULL;
+  }
+  g_free (stream->hls.playlist_base_url);
+  stream->hls.playlist_base_url = NULL;
+
+  if (stream->hls.scanner) {
+    gss_ts_scanner_free (stream->hls.scanner);
+    stream->hls.scanner = NULL;
+  }
+  if (stream->hls.mp4_scanner) {
+    gss_mp4_scanner_free (stream->hls.mp4_scanner);
+    stream->hls.mp4_scanner = NULL;
+  }
+}
+
+gboolean
+gss_hls_segment_is_available (GssStream * stream, GssHLSSegment * segment)
+{
+  if (!segment->published)
+    return FALSE;
+  if (segment->buffers)
+    return TRUE;
+  return stream->hls.store &&
+      gss_segment_store_is_valid (stream->hls.store, segment->store_offset,
+      segment->size);
+}
 
 void
 gss_stream_add_hls (GssStream * stream)
@@ -58,16 +737,36 @@ gss_stream_add_hls (GssStream * stream)
   int profile;
 
   if (!program->enable_hls) {
-
-    program->hls.target_duration = 4;
-
     program->enable_hls = TRUE;
 
     s = g_strdup_printf ("/%s.m3u8", GSS_OBJECT_NAME (program));
     gss_server_add_resource (GSS_OBJECT_SERVER (program), s, 0,
         "video/x-mpegurl", gss_hls_handle_m3u8, NULL, NULL, program);
     g_free (s);
+
+    gss_program_add_dash (program);
   }
+
+  /* the streaming thread's copy of the encryption settings */
+  stream->hls.encrypt = program->hls.is_encrypted;
+  stream->hls.key_rotation = program->hls.key_rotation;
+  stream->hls.n_segments = stream->n_chunks;
+  stream->hls.key_period = -1;
+  if (stream->hls.encrypt && stream->type == GSS_STREAM_TYPE_FMP4_H264_AAC) {
+    /* would need SAMPLE-AES or CENC */
+    GST_WARNING ("stream %s: encryption is not supported for fMP4",
+        GSS_OBJECT_NAME (stream));
+    stream->hls.encrypt = FALSE;
+  }
+
+  if (stream->hls.queue == NULL) {
+    stream->hls.queue = gss_queue_new (GSS_HLS_QUEUE_LENGTH,
+        sizeof (ChunkCallback));
+    gss_queue_attach (stream->hls.queue, NULL, G_PRIORITY_HIGH,
+        gss_hls_queue_dispatch, stream);
+  }
+  g_atomic_int_set (&stream->hls.flushing, FALSE);
+
 #if GST_CHECK_VERSION(1,0,0)
   gst_pad_add_probe (gst_element_get_static_pad (stream->sink, "sink"),
       GST_PAD_PROBE_TYPE_BUFFER, sink_probe_callback, stream, NULL);
@@ -79,7 +778,9 @@ gss_stream_add_hls (GssStream * stream)
   profile = 0;
   if (stream->type == GSS_STREAM_TYPE_M2TS_H264BASE_AAC) {
     profile = 0x42e0;           /* baseline */
-  } else if (stream->type == GSS_STREAM_TYPE_M2TS_H264MAIN_AAC) {
+  } else if (stream->type == GSS_STREAM_TYPE_M2TS_H264MAIN_AAC ||
+      stream->type == GSS_STREAM_TYPE_FMP4_H264_AAC) {
+    /* fMP4 codecs are updated from the initialization segment */
     profile = 0x4d40;           /* main */
   }
 
@@ -109,47 +810,600 @@ gss_stream_add_hls (GssStream * stream)
   } else if (mbs_per_sec <= 983040) {
     level = 51;
   } else {
-    level = 0xff;
+    level = 0xff;
+  }
+
+  stream->codecs = g_strdup_printf ("avc1.%04X%02X, mp4a.40.2", profile, level);
+  stream->is_hls = TRUE;
+
+  stream->adapter = gst_adapter_new ();
+  stream->hls.target_duration = 1;
+  stream->hls.segment_start = GST_CLOCK_TIME_NONE;
+  stream->hls.segment_end = GST_CLOCK_TIME_NONE;
+  stream->hls.segment_size = 0;
+  stream->hls.segment_pts = GSS_TS_NO_PTS;
+  stream->hls.part_start = GST_CLOCK_TIME_NONE;
+  stream->hls.part_independent = FALSE;
+  if (stream->hls.scanner) {
+    gss_ts_scanner_free (stream->hls.scanner);
+    stream->hls.scanner = NULL;
+  }
+  if (stream->hls.mp4_scanner) {
+    gss_mp4_scanner_free (stream->hls.mp4_scanner);
+    stream->hls.mp4_scanner = NULL;
+  }
+  if (stream->type == GSS_STREAM_TYPE_FMP4_H264_AAC) {
+    stream->hls.mp4_scanner = gss_mp4_scanner_new ();
+    stream->hls.have_key_fragment = FALSE;
+  } else {
+    stream->hls.scanner = gss_ts_scanner_new ();
+  }
+  stream->hls.segment_offset = 0;
+  if (stream->hls.segment_iframes) {
+    g_array_set_size (stream->hls.segment_iframes, 0);
+  }
+
+  if (stream->chunks == NULL) {
+    stream->hls.epoch = g_random_int ();
+    gss_hls_stream_alloc_segments (stream);
+
+    /* one resource for all segments and parts of the stream */
+    stream->hls.segment_prefix = g_strdup_printf ("/%s-%dx%d-%dkbps%s-%08x-",
+        GSS_OBJECT_NAME (program), stream->width, stream->height,
+        stream->bitrate / 1000, gss_stream_type_get_mod (stream->type),
+        stream->hls.epoch);
+    gss_server_add_resource (GSS_OBJECT_SERVER (program),
+        stream->hls.segment_prefix, GSS_RESOURCE_PREFIX,
+        gss_stream_type_get_content_type (stream->type),
+        gss_hls_handle_segment, NULL, NULL, stream);
+  }
+
+  stream->hls.part_target = program->hls.part_target * GST_MSECOND;
+  if (stream->hls.part_target && stream->hls.encrypt) {
+    GST_WARNING ("stream %s: LL-HLS parts are not supported with "
+        "encryption", GSS_OBJECT_NAME (stream));
+    stream->hls.part_target = 0;
+  }
+  if (stream->hls.part_target &&
+      stream->type == GSS_STREAM_TYPE_FMP4_H264_AAC) {
+    /* parts would have to be cut on fragment boundaries */
+    GST_WARNING ("stream %s: LL-HLS parts are not supported for fMP4",
+        GSS_OBJECT_NAME (stream));
+    stream->hls.part_target = 0;
+  }
+  if (stream->hls.part_target && stream->hls.next_part == NULL) {
+    stream->hls.next_part = gss_hls_part_new (stream);
+  }
+
+  s = g_strdup_printf ("/%s-%dx%d-%dkbps%s.m3u8", GSS_OBJECT_NAME (program),
+      stream->width, stream->height, stream->bitrate / 1000,
+      gss_stream_type_get_mod (stream->type));
+  gss_server_add_resource (GSS_OBJECT_SERVER (program), s, 0,
+      "video/x-mpegurl", gss_hls_handle_stream_m3u8, NULL, NULL, stream);
+  g_free (s);
+
+  if (gss_hls_has_iframes (stream)) {
+    s = g_strdup_printf ("/%s-%dx%d-%dkbps%s-iframes.m3u8",
+        GSS_OBJECT_NAME (program), stream->width, stream->height,
+        stream->bitrate / 1000, gss_stream_type_get_mod (stream->type));
+    gss_server_add_resource (GSS_OBJECT_SERVER (program), s, 0,
+        "video/x-mpegurl", gss_hls_handle_iframes_m3u8, NULL, NULL, stream);
+    g_free (s);
+  }
+
+  gss_hls_update_variant (program);
+}
+
+#if GST_CHECK_VERSION(1,0,0)
+typedef struct _GssMappedBuffer GssMappedBuffer;
+struct _GssMappedBuffer
+{
+  GstBuffer *buffer;
+  GstMapInfo mapinfo;
+};
+
+static void
+gss_mapped_buffer_free (gpointer priv)
+{
+  GssMappedBuffer *mapped = (GssMappedBuffer *) priv;
+
+  gst_buffer_unmap (mapped->buffer, &mapped->mapinfo);
+  gst_buffer_unref (mapped->buffer);
+  g_free (mapped);
+}
+#endif
+
+/* Takes ownership of buffer and exposes its memory to libsoup without
+ * copying.  The GstBuffer is released when the last SoupBuffer reference
+ * (ours or one held by a message body being written) goes away. */
+static SoupBuffer *
+gss_hls_soup_buffer_new (GstBuffer * buffer)
+{
+#if GST_CHECK_VERSION(1,0,0)
+  GssMappedBuffer *mapped;
+
+  mapped = g_malloc0 (sizeof (GssMappedBuffer));
+  if (!gst_buffer_map (buffer, &mapped->mapinfo, GST_MAP_READ)) {
+    GST_ERROR ("failed map");
+    gst_buffer_unref (buffer);
+    g_free (mapped);
+    return NULL;
+  }
+  mapped->buffer = buffer;
+
+  return soup_buffer_new_with_owner (mapped->mapinfo.data,
+      mapped->mapinfo.size, mapped, gss_mapped_buffer_free);
+#else
+  return soup_buffer_new_with_owner (GST_BUFFER_DATA (buffer),
+      GST_BUFFER_SIZE (buffer), buffer, (GDestroyNotify) gst_mini_object_unref);
+#endif
+}
+
+static void
+gss_hls_add_part (GssStream * stream, GList * buffers, gsize size,
+    GstClockTime duration, gboolean independent)
+{
+  GssHLSPart *part;
+
+  part = stream->hls.next_part;
+  if (part == NULL) {
+    part = gss_hls_part_new (stream);
+  }
+
+  part->buffers = buffers;
+  part->size = size;
+  part->duration = GST_CLOCK_TIME_IS_VALID (duration) ? duration : 0;
+  part->independent = independent;
+
+  if (stream->hls.parts == NULL) {
+    stream->hls.parts = g_ptr_array_new ();
+  }
+  g_ptr_array_add (stream->hls.parts, part);
+  stream->hls.next_part = NULL;
+  stream->hls.need_index_update = TRUE;
+
+  while (part->waiters) {
+    gss_hls_waiter_release ((GssHLSWaiter *) part->waiters->data, TRUE);
+  }
+}
+
+/* The last part of a segment has arrived, so publish the segment.  It
+ * shares the data of its parts. */
+static void
+gss_hls_finish_parts (GssStream * stream, GstClockTime duration)
+{
+  GList *buffers = NULL;
+  gsize size = 0;
+  guint i;
+
+  for (i = 0; i < stream->hls.parts->len; i++) {
+    GssHLSPart *part = g_ptr_array_index (stream->hls.parts, i);
+    GList *g;
+
+    for (g = part->buffers; g; g = g_list_next (g)) {
+      buffers = g_list_prepend (buffers, soup_buffer_copy (g->data));
+    }
+    size += part->size;
+  }
+
+  gss_program_add_hls_chunk (stream, g_list_reverse (buffers), size,
+      duration, NULL);
+}
+
+/* A new initialization segment gets a new location, since segments
+ * that refer to the old one may still be cached. */
+static void
+gss_hls_set_init_segment (GssStream * stream, SoupBuffer * init)
+{
+  char *codecs;
+
+  if (stream->hls.init_segment) {
+    soup_buffer_free (stream->hls.init_segment);
+  }
+  stream->hls.init_segment = init;
+  stream->hls.init_version++;
+  stream->hls.need_index_update = TRUE;
+
+  codecs = gss_mp4_get_codecs ((const guint8 *) init->data, init->length);
+  if (codecs) {
+    g_free (stream->codecs);
+    stream->codecs = codecs;
+    gss_hls_update_variant (stream->program);
+  }
+}
+
+static void
+gss_hls_publish_chunk (ChunkCallback * chunk_callback)
+{
+  GList *buffers = NULL;
+  GList *g;
+
+  if (chunk_callback->init) {
+    gss_hls_set_init_segment (chunk_callback->stream, chunk_callback->init);
+    return;
+  }
+
+  /* picked up by gss_program_add_hls_chunk () */
+  if (chunk_callback->iframes) {
+    GssStream *stream = chunk_callback->stream;
+
+    if (stream->hls.iframes) {
+      g_array_free (stream->hls.iframes, TRUE);
+    }
+    stream->hls.iframes = chunk_callback->iframes;
+  }
+
+  for (g = chunk_callback->buffers; g; g = g_list_next (g)) {
+    SoupBuffer *buffer;
+
+    buffer = gss_hls_soup_buffer_new (GST_BUFFER (g->data));
+    if (buffer) {
+      buffers = g_list_prepend (buffers, buffer);
+    }
+  }
+  g_list_free (chunk_callback->buffers);
+  buffers = g_list_reverse (buffers);
+  if (chunk_callback->encrypted) {
+    buffers = g_list_prepend (buffers, chunk_callback->encrypted);
+  }
+
+  if (chunk_callback->is_part) {
+    gss_hls_add_part (chunk_callback->stream, buffers, chunk_callback->n,
+        chunk_callback->duration, chunk_callback->independent);
+    if (chunk_callback->ends_segment) {
+      gss_hls_finish_parts (chunk_callback->stream,
+          chunk_callback->segment_duration);
+    }
+    chunk_callback->stream->hls.next_part =
+        gss_hls_part_new (chunk_callback->stream);
+  } else {
+    GssHLSKey *key = NULL;
+
+    if (chunk_callback->encrypted) {
+      key = gss_hls_key_get (chunk_callback->stream,
+          chunk_callback->key_period, chunk_callback->key);
+    }
+    gss_program_add_hls_chunk (chunk_callback->stream, buffers,
+        chunk_callback->n, chunk_callback->duration, key);
+  }
+  gss_hls_wake_waiters (chunk_callback->stream);
+}
+
+/* Runs at high priority, so that segments are published ahead of
+ * whatever else the main loop has to do. */
+static gboolean
+gss_hls_queue_dispatch (gpointer data)
+{
+  GssStream *stream = (GssStream *) data;
+  ChunkCallback chunk_callback;
+
+  while (gss_queue_pop (stream->hls.queue, &chunk_callback)) {
+    gint64 delay = g_get_monotonic_time () - chunk_callback.queued_time;
+
+    gss_hls_publish_chunk (&chunk_callback);
+
+    if (chunk_callback.init == NULL &&
+        (!chunk_callback.is_part || chunk_callback.ends_segment)) {
+      GST_DEBUG ("stream %s: segment published after %" G_GINT64_FORMAT
+          " us", GSS_OBJECT_NAME (stream), delay);
+      gss_metrics_add_segment (stream->metrics, delay);
+      gss_metrics_add_segment (stream->program->metrics, delay);
+      gss_metrics_add_segment (GSS_OBJECT_SERVER (stream->program)->metrics,
+          delay);
+    }
+  }
+
+  return TRUE;
+}
+
+static GstClockTime
+gss_hls_time_diff (GstClockTime start, GstClockTime end)
+{
+  if (GST_CLOCK_TIME_IS_VALID (start) && GST_CLOCK_TIME_IS_VALID (end) &&
+      end > start) {
+    return end - start;
+  }
+  return GST_CLOCK_TIME_NONE;
+}
+
+/* Encrypts a complete segment, once, in the streaming thread; all
+ * clients are then served the same encrypted copy, in a block from the
+ * buffer pool.  The media is taken from the adapter.  With key
+ * rotation, a new key is made every key_rotation segments. */
+static void
+gss_hls_encrypt_segment (GssStream * stream, ChunkCallback * chunk_callback)
+{
+  GssProgram *program = stream->program;
+  GssAesCbc cbc;
+  guint8 iv[GSS_AES_BLOCK_SIZE];
+  guint8 *data;
+  gsize n = 0;
+  GList *buffers;
+  GList *g;
+  int msn;
+  int period;
+
+  msn = stream->hls.n_segments++;
+  period = stream->hls.key_rotation ? msn / stream->hls.key_rotation : 0;
+  if (period != stream->hls.key_period) {
+    gss_utils_get_random_bytes (stream->hls.key_data,
+        sizeof (stream->hls.key_data));
+    stream->hls.key_period = period;
+  }
+  chunk_callback->key_period = period;
+  memcpy (chunk_callback->key, stream->hls.key_data,
+      sizeof (chunk_callback->key));
+
+  if (program->hls.have_iv) {
+    int i;
+
+    for (i = 0; i < 4; i++) {
+      GST_WRITE_UINT32_BE (iv + 4 * i, program->hls.init_vector[i]);
+    }
+  } else {
+    /* without an IV in the playlist, it is the media sequence number */
+    memset (iv, 0, sizeof (iv));
+    GST_WRITE_UINT32_BE (iv + 12, msn);
+  }
+  gss_aes_cbc_init (&cbc, stream->hls.key_data, iv);
+
+  buffers = gst_adapter_take_list (stream->adapter, chunk_callback->n);
+  data = gss_buffer_pool_alloc (stream->hls.pool,
+      chunk_callback->n + GSS_AES_BLOCK_SIZE);
+  for (g = buffers; g; g = g_list_next (g)) {
+    GstBuffer *buffer = GST_BUFFER (g->data);
+#if GST_CHECK_VERSION(1,0,0)
+    GstMapInfo mapinfo;
+
+    if (gst_buffer_map (buffer, &mapinfo, GST_MAP_READ)) {
+      n += gss_aes_cbc_encrypt (&cbc, data + n, mapinfo.data, mapinfo.size);
+      gst_buffer_unmap (buffer, &mapinfo);
+    } else {
+      GST_ERROR ("failed map");
+    }
+#else
+    n += gss_aes_cbc_encrypt (&cbc, data + n, GST_BUFFER_DATA (buffer),
+        GST_BUFFER_SIZE (buffer));
+#endif
+    gst_buffer_unref (buffer);
+  }
+  g_list_free (buffers);
+  n += gss_aes_cbc_finish (&cbc, data + n);
+
+  chunk_callback->encrypted = gss_buffer_pool_soup_buffer_new (data, n);
+  chunk_callback->n = n;
+}
+
+static void
+gss_hls_chunk_callback_init (ChunkCallback * chunk_callback, GssStream * stream,
+    int n)
+{
+  memset (chunk_callback, 0, sizeof (ChunkCallback));
+  chunk_callback->n = n;
+  chunk_callback->stream = stream;
+  chunk_callback->segment_duration = GST_CLOCK_TIME_NONE;
+
+  /* parts are disabled when encrypting, so this is a whole segment */
+  if (stream->hls.encrypt) {
+    gss_hls_encrypt_segment (stream, chunk_callback);
+  } else {
+    /* the muxer's buffers, by reference */
+    chunk_callback->buffers = gst_adapter_take_list (stream->adapter, n);
+  }
+}
+
+/* Hands a segment or part over to the main loop.  If the main loop has
+ * fallen that far behind, the streaming thread waits for it, unless the
+ * main loop is stopping the pipeline and so waiting for this thread. */
+static void
+gss_hls_queue_push (GssStream * stream, ChunkCallback * chunk_callback)
+{
+  chunk_callback->queued_time = g_get_monotonic_time ();
+  if (G_UNLIKELY (!gss_queue_push (stream->hls.queue, chunk_callback))) {
+    GST_WARNING ("stream %s: segment queue full, waiting for main loop",
+        GSS_OBJECT_NAME (stream));
+    while (!gss_queue_push (stream->hls.queue, chunk_callback)) {
+      if (g_atomic_int_get (&stream->hls.flushing)) {
+        stream->hls.n_dropped++;
+        GST_WARNING ("stream %s: flushing, dropped segment (%d so far)",
+            GSS_OBJECT_NAME (stream), stream->hls.n_dropped);
+        gss_hls_chunk_callback_clear (chunk_callback);
+        return;
+      }
+      g_usleep (10 * 1000);
+    }
+  }
+}
+
+/* Moves the IDR access units completed by the TS scanner that end by
+ * offset end to the segment being collected, relative to its start.
+ * Those after end are left for the next segment. */
+static void
+gss_hls_collect_iframes (GssStream * stream, guint64 end)
+{
+  GArray *iframes = stream->hls.scanner->iframes;
+  guint n;
+  guint i;
+
+  if (stream->hls.encrypt) {
+    g_array_set_size (iframes, 0);
+    return;
+  }
+
+  n = gss_ts_scanner_count_iframes (stream->hls.scanner, end);
+  for (i = 0; i < n; i++) {
+    GssTsIFrame *f = &g_array_index (iframes, GssTsIFrame, i);
+    GssHLSIFrame iframe;
+
+    if (f->offset < stream->hls.segment_offset)
+      continue;
+
+    iframe.offset = f->offset - stream->hls.segment_offset;
+    iframe.size = f->size;
+    iframe.time = 0;
+    if (f->pts != GSS_TS_NO_PTS && stream->hls.segment_pts != GSS_TS_NO_PTS) {
+      iframe.time = gst_util_uint64_scale ((f->pts - stream->hls.segment_pts) &
+          ((G_GUINT64_CONSTANT (1) << 33) - 1), GST_SECOND, 90000);
+    }
+
+    if (stream->hls.segment_iframes == NULL) {
+      stream->hls.segment_iframes = g_array_new (FALSE, FALSE,
+          sizeof (GssHLSIFrame));
+    }
+    g_array_append_val (stream->hls.segment_iframes, iframe);
+  }
+  g_array_remove_range (iframes, 0, n);
+}
+
+/* Called for every buffer leaving the muxer.  The TS scanner finds the
+ * start of IDR access units, which is where the pending segment gets
+ * cut, even if that is in the middle of the buffer or in an earlier
+ * buffer still sitting in the adapter.  Segment durations come from the
+ * PTS of the IDR access units, or from buffer timestamps if there are
+ * none.  With LL-HLS, the segment is sent to the main loop piecewise,
+ * one part at a time, with parts cut on buffer boundaries.  fMP4 is cut
+ * the same way, at fragments that start with a sync sample, and its
+ * initialization segment is sent to the main loop on its own. */
+static void
+gss_hls_collect_buffer (GssStream * stream, GstBuffer * buffer,
+    const guint8 * data, gsize size)
+{
+#if GST_CHECK_VERSION(1,0,0)
+  GstClockTime pts = GST_BUFFER_PTS (buffer);
+#else
+  GstClockTime pts = GST_BUFFER_TIMESTAMP (buffer);
+#endif
+  gboolean part_ok = FALSE;
+  gboolean found;
+  guint64 idr_offset = 0;
+  guint64 idr_pts = GSS_TS_NO_PTS;
+  guint64 scanned;
+  SoupBuffer *init = NULL;
+  int n;
+
+  if (stream->hls.mp4_scanner) {
+    found = gss_mp4_scanner_push (stream->hls.mp4_scanner, data, size,
+        &idr_offset, &idr_pts);
+    scanned = stream->hls.mp4_scanner->offset;
+    init = gss_mp4_scanner_take_init (stream->hls.mp4_scanner);
+  } else {
+    /* don't cut a part while the access unit it would split might still
+     * turn out to start a segment */
+    part_ok = !gss_ts_scanner_au_pending (stream->hls.scanner);
+
+    found = gss_ts_scanner_push (stream->hls.scanner, data, size,
+        &idr_offset, &idr_pts);
+    scanned = stream->hls.scanner->offset;
+
+    /* before the segment they are in is cut */
+    gss_hls_collect_iframes (stream, found ? idr_offset : G_MAXUINT64);
   }
 
-  stream->codecs = g_strdup_printf ("avc1.%04X%02X, mp4a.40.2", profile, level);
-  stream->is_hls = TRUE;
+  n = gst_adapter_available (stream->adapter);
+
+  /* Parts are cut before they would grow beyond the part target, going
+   * by the timestamp increment of the last buffer. */
+  if (stream->hls.part_target && part_ok && n > 0 &&
+      GST_CLOCK_TIME_IS_VALID (pts) &&
+      GST_CLOCK_TIME_IS_VALID (stream->hls.part_start) &&
+      GST_CLOCK_TIME_IS_VALID (stream->hls.segment_end) &&
+      pts > stream->hls.segment_end && pts > stream->hls.part_start &&
+      2 * pts - stream->hls.segment_end - stream->hls.part_start >
+      stream->hls.part_target) {
+    ChunkCallback chunk_callback;
+
+    gss_hls_chunk_callback_init (&chunk_callback, stream, n);
+    chunk_callback.is_part = TRUE;
+    chunk_callback.independent = stream->hls.part_independent;
+    chunk_callback.duration = pts - stream->hls.part_start;
+
+    gss_hls_queue_push (stream, &chunk_callback);
+
+    stream->hls.segment_size += n;
+    stream->hls.part_start = pts;
+    stream->hls.part_independent = FALSE;
+  }
 
-  stream->adapter = gst_adapter_new ();
+  gst_adapter_push (stream->adapter, gst_buffer_ref (buffer));
 
-  s = g_strdup_printf ("/%s-%dx%d-%dkbps%s.m3u8", GSS_OBJECT_NAME (program),
-      stream->width, stream->height, stream->bitrate / 1000,
-      gss_stream_type_get_mod (stream->type));
-  gss_server_add_resource (GSS_OBJECT_SERVER (program), s, 0,
-      "video/x-mpegurl", gss_hls_handle_stream_m3u8, NULL, NULL, stream);
-  g_free (s);
+  if (found) {
+    guint64 adapter_offset;
+    GstClockTime duration;
 
-  gss_hls_update_variant (program);
-}
+    adapter_offset = scanned - gst_adapter_available (stream->adapter);
+    n = (idr_offset > adapter_offset) ? idr_offset - adapter_offset : 0;
 
+    if (stream->hls.segment_pts != GSS_TS_NO_PTS && idr_pts != GSS_TS_NO_PTS) {
+      /* 33 bit PTS wraps around */
+      duration = gst_util_uint64_scale ((idr_pts - stream->hls.segment_pts) &
+          ((G_GUINT64_CONSTANT (1) << 33) - 1), GST_SECOND, 90000);
+    } else {
+      duration = gss_hls_time_diff (stream->hls.segment_start,
+          GST_CLOCK_TIME_IS_VALID (pts) ? pts : stream->hls.segment_end);
+    }
 
-typedef struct _ChunkCallback ChunkCallback;
-struct _ChunkCallback
-{
-  GssStream *stream;
-  guint8 *data;
-  int n;
-};
+    if ((stream->hls.scanner && stream->hls.segment_size + n < 188 * 100) ||
+        ((stream->hls.scanner || stream->hls.have_key_fragment) &&
+            GST_CLOCK_TIME_IS_VALID (duration) &&
+            duration < GSS_STREAM_HLS_MIN_DURATION)) {
+      /* skipped (too early) */
+    } else {
+      if (stream->hls.mp4_scanner && !stream->hls.have_key_fragment) {
+        /* the initialization segment is served on its own, and media
+         * before the first sync sample can't be decoded */
+        gst_adapter_flush (stream->adapter, n);
+        stream->hls.have_key_fragment = TRUE;
+      } else {
+        ChunkCallback chunk_callback;
+
+        gss_hls_chunk_callback_init (&chunk_callback, stream, n);
+        chunk_callback.duration = duration;
+        if (stream->hls.part_target) {
+          /* the rest of the segment goes out as its last part */
+          chunk_callback.is_part = TRUE;
+          chunk_callback.ends_segment = TRUE;
+          chunk_callback.independent = stream->hls.part_independent;
+          chunk_callback.segment_duration = duration;
+          chunk_callback.duration = gss_hls_time_diff (stream->hls.part_start,
+              GST_CLOCK_TIME_IS_VALID (pts) ? pts : stream->hls.segment_end);
+        }
+
+        chunk_callback.iframes = stream->hls.segment_iframes;
+        stream->hls.segment_iframes = NULL;
+
+        gss_hls_queue_push (stream, &chunk_callback);
+      }
 
-static gboolean
-gss_program_add_hls_chunk_callback (gpointer data)
-{
-  ChunkCallback *chunk_callback = (ChunkCallback *) data;
-  SoupBuffer *buffer;
+      stream->hls.segment_offset = adapter_offset + n;
+      stream->hls.segment_pts = idr_pts;
+      stream->hls.segment_start = pts;
+      stream->hls.segment_end = pts;
+      stream->hls.segment_size = 0;
+      stream->hls.part_start = pts;
+      stream->hls.part_independent = TRUE;
+    }
+  }
 
-  buffer =
-      soup_buffer_new (SOUP_MEMORY_TAKE, chunk_callback->data,
-      chunk_callback->n);
-  gss_program_add_hls_chunk (chunk_callback->stream, buffer);
+  if (GST_CLOCK_TIME_IS_VALID (pts)) {
+    if (!GST_CLOCK_TIME_IS_VALID (stream->hls.segment_start)) {
+      stream->hls.segment_start = pts;
+    }
+    if (!GST_CLOCK_TIME_IS_VALID (stream->hls.part_start)) {
+      stream->hls.part_start = pts;
+    }
+    stream->hls.segment_end = pts;
+  }
 
-  g_free (chunk_callback);
+  if (init) {
+    ChunkCallback chunk_callback;
 
-  return FALSE;
+    /* queued after a segment cut above, which belongs to the previous
+     * initialization segment */
+    memset (&chunk_callback, 0, sizeof (ChunkCallback));
+    chunk_callback.stream = stream;
+    chunk_callback.init = init;
+    gss_hls_queue_push (stream, &chunk_callback);
+  }
 }
 
 #if GST_CHECK_VERSION(1,0,0)
@@ -161,36 +1415,15 @@ sink_probe_callback (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
   if (info->type == GST_PAD_PROBE_TYPE_BUFFER) {
     GstBuffer *buffer = GST_BUFFER (info->data);
     GstMapInfo mapinfo;
-    guint8 *data;
-    gboolean ret;
 
-    ret = gst_buffer_map (buffer, &mapinfo, GST_MAP_READ);
-    if (!ret) {
+    if (!gst_buffer_map (buffer, &mapinfo, GST_MAP_READ)) {
       GST_ERROR ("failed map");
+      return GST_PAD_PROBE_OK;
     }
-    data = mapinfo.data;
-
-    if (((data[3] >> 4) & 2) && ((data[5] >> 6) & 1)) {
-      int n;
-
-      n = gst_adapter_available (stream->adapter);
-      if (n < 188 * 100) {
-        /* skipped (too early) */
-      } else {
-        ChunkCallback *chunk_callback;
-
-        chunk_callback = g_malloc0 (sizeof (ChunkCallback));
-        chunk_callback->data = gst_adapter_take (stream->adapter, n);
-        chunk_callback->n = n;
-        chunk_callback->stream = stream;
 
-        g_idle_add (gss_program_add_hls_chunk_callback, chunk_callback);
-      }
-    }
+    gss_hls_collect_buffer (stream, buffer, mapinfo.data, mapinfo.size);
 
     gst_buffer_unmap (buffer, &mapinfo);
-
-    gst_adapter_push (stream->adapter, gst_buffer_ref (buffer));
   }
 
   return GST_PAD_PROBE_OK;
@@ -203,27 +1436,9 @@ sink_data_probe_callback (GstPad * pad, GstMiniObject * mo, gpointer user_data)
 
   if (GST_IS_BUFFER (mo)) {
     GstBuffer *buffer = GST_BUFFER (mo);
-    guint8 *data = GST_BUFFER_DATA (buffer);
-
-    if (((data[3] >> 4) & 2) && ((data[5] >> 6) & 1)) {
-      int n;
-
-      n = gst_adapter_available (stream->adapter);
-      if (n < 188 * 100) {
-        /* skipped (too early) */
-      } else {
-        ChunkCallback *chunk_callback;
-
-        chunk_callback = g_malloc0 (sizeof (ChunkCallback));
-        chunk_callback->data = gst_adapter_take (stream->adapter, n);
-        chunk_callback->n = n;
-        chunk_callback->stream = stream;
-
-        g_idle_add (gss_program_add_hls_chunk_callback, chunk_callback);
-      }
-    }
 
-    gst_adapter_push (stream->adapter, gst_buffer_ref (buffer));
+    gss_hls_collect_buffer (stream, buffer, GST_BUFFER_DATA (buffer),
+        GST_BUFFER_SIZE (buffer));
   } else {
     /* got event */
   }
@@ -232,97 +1447,473 @@ sink_data_probe_callback (GstPad * pad, GstMiniObject * mo, gpointer user_data)
 }
 #endif
 
+/* Segments that are in memory but no longer in the live window, the
+ * newest ones that add up to at least the window duration, are only
+ * kept for clients that are late, so they go first when the server is
+ * short of memory.  Older segments are cold already, or spilled. */
+static void
+gss_hls_retire_segments (GssStream * stream)
+{
+  GstClockTime window = stream->program->hls.window * GST_SECOND;
+  GstClockTime duration = 0;
+  int first = MAX (0, stream->n_chunks - stream->max_chunks);
+  int last;
+  int i;
+
+  for (i = stream->n_chunks - 1; i >= first && duration < window; i--) {
+    duration += stream->chunks[i % stream->max_chunks].duration;
+  }
+  last = i;
+
+  for (; i >= first; i--) {
+    GssHLSSegment *segment = &stream->chunks[i % stream->max_chunks];
+
+    if (segment->buffers == NULL || segment->cold)
+      break;
+  }
+
+  /* oldest first, so they are evicted in that order */
+  for (i++; i <= last; i++) {
+    gss_segment_cache_retire (stream->hls.cache,
+        &stream->chunks[i % stream->max_chunks]);
+  }
+}
+
 void
-gss_program_add_hls_chunk (GssStream * stream, SoupBuffer * buf)
+gss_program_add_hls_chunk (GssStream * stream, GList * buffers, gsize size,
+    GstClockTime duration, GssHLSKey * key)
 {
   GssHLSSegment *segment;
+  int target_duration;
 
-  segment = &stream->chunks[stream->n_chunks % GSS_STREAM_HLS_CHUNKS];
+  segment = &stream->chunks[stream->n_chunks % stream->max_chunks];
 
-  if (segment->buffer) {
-    gss_server_remove_resource (GSS_OBJECT_SERVER (stream->program),
-        segment->location);
-    g_free (segment->location);
-    soup_buffer_free (segment->buffer);
-  }
+  gss_hls_segment_clear (stream, segment);
+  segment->stream = stream;
   segment->index = stream->n_chunks;
-  segment->buffer = buf;
-  segment->location = g_strdup_printf ("/%s-%dx%d-%dkbps%s-%05d.ts",
-      GSS_OBJECT_NAME (stream->program), stream->width, stream->height,
-      stream->bitrate / 1000, gss_stream_type_get_mod (stream->type),
-      stream->n_chunks);
-  segment->duration = stream->program->hls.target_duration;
+  segment->buffers = buffers;
+  segment->size = size;
+  gss_segment_cache_add (stream->hls.cache, segment);
+  segment->parts = stream->hls.parts;
+  stream->hls.parts = NULL;
+  if (key) {
+    key->refcount++;
+    segment->key = key;
+  }
+  segment->iframes = stream->hls.iframes;
+  stream->hls.iframes = NULL;
+  segment->published = TRUE;
+  if (!GST_CLOCK_TIME_IS_VALID (duration) && stream->bitrate > 0) {
+    /* muxer output without timestamps, estimate from the size */
+    duration = gst_util_uint64_scale (size, 8 * GST_SECOND, stream->bitrate);
+  }
+  segment->duration = GST_CLOCK_TIME_IS_VALID (duration) ? duration : 0;
+
+  /* The DASH timeline starts when the program's first segment began.
+   * Streams that start later start at the wall clock time since. */
+  if (stream->n_chunks == 0) {
+    gint64 now = g_get_real_time ();
+    gint64 start = now - segment->duration / GST_USECOND;
+
+    if (stream->program->hls.start_time == 0) {
+      stream->program->hls.start_time = start;
+    }
+    stream->hls.timeline = MAX (0,
+        start - stream->program->hls.start_time) * GST_USECOND;
+  }
+  segment->start = stream->hls.timeline;
+  stream->hls.timeline += segment->duration;
+
+  if (segment->iframes) {
+    guint i;
+
+    for (i = 0; i < segment->iframes->len; i++) {
+      GstClockTime duration = gss_hls_iframe_duration (segment, i);
+      gsize iframe_size =
+          g_array_index (segment->iframes, GssHLSIFrame, i).size;
+
+      if (duration > 0) {
+        stream->hls.iframe_bandwidth = MAX (stream->hls.iframe_bandwidth,
+            gst_util_uint64_scale (8 * iframe_size, GST_SECOND, duration));
+      }
+    }
+  }
+
+  /* EXTINF rounded to the nearest integer must not exceed the target
+   * duration, and the target duration must not shrink while live. */
+  target_duration = (segment->duration + GST_SECOND / 2) / GST_SECOND;
+  if (target_duration > stream->hls.target_duration) {
+    GST_DEBUG ("stream %s: target duration %d -> %d",
+        GSS_OBJECT_NAME (stream), stream->hls.target_duration,
+        target_duration);
+    stream->hls.target_duration = target_duration;
+  }
 
   stream->hls.need_index_update = TRUE;
 
-  gss_server_add_resource (GSS_OBJECT_SERVER (stream->program),
-      segment->location, 0, "video/mp2t", gss_hls_handle_ts_chunk, NULL, NULL,
-      segment);
+  /* parts stay around one segment longer than they are listed */
+  if (stream->n_chunks > GSS_HLS_PART_SEGMENTS) {
+    GssHLSSegment *old = &stream->chunks[(stream->n_chunks -
+            GSS_HLS_PART_SEGMENTS - 1) % stream->max_chunks];
+
+    gss_hls_parts_free (old->parts);
+    old->parts = NULL;
+  }
+
+  if (stream->hls.store && stream->n_chunks >= GSS_STREAM_HLS_CHUNKS) {
+    gss_hls_segment_spill (stream, &stream->chunks[(stream->n_chunks -
+                GSS_STREAM_HLS_CHUNKS) % stream->max_chunks]);
+  }
 
   stream->n_chunks++;
   stream->program->n_hls_chunks = stream->n_chunks;
 
-  if (stream->n_chunks == 1) {
+  gss_hls_retire_segments (stream);
+  gss_segment_cache_trim (stream->hls.cache);
+
+  /* BANDWIDTH of the I-frame playlist is a peak, so it may only go up */
+  if (stream->n_chunks == 1 ||
+      stream->hls.iframe_bandwidth > stream->hls.iframe_bandwidth_listed) {
     gss_hls_update_variant (stream->program);
   }
 
 }
 
 
+static void
+gss_hls_append_parts (GString * s, GssStream * stream, GPtrArray * parts)
+{
+  guint i;
+
+  for (i = 0; i < parts->len; i++) {
+    GssHLSPart *part = g_ptr_array_index (parts, i);
+    char duration[G_ASCII_DTOSTR_BUF_SIZE];
+
+    g_ascii_formatd (duration, sizeof (duration), "%.3f",
+        (double) part->duration / GST_SECOND);
+    g_string_append_printf (s,
+        "#EXT-X-PART:DURATION=%s,URI=\"%s%s%05d.%d.ts\"%s\n",
+        duration, GSS_OBJECT_SERVER (stream->program)->base_url,
+        stream->hls.segment_prefix, part->msn, part->index,
+        part->independent ? ",INDEPENDENT=YES" : "");
+  }
+}
+
+/* Returns where the key URI ends in s */
+static gsize
+gss_hls_append_key (GString * s, GssStream * stream, GssHLSKey * key)
+{
+  GssServer *server = GSS_OBJECT_SERVER (stream->program);
+  GssProgram *program = stream->program;
+  gsize end;
+
+  g_string_append_printf (s, "#EXT-X-KEY:METHOD=AES-128,URI=\"%s%s",
+      server->base_url_https ? server->base_url_https : server->base_url,
+      key->location);
+  end = s->len;
+  g_string_append_c (s, '"');
+  if (program->hls.have_iv) {
+    g_string_append_printf (s, ",IV=0x%08x%08x%08x%08x",
+        program->hls.init_vector[0], program->hls.init_vector[1],
+        program->hls.init_vector[2], program->hls.init_vector[3]);
+  }
+  g_string_append (s, "\n");
+
+  return end;
+}
+
+/* Returns where a key URI in the entry ends in s, or -1 if there is
+ * none */
+static gssize
+gss_hls_append_segment (GString * s, GssStream * stream,
+    GssHLSSegment * segment)
+{
+  char extinf[G_ASCII_DTOSTR_BUF_SIZE];
+  gssize key_end = -1;
+
+  /* applies to this and the following segments */
+  if (segment->key && segment->key->first_msn == segment->index) {
+    key_end = gss_hls_append_key (s, stream, segment->key);
+  }
+
+  g_ascii_formatd (extinf, sizeof (extinf), "%.3f",
+      (double) segment->duration / GST_SECOND);
+  g_string_append_printf (s,
+      "#EXTINF:%s,\n"
+      "%s%s%05d.%s\n",
+      extinf, GSS_OBJECT_SERVER (stream->program)->base_url,
+      stream->hls.segment_prefix, segment->index,
+      gss_hls_segment_ext (stream));
+
+  return key_end;
+}
+
+static void
+gss_hls_append_iframes (GString * s, GssStream * stream,
+    GssHLSSegment * segment)
+{
+  guint i;
+
+  if (segment->iframes == NULL)
+    return;
+
+  for (i = 0; i < segment->iframes->len; i++) {
+    GssHLSIFrame *iframe = &g_array_index (segment->iframes, GssHLSIFrame, i);
+    char extinf[G_ASCII_DTOSTR_BUF_SIZE];
+
+    g_ascii_formatd (extinf, sizeof (extinf), "%.3f",
+        (double) gss_hls_iframe_duration (segment, i) / GST_SECOND);
+    g_string_append_printf (s,
+        "#EXTINF:%s,\n"
+        "#EXT-X-BYTERANGE:%" G_GSIZE_FORMAT "@%" G_GSIZE_FORMAT "\n"
+        "%s%s%05d.%s\n",
+        extinf, iframe->size, iframe->offset,
+        GSS_OBJECT_SERVER (stream->program)->base_url,
+        stream->hls.segment_prefix, segment->index,
+        gss_hls_segment_ext (stream));
+  }
+}
+
+/* Brings the index up to date.  Segment entries are formatted once, when
+ * they are added to the playlist, and removed from its front when they
+ * leave the window, so the work per new segment does not depend on the
+ * window length.  Only the header and the tail, which holds the most
+ * recent segments while they are listed with their LL-HLS parts, are
+ * formatted again.  The I-frame playlist, which lists the IDR access
+ * units of the same window as byte ranges of the segments, is kept the
+ * same way. */
 static void
 gss_hls_update_index (GssStream * stream)
 {
   GssProgram *program = stream->program;
+  const char *base_url = GSS_OBJECT_SERVER (program)->base_url;
   GString *s;
+  GstClockTime window;
+  int tail_first;
   int i;
-  int seq_num = MAX (0, program->n_hls_chunks - 5);
 
-  s = g_string_new ("#EXTM3U\n");
+  /* segments with parts are formatted with the tail */
+  tail_first = stream->n_chunks;
+  if (stream->hls.part_target) {
+    tail_first = MAX (0, stream->n_chunks - GSS_HLS_PART_SEGMENTS);
+  }
 
-  g_string_append_printf (s, "#EXT-X-TARGETDURATION:%d\n",
-      program->hls.target_duration);
-  g_string_append_printf (s, "#EXT-X-MEDIA-SEQUENCE:%d\n", seq_num);
-  if (program->hls.is_encrypted) {
-    g_string_append_printf (s, "#EXT-X-KEY:METHOD=AES-128,URI=\"%s\"",
-        program->hls.key_uri);
-    if (program->hls.have_iv) {
-      g_string_append_printf (s, ",IV=0x%08x%08x%08x%08x",
-          program->hls.init_vector[0], program->hls.init_vector[1],
-          program->hls.init_vector[2], program->hls.init_vector[3]);
-    } else {
-      g_string_append (s, "\n");
+  if (stream->hls.playlist == NULL ||
+      stream->hls.window_first < stream->n_chunks - stream->max_chunks ||
+      g_strcmp0 (stream->hls.playlist_base_url, base_url) != 0) {
+    int first;
+
+    /* Start over.  Only happens when the base URL changes, or if nobody
+     * asked for the index while the whole ring was replaced. */
+    if (stream->hls.playlist == NULL) {
+      stream->hls.playlist = gss_playlist_new ();
+    }
+    gss_playlist_clear (stream->hls.playlist);
+    if (stream->hls.key_ends == NULL) {
+      stream->hls.key_ends = g_array_new (FALSE, FALSE, sizeof (guint64));
+    }
+    g_array_set_size (stream->hls.key_ends, 0);
+    stream->hls.playlist_appended = 0;
+    stream->hls.playlist_dropped = 0;
+    if (stream->hls.iframe_playlist == NULL) {
+      stream->hls.iframe_playlist = gss_playlist_new ();
     }
+    gss_playlist_clear (stream->hls.iframe_playlist);
+    g_free (stream->hls.playlist_base_url);
+    stream->hls.playlist_base_url = g_strdup (base_url);
+
+    first = MAX (0, stream->n_chunks - stream->max_chunks + 2);
+    while (first < stream->n_chunks &&
+        !gss_hls_segment_is_available (stream,
+            &stream->chunks[first % stream->max_chunks])) {
+      first++;
+    }
+    stream->hls.window_first = first;
+    stream->hls.window_end = first;
+    stream->hls.playlist_end = first;
+    stream->hls.iframe_end = first;
+    stream->hls.window_duration = 0;
+  }
+
+  for (; stream->hls.window_end < stream->n_chunks; stream->hls.window_end++) {
+    GssHLSSegment *segment =
+        &stream->chunks[stream->hls.window_end % stream->max_chunks];
+
+    stream->hls.window_duration += segment->duration;
+  }
+
+  s = g_string_new ("");
+  for (; stream->hls.playlist_end < tail_first; stream->hls.playlist_end++) {
+    GssHLSSegment *segment =
+        &stream->chunks[stream->hls.playlist_end % stream->max_chunks];
+
+    gssize key_end;
+
+    g_string_truncate (s, 0);
+    key_end = gss_hls_append_segment (s, stream, segment);
+    gss_playlist_append (stream->hls.playlist, s->str, s->len);
+    segment->entry_length = s->len;
+    if (key_end >= 0) {
+      guint64 end = stream->hls.playlist_appended + key_end;
+
+      g_array_append_val (stream->hls.key_ends, end);
+    }
+    stream->hls.playlist_appended += s->len;
+  }
+  for (; stream->hls.iframe_end < stream->n_chunks; stream->hls.iframe_end++) {
+    GssHLSSegment *segment =
+        &stream->chunks[stream->hls.iframe_end % stream->max_chunks];
+
+    g_string_truncate (s, 0);
+    gss_hls_append_iframes (s, stream, segment);
+    gss_playlist_append (stream->hls.iframe_playlist, s->str, s->len);
+    segment->iframe_entry_length = s->len;
+  }
+  g_string_free (s, TRUE);
+
+  /* Drop segments from the front while the rest still fills the window.
+   * Segments in the two oldest slots are dropped as well, since the
+   * slots are about to be reused, and so are segments that were
+   * overwritten in the segment store. */
+  window = program->hls.window * GST_SECOND;
+  while (stream->hls.window_first < stream->n_chunks) {
+    GssHLSSegment *segment =
+        &stream->chunks[stream->hls.window_first % stream->max_chunks];
+
+    if (stream->hls.window_first >= stream->n_chunks - stream->max_chunks + 2 &&
+        gss_hls_segment_is_available (stream, segment) &&
+        stream->hls.window_duration - segment->duration < window) {
+      break;
+    }
+
+    if (stream->hls.window_first < stream->hls.playlist_end) {
+      gss_playlist_drop (stream->hls.playlist, segment->entry_length);
+      stream->hls.playlist_dropped += segment->entry_length;
+      while (stream->hls.key_ends->len > 0 &&
+          g_array_index (stream->hls.key_ends, guint64, 0) <
+          stream->hls.playlist_dropped) {
+        g_array_remove_index (stream->hls.key_ends, 0);
+      }
+    }
+    if (stream->hls.window_first < stream->hls.iframe_end) {
+      gss_playlist_drop (stream->hls.iframe_playlist,
+          segment->iframe_entry_length);
+    }
+    stream->hls.window_duration -= segment->duration;
+    stream->hls.window_first++;
+  }
+  if (stream->hls.playlist_end < stream->hls.window_first) {
+    stream->hls.playlist_end = stream->hls.window_first;
+  }
+  if (stream->hls.iframe_end < stream->hls.window_first) {
+    stream->hls.iframe_end = stream->hls.window_first;
+  }
+
+  /* I-frame playlist header, version 4 for byte ranges */
+  s = g_string_new ("#EXTM3U\n#EXT-X-VERSION:4\n");
+  g_string_append_printf (s, "#EXT-X-TARGETDURATION:%d\n",
+      stream->hls.target_duration);
+  g_string_append_printf (s, "#EXT-X-MEDIA-SEQUENCE:%d\n",
+      stream->hls.window_first);
+  g_string_append (s, "#EXT-X-I-FRAMES-ONLY\n");
+  if (stream->hls.iframe_header) {
+    soup_buffer_free (stream->hls.iframe_header);
+  }
+  stream->hls.iframe_header =
+      soup_buffer_new (SOUP_MEMORY_TAKE, s->str, s->len);
+  g_string_free (s, FALSE);
+
+  /* header */
+  s = g_string_new ("#EXTM3U\n");
+
+  if (stream->hls.part_target) {
+    char part_target[G_ASCII_DTOSTR_BUF_SIZE];
+    char hold_back[G_ASCII_DTOSTR_BUF_SIZE];
+
+    g_string_append (s, "#EXT-X-VERSION:6\n");
+    g_string_append_printf (s, "#EXT-X-TARGETDURATION:%d\n",
+        stream->hls.target_duration);
+    g_ascii_formatd (part_target, sizeof (part_target), "%.3f",
+        (double) stream->hls.part_target / GST_SECOND);
+    g_ascii_formatd (hold_back, sizeof (hold_back), "%.3f",
+        (double) 3 * stream->hls.part_target / GST_SECOND);
+    g_string_append_printf (s, "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,"
+        "PART-HOLD-BACK=%s\n", hold_back);
+    g_string_append_printf (s, "#EXT-X-PART-INF:PART-TARGET=%s\n",
+        part_target);
+  } else if (stream->hls.init_segment) {
+    /* version 6 for EXT-X-MAP */
+    g_string_append (s, "#EXT-X-VERSION:6\n");
+    g_string_append_printf (s, "#EXT-X-TARGETDURATION:%d\n",
+        stream->hls.target_duration);
   } else {
+    /* version 3 for floating point EXTINF durations */
+    g_string_append (s, "#EXT-X-VERSION:3\n");
+    g_string_append_printf (s, "#EXT-X-TARGETDURATION:%d\n",
+        stream->hls.target_duration);
+  }
+  g_string_append_printf (s, "#EXT-X-MEDIA-SEQUENCE:%d\n",
+      stream->hls.window_first);
+  stream->hls.header_key_end = -1;
+  if (stream->hls.window_first < stream->n_chunks &&
+      stream->chunks[stream->hls.window_first % stream->max_chunks].key) {
+    /* key of the first segment, which may not be the first one of its
+     * rotation period */
+    stream->hls.header_key_end = gss_hls_append_key (s, stream,
+        stream->chunks[stream->hls.window_first % stream->max_chunks].key);
+  } else if (!stream->hls.encrypt) {
     g_string_append (s, "#EXT-X-KEY:METHOD=NONE\n");
   }
+  if (stream->hls.init_segment) {
+    g_string_append_printf (s, "#EXT-X-MAP:URI=\"%s%sinit%d.mp4\"\n",
+        base_url, stream->hls.segment_prefix, stream->hls.init_version);
+  }
 
   if (0) {
     g_string_append (s, "#EXT-X-PROGRAM-DATE-TIME:YYYY-MM-DDThh:mm:ssZ\n");
   }
-  g_string_append (s, "#EXT-X-ALLOW-CACHE:NO\n");
-  g_string_append (s, "#EXT-X-VERSION:1\n");
 
-  for (i = seq_num; i < stream->n_chunks; i++) {
-    GssHLSSegment *segment = &stream->chunks[i % GSS_STREAM_HLS_CHUNKS];
+  if (stream->hls.index_header) {
+    soup_buffer_free (stream->hls.index_header);
+  }
+  stream->hls.index_header =
+      soup_buffer_new (SOUP_MEMORY_TAKE, s->str, s->len);
+  g_string_free (s, FALSE);
+
+  /* tail */
+  s = g_string_new ("");
+  for (i = MAX (tail_first, stream->hls.window_first); i < stream->n_chunks;
+      i++) {
+    GssHLSSegment *segment = &stream->chunks[i % stream->max_chunks];
+
+    if (segment->parts) {
+      gss_hls_append_parts (s, stream, segment->parts);
+    }
+    gss_hls_append_segment (s, stream, segment);
+  }
 
+  if (stream->hls.parts) {
+    gss_hls_append_parts (s, stream, stream->hls.parts);
+  }
+  if (stream->hls.next_part && !stream->hls.at_eos) {
     g_string_append_printf (s,
-        "#EXTINF:%d,\n"
-        "%s%s\n",
-        segment->duration, GSS_OBJECT_SERVER (program)->base_url,
-        segment->location);
+        "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"%s%s%05d.%d.ts\"\n",
+        base_url, stream->hls.segment_prefix, stream->hls.next_part->msn,
+        stream->hls.next_part->index);
   }
 
   if (stream->hls.at_eos) {
     g_string_append (s, "#EXT-X-ENDLIST\n");
   }
 
-  if (stream->hls.index_buffer) {
-    soup_buffer_free (stream->hls.index_buffer);
+  if (stream->hls.index_tail) {
+    soup_buffer_free (stream->hls.index_tail);
   }
-  stream->hls.index_buffer = soup_buffer_new (SOUP_MEMORY_TAKE, s->str, s->len);
+  stream->hls.index_tail = soup_buffer_new (SOUP_MEMORY_TAKE, s->str, s->len);
   g_string_free (s, FALSE);
 
   stream->hls.need_index_update = FALSE;
+  stream->hls.index_version++;
 }
 
 static void
@@ -337,6 +1928,7 @@ gss_hls_update_variant (GssProgram * program)
 
     if (!stream->is_hls)
       continue;
+    stream->hls.iframe_bandwidth_listed = stream->hls.iframe_bandwidth;
     if (stream->bitrate == 0)
       continue;
     if (stream->n_chunks == 0)
@@ -352,6 +1944,16 @@ gss_hls_update_variant (GssProgram * program)
         GSS_OBJECT_NAME (program),
         stream->width, stream->height, stream->bitrate / 1000,
         gss_stream_type_get_mod (stream->type));
+
+    if (gss_hls_has_iframes (stream) && stream->hls.iframe_bandwidth > 0) {
+      g_string_append_printf (s,
+          "#EXT-X-I-FRAME-STREAM-INF:BANDWIDTH=%d,CODECS=\"%s\","
+          "RESOLUTION=%dx%d,URI=\"%s/%s-%dx%d-%dkbps%s-iframes.m3u8\"\n",
+          stream->hls.iframe_bandwidth, stream->codecs, stream->width,
+          stream->height, GSS_OBJECT_SERVER (program)->base_url,
+          GSS_OBJECT_NAME (program), stream->width, stream->height,
+          stream->bitrate / 1000, gss_stream_type_get_mod (stream->type));
+    }
   }
   if (program->hls.variant_buffer) {
     soup_buffer_free (program->hls.variant_buffer);
@@ -359,6 +1961,7 @@ gss_hls_update_variant (GssProgram * program)
   program->hls.variant_buffer =
       soup_buffer_new (SOUP_MEMORY_TAKE, s->str, s->len);
   g_string_free (s, FALSE);
+  program->hls.variant_version++;
 
 }
 
@@ -366,12 +1969,31 @@ static void
 gss_hls_handle_m3u8 (GssTransaction * t)
 {
   GssProgram *program = (GssProgram *) t->resource->priv;
+  int max_age = 0;
+  char *etag;
+  GList *g;
 
   g_assert (program->hls.variant_buffer != NULL);
 
+  if (program->hls.cache_playlists) {
+    for (g = program->streams; g; g = g_list_next (g)) {
+      GssStream *stream = g->data;
+
+      if (stream->is_hls) {
+        max_age = MAX (max_age, gss_hls_playlist_max_age (stream, FALSE));
+      }
+    }
+  }
+  gss_hls_set_cache_control (t->msg, max_age, FALSE);
+  etag = g_strdup_printf ("\"%08x-%d\"", program->hls.epoch,
+      program->hls.variant_version);
+  if (gss_transaction_check_etag (t, etag)) {
+    g_free (etag);
+    return;
+  }
+  g_free (etag);
+
   soup_message_set_status (t->msg, SOUP_STATUS_OK);
-  soup_message_headers_replace (t->msg->response_headers,
-      "Cache-Control", "no-store");
   soup_message_body_append_buffer (t->msg->response_body,
       program->hls.variant_buffer);
 }
@@ -380,29 +2002,249 @@ static void
 gss_hls_handle_stream_m3u8 (GssTransaction * t)
 {
   GssStream *stream = (GssStream *) t->resource->priv;
+  gboolean blocking = FALSE;
+  const char *s;
+
+  /* LL-HLS blocking playlist reload */
+  s = t->query ? g_hash_table_lookup (t->query, "_HLS_msn") : NULL;
+  if (stream->hls.part_target && s) {
+    int msn;
+    int part_index = -1;
+
+    msn = strtol (s, NULL, 10);
+    s = g_hash_table_lookup (t->query, "_HLS_part");
+    if (s) {
+      part_index = strtol (s, NULL, 10);
+    }
+
+    if (msn < 0 || msn > stream->n_chunks + 2) {
+      soup_message_set_status (t->msg, SOUP_STATUS_BAD_REQUEST);
+      return;
+    }
+    if (!gss_hls_playlist_has (stream, msn, part_index)) {
+      gss_hls_waiter_add (stream, NULL, t, msn, part_index);
+      return;
+    }
+    blocking = TRUE;
+  }
+
+  gss_hls_respond_playlist (stream, t, blocking);
+}
+
+static void
+gss_hls_handle_iframes_m3u8 (GssTransaction * t)
+{
+  GssStream *stream = (GssStream *) t->resource->priv;
+  char *etag;
+
+  if (!gss_hls_has_iframes (stream)) {
+    soup_message_set_status (t->msg, SOUP_STATUS_NOT_FOUND);
+    return;
+  }
 
-  if (stream->hls.index_buffer == NULL || stream->hls.need_index_update) {
+  if (stream->hls.index_header == NULL || stream->hls.need_index_update) {
     gss_hls_update_index (stream);
   }
 
+  gss_hls_set_cache_control (t->msg, gss_hls_playlist_max_age (stream, FALSE),
+      FALSE);
+  etag = g_strdup_printf ("\"%08x-i%d\"", stream->hls.epoch,
+      stream->hls.index_version);
+  if (gss_transaction_check_etag (t, etag)) {
+    g_free (etag);
+    return;
+  }
+  g_free (etag);
+
   soup_message_set_status (t->msg, SOUP_STATUS_OK);
-  soup_message_headers_replace (t->msg->response_headers,
-      "Cache-Control", "no-store");
   soup_message_body_append_buffer (t->msg->response_body,
-      stream->hls.index_buffer);
+      stream->hls.iframe_header);
+  soup_message_body_append_buffer (t->msg->response_body,
+      gss_playlist_get_buffer (stream->hls.iframe_playlist));
+  if (stream->hls.at_eos) {
+    soup_message_body_append (t->msg->response_body, SOUP_MEMORY_STATIC,
+        "#EXT-X-ENDLIST\n", strlen ("#EXT-X-ENDLIST\n"));
+  }
 }
 
 static void
-gss_hls_handle_ts_chunk (GssTransaction * t)
+gss_hls_respond_part (GssTransaction * t, GssHLSPart * part)
 {
-  GssHLSSegment *segment = (GssHLSSegment *) t->resource->priv;
+  char *etag;
 
-  soup_message_set_status (t->msg, SOUP_STATUS_OK);
+  if (part->buffers == NULL) {
+    /* preload hint, block until the part is complete */
+    gss_hls_waiter_add (part->stream, part, t, part->msn, part->index);
+    return;
+  }
 
-  soup_message_headers_replace (t->msg->response_headers,
-      "Cache-Control", "no-store");
+  gss_hls_set_cache_control (t->msg,
+      part->stream->program->hls.segment_max_age, TRUE);
+  etag = gss_hls_part_etag (part);
+  if (!gss_transaction_check_etag (t, etag)) {
+    gss_transaction_send_buffers (t, part->buffers);
+  }
+  g_free (etag);
+}
+
+static void
+gss_hls_respond_segment (GssTransaction * t, GssHLSSegment * segment)
+{
+  GssStream *stream = segment->stream;
+  SoupBuffer *buffer = NULL;
+  char *etag;
+
+  if (segment->buffers == NULL) {
+    if (stream->hls.store) {
+      buffer = gss_segment_store_get_buffer (stream->hls.store,
+          segment->store_offset, segment->size);
+    }
+    if (buffer == NULL) {
+      /* overwritten in the segment store */
+      soup_message_set_status (t->msg, SOUP_STATUS_NOT_FOUND);
+      return;
+    }
+  }
+
+  gss_hls_set_cache_control (t->msg, stream->program->hls.segment_max_age,
+      TRUE);
+  etag = gss_hls_segment_etag (segment);
+  if (!gss_transaction_check_etag (t, etag)) {
+    if (buffer) {
+      GList list = { buffer, NULL, NULL };
+
+      gss_transaction_send_buffers (t, &list);
+    } else {
+      gss_segment_cache_touch (stream->hls.cache, segment);
+      gss_transaction_send_buffers (t, segment->buffers);
+    }
+  }
+  g_free (etag);
+  if (buffer) {
+    soup_buffer_free (buffer);
+  }
+}
+
+static void
+gss_hls_respond_init (GssTransaction * t, GssStream * stream)
+{
+  char *etag;
+
+  gss_hls_set_cache_control (t->msg, stream->program->hls.segment_max_age,
+      TRUE);
+  etag = g_strdup_printf ("\"%08x-init%d\"", stream->hls.epoch,
+      stream->hls.init_version);
+  if (!gss_transaction_check_etag (t, etag)) {
+    GList list = { stream->hls.init_segment, NULL, NULL };
+
+    gss_transaction_send_buffers (t, &list);
+  }
+  g_free (etag);
+}
+
+static GssHLSSegment *
+gss_hls_find_segment (GssStream * stream, int msn)
+{
+  GssHLSSegment *segment;
+
+  if (msn < 0 || msn >= stream->n_chunks ||
+      msn < stream->n_chunks - stream->max_chunks)
+    return NULL;
 
-  soup_message_body_append_buffer (t->msg->response_body, segment->buffer);
+  segment = &stream->chunks[msn % stream->max_chunks];
+  if (!segment->published || segment->index != msn)
+    return NULL;
+  return segment;
+}
+
+static GssHLSPart *
+gss_hls_find_part (GssStream * stream, int msn, int part_index)
+{
+  GPtrArray *parts;
+
+  if (msn == stream->n_chunks) {
+    GssHLSPart *part = stream->hls.next_part;
+
+    /* the preload hint */
+    if (part && part->msn == msn && part->index == part_index)
+      return part;
+    parts = stream->hls.parts;
+  } else {
+    GssHLSSegment *segment = gss_hls_find_segment (stream, msn);
+
+    parts = segment ? segment->parts : NULL;
+  }
+
+  if (parts == NULL || part_index < 0 || part_index >= (int) parts->len)
+    return NULL;
+  return g_ptr_array_index (parts, part_index);
+}
+
+/* Handles all segment and part locations of a stream, which start with
+ * hls.segment_prefix followed by "<msn>.ts" or "<msn>.<part>.ts", or
+ * for fMP4 "<msn>.m4s" and "init<version>.mp4".  The sequence numbers
+ * index the segment ring directly, so publishing a segment doesn't
+ * touch the server's resource table. */
+static void
+gss_hls_handle_segment (GssTransaction * t)
+{
+  GssStream *stream = (GssStream *) t->resource->priv;
+  const char *s;
+  char *end;
+  long msn;
+  long part_index = -1;
+
+  s = t->path + strlen (stream->hls.segment_prefix);
+  if (strncmp (s, "init", 4) == 0 && stream->hls.init_segment &&
+      g_ascii_isdigit (s[4]) &&
+      strtol (s + 4, &end, 10) == stream->hls.init_version &&
+      strcmp (end, ".mp4") == 0) {
+    gss_hls_respond_init (t, stream);
+    return;
+  }
+  if (!g_ascii_isdigit (s[0])) {
+    soup_message_set_status (t->msg, SOUP_STATUS_NOT_FOUND);
+    return;
+  }
+  msn = strtol (s, &end, 10);
+  if (end[0] == '.' && g_ascii_isdigit (end[1])) {
+    part_index = strtol (end + 1, &end, 10);
+  }
+  if (end[0] != '.' || strcmp (end + 1, part_index >= 0 ? "ts" :
+          gss_hls_segment_ext (stream)) != 0 ||
+      msn > G_MAXINT || part_index > G_MAXINT) {
+    soup_message_set_status (t->msg, SOUP_STATUS_NOT_FOUND);
+    return;
+  }
+
+  if (part_index >= 0) {
+    GssHLSPart *part = gss_hls_find_part (stream, msn, part_index);
+
+    if (part) {
+      gss_hls_respond_part (t, part);
+      return;
+    }
+  } else {
+    GssHLSSegment *segment = gss_hls_find_segment (stream, msn);
+
+    if (segment) {
+      gss_hls_respond_segment (t, segment);
+      return;
+    }
+  }
+  soup_message_set_status (t->msg, SOUP_STATUS_NOT_FOUND);
+}
+
+static void
+gss_hls_handle_key (GssTransaction * t)
+{
+  GssHLSKey *key = (GssHLSKey *) t->resource->priv;
+
+  soup_message_set_status (t->msg, SOUP_STATUS_OK);
+  soup_message_headers_replace (t->msg->response_headers,
+      "Cache-Control", "private, no-store");
+  soup_message_body_append (t->msg->response_body, SOUP_MEMORY_COPY,
+      key->data, sizeof (key->data));
 }
 
 void
@@ -44,6 +44,7 @@ void
 gss_metrics_add_client (GssMetrics * metrics, int bitrate)
 {
   metrics->n_clients++;
+  metrics->total_clients++;
   metrics->max_clients = MAX (metrics->max_clients, metrics->n_clients);
 
   metrics->bitrate += bitrate;
@@ -57,3 +58,24 @@ gss_metrics_remove_client (GssMetrics * metrics, int bitrate)
   metrics->n_clients--;
   metrics->bitrate -= bitrate;
 }
+
+void
+gss_metrics_add_segment (GssMetrics * metrics, gint64 delay)
+{
+  metrics->n_segments++;
+  metrics->segment_delay = delay;
+  metrics->max_segment_delay = MAX (metrics->max_segment_delay, delay);
+  metrics->total_segment_delay += delay;
+}
+
+void
+gss_metrics_add_stall (GssMetrics * metrics)
+{
+  metrics->n_stalls++;
+}
+
+void
+gss_metrics_add_switch (GssMetrics * metrics)
+{
+  metrics->n_switches++;
+}
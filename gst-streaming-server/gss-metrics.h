@@ -30,14 +30,32 @@ G_BEGIN_DECLS
 struct _GssMetrics {
   int n_clients;
   int max_clients;
-  gint64 bitrate;
+  guint64 total_clients; /* ever added */
+  guint64 n_stalls; /* clients dropped for falling behind */
+  guint64 n_switches; /* slow clients moved to a lower bitrate */
+  gint64 bitrate; /* nominal, of the streams the clients are on */
   gint64 max_bitrate;
+  gint64 egress_rate; /* measured over the last second (in bits/sec) */
+  gint64 max_egress_rate;
+
+  /* time from a segment being cut until it is published (in us) */
+  guint64 n_segments;
+  gint64 segment_delay;
+  gint64 max_segment_delay;
+  gint64 total_segment_delay;
+
+  /* bytes of HLS segments held in memory */
+  gint64 segment_memory;
+  gint64 max_segment_memory;
 };
 
 GssMetrics * gss_metrics_new (void);
 void gss_metrics_free (GssMetrics * metrics);
 void gss_metrics_add_client (GssMetrics * metrics, int bitrate);
 void gss_metrics_remove_client (GssMetrics * metrics, int bitrate);
+void gss_metrics_add_segment (GssMetrics * metrics, gint64 delay);
+void gss_metrics_add_stall (GssMetrics * metrics);
+void gss_metrics_add_switch (GssMetrics * metrics);
 
 G_END_DECLS
 
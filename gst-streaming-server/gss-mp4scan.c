@@ -0,0 +1,468 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include "gss-server.h"
+
+#include <string.h>
+
+
+#define GSS_MP4_FOURCC(a,b,c,d) \
+  (((guint32) (a) << 24) | ((b) << 16) | ((c) << 8) | (d))
+
+/* moov and moof boxes are small; anything larger is not parsed */
+#define GSS_MP4_MAX_BOX (4 * 1024 * 1024)
+
+/* sample_is_non_sync_sample in the sample flags */
+#define GSS_MP4_NON_SYNC 0x00010000
+
+
+/* Steps through the boxes in data.  Returns FALSE at the end, or if a
+ * box is truncated. */
+static gboolean
+gss_mp4_next_box (const guint8 ** data, gsize * size, guint32 * type,
+    const guint8 ** payload, gsize * payload_size)
+{
+  guint64 box_size;
+  int header_size = 8;
+
+  if (*size < 8)
+    return FALSE;
+
+  box_size = GST_READ_UINT32_BE (*data);
+  if (box_size == 1) {
+    if (*size < 16)
+      return FALSE;
+    box_size = GST_READ_UINT64_BE (*data + 8);
+    header_size = 16;
+  } else if (box_size == 0) {
+    box_size = *size;
+  }
+  if (box_size < (guint64) header_size || box_size > *size)
+    return FALSE;
+
+  *type = GST_READ_UINT32_BE (*data + 4);
+  *payload = *data + header_size;
+  *payload_size = box_size - header_size;
+  *data += box_size;
+  *size -= box_size;
+
+  return TRUE;
+}
+
+static const guint8 *
+gss_mp4_find_box (const guint8 * data, gsize size, guint32 type,
+    gsize * payload_size)
+{
+  const guint8 *payload;
+  guint32 t;
+
+  while (gss_mp4_next_box (&data, &size, &t, &payload, payload_size)) {
+    if (t == type)
+      return payload;
+  }
+  return NULL;
+}
+
+static void
+gss_mp4_scanner_parse_trak (GssMp4Scanner * scanner, const guint8 * trak,
+    gsize size)
+{
+  const guint8 *mdia, *hdlr, *tkhd, *mdhd;
+  gsize mdia_size, hdlr_size, tkhd_size, mdhd_size;
+  int offset;
+
+  mdia = gss_mp4_find_box (trak, size, GSS_MP4_FOURCC ('m', 'd', 'i', 'a'),
+      &mdia_size);
+  if (mdia == NULL)
+    return;
+  hdlr = gss_mp4_find_box (mdia, mdia_size,
+      GSS_MP4_FOURCC ('h', 'd', 'l', 'r'), &hdlr_size);
+  if (hdlr == NULL || hdlr_size < 12 ||
+      GST_READ_UINT32_BE (hdlr + 8) != GSS_MP4_FOURCC ('v', 'i', 'd', 'e'))
+    return;
+
+  /* version 1 boxes have 64 bit creation and modification times */
+  tkhd = gss_mp4_find_box (trak, size, GSS_MP4_FOURCC ('t', 'k', 'h', 'd'),
+      &tkhd_size);
+  mdhd = gss_mp4_find_box (mdia, mdia_size,
+      GSS_MP4_FOURCC ('m', 'd', 'h', 'd'), &mdhd_size);
+  if (tkhd == NULL || mdhd == NULL || tkhd_size < 1 || mdhd_size < 1)
+    return;
+
+  offset = (tkhd[0] == 1) ? 20 : 12;
+  if (tkhd_size < offset + 4)
+    return;
+  scanner->video_track_id = GST_READ_UINT32_BE (tkhd + offset);
+
+  offset = (mdhd[0] == 1) ? 20 : 12;
+  if (mdhd_size < offset + 4)
+    return;
+  scanner->timescale = GST_READ_UINT32_BE (mdhd + offset);
+}
+
+static void
+gss_mp4_scanner_parse_moov (GssMp4Scanner * scanner, const guint8 * data,
+    gsize size)
+{
+  const guint8 *d, *payload, *mvex;
+  gsize s, payload_size, mvex_size;
+  guint32 type;
+
+  scanner->video_track_id = 0;
+  scanner->timescale = 0;
+  scanner->default_sample_flags = 0;
+
+  d = data;
+  s = size;
+  while (gss_mp4_next_box (&d, &s, &type, &payload, &payload_size)) {
+    if (type == GSS_MP4_FOURCC ('t', 'r', 'a', 'k')) {
+      gss_mp4_scanner_parse_trak (scanner, payload, payload_size);
+      if (scanner->video_track_id)
+        break;
+    }
+  }
+
+  mvex = gss_mp4_find_box (data, size, GSS_MP4_FOURCC ('m', 'v', 'e', 'x'),
+      &mvex_size);
+  if (mvex == NULL)
+    return;
+  d = mvex;
+  s = mvex_size;
+  while (gss_mp4_next_box (&d, &s, &type, &payload, &payload_size)) {
+    if (type == GSS_MP4_FOURCC ('t', 'r', 'e', 'x') && payload_size >= 24 &&
+        GST_READ_UINT32_BE (payload + 4) == scanner->video_track_id) {
+      scanner->default_sample_flags = GST_READ_UINT32_BE (payload + 20);
+    }
+  }
+
+  GST_DEBUG ("video track %u, timescale %u", scanner->video_track_id,
+      scanner->timescale);
+}
+
+/* Looks at the video track fragment.  Returns TRUE if its first sample
+ * is a sync sample, with its decode time in *time. */
+static gboolean
+gss_mp4_scanner_parse_moof (GssMp4Scanner * scanner, const guint8 * data,
+    gsize size, guint64 * time)
+{
+  const guint8 *traf;
+  gsize traf_size;
+  guint32 type;
+
+  while (gss_mp4_next_box (&data, &size, &type, &traf, &traf_size)) {
+    const guint8 *tfhd, *tfdt, *trun;
+    gsize tfhd_size, tfdt_size, trun_size;
+    guint32 flags;
+    guint32 sample_flags;
+    int offset;
+
+    if (type != GSS_MP4_FOURCC ('t', 'r', 'a', 'f'))
+      continue;
+
+    tfhd = gss_mp4_find_box (traf, traf_size,
+        GSS_MP4_FOURCC ('t', 'f', 'h', 'd'), &tfhd_size);
+    if (tfhd == NULL || tfhd_size < 8)
+      continue;
+    if (scanner->video_track_id &&
+        GST_READ_UINT32_BE (tfhd + 4) != scanner->video_track_id)
+      continue;
+
+    flags = GST_READ_UINT32_BE (tfhd) & 0xffffff;
+    sample_flags = scanner->default_sample_flags;
+    offset = 8;
+    if (flags & 0x01)
+      offset += 8;              /* base_data_offset */
+    if (flags & 0x02)
+      offset += 4;              /* sample_description_index */
+    if (flags & 0x08)
+      offset += 4;              /* default_sample_duration */
+    if (flags & 0x10)
+      offset += 4;              /* default_sample_size */
+    if ((flags & 0x20) && tfhd_size >= offset + 4)
+      sample_flags = GST_READ_UINT32_BE (tfhd + offset);
+
+    *time = GSS_TS_NO_PTS;
+    tfdt = gss_mp4_find_box (traf, traf_size,
+        GSS_MP4_FOURCC ('t', 'f', 'd', 't'), &tfdt_size);
+    if (tfdt && tfdt_size >= 8) {
+      if (tfdt[0] == 1 && tfdt_size >= 12) {
+        *time = GST_READ_UINT64_BE (tfdt + 4);
+      } else {
+        *time = GST_READ_UINT32_BE (tfdt + 4);
+      }
+    }
+
+    trun = gss_mp4_find_box (traf, traf_size,
+        GSS_MP4_FOURCC ('t', 'r', 'u', 'n'), &trun_size);
+    if (trun && trun_size >= 8) {
+      flags = GST_READ_UINT32_BE (trun) & 0xffffff;
+      offset = 8;
+      if (flags & 0x001)
+        offset += 4;            /* data_offset */
+      if (flags & 0x004) {
+        if (trun_size >= offset + 4)
+          sample_flags = GST_READ_UINT32_BE (trun + offset);
+      } else if ((flags & 0x400) && GST_READ_UINT32_BE (trun + 4) > 0) {
+        /* flags of the first sample record */
+        if (flags & 0x100)
+          offset += 4;
+        if (flags & 0x200)
+          offset += 4;
+        if (trun_size >= offset + 4)
+          sample_flags = GST_READ_UINT32_BE (trun + offset);
+      }
+    }
+
+    return !(sample_flags & GSS_MP4_NON_SYNC);
+  }
+
+  return FALSE;
+}
+
+static void
+gss_mp4_scanner_box_end (GssMp4Scanner * scanner)
+{
+  const guint8 *payload = NULL;
+  gsize payload_size = 0;
+  guint32 type = scanner->box_type;
+  gboolean after_styp = scanner->after_styp;
+
+  scanner->in_box = FALSE;
+  scanner->after_styp = FALSE;
+
+  if (scanner->box) {
+    const guint8 *d = scanner->box->data;
+    gsize s = scanner->box->len;
+
+    gss_mp4_next_box (&d, &s, &type, &payload, &payload_size);
+  }
+
+  switch (type) {
+    case GSS_MP4_FOURCC ('s', 't', 'y', 'p'):
+      scanner->after_styp = TRUE;
+      scanner->styp_offset = scanner->box_start;
+      break;
+    case GSS_MP4_FOURCC ('f', 't', 'y', 'p'):
+      if (scanner->box) {
+        g_byte_array_set_size (scanner->init, 0);
+        g_byte_array_append (scanner->init, scanner->box->data,
+            scanner->box->len);
+      }
+      break;
+    case GSS_MP4_FOURCC ('m', 'o', 'o', 'v'):
+      if (scanner->box) {
+        g_byte_array_append (scanner->init, scanner->box->data,
+            scanner->box->len);
+        gss_mp4_scanner_parse_moov (scanner, payload, payload_size);
+        scanner->new_init = TRUE;
+      }
+      break;
+    case GSS_MP4_FOURCC ('m', 'o', 'o', 'f'):
+      scanner->n_fragments++;
+      if (scanner->box && !scanner->found_key) {
+        guint64 time;
+
+        if (gss_mp4_scanner_parse_moof (scanner, payload, payload_size,
+                &time)) {
+          scanner->found_key = TRUE;
+          /* a styp belongs to the segment it starts */
+          scanner->key_offset = after_styp ? scanner->styp_offset :
+              scanner->box_start;
+          scanner->key_time = GSS_TS_NO_PTS;
+          if (time != GSS_TS_NO_PTS && scanner->timescale > 0) {
+            scanner->key_time = gst_util_uint64_scale (time, 90000,
+                scanner->timescale);
+          }
+        }
+      }
+      break;
+    default:
+      break;
+  }
+
+  if (scanner->box) {
+    g_byte_array_free (scanner->box, TRUE);
+    scanner->box = NULL;
+  }
+}
+
+static void
+gss_mp4_scanner_box_begin (GssMp4Scanner * scanner, guint64 box_size,
+    int header_size)
+{
+  scanner->in_box = TRUE;
+  scanner->box_type = GST_READ_UINT32_BE (scanner->header + 4);
+  scanner->box_remaining = box_size - header_size;
+
+  switch (scanner->box_type) {
+    case GSS_MP4_FOURCC ('f', 't', 'y', 'p'):
+    case GSS_MP4_FOURCC ('m', 'o', 'o', 'v'):
+    case GSS_MP4_FOURCC ('m', 'o', 'o', 'f'):
+      if (box_size <= GSS_MP4_MAX_BOX) {
+        scanner->box = g_byte_array_sized_new (box_size);
+        g_byte_array_append (scanner->box, scanner->header, header_size);
+      } else {
+        GST_WARNING ("box too large (%" G_GUINT64_FORMAT " bytes)", box_size);
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+GssMp4Scanner *
+gss_mp4_scanner_new (void)
+{
+  GssMp4Scanner *scanner;
+
+  scanner = g_new0 (GssMp4Scanner, 1);
+  scanner->init = g_byte_array_new ();
+
+  return scanner;
+}
+
+void
+gss_mp4_scanner_free (GssMp4Scanner * scanner)
+{
+  if (scanner->box) {
+    g_byte_array_free (scanner->box, TRUE);
+  }
+  g_byte_array_free (scanner->init, TRUE);
+  g_free (scanner);
+}
+
+/* Scans the next chunk of the stream.  Returns TRUE if it completed a
+ * moof whose video starts with a sync sample.  key_offset is then set
+ * to where the fragment starts, including a preceding styp, and
+ * key_time to its decode time in 90 kHz units, or GSS_TS_NO_PTS. */
+gboolean
+gss_mp4_scanner_push (GssMp4Scanner * scanner, const guint8 * data,
+    gsize size, guint64 * key_offset, guint64 * key_time)
+{
+  gsize pos = 0;
+
+  scanner->found_key = FALSE;
+
+  while (pos < size) {
+    if (scanner->in_box) {
+      gsize n = MIN (scanner->box_remaining, size - pos);
+
+      if (scanner->box) {
+        g_byte_array_append (scanner->box, data + pos, n);
+      }
+      pos += n;
+      scanner->box_remaining -= n;
+      if (scanner->box_remaining == 0) {
+        gss_mp4_scanner_box_end (scanner);
+      }
+    } else {
+      int header_size = 8;
+      guint64 box_size;
+      int n;
+
+      if (scanner->n_header == 0) {
+        scanner->box_start = scanner->offset + pos;
+      }
+      if (scanner->n_header >= 8 &&
+          GST_READ_UINT32_BE (scanner->header) == 1) {
+        header_size = 16;
+      }
+      n = MIN (header_size - scanner->n_header, (int) (size - pos));
+      memcpy (scanner->header + scanner->n_header, data + pos, n);
+      scanner->n_header += n;
+      pos += n;
+      if (scanner->n_header < header_size)
+        continue;
+
+      box_size = GST_READ_UINT32_BE (scanner->header);
+      if (box_size == 1) {
+        if (header_size < 16)
+          continue;             /* read the 64 bit size first */
+        box_size = GST_READ_UINT64_BE (scanner->header + 8);
+      } else if (box_size == 0) {
+        /* runs to the end of the stream */
+        box_size = G_MAXUINT64;
+      }
+      scanner->n_header = 0;
+      if (box_size < (guint64) header_size) {
+        GST_DEBUG ("bad box size at offset %" G_GUINT64_FORMAT,
+            scanner->box_start);
+        box_size = header_size;
+      }
+
+      gss_mp4_scanner_box_begin (scanner, box_size, header_size);
+      if (scanner->box_remaining == 0) {
+        gss_mp4_scanner_box_end (scanner);
+      }
+    }
+  }
+
+  scanner->offset += size;
+
+  if (scanner->found_key) {
+    if (key_offset)
+      *key_offset = scanner->key_offset;
+    if (key_time)
+      *key_time = scanner->key_time;
+  }
+
+  return scanner->found_key;
+}
+
+/* Returns the initialization segment if a new one has been completed
+ * since the last call, otherwise NULL. */
+SoupBuffer *
+gss_mp4_scanner_take_init (GssMp4Scanner * scanner)
+{
+  if (!scanner->new_init)
+    return NULL;
+
+  scanner->new_init = FALSE;
+  return soup_buffer_new (SOUP_MEMORY_COPY, scanner->init->data,
+      scanner->init->len);
+}
+
+/* RFC 6381 codecs parameter for an initialization segment, from the
+ * avcC box of the video, or NULL. */
+char *
+gss_mp4_get_codecs (const guint8 * init, gsize size)
+{
+  const guint8 *avcc = NULL;
+  gboolean have_aac = FALSE;
+  gsize i;
+
+  for (i = 4; i + 8 <= size; i++) {
+    guint32 type = GST_READ_UINT32_BE (init + i);
+
+    if (type == GSS_MP4_FOURCC ('a', 'v', 'c', 'C') && avcc == NULL) {
+      avcc = init + i + 4;
+    } else if (type == GSS_MP4_FOURCC ('m', 'p', '4', 'a')) {
+      have_aac = TRUE;
+    }
+  }
+  if (avcc == NULL)
+    return NULL;
+
+  return g_strdup_printf ("avc1.%02X%02X%02X%s", avcc[1], avcc[2], avcc[3],
+      have_aac ? ", mp4a.40.2" : "");
+}
@@ -0,0 +1,77 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+
+#ifndef _GSS_MP4SCAN_H
+#define _GSS_MP4SCAN_H
+
+#include <libsoup/soup.h>
+#include "gss-config.h"
+#include "gss-types.h"
+
+G_BEGIN_DECLS
+
+/* Follows the top-level boxes of a fragmented MP4 (CMAF) stream as it
+ * goes through the segmenter.  It collects the initialization segment
+ * (ftyp and moov) and finds the fragments that start with a sync
+ * sample of the video track.  Byte offsets are counted from the first
+ * byte ever pushed. */
+struct _GssMp4Scanner {
+  guint64 offset; /* bytes pushed so far */
+
+  /* top-level box being read */
+  guint8 header[16];
+  int n_header;
+  gboolean in_box;
+  guint32 box_type;
+  guint64 box_start;
+  guint64 box_remaining;
+  GByteArray *box; /* contents, for boxes that are parsed */
+
+  GByteArray *init;
+  gboolean new_init; /* init complete, but not taken yet */
+  gboolean after_styp; /* the previous box was a styp */
+  guint64 styp_offset;
+
+  /* from the moov */
+  guint32 video_track_id;
+  guint32 timescale;
+  guint32 default_sample_flags;
+
+  /* key fragment found by the current push */
+  gboolean found_key;
+  guint64 key_offset;
+  guint64 key_time;
+
+  guint64 n_fragments;
+};
+
+GssMp4Scanner * gss_mp4_scanner_new (void);
+void gss_mp4_scanner_free (GssMp4Scanner *scanner);
+gboolean gss_mp4_scanner_push (GssMp4Scanner *scanner, const guint8 *data,
+    gsize size, guint64 *key_offset, guint64 *key_time);
+SoupBuffer * gss_mp4_scanner_take_init (GssMp4Scanner *scanner);
+char * gss_mp4_get_codecs (const guint8 *init, gsize size);
+
+G_END_DECLS
+
+#endif
+
@@ -0,0 +1,126 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include "gss-server.h"
+
+#include <string.h>
+
+
+GssPlaylist *
+gss_playlist_new (void)
+{
+  return g_new0 (GssPlaylist, 1);
+}
+
+void
+gss_playlist_free (GssPlaylist * playlist)
+{
+  gss_playlist_clear (playlist);
+  g_free (playlist);
+}
+
+void
+gss_playlist_clear (GssPlaylist * playlist)
+{
+  if (playlist->buffer) {
+    soup_buffer_free (playlist->buffer);
+    playlist->buffer = NULL;
+  }
+  if (playlist->arena) {
+    soup_buffer_free (playlist->arena);
+    playlist->arena = NULL;
+  }
+  playlist->data = NULL;
+  playlist->alloc = 0;
+  playlist->start = 0;
+  playlist->end = 0;
+}
+
+static void
+gss_playlist_invalidate (GssPlaylist * playlist)
+{
+  if (playlist->buffer) {
+    soup_buffer_free (playlist->buffer);
+    playlist->buffer = NULL;
+  }
+}
+
+/* Text is only ever written past the end of what has been published,
+ * so published buffers never change.  When the arena is full, the live
+ * part moves to a new arena twice its size; the old one goes away when
+ * the last buffer pointing into it is freed. */
+void
+gss_playlist_append (GssPlaylist * playlist, const char *data, gsize len)
+{
+  if (playlist->end + len > playlist->alloc) {
+    gsize live = playlist->end - playlist->start;
+    gsize alloc = MAX (4096, 2 * (live + len));
+    guint8 *new_data;
+
+    new_data = g_malloc (alloc);
+    if (live > 0) {
+      memcpy (new_data, playlist->data + playlist->start, live);
+    }
+    if (playlist->arena) {
+      soup_buffer_free (playlist->arena);
+    }
+    playlist->arena = soup_buffer_new (SOUP_MEMORY_TAKE, new_data, alloc);
+    playlist->data = new_data;
+    playlist->alloc = alloc;
+    playlist->start = 0;
+    playlist->end = live;
+  }
+
+  memcpy (playlist->data + playlist->end, data, len);
+  playlist->end += len;
+
+  gss_playlist_invalidate (playlist);
+}
+
+void
+gss_playlist_drop (GssPlaylist * playlist, gsize len)
+{
+  g_return_if_fail (len <= playlist->end - playlist->start);
+
+  playlist->start += len;
+
+  gss_playlist_invalidate (playlist);
+}
+
+/* Returns the current contents.  The buffer belongs to the playlist;
+ * use soup_buffer_copy() or soup_message_body_append_buffer() to keep
+ * it around. */
+SoupBuffer *
+gss_playlist_get_buffer (GssPlaylist * playlist)
+{
+  if (playlist->buffer == NULL) {
+    if (playlist->arena) {
+      playlist->buffer = soup_buffer_new_subbuffer (playlist->arena,
+          playlist->start, playlist->end - playlist->start);
+    } else {
+      playlist->buffer = soup_buffer_new (SOUP_MEMORY_STATIC, "", 0);
+    }
+  }
+
+  return playlist->buffer;
+}
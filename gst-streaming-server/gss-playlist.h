@@ -0,0 +1,56 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+
+#ifndef _GSS_PLAYLIST_H
+#define _GSS_PLAYLIST_H
+
+#include <libsoup/soup.h>
+#include "gss-config.h"
+#include "gss-types.h"
+
+G_BEGIN_DECLS
+
+/* Text that grows at the end and shrinks at the front, like the entries
+ * of a live playlist.  Appending and dropping is O(1) (amortized), and
+ * the current contents are published as a read-only SoupBuffer that
+ * stays valid, and unchanged, for as long as someone holds it. */
+struct _GssPlaylist {
+  SoupBuffer *arena;
+  guint8 *data;
+  gsize alloc;
+  gsize start;
+  gsize end;
+
+  SoupBuffer *buffer; /* published [start,end), NULL if out of date */
+};
+
+GssPlaylist * gss_playlist_new (void);
+void gss_playlist_free (GssPlaylist *playlist);
+void gss_playlist_clear (GssPlaylist *playlist);
+void gss_playlist_append (GssPlaylist *playlist, const char *data, gsize len);
+void gss_playlist_drop (GssPlaylist *playlist, gsize len);
+SoupBuffer * gss_playlist_get_buffer (GssPlaylist *playlist);
+
+G_END_DECLS
+
+#endif
+
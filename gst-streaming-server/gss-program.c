@@ -33,13 +33,31 @@ enum
   PROP_ENABLED,
   PROP_STATE,
   PROP_UUID,
-  PROP_DESCRIPTION
+  PROP_DESCRIPTION,
+  PROP_HLS_WINDOW,
+  PROP_HLS_DVR,
+  PROP_HLS_PART_TARGET,
+  PROP_HLS_SEGMENT_MAX_AGE,
+  PROP_HLS_CACHE_PLAYLISTS,
+  PROP_HLS_ENCRYPT,
+  PROP_HLS_KEY_ROTATION,
+  PROP_DELIVERY_PROFILE,
+  PROP_MAX_RATE
 };
 
 #define DEFAULT_ENABLED FALSE
 #define DEFAULT_STATE GSS_PROGRAM_STATE_STOPPED
 #define DEFAULT_UUID "00000000-0000-0000-0000-000000000000"
 #define DEFAULT_DESCRIPTION ""
+#define DEFAULT_HLS_WINDOW 20
+#define DEFAULT_HLS_DVR FALSE
+#define DEFAULT_HLS_PART_TARGET 0
+#define DEFAULT_HLS_SEGMENT_MAX_AGE 86400
+#define DEFAULT_HLS_CACHE_PLAYLISTS TRUE
+#define DEFAULT_HLS_ENCRYPT FALSE
+#define DEFAULT_HLS_KEY_ROTATION 0
+#define DEFAULT_DELIVERY_PROFILE GSS_DELIVERY_PROFILE_DEFAULT
+#define DEFAULT_MAX_RATE 0
 
 
 static void gss_program_get_resource (GssTransaction * transaction);
@@ -107,6 +125,16 @@ gss_program_init (GssProgram * program)
   gss_uuid_create (uuid);
   program->uuid = gss_uuid_to_string (uuid);
   program->description = g_strdup (DEFAULT_DESCRIPTION);
+  program->hls.window = DEFAULT_HLS_WINDOW;
+  program->hls.dvr = DEFAULT_HLS_DVR;
+  program->hls.part_target = DEFAULT_HLS_PART_TARGET;
+  program->hls.segment_max_age = DEFAULT_HLS_SEGMENT_MAX_AGE;
+  program->hls.cache_playlists = DEFAULT_HLS_CACHE_PLAYLISTS;
+  program->hls.is_encrypted = DEFAULT_HLS_ENCRYPT;
+  program->hls.key_rotation = DEFAULT_HLS_KEY_ROTATION;
+  program->delivery_profile = g_strdup (DEFAULT_DELIVERY_PROFILE);
+  program->max_rate = DEFAULT_MAX_RATE;
+  program->hls.epoch = g_random_int ();
 }
 
 static void
@@ -132,6 +160,57 @@ gss_program_class_init (GssProgramClass * program_class)
       PROP_DESCRIPTION, g_param_spec_string ("description", "Description",
           "Description", DEFAULT_DESCRIPTION,
           (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (program_class),
+      PROP_HLS_WINDOW, g_param_spec_int ("hls-window", "HLS Window",
+          "[seconds] Length of HLS playlists, i.e., how far clients can rewind",
+          1, 24 * 3600, DEFAULT_HLS_WINDOW,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (program_class),
+      PROP_HLS_DVR, g_param_spec_boolean ("hls-dvr", "HLS DVR",
+          "Keep HLS segments for the whole window, storing older segments "
+          "in the archive directory", DEFAULT_HLS_DVR,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (program_class),
+      PROP_HLS_PART_TARGET, g_param_spec_int ("hls-part-target",
+          "HLS Part Target",
+          "[ms] Duration of Low-Latency HLS partial segments (0 is disabled)",
+          0, 5000, DEFAULT_HLS_PART_TARGET,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (program_class),
+      PROP_HLS_SEGMENT_MAX_AGE, g_param_spec_int ("hls-segment-max-age",
+          "HLS Segment Max Age",
+          "[seconds] How long caches may keep HLS segments (0 disables "
+          "caching)", 0, G_MAXINT, DEFAULT_HLS_SEGMENT_MAX_AGE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (program_class),
+      PROP_HLS_CACHE_PLAYLISTS, g_param_spec_boolean ("hls-cache-playlists",
+          "HLS Cache Playlists",
+          "Allow caches to keep HLS playlists for a fraction of the target "
+          "duration", DEFAULT_HLS_CACHE_PLAYLISTS,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (program_class),
+      PROP_HLS_ENCRYPT, g_param_spec_boolean ("hls-encrypt", "HLS Encrypt",
+          "Encrypt HLS segments with AES-128, keys are only given out "
+          "to logged in users", DEFAULT_HLS_ENCRYPT,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (program_class),
+      PROP_HLS_KEY_ROTATION, g_param_spec_int ("hls-key-rotation",
+          "HLS Key Rotation",
+          "Number of HLS segments encrypted with the same key (0 is never "
+          "change the key)", 0, G_MAXINT, DEFAULT_HLS_KEY_ROTATION,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (program_class),
+      PROP_DELIVERY_PROFILE, g_param_spec_string ("delivery-profile",
+          "Delivery Profile", "How live clients are served: "
+          "ultra-low-latency, balanced or resilient, unless the stream "
+          "has its own", DEFAULT_DELIVERY_PROFILE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (program_class),
+      PROP_MAX_RATE, g_param_spec_int ("max-rate",
+          "Maximum rate (in kbytes/sec, 0 is unlimited)",
+          "Rate that the clients of all streams of the program are paced "
+          "to together (in kbytes/sec)", 0, G_MAXINT, DEFAULT_MAX_RATE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
 
   program_class->add_resources = gss_program_add_resources;
 
@@ -159,6 +238,7 @@ gss_program_finalize (GObject * object)
   g_free (program->follow_uri);
   g_free (program->follow_host);
   g_free (program->description);
+  g_free (program->delivery_profile);
   g_free (program->uuid);
 
   parent_class->finalize (object);
@@ -180,6 +260,41 @@ gss_program_set_property (GObject * object, guint prop_id,
       g_free (program->description);
       program->description = g_value_dup_string (value);
       break;
+    case PROP_HLS_WINDOW:
+      program->hls.window = g_value_get_int (value);
+      break;
+    case PROP_HLS_DVR:
+      program->hls.dvr = g_value_get_boolean (value);
+      break;
+    case PROP_HLS_PART_TARGET:
+      program->hls.part_target = g_value_get_int (value);
+      break;
+    case PROP_HLS_SEGMENT_MAX_AGE:
+      program->hls.segment_max_age = g_value_get_int (value);
+      break;
+    case PROP_HLS_CACHE_PLAYLISTS:
+      program->hls.cache_playlists = g_value_get_boolean (value);
+      break;
+    case PROP_HLS_ENCRYPT:
+      program->hls.is_encrypted = g_value_get_boolean (value);
+      break;
+    case PROP_HLS_KEY_ROTATION:
+      program->hls.key_rotation = g_value_get_int (value);
+      break;
+    case PROP_DELIVERY_PROFILE:
+    {
+      GList *g;
+
+      g_free (program->delivery_profile);
+      program->delivery_profile = g_value_dup_string (value);
+      for (g = program->streams; g; g = g_list_next (g)) {
+        gss_stream_apply_delivery_profile (g->data);
+      }
+      break;
+    }
+    case PROP_MAX_RATE:
+      program->max_rate = g_value_get_int (value);
+      break;
     default:
       g_assert_not_reached ();
       break;
@@ -207,6 +322,33 @@ gss_program_get_property (GObject * object, guint prop_id,
     case PROP_UUID:
       g_value_set_string (value, program->uuid);
       break;
+    case PROP_HLS_WINDOW:
+      g_value_set_int (value, program->hls.window);
+      break;
+    case PROP_HLS_DVR:
+      g_value_set_boolean (value, program->hls.dvr);
+      break;
+    case PROP_HLS_PART_TARGET:
+      g_value_set_int (value, program->hls.part_target);
+      break;
+    case PROP_HLS_SEGMENT_MAX_AGE:
+      g_value_set_int (value, program->hls.segment_max_age);
+      break;
+    case PROP_HLS_CACHE_PLAYLISTS:
+      g_value_set_boolean (value, program->hls.cache_playlists);
+      break;
+    case PROP_HLS_ENCRYPT:
+      g_value_set_boolean (value, program->hls.is_encrypted);
+      break;
+    case PROP_HLS_KEY_ROTATION:
+      g_value_set_int (value, program->hls.key_rotation);
+      break;
+    case PROP_DELIVERY_PROFILE:
+      g_value_set_string (value, program->delivery_profile);
+      break;
+    case PROP_MAX_RATE:
+      g_value_set_int (value, program->max_rate);
+      break;
     default:
       g_assert_not_reached ();
       break;
@@ -280,6 +422,10 @@ gss_program_remove_stream (GssProgram * program, GssStream * stream)
   program->streams = g_list_remove (program->streams, stream);
 
   gss_stream_remove_resources (stream);
+  if (GSS_OBJECT_SERVER (program)) {
+    gss_server_remove_stream_connections (GSS_OBJECT_SERVER (program),
+        stream);
+  }
   stream->program = NULL;
 
   g_object_unref (stream);
@@ -299,7 +445,11 @@ gss_program_disable_streaming (GssProgram * program)
   program->enable_streaming = FALSE;
   for (g = program->streams; g; g = g_list_next (g)) {
     GssStream *stream = g->data;
-    g_signal_emit_by_name (stream->sink, "clear");
+    if (stream->fanout) {
+      gss_fanout_clear (stream->fanout);
+    } else {
+      g_signal_emit_by_name (stream->sink, "clear");
+    }
   }
 }
 
@@ -545,8 +695,7 @@ gss_program_add_video_block (GssProgram * program, GssTransaction * t,
 
     for (g = g_list_last (program->streams); g; g = g_list_previous (g)) {
       GssStream *stream = g->data;
-      if (stream->type == GSS_STREAM_TYPE_M2TS_H264BASE_AAC ||
-          stream->type == GSS_STREAM_TYPE_M2TS_H264MAIN_AAC) {
+      if (stream->is_hls) {
         GSS_P ("<source src=\"/%s.m3u8\" >\n", GSS_OBJECT_NAME (program));
         break;
       }
@@ -660,12 +809,30 @@ gss_program_get_resource (GssTransaction * t)
   gss_program_add_stream_table (program, s);
 
   if (t->session && t->session->is_admin) {
+    GSS_P ("<p>Segment memory: %" G_GINT64_FORMAT " kB</p>\n",
+        gss_program_get_segment_memory (program) / 1024);
     gss_config_append_config_block (G_OBJECT (program), t, FALSE);
   }
 
   gss_html_footer (t);
 }
 
+/* bytes of HLS segments of all streams held in memory */
+gint64
+gss_program_get_segment_memory (GssProgram * program)
+{
+  gint64 size = 0;
+  GList *g;
+
+  for (g = program->streams; g; g = g_list_next (g)) {
+    GssStream *stream = g->data;
+
+    size += stream->metrics->segment_memory;
+  }
+
+  return size;
+}
+
 void
 gss_program_add_stream_table (GssProgram * program, GString * s)
 {
@@ -679,6 +846,11 @@ gss_program_add_stream_table (GssProgram * program, GString * s)
   GSS_A ("<th>Type</th>\n");
   GSS_A ("<th>Size</th>\n");
   GSS_A ("<th>Bitrate</th>\n");
+  GSS_A ("<th>Sent</th>\n");
+  GSS_A ("<th>Delivery</th>\n");
+  GSS_A ("<th>First Frame</th>\n");
+  GSS_A ("<th>Stalls</th>\n");
+  GSS_A ("<th>Switched Down</th>\n");
   GSS_A ("<th></th>\n");
   GSS_A ("<th></th>\n");
   GSS_A ("</tr>\n");
@@ -686,28 +858,41 @@ gss_program_add_stream_table (GssProgram * program, GString * s)
   GSS_A ("<tbody>\n");
   for (g = program->streams; g; g = g_list_next (g)) {
     GssStream *stream = g->data;
+    GssDeliveryProfile *profile = gss_stream_get_delivery_profile (stream);
+    gint64 start_time;
+    double stall_rate;
+
+    gss_stream_get_delivery_stats (stream, &start_time, &stall_rate);
 
     GSS_A ("<tr>\n");
     GSS_P ("<td>%s</td>\n", gss_stream_type_get_name (stream->type));
     GSS_P ("<td>%dx%d</td>\n", stream->width, stream->height);
     GSS_P ("<td>%d kbps</td>\n", stream->bitrate / 1000);
+    GSS_P ("<td>%d kbps</td>\n", (int) (stream->metrics->egress_rate / 1000));
+    GSS_P ("<td>%s</td>\n", profile ? GSS_OBJECT_SAFE_TITLE (profile) : "");
+    if (start_time >= 0) {
+      GSS_P ("<td>%.0f ms</td>\n", start_time / 1000.0);
+    } else {
+      GSS_A ("<td></td>\n");
+    }
+    GSS_P ("<td>%.1f%%</td>\n", 100.0 * stall_rate);
+    GSS_P ("<td>%" G_GUINT64_FORMAT "</td>\n", stream->metrics->n_switches);
     GSS_P ("<td><a href=\"%s\">stream</a></td>\n", stream->location);
     GSS_P ("<td><a href=\"%s\">playlist</a></td>\n", stream->playlist_location);
     GSS_A ("</tr>\n");
 
-    if (stream->type == GSS_STREAM_TYPE_M2TS_H264BASE_AAC ||
-        stream->type == GSS_STREAM_TYPE_M2TS_H264MAIN_AAC) {
+    if (stream->is_hls) {
       have_hls = TRUE;
     }
   }
   if (have_hls) {
     GSS_A ("<tr>\n");
-    GSS_P ("<td colspan='5'><a href='/%s.m3u8'>HLS</a></td>\n",
+    GSS_P ("<td colspan='10'><a href='/%s.m3u8'>HLS</a></td>\n",
         GSS_OBJECT_NAME (program));
     GSS_A ("</tr>\n");
   }
   GSS_A ("<tr>\n");
-  GSS_P ("<td colspan='5'><a class='btn btn-mini' href='/'>"
+  GSS_P ("<td colspan='10'><a class='btn btn-mini' href='/'>"
       "<i class='icon-plus'></i>Add</a></td>\n");
   GSS_A ("</tr>\n");
   GSS_A ("</tbody>\n");
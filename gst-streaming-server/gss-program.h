@@ -64,6 +64,8 @@ struct _GssProgram {
   gboolean enabled;
   char *uuid;
   char *description;
+  char *delivery_profile; /* name of the server's GssDeliveryProfile */
+  int max_rate; /* kbytes/sec for all its clients, 0 for unlimited */
 
   gboolean is_archive;
 
@@ -88,10 +90,17 @@ struct _GssProgram {
   int n_hls_chunks;
   struct {
     SoupBuffer *variant_buffer; /* contents of current variant file */
+    int window; /* length of media playlists (in seconds) */
+    gboolean dvr; /* keep the whole window, spilling to archive_dir */
+    int part_target; /* LL-HLS part duration (in ms), 0 to disable */
+    int segment_max_age; /* Cache-Control for segments, 0 is no-store */
+    gboolean cache_playlists;
+    guint32 epoch; /* random, so variant ETags differ after a restart */
+    int variant_version;
+    gint64 start_time; /* wall clock (us) at time 0 of the DASH timeline */
 
-    int target_duration; /* max length of a chunk (in seconds) */
     gboolean is_encrypted;
-    const char *key_uri;
+    int key_rotation; /* segments per key, 0 to never rotate */
     gboolean have_iv;
     guint32 init_vector[4];
   } hls;
@@ -127,6 +136,7 @@ void gss_program_follow_get_list (GssProgram *program);
 GssStream * gss_program_add_ogv_stream (GssProgram *program);
 GssStream * gss_program_add_webm_stream (GssProgram *program);
 GssStream * gss_program_add_hls_stream (GssProgram *program);
+void gss_program_add_dash (GssProgram *program);
 void gss_program_add_stream (GssProgram *program, GssStream *stream);
 void gss_program_remove_stream (GssProgram *program, GssStream *stream);
 GssStream * gss_program_add_stream_full (GssProgram *program,
@@ -144,6 +154,7 @@ void gss_program_add_jpeg_block (GssProgram * program,
 void gss_program_add_video_block (GssProgram *program, GssTransaction * t,
     int max_width);
 void gss_program_add_stream_table (GssProgram *program, GString *s);
+gint64 gss_program_get_segment_memory (GssProgram *program);
 
 const char * gss_program_state_get_name (GssProgramState state);
 
@@ -217,6 +217,10 @@ gss_stream_create_follow_pipeline (GssStream * stream, const char *follow_url)
     case GSS_STREAM_TYPE_FLV_H264BASE_AAC:
       g_string_append (pipe_desc, "flvparse name=parse ! ");
       break;
+    case GSS_STREAM_TYPE_FMP4_H264_AAC:
+      /* fragments are passed through as they are */
+      g_string_append (pipe_desc, "identity name=parse ! ");
+      break;
     default:
       g_assert_not_reached ();
       break;
@@ -253,6 +253,10 @@ gss_stream_create_push_pipeline (GssStream * stream, int push_fd)
     case GSS_STREAM_TYPE_FLV_H264BASE_AAC:
       g_string_append (pipe_desc, "flvparse name=parse ! ");
       break;
+    case GSS_STREAM_TYPE_FMP4_H264_AAC:
+      /* fragments are passed through as they are */
+      g_string_append (pipe_desc, "identity name=parse ! ");
+      break;
     default:
       g_assert_not_reached ();
       break;
@@ -441,6 +445,8 @@ gss_push_put_resource (GssTransaction * t)
       push->push_media_type = GSS_STREAM_TYPE_M2TS_H264MAIN_AAC;
     } else if (strcmp (content_type, "video/x-flv") == 0) {
       push->push_media_type = GSS_STREAM_TYPE_FLV_H264BASE_AAC;
+    } else if (strcmp (content_type, "video/mp4") == 0) {
+      push->push_media_type = GSS_STREAM_TYPE_FMP4_H264_AAC;
     } else {
       push->push_media_type = GSS_STREAM_TYPE_OGG_THEORA_VORBIS;
     }
@@ -485,16 +491,20 @@ gss_push_put_resource (GssTransaction * t)
     if (t->msg->request_body) {
       GstBuffer *buffer;
       GstFlowReturn flow_ret;
-#if GST_CHECK_VERSION(1,0,0)
+      gsize size = t->msg->request_body->length;
       void *data;
 
-      data = g_malloc (t->msg->request_body->length);
-      memcpy (data, t->msg->request_body->data, t->msg->request_body->length);
-      buffer = gst_buffer_new_wrapped (data, t->msg->request_body->length);
+      data = gss_buffer_pool_alloc (t->server->buffer_pool, size);
+      memcpy (data, t->msg->request_body->data, size);
+#if GST_CHECK_VERSION(1,0,0)
+      buffer = gst_buffer_new_wrapped_full (0, data, size, 0, size, data,
+          gss_buffer_pool_release);
 #else
-      buffer = gst_buffer_new_and_alloc (t->msg->request_body->length);
-      memcpy (GST_BUFFER_DATA (buffer), t->msg->request_body->data,
-          t->msg->request_body->length);
+      buffer = gst_buffer_new ();
+      GST_BUFFER_DATA (buffer) = data;
+      GST_BUFFER_SIZE (buffer) = size;
+      GST_BUFFER_MALLOCDATA (buffer) = data;
+      GST_BUFFER_FREE_FUNC (buffer) = gss_buffer_pool_release;
 #endif
 
       g_signal_emit_by_name (stream->src, "push-buffer", buffer, &flow_ret);
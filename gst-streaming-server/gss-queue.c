@@ -0,0 +1,162 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include "gss-server.h"
+
+#include <string.h>
+
+
+typedef struct _GssQueueSource GssQueueSource;
+struct _GssQueueSource
+{
+  GSource source;
+  GssQueue *queue;
+};
+
+static gboolean
+gss_queue_is_empty (GssQueue * queue)
+{
+  return g_atomic_int_get (&queue->head) == g_atomic_int_get (&queue->tail);
+}
+
+static gboolean
+gss_queue_source_prepare (GSource * source, gint * timeout)
+{
+  *timeout = -1;
+  return !gss_queue_is_empty (((GssQueueSource *) source)->queue);
+}
+
+static gboolean
+gss_queue_source_check (GSource * source)
+{
+  return !gss_queue_is_empty (((GssQueueSource *) source)->queue);
+}
+
+static gboolean
+gss_queue_source_dispatch (GSource * source, GSourceFunc callback,
+    gpointer user_data)
+{
+  if (callback == NULL)
+    return FALSE;
+  return callback (user_data);
+}
+
+static GSourceFuncs gss_queue_source_funcs = {
+  gss_queue_source_prepare,
+  gss_queue_source_check,
+  gss_queue_source_dispatch,
+  NULL
+};
+
+/* n_items is rounded up to a power of two */
+GssQueue *
+gss_queue_new (guint n_items, gsize item_size)
+{
+  GssQueue *queue;
+  guint n = 1;
+
+  while (n < n_items) {
+    n <<= 1;
+  }
+
+  queue = g_new0 (GssQueue, 1);
+  queue->items = g_malloc (n * item_size);
+  queue->item_size = item_size;
+  queue->mask = n - 1;
+
+  return queue;
+}
+
+/* Items still in the queue are not freed. */
+void
+gss_queue_free (GssQueue * queue)
+{
+  if (queue->source) {
+    g_source_destroy (queue->source);
+    g_source_unref (queue->source);
+  }
+  g_free (queue->items);
+  g_free (queue);
+}
+
+/* Producer side.  Returns FALSE if the queue is full. */
+gboolean
+gss_queue_push (GssQueue * queue, gconstpointer item)
+{
+  guint tail = (guint) queue->tail;
+  guint head = (guint) g_atomic_int_get (&queue->head);
+
+  if (tail - head > queue->mask)
+    return FALSE;
+
+  memcpy (queue->items + (tail & queue->mask) * queue->item_size, item,
+      queue->item_size);
+  /* publishes the item, g_atomic_int_set() is a full barrier */
+  g_atomic_int_set (&queue->tail, (gint) (tail + 1));
+
+  if (queue->source) {
+    g_main_context_wakeup (queue->context);
+  }
+
+  return TRUE;
+}
+
+/* Consumer side.  Returns FALSE if the queue is empty. */
+gboolean
+gss_queue_pop (GssQueue * queue, gpointer item)
+{
+  guint head = (guint) queue->head;
+  guint tail = (guint) g_atomic_int_get (&queue->tail);
+
+  if (head == tail)
+    return FALSE;
+
+  memcpy (item, queue->items + (head & queue->mask) * queue->item_size,
+      queue->item_size);
+  g_atomic_int_set (&queue->head, (gint) (head + 1));
+
+  return TRUE;
+}
+
+/* Makes the consumer a main loop.  func is called from context, at
+ * the given priority, whenever the queue has items, and should pop all
+ * of them.  Pushing wakes up the main loop, so no polling is
+ * involved. */
+guint
+gss_queue_attach (GssQueue * queue, GMainContext * context, int priority,
+    GSourceFunc func, gpointer data)
+{
+  GSource *source;
+
+  g_return_val_if_fail (queue->source == NULL, 0);
+
+  source = g_source_new (&gss_queue_source_funcs, sizeof (GssQueueSource));
+  ((GssQueueSource *) source)->queue = queue;
+  g_source_set_priority (source, priority);
+  g_source_set_callback (source, func, data, NULL);
+
+  queue->context = context ? context : g_main_context_default ();
+  queue->source = source;
+
+  return g_source_attach (source, context);
+}
@@ -0,0 +1,58 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+
+#ifndef _GSS_QUEUE_H
+#define _GSS_QUEUE_H
+
+#include "gss-config.h"
+#include "gss-types.h"
+
+G_BEGIN_DECLS
+
+/* Bounded lock-free queue with a single producer thread and a single
+ * consumer thread.  Items are fixed size and copied in and out, so
+ * neither side allocates.  The consumer can be woken up by a GSource
+ * that is dispatched whenever the queue is not empty. */
+struct _GssQueue {
+  guint8 *items;
+  gsize item_size;
+  guint mask;
+
+  volatile gint head; /* written by the consumer */
+  guint8 pad[64];
+  volatile gint tail; /* written by the producer */
+
+  GSource *source;
+  GMainContext *context;
+};
+
+GssQueue * gss_queue_new (guint n_items, gsize item_size);
+void gss_queue_free (GssQueue *queue);
+gboolean gss_queue_push (GssQueue *queue, gconstpointer item);
+gboolean gss_queue_pop (GssQueue *queue, gpointer item);
+guint gss_queue_attach (GssQueue *queue, GMainContext *context,
+    int priority, GSourceFunc func, gpointer data);
+
+G_END_DECLS
+
+#endif
+
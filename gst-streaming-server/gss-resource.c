@@ -71,6 +71,8 @@ void
 gss_resource_file (GssTransaction * t)
 {
   GssStaticResource *sr = (GssStaticResource *) t->resource;
+  GList list = { NULL, NULL, NULL };
+  SoupBuffer *buffer;
 
   soup_message_headers_replace (t->msg->response_headers, "Keep-Alive",
       "timeout=5, max=100");
@@ -79,10 +81,11 @@ gss_resource_file (GssTransaction * t)
   soup_message_headers_append (t->msg->response_headers, "Cache-Control",
       "max-age=86400");
 
-  soup_message_set_status (t->msg, SOUP_STATUS_OK);
-
-  soup_message_set_response (t->msg, sr->resource.content_type,
-      SOUP_MEMORY_STATIC, sr->contents, sr->size);
+  /* the content type is set already */
+  buffer = soup_buffer_new (SOUP_MEMORY_STATIC, sr->contents, sr->size);
+  list.data = buffer;
+  gss_transaction_send_buffers (t, &list);
+  soup_buffer_free (buffer);
 }
 
 static void
@@ -37,6 +37,9 @@ typedef enum {
   GSS_RESOURCE_ONETIME = (1<<4),
   GSS_RESOURCE_USER = (1<<5),
   GSS_RESOURCE_KIOSK = (1<<6),
+  /* location ends with '-' and is a prefix; the resource handles all
+   * paths that continue without another '-' and match nothing else */
+  GSS_RESOURCE_PREFIX = (1<<7),
 } GssResourceFlags;
 
 struct _GssResource {
@@ -92,7 +92,7 @@ gss_rtsp_stream_start (GssRtspStream * rtsp_stream)
       rtsp_stream->factory);
   g_object_unref (rtsp_stream->mapping);
 
-  g_signal_emit_by_name (rtsp_stream->stream->sink, "add", pipe_fds[1]);
+  gss_stream_add_fd (rtsp_stream->stream, pipe_fds[1], NULL, NULL);
 
   gst_rtsp_server_attach (rtsp_stream->server, NULL);
 }
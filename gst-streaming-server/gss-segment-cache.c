@@ -0,0 +1,141 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+
+#include "config.h"
+
+#include "gss-server.h"
+
+
+GssSegmentCache *
+gss_segment_cache_new (void)
+{
+  GssSegmentCache *cache;
+
+  cache = g_new0 (GssSegmentCache, 1);
+  g_queue_init (&cache->lru);
+
+  return cache;
+}
+
+void
+gss_segment_cache_free (GssSegmentCache * cache)
+{
+  if (cache->used > 0) {
+    GST_WARNING ("%" G_GUINT64_FORMAT " bytes of segments still accounted",
+        cache->used);
+  }
+  g_free (cache);
+}
+
+void
+gss_segment_cache_set_budget (GssSegmentCache * cache, guint64 budget)
+{
+  cache->budget = budget;
+  cache->over_budget = FALSE;
+  gss_segment_cache_trim (cache);
+}
+
+/* Accounts a segment that was just published with its buffers */
+void
+gss_segment_cache_add (GssSegmentCache * cache, GssHLSSegment * segment)
+{
+  if (segment->cached)
+    return;
+
+  segment->cached = TRUE;
+  segment->cold = FALSE;
+  segment->lru_link.data = segment;
+
+  cache->used += segment->size;
+  cache->max_used = MAX (cache->max_used, cache->used);
+  segment->stream->metrics->segment_memory += segment->size;
+  segment->stream->metrics->max_segment_memory =
+      MAX (segment->stream->metrics->max_segment_memory,
+      segment->stream->metrics->segment_memory);
+}
+
+/* Called before the buffers of a segment are freed */
+void
+gss_segment_cache_remove (GssSegmentCache * cache, GssHLSSegment * segment)
+{
+  if (!segment->cached)
+    return;
+
+  if (segment->cold) {
+    g_queue_unlink (&cache->lru, &segment->lru_link);
+    segment->cold = FALSE;
+  }
+  segment->cached = FALSE;
+
+  cache->used -= segment->size;
+  segment->stream->metrics->segment_memory -= segment->size;
+  if (cache->used <= cache->budget) {
+    cache->over_budget = FALSE;
+  }
+}
+
+/* The segment has left the live window, so it may be evicted */
+void
+gss_segment_cache_retire (GssSegmentCache * cache, GssHLSSegment * segment)
+{
+  if (!segment->cached || segment->cold)
+    return;
+
+  segment->cold = TRUE;
+  g_queue_push_tail_link (&cache->lru, &segment->lru_link);
+}
+
+/* The segment was requested */
+void
+gss_segment_cache_touch (GssSegmentCache * cache, GssHLSSegment * segment)
+{
+  if (!segment->cold)
+    return;
+
+  g_queue_unlink (&cache->lru, &segment->lru_link);
+  g_queue_push_tail_link (&cache->lru, &segment->lru_link);
+}
+
+void
+gss_segment_cache_trim (GssSegmentCache * cache)
+{
+  while (cache->budget > 0 && cache->used > cache->budget) {
+    GssHLSSegment *segment;
+
+    segment = g_queue_peek_head (&cache->lru);
+    if (segment == NULL) {
+      if (!cache->over_budget) {
+        GST_WARNING ("segments use %" G_GUINT64_FORMAT " bytes, over the "
+            "budget of %" G_GUINT64_FORMAT ", and all of them are live",
+            cache->used, cache->budget);
+        cache->over_budget = TRUE;
+      }
+      return;
+    }
+
+    GST_DEBUG ("stream %s: evicting segment %d (%" G_GSIZE_FORMAT
+        " bytes)", GSS_OBJECT_NAME (segment->stream), segment->index,
+        segment->size);
+    gss_hls_segment_evict (segment->stream, segment);
+    cache->n_evicted++;
+  }
+}
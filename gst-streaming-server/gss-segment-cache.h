@@ -0,0 +1,59 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef _GSS_SEGMENT_CACHE_H
+#define _GSS_SEGMENT_CACHE_H
+
+#include "gss-config.h"
+#include "gss-types.h"
+
+G_BEGIN_DECLS
+
+/* Server-wide accounting of the memory held by HLS segments.  Segments
+ * that have left the live window of their playlist are kept for clients
+ * that are late, until the total goes over the budget.  Then the least
+ * recently requested of them, from any program, are dropped, or spilled
+ * to the stream's segment store if it has one.  Segments in the live
+ * window are never evicted. */
+struct _GssSegmentCache {
+  guint64 budget; /* in bytes, 0 for no limit */
+  guint64 used;
+  guint64 max_used;
+  guint64 n_evicted;
+  GQueue lru; /* cold GssHLSSegments, least recently requested first */
+  gboolean over_budget; /* with nothing left to evict */
+};
+
+GssSegmentCache * gss_segment_cache_new (void);
+void gss_segment_cache_free (GssSegmentCache *cache);
+void gss_segment_cache_set_budget (GssSegmentCache *cache, guint64 budget);
+void gss_segment_cache_add (GssSegmentCache *cache, GssHLSSegment *segment);
+void gss_segment_cache_remove (GssSegmentCache *cache,
+    GssHLSSegment *segment);
+void gss_segment_cache_retire (GssSegmentCache *cache,
+    GssHLSSegment *segment);
+void gss_segment_cache_touch (GssSegmentCache *cache, GssHLSSegment *segment);
+void gss_segment_cache_trim (GssSegmentCache *cache);
+
+G_END_DECLS
+
+#endif
+
@@ -0,0 +1,219 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include "gss-server.h"
+
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+typedef struct _GssSegmentStorePin GssSegmentStorePin;
+struct _GssSegmentStorePin
+{
+  GssSegmentStore *store;
+  guint64 offset;
+  gsize size;
+};
+
+GssSegmentStore *
+gss_segment_store_new (const char *dir, const char *name, gsize size)
+{
+  GssSegmentStore *store;
+  void *data;
+  int fd;
+  int ret;
+
+  g_return_val_if_fail (size > 0, NULL);
+
+  if (g_mkdir_with_parents (dir, 0755) < 0) {
+    GST_WARNING ("failed to create %s: %s", dir, g_strerror (errno));
+    return NULL;
+  }
+
+  store = g_new0 (GssSegmentStore, 1);
+  store->refcount = 1;
+  store->filename = g_strdup_printf ("%s/%s.hls", dir, name);
+  store->size = size;
+
+  fd = open (store->filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    GST_WARNING ("failed to open %s: %s", store->filename, g_strerror (errno));
+    g_free (store->filename);
+    g_free (store);
+    return NULL;
+  }
+
+  ret = ftruncate (fd, size);
+  if (ret < 0) {
+    GST_WARNING ("failed to resize %s: %s", store->filename,
+        g_strerror (errno));
+    close (fd);
+    unlink (store->filename);
+    g_free (store->filename);
+    g_free (store);
+    return NULL;
+  }
+
+  data = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (data == MAP_FAILED) {
+    GST_WARNING ("failed to map %s: %s", store->filename, g_strerror (errno));
+    close (fd);
+    unlink (store->filename);
+    g_free (store->filename);
+    g_free (store);
+    return NULL;
+  }
+
+  store->fd = fd;
+  store->data = data;
+
+  GST_DEBUG ("segment store %s, %" G_GSIZE_FORMAT " bytes", store->filename,
+      size);
+
+  return store;
+}
+
+GssSegmentStore *
+gss_segment_store_ref (GssSegmentStore * store)
+{
+  store->refcount++;
+  return store;
+}
+
+void
+gss_segment_store_unref (GssSegmentStore * store)
+{
+  store->refcount--;
+  if (store->refcount > 0)
+    return;
+
+  munmap (store->data, store->size);
+  close (store->fd);
+  unlink (store->filename);
+  g_free (store->filename);
+  g_free (store);
+}
+
+/* TRUE if writing [offset, offset + size) would overwrite a segment
+ * that is being sent */
+static gboolean
+gss_segment_store_is_pinned (GssSegmentStore * store, guint64 offset,
+    gsize size)
+{
+  GList *g;
+
+  for (g = store->pins; g; g = g_list_next (g)) {
+    GssSegmentStorePin *pin = g->data;
+
+    if (pin->offset + store->size < offset + size &&
+        pin->offset + pin->size + store->size > offset)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* Copies a segment (a list of SoupBuffers) into the ring.  A segment is
+ * never split across the end of the file; if it doesn't fit, the tail
+ * is skipped and the segment starts at the beginning.  Returns FALSE,
+ * with offset set to GSS_SEGMENT_STORE_NONE, if the segment is larger
+ * than the store or its place is pinned. */
+gboolean
+gss_segment_store_write (GssSegmentStore * store, GList * buffers,
+    gsize size, guint64 * offset)
+{
+  guint64 write_offset = store->write_offset;
+  guint8 *dest;
+  gsize pos;
+  GList *g;
+
+  *offset = GSS_SEGMENT_STORE_NONE;
+  if (size > store->size)
+    return FALSE;
+
+  pos = write_offset % store->size;
+  if (pos + size > store->size) {
+    write_offset += store->size - pos;
+    pos = 0;
+  }
+  if (gss_segment_store_is_pinned (store, write_offset, size))
+    return FALSE;
+  store->write_offset = write_offset;
+
+  dest = store->data + pos;
+  for (g = buffers; g; g = g_list_next (g)) {
+    SoupBuffer *buffer = (SoupBuffer *) g->data;
+
+    memcpy (dest, buffer->data, buffer->length);
+    dest += buffer->length;
+  }
+
+  *offset = store->write_offset;
+  store->write_offset += size;
+
+  return TRUE;
+}
+
+gboolean
+gss_segment_store_is_valid (GssSegmentStore * store, guint64 offset,
+    gsize size)
+{
+  return offset != GSS_SEGMENT_STORE_NONE &&
+      offset + size <= store->write_offset &&
+      offset + store->size >= store->write_offset;
+}
+
+static void
+gss_segment_store_unpin (gpointer priv)
+{
+  GssSegmentStorePin *pin = (GssSegmentStorePin *) priv;
+  GssSegmentStore *store = pin->store;
+
+  store->pins = g_list_remove (store->pins, pin);
+  g_free (pin);
+  gss_segment_store_unref (store);
+}
+
+/* Returns a SoupBuffer pointing into the mapping.  Until it is freed,
+ * it keeps the store alive and the segment pinned. */
+SoupBuffer *
+gss_segment_store_get_buffer (GssSegmentStore * store, guint64 offset,
+    gsize size)
+{
+  GssSegmentStorePin *pin;
+
+  if (!gss_segment_store_is_valid (store, offset, size))
+    return NULL;
+
+  pin = g_new0 (GssSegmentStorePin, 1);
+  pin->store = gss_segment_store_ref (store);
+  pin->offset = offset;
+  pin->size = size;
+  store->pins = g_list_prepend (store->pins, pin);
+
+  return soup_buffer_new_with_owner (store->data + offset % store->size, size,
+      pin, gss_segment_store_unpin);
+}
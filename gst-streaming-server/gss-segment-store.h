@@ -0,0 +1,67 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+
+#ifndef _GSS_SEGMENT_STORE_H
+#define _GSS_SEGMENT_STORE_H
+
+#include <libsoup/soup.h>
+#include "gss-config.h"
+#include "gss-types.h"
+
+G_BEGIN_DECLS
+
+/* A fixed size file under the archive directory, mapped into memory and
+ * written as a ring.  Offsets handed out by the store are absolute
+ * (they keep increasing when the ring wraps), so a reader can tell
+ * whether the data it is looking for has been overwritten since.
+ * Segments being sent to clients are pinned, and a write that would
+ * overwrite a pinned segment fails instead. */
+struct _GssSegmentStore {
+  int refcount;
+
+  char *filename;
+  int fd;
+  guint8 *data;
+  gsize size;
+
+  guint64 write_offset;
+  GList *pins; /* GssSegmentStorePin, of buffers handed out */
+};
+
+/* no offset in the store, never valid */
+#define GSS_SEGMENT_STORE_NONE G_MAXUINT64
+
+GssSegmentStore * gss_segment_store_new (const char *dir, const char *name,
+    gsize size);
+GssSegmentStore * gss_segment_store_ref (GssSegmentStore *store);
+void gss_segment_store_unref (GssSegmentStore *store);
+gboolean gss_segment_store_write (GssSegmentStore *store, GList *buffers,
+    gsize size, guint64 *offset);
+gboolean gss_segment_store_is_valid (GssSegmentStore *store, guint64 offset,
+    gsize size);
+SoupBuffer * gss_segment_store_get_buffer (GssSegmentStore *store,
+    guint64 offset, gsize size);
+
+G_END_DECLS
+
+#endif
+
@@ -46,6 +46,14 @@ enum
   PROP_SERVER_HOSTNAME,
   PROP_MAX_CONNECTIONS,
   PROP_MAX_RATE,
+  PROP_SEGMENT_MEMORY,
+  PROP_ENABLE_HUGE_PAGES,
+  PROP_ENABLE_FANOUT,
+  PROP_ENABLE_IO_URING,
+  PROP_SLOW_CLIENT_TIME,
+  PROP_ENABLE_SWITCHING,
+  PROP_CLIENT_PACING,
+  PROP_EGRESS_RATE,
   PROP_ADMIN_HOSTS_ALLOW,
   PROP_KIOSK_HOSTS_ALLOW,
   PROP_REALM,
@@ -66,6 +74,17 @@ enum
 #define DEFAULT_SERVER_HOSTNAME ""
 #define DEFAULT_MAX_CONNECTIONS 10000
 #define DEFAULT_MAX_RATE 100000
+#define DEFAULT_SEGMENT_MEMORY 0
+#define DEFAULT_ENABLE_HUGE_PAGES FALSE
+#define DEFAULT_ENABLE_FANOUT FALSE
+#define DEFAULT_ENABLE_IO_URING TRUE
+#define DEFAULT_SLOW_CLIENT_TIME 5
+#define DEFAULT_ENABLE_SWITCHING TRUE
+#define DEFAULT_CLIENT_PACING 0
+#define DEFAULT_EGRESS_RATE 0
+
+/* free blocks the buffer pool holds on to */
+#define BUFFER_POOL_MAX_FREE (256 * 1024 * 1024)
 #define DEFAULT_ADMIN_HOSTS_ALLOW "0.0.0.0/0"
 #define DEFAULT_KIOSK_HOSTS_ALLOW ""
 /* This is the result of soup_auth_domain_digest_encode_password ("admin",
@@ -100,6 +119,7 @@ static void gss_server_set_property (GObject * object, guint prop_id,
 static void gss_server_get_property (GObject * object, guint prop_id,
     GValue * value, GParamSpec * pspec);
 static void gss_server_setup_resources (GssServer * server);
+static void gss_server_add_delivery_profiles (GssServer * server);
 
 
 static gboolean periodic_timer (gpointer data);
@@ -206,6 +226,23 @@ gss_server_init (GssServer * server)
   int port, https_port;
 
   server->metrics = gss_metrics_new ();
+  server->segment_cache = gss_segment_cache_new ();
+  server->segment_memory = DEFAULT_SEGMENT_MEMORY;
+  server->buffer_pool = gss_buffer_pool_new (BUFFER_POOL_MAX_FREE);
+  server->connections = g_hash_table_new (NULL, NULL);
+#if GLIB_CHECK_VERSION(2,32,0)
+  g_mutex_init (&server->connections_lock);
+#else
+  server->connections_lock = g_mutex_new ();
+#endif
+  server->enable_huge_pages = DEFAULT_ENABLE_HUGE_PAGES;
+  server->enable_fanout = DEFAULT_ENABLE_FANOUT;
+  server->enable_io_uring = DEFAULT_ENABLE_IO_URING;
+  server->slow_client_time = DEFAULT_SLOW_CLIENT_TIME;
+  server->enable_switching = DEFAULT_ENABLE_SWITCHING;
+  server->client_pacing = DEFAULT_CLIENT_PACING;
+  server->egress_rate = DEFAULT_EGRESS_RATE;
+  gss_server_add_delivery_profiles (server);
 
   server->resources = g_hash_table_new_full (g_str_hash, g_str_equal,
       g_free, (GDestroyNotify) gss_resource_free);
@@ -275,6 +312,13 @@ gss_server_finalize (GObject * object)
   GssServer *server = GSS_SERVER (object);
 
   g_list_free_full (server->programs, g_object_unref);
+  g_list_free_full (server->delivery_profiles, g_object_unref);
+  gss_server_free_connections (server);
+#if GLIB_CHECK_VERSION(2,32,0)
+  g_mutex_clear (&server->connections_lock);
+#else
+  g_mutex_free (server->connections_lock);
+#endif
 
   if (server->server)
     g_object_unref (server->server);
@@ -286,6 +330,8 @@ gss_server_finalize (GObject * object)
 
   g_hash_table_unref (server->resources);
   gss_metrics_free (server->metrics);
+  gss_segment_cache_free (server->segment_cache);
+  gss_buffer_pool_free (server->buffer_pool);
   g_free (server->base_url);
   g_free (server->base_url_https);
   g_free (server->server_hostname);
@@ -344,6 +390,59 @@ gss_server_class_init (GssServerClass * server_class)
           "Maximum bitrate (in kbytes/sec, 0 is unlimited)",
           "Maximum bitrate (in kbytes/sec)", 0, G_MAXINT, DEFAULT_MAX_RATE,
           (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_SEGMENT_MEMORY, g_param_spec_int ("segment-memory",
+          "Segment memory (in Mbytes, 0 is unlimited)",
+          "Memory for HLS segments of all programs (in Mbytes).  Segments "
+          "out of the live window are evicted when it is used up.",
+          0, G_MAXINT, DEFAULT_SEGMENT_MEMORY,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_ENABLE_HUGE_PAGES, g_param_spec_boolean ("enable-huge-pages",
+          "Enable Huge Pages", "Map large media buffers from huge pages",
+          DEFAULT_ENABLE_HUGE_PAGES,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_ENABLE_FANOUT, g_param_spec_boolean ("enable-fanout",
+          "Enable Fan-out", "Serve streams from an epoll based egress "
+          "thread instead of multifdsink.  Applies to streams started "
+          "afterwards.", DEFAULT_ENABLE_FANOUT,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_ENABLE_IO_URING, g_param_spec_boolean ("enable-io-uring",
+          "Enable io_uring", "Have the fan-out egress threads send with "
+          "io_uring, where the kernel allows it, instead of epoll and "
+          "sendmsg().  Applies to streams started afterwards.",
+          DEFAULT_ENABLE_IO_URING,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_SLOW_CLIENT_TIME, g_param_spec_int ("slow-client-time",
+          "Slow client time (in seconds, 0 is disabled)",
+          "How long a client may fall behind its stream before it is moved "
+          "to a lower bitrate stream of the program, or disconnected.",
+          0, 3600, DEFAULT_SLOW_CLIENT_TIME,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_ENABLE_SWITCHING, g_param_spec_boolean ("enable-switching",
+          "Enable Stream Switching",
+          "Move slow clients of MPEG-TS streams to a lower bitrate stream "
+          "of the same program, instead of disconnecting them.",
+          DEFAULT_ENABLE_SWITCHING,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_CLIENT_PACING, g_param_spec_int ("client-pacing",
+          "Client pacing (in percent of the bitrate, 0 is unpaced)",
+          "Rate each client is paced to, in percent of its stream's "
+          "bitrate.  Limits the burst new clients get.",
+          0, 10000, DEFAULT_CLIENT_PACING,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (server_class),
+      PROP_EGRESS_RATE, g_param_spec_int ("egress-rate",
+          "Egress rate (in kbytes/sec, 0 is unlimited)",
+          "Rate that all clients are paced to together (in kbytes/sec).  "
+          "Unlike max-rate, this limits what is actually sent.",
+          0, G_MAXINT, DEFAULT_EGRESS_RATE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
   g_object_class_install_property (G_OBJECT_CLASS (server_class),
       PROP_ADMIN_HOSTS_ALLOW, g_param_spec_string ("admin-hosts-allow",
           "Allowed Hosts (admin)", "Allowed Hosts (admin)",
@@ -452,6 +551,34 @@ gss_server_set_property (GObject * object, guint prop_id,
     case PROP_MAX_RATE:
       server->max_rate = g_value_get_int (value);
       break;
+    case PROP_SEGMENT_MEMORY:
+      server->segment_memory = g_value_get_int (value);
+      gss_segment_cache_set_budget (server->segment_cache,
+          (guint64) server->segment_memory * 1024 * 1024);
+      break;
+    case PROP_ENABLE_HUGE_PAGES:
+      server->enable_huge_pages = g_value_get_boolean (value);
+      gss_buffer_pool_set_huge_pages (server->buffer_pool,
+          server->enable_huge_pages);
+      break;
+    case PROP_ENABLE_FANOUT:
+      server->enable_fanout = g_value_get_boolean (value);
+      break;
+    case PROP_ENABLE_IO_URING:
+      server->enable_io_uring = g_value_get_boolean (value);
+      break;
+    case PROP_SLOW_CLIENT_TIME:
+      server->slow_client_time = g_value_get_int (value);
+      break;
+    case PROP_ENABLE_SWITCHING:
+      server->enable_switching = g_value_get_boolean (value);
+      break;
+    case PROP_CLIENT_PACING:
+      server->client_pacing = g_value_get_int (value);
+      break;
+    case PROP_EGRESS_RATE:
+      server->egress_rate = g_value_get_int (value);
+      break;
     case PROP_ADMIN_HOSTS_ALLOW:
       if (strcmp (server->admin_hosts_allow, g_value_get_string (value))) {
         g_free (server->admin_hosts_allow);
@@ -537,6 +664,30 @@ gss_server_get_property (GObject * object, guint prop_id,
     case PROP_MAX_RATE:
       g_value_set_int (value, server->max_rate);
       break;
+    case PROP_SEGMENT_MEMORY:
+      g_value_set_int (value, server->segment_memory);
+      break;
+    case PROP_ENABLE_HUGE_PAGES:
+      g_value_set_boolean (value, server->enable_huge_pages);
+      break;
+    case PROP_ENABLE_FANOUT:
+      g_value_set_boolean (value, server->enable_fanout);
+      break;
+    case PROP_ENABLE_IO_URING:
+      g_value_set_boolean (value, server->enable_io_uring);
+      break;
+    case PROP_SLOW_CLIENT_TIME:
+      g_value_set_int (value, server->slow_client_time);
+      break;
+    case PROP_ENABLE_SWITCHING:
+      g_value_set_boolean (value, server->enable_switching);
+      break;
+    case PROP_CLIENT_PACING:
+      g_value_set_int (value, server->client_pacing);
+      break;
+    case PROP_EGRESS_RATE:
+      g_value_set_int (value, server->egress_rate);
+      break;
     case PROP_ADMIN_HOSTS_ALLOW:
       g_value_set_string (value, server->admin_hosts_allow);
       break;
@@ -855,10 +1006,15 @@ gss_server_add_program (GssServer * server, const char *program_name)
 void
 gss_server_remove_program (GssServer * server, GssProgram * program)
 {
+  GList *g;
+
   g_return_if_fail (GSS_IS_SERVER (server));
   g_return_if_fail (GSS_IS_PROGRAM (program));
 
   gss_server_remove_resources_by_priv (server, program);
+  for (g = program->streams; g; g = g_list_next (g)) {
+    gss_server_remove_stream_connections (server, (GssStream *) g->data);
+  }
   server->programs = g_list_remove (server->programs, program);
   GSS_OBJECT_SERVER (program) = NULL;
 }
@@ -907,15 +1063,88 @@ gss_server_get_program_by_name (GssServer * server, const char *name)
   return NULL;
 }
 
+/* The stream's delivery profile sets the rest in gss_stream_set_sink() */
 const char *
 gss_server_get_multifdsink_string (void)
 {
-  return "multifdsink "
-      "sync=false " "time-min=200000000 " "recover-policy=keyframe "
-      "unit-type=2 "
-      "units-max=20000000000 "
-      "units-soft-max=11000000000 "
-      "sync-method=burst-keyframe " "burst-unit=2 " "burst-value=3000000000";
+  return "multifdsink sync=false unit-type=2 burst-unit=2";
+}
+
+GssDeliveryProfile *
+gss_server_get_delivery_profile (GssServer * server, const char *name)
+{
+  GList *g;
+
+  for (g = server->delivery_profiles; g; g = g_list_next (g)) {
+    GssDeliveryProfile *profile = g->data;
+
+    if (strcmp (GSS_OBJECT_NAME (profile), name) == 0) {
+      return profile;
+    }
+  }
+  return NULL;
+}
+
+/* Applies a changed profile to the streams that use it */
+static void
+delivery_profile_notify (GObject * object, GParamSpec * pspec,
+    gpointer user_data)
+{
+  GssServer *server = user_data;
+  GList *g;
+  GList *h;
+
+  for (g = server->programs; g; g = g_list_next (g)) {
+    GssProgram *program = g->data;
+
+    for (h = program->streams; h; h = g_list_next (h)) {
+      GssStream *stream = h->data;
+
+      if (gss_stream_get_delivery_profile (stream) ==
+          GSS_DELIVERY_PROFILE (object)) {
+        gss_stream_apply_delivery_profile (stream);
+      }
+    }
+  }
+}
+
+static void
+gss_server_add_delivery_profiles (GssServer * server)
+{
+  const char *const *presets = gss_delivery_profile_get_presets ();
+  int i;
+
+  for (i = 0; presets[i]; i++) {
+    GssDeliveryProfile *profile;
+
+    profile = gss_delivery_profile_new (presets[i]);
+    g_signal_connect (profile, "notify", G_CALLBACK (delivery_profile_notify),
+        server);
+    server->delivery_profiles = g_list_append (server->delivery_profiles,
+        profile);
+  }
+}
+
+/* Finds the GSS_RESOURCE_PREFIX resource for path, which is registered
+ * as path up to and including the last '-'. */
+static GssResource *
+gss_server_lookup_prefix (GssServer * server, const char *path)
+{
+  GssResource *resource;
+  const char *dash;
+  char *prefix;
+
+  dash = strrchr (path, '-');
+  if (dash == NULL)
+    return NULL;
+
+  prefix = g_strndup (path, dash + 1 - path);
+  resource = g_hash_table_lookup (server->resources, prefix);
+  g_free (prefix);
+
+  if (resource && !(resource->flags & GSS_RESOURCE_PREFIX))
+    return NULL;
+  return resource;
 }
 
 static void
@@ -929,6 +1158,9 @@ gss_server_resource_callback (SoupServer * soupserver, SoupMessage * msg,
   GssSession *session;
 
   resource = g_hash_table_lookup (server->resources, path);
+  if (!resource) {
+    resource = gss_server_lookup_prefix (server, path);
+  }
 
   if (!resource) {
     gss_html_error_404 (server, msg);
@@ -1144,6 +1376,9 @@ periodic_timer (gpointer data)
 
   }
 
+  gss_server_check_slow_clients (server);
+  gss_server_update_pacing (server);
+
   return TRUE;
 }
 
@@ -34,6 +34,18 @@
 #include "gss-session.h"
 #include "gss-program.h"
 #include "gss-metrics.h"
+#include "gss-mp4scan.h"
+#include "gss-aes.h"
+#include "gss-buffer-pool.h"
+#include "gss-connection.h"
+#include "gss-delivery-profile.h"
+#include "gss-fanout.h"
+#include "gss-playlist.h"
+#include "gss-queue.h"
+#include "gss-segment-cache.h"
+#include "gss-segment-store.h"
+#include "gss-tsscan.h"
+#include "gss-uring.h"
 #include "gss-stream.h"
 #include "gss-resource.h"
 #include "gss-transaction.h"
@@ -65,6 +77,14 @@ struct _GssServer
   char *server_hostname;
   int max_connections;
   int max_rate;
+  int segment_memory;
+  gboolean enable_huge_pages;
+  gboolean enable_fanout;
+  gboolean enable_io_uring;
+  int slow_client_time;
+  gboolean enable_switching;
+  int client_pacing;
+  int egress_rate;
   char *admin_hosts_allow;
   char *kiosk_hosts_allow;
   char *realm;
@@ -81,7 +101,18 @@ struct _GssServer
   char *alt_hostname;
   gboolean enable_programs;
   GList *programs;
+  GList *delivery_profiles; /* one for each preset */
   GssMetrics *metrics;
+  GssSegmentCache *segment_cache;
+  GssBufferPool *buffer_pool;
+
+  /* fd to GssConnection, of all streams */
+  GHashTable *connections;
+#if GLIB_CHECK_VERSION(2,32,0)
+  GMutex connections_lock;
+#else
+  GMutex *connections_lock;
+#endif
   char *admin_token;
 
   SoupServer *server;
@@ -143,6 +174,8 @@ void gss_server_deinit (void);
 
 void gss_server_add_admin_callbacks (GssServer *server, SoupServer *soupserver);
 GssProgram * gss_server_get_program_by_name (GssServer *server, const char *name);
+GssDeliveryProfile * gss_server_get_delivery_profile (GssServer *server,
+    const char *name);
 
 void gss_server_add_static_file (SoupServer *soupserver, const char *filename,
     const char *content_type);
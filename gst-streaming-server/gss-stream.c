@@ -35,13 +35,21 @@ enum
   PROP_TYPE = 1,
   PROP_WIDTH,
   PROP_HEIGHT,
-  PROP_BITRATE
+  PROP_BITRATE,
+  PROP_FANOUT_SHARDS,
+  PROP_FANOUT_ZERO_COPY,
+  PROP_GOP_CACHE,
+  PROP_DELIVERY_PROFILE
 };
 
 #define DEFAULT_TYPE GSS_STREAM_TYPE_WEBM
 #define DEFAULT_WIDTH 640
 #define DEFAULT_HEIGHT 360
 #define DEFAULT_BITRATE 600000
+#define DEFAULT_FANOUT_SHARDS 0
+#define DEFAULT_FANOUT_ZERO_COPY FALSE
+#define DEFAULT_GOP_CACHE (-1)
+#define DEFAULT_DELIVERY_PROFILE ""
 
 
 
@@ -69,6 +77,10 @@ gss_stream_init (GssStream * stream)
   stream->width = DEFAULT_WIDTH;
   stream->height = DEFAULT_HEIGHT;
   stream->bitrate = DEFAULT_BITRATE;
+  stream->fanout_shards = DEFAULT_FANOUT_SHARDS;
+  stream->fanout_zero_copy = DEFAULT_FANOUT_ZERO_COPY;
+  stream->gop_cache = DEFAULT_GOP_CACHE;
+  stream->delivery_profile = g_strdup (DEFAULT_DELIVERY_PROFILE);
 }
 
 GType
@@ -86,6 +98,8 @@ gss_stream_type_get_type (void)
     {GSS_STREAM_TYPE_FLV_H264BASE_AAC, "flv-h264base-aac",
         "Flash/H.264 Baseline/AAC"},
     {GSS_STREAM_TYPE_OGG_THEORA_OPUS, "ogg-theora-opus", "Ogg/Theora/Opus"},
+    {GSS_STREAM_TYPE_FMP4_H264_AAC, "fmp4-h264-aac",
+        "Fragmented MP4 (CMAF)/H.264/AAC"},
     {0, NULL, NULL}
   };
 
@@ -120,6 +134,29 @@ gss_stream_class_init (GssStreamClass * stream_class)
       PROP_BITRATE, g_param_spec_int ("bitrate", "Bit Rate",
           "[bits/sec] Bit Rate", 0, G_MAXINT, DEFAULT_BITRATE,
           (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (stream_class),
+      PROP_FANOUT_SHARDS, g_param_spec_int ("fanout-shards",
+          "Fan-out Shards", "Egress threads serving the stream's clients "
+          "when the server has fan-out enabled, 0 for one per core",
+          0, 256, DEFAULT_FANOUT_SHARDS,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (stream_class),
+      PROP_FANOUT_ZERO_COPY, g_param_spec_boolean ("fanout-zero-copy",
+          "Fan-out Zero Copy", "Serve clients with the fan-out, sending "
+          "from a staging file with sendfile() instead of copying, even if "
+          "the server has fan-out disabled", DEFAULT_FANOUT_ZERO_COPY,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (stream_class),
+      PROP_GOP_CACHE, g_param_spec_int ("gop-cache", "GOP Cache",
+          "GOPs new clients get after the stream headers, counting the one "
+          "in progress, 0 to wait for the next keyframe, -1 for the "
+          "delivery profile's", -1, GSS_FANOUT_MAX_GOPS, DEFAULT_GOP_CACHE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
+  g_object_class_install_property (G_OBJECT_CLASS (stream_class),
+      PROP_DELIVERY_PROFILE, g_param_spec_string ("delivery-profile",
+          "Delivery Profile", "ultra-low-latency, balanced or resilient, "
+          "empty for the program's", DEFAULT_DELIVERY_PROFILE,
+          (GParamFlags) (G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS)));
 
   parent_class = g_type_class_peek_parent (stream_class);
 }
@@ -128,24 +165,12 @@ static void
 gss_stream_finalize (GObject * object)
 {
   GssStream *stream = GSS_STREAM (object);
-  int i;
 
   g_free (stream->playlist_location);
   g_free (stream->location);
   g_free (stream->codecs);
+  g_free (stream->delivery_profile);
 
-  for (i = 0; i < GSS_STREAM_HLS_CHUNKS; i++) {
-    GssHLSSegment *segment = &stream->chunks[i];
-
-    if (segment->buffer) {
-      soup_buffer_free (segment->buffer);
-      g_free (segment->location);
-    }
-  }
-
-  if (stream->hls.index_buffer) {
-    soup_buffer_free (stream->hls.index_buffer);
-  }
 #define CLEANUP(x) do { \
   if (x) { \
     if (GST_OBJECT_REFCOUNT (x) != 1) \
@@ -163,6 +188,8 @@ gss_stream_finalize (GObject * object)
     gst_element_set_state (GST_ELEMENT (stream->pipeline), GST_STATE_NULL);
     CLEANUP (stream->pipeline);
   }
+  /* once the segmenter is no longer running */
+  gss_stream_free_hls (stream);
   gss_metrics_free (stream->metrics);
 
   parent_class->finalize (object);
@@ -189,6 +216,21 @@ gss_stream_set_property (GObject * object, guint prop_id,
     case PROP_BITRATE:
       stream->bitrate = g_value_get_int (value);
       break;
+    case PROP_FANOUT_SHARDS:
+      stream->fanout_shards = g_value_get_int (value);
+      break;
+    case PROP_FANOUT_ZERO_COPY:
+      stream->fanout_zero_copy = g_value_get_boolean (value);
+      break;
+    case PROP_GOP_CACHE:
+      stream->gop_cache = g_value_get_int (value);
+      gss_stream_apply_delivery_profile (stream);
+      break;
+    case PROP_DELIVERY_PROFILE:
+      g_free (stream->delivery_profile);
+      stream->delivery_profile = g_value_dup_string (value);
+      gss_stream_apply_delivery_profile (stream);
+      break;
     default:
       g_assert_not_reached ();
       break;
@@ -216,6 +258,18 @@ gss_stream_get_property (GObject * object, guint prop_id,
     case PROP_BITRATE:
       g_value_set_int (value, stream->bitrate);
       break;
+    case PROP_FANOUT_SHARDS:
+      g_value_set_int (value, stream->fanout_shards);
+      break;
+    case PROP_FANOUT_ZERO_COPY:
+      g_value_set_boolean (value, stream->fanout_zero_copy);
+      break;
+    case PROP_GOP_CACHE:
+      g_value_set_int (value, stream->gop_cache);
+      break;
+    case PROP_DELIVERY_PROFILE:
+      g_value_set_string (value, stream->delivery_profile);
+      break;
     default:
       g_assert_not_reached ();
       break;
@@ -270,6 +324,8 @@ gss_stream_type_from_id (const char *id)
     return GSS_STREAM_TYPE_M2TS_H264MAIN_AAC;
   } else if (strcmp (id, "flv") == 0) {
     return GSS_STREAM_TYPE_FLV_H264BASE_AAC;
+  } else if (strcmp (id, "cmaf") == 0) {
+    return GSS_STREAM_TYPE_FMP4_H264_AAC;
   }
 
   return GSS_STREAM_TYPE_UNKNOWN;
@@ -300,6 +356,8 @@ gss_stream_type_get_ext (int type)
       return "ts";
     case GSS_STREAM_TYPE_FLV_H264BASE_AAC:
       return "flv";
+    case GSS_STREAM_TYPE_FMP4_H264_AAC:
+      return "mp4";
     default:
       g_assert_not_reached ();
       break;
@@ -322,6 +380,8 @@ gss_stream_type_get_mod (int type)
       return "";
     case GSS_STREAM_TYPE_M2TS_H264MAIN_AAC:
       return "-main";
+    case GSS_STREAM_TYPE_FMP4_H264_AAC:
+      return "-cmaf";
     default:
       g_assert_not_reached ();
       break;
@@ -344,6 +404,8 @@ gss_stream_type_get_content_type (int type)
       return "video/mp2t";
     case GSS_STREAM_TYPE_FLV_H264BASE_AAC:
       return "video/x-flv";
+    case GSS_STREAM_TYPE_FMP4_H264_AAC:
+      return "video/mp4";
     default:
       g_assert_not_reached ();
       break;
@@ -355,7 +417,9 @@ gss_stream_type_get_content_type (int type)
 void
 gss_stream_get_stats (GssStream * stream, guint64 * in, guint64 * out)
 {
-  if (stream->sink) {
+  if (stream->fanout) {
+    gss_fanout_get_stats (stream->fanout, in, out, NULL, NULL);
+  } else if (stream->sink) {
     g_object_get (stream->sink, "bytes-to-serve", in, "bytes-served", out,
         NULL);
   } else {
@@ -364,35 +428,92 @@ gss_stream_get_stats (GssStream * stream, guint64 * in, guint64 * out)
   }
 }
 
+static GssServer *
+gss_stream_get_server (GssStream * stream)
+{
+  return stream->program ? GSS_OBJECT_SERVER (stream->program) : NULL;
+}
+
 static void
 client_removed (GstElement * e, int fd, int status, gpointer user_data)
 {
   GssStream *stream = user_data;
-
-  if (gss_stream_fd_table[fd].callback == NULL) {
-    if (stream) {
-      gss_metrics_remove_client (stream->metrics, stream->bitrate);
-      gss_metrics_remove_client (stream->program->metrics, stream->bitrate);
-      gss_metrics_remove_client (GSS_OBJECT_SERVER (stream->program)->metrics,
-          stream->bitrate);
+  GssServer *server = gss_stream_get_server (stream);
+
+  if (server && gss_server_is_http_connection (server, fd)) {
+    gss_metrics_remove_client (stream->metrics, stream->bitrate);
+    gss_metrics_remove_client (stream->program->metrics, stream->bitrate);
+    gss_metrics_remove_client (server->metrics, stream->bitrate);
+    /* multifdsink's status values are the same */
+    if (status == GSS_FANOUT_STATUS_SLOW) {
+      gss_metrics_add_stall (stream->metrics);
+      gss_metrics_add_stall (stream->program->metrics);
+      gss_metrics_add_stall (server->metrics);
     }
   }
 }
 
+static void gss_stream_add_client (GssStream * stream,
+    GssConnection * connection);
+
+/* Moves a connection that the slow-client check took off its stream to
+ * the stream picked for it */
+static gboolean
+switch_connection (gpointer data)
+{
+  GssConnection *connection = data;
+  GssStream *stream = connection->switch_to;
+
+  connection->switch_to = NULL;
+  connection->stream = stream;
+  connection->sample_time = 0;
+  connection->slow_since = 0;
+  /* the new sink may need to be told */
+  connection->pacing_rate = -1;
+  if (stream->sink && stream->program) {
+    gss_stream_add_client (stream, connection);
+  } else {
+    soup_socket_disconnect (connection->socket);
+    gss_connection_free (connection);
+  }
+  g_object_unref (stream);
+
+  return FALSE;
+}
+
 static void
 client_fd_removed (GstElement * e, int fd, gpointer user_data)
 {
   GssStream *stream = user_data;
+  GssServer *server = gss_stream_get_server (stream);
+  GssConnection *connection;
 
-  if (gss_stream_fd_table[fd].callback) {
-    gss_stream_fd_table[fd].callback (stream, fd, gss_stream_fd_table[fd].priv);
-  } else {
-    SoupSocket *sock = gss_stream_fd_table[fd].priv;
-    if (sock)
-      soup_socket_disconnect (sock);
+  if (server == NULL)
+    return;
+
+  connection = gss_server_steal_connection (server, fd);
+  if (connection == NULL)
+    return;
+
+  if (connection->switch_to) {
+    /* the sink may call this from its own thread */
+    g_idle_add (switch_connection, connection);
+    return;
+  }
+  if (connection->callback) {
+    connection->callback (stream, fd, connection->priv);
+  } else if (connection->socket) {
+    soup_socket_disconnect (connection->socket);
   }
-  gss_stream_fd_table[fd].priv = NULL;
-  gss_stream_fd_table[fd].callback = NULL;
+  gss_connection_free (connection);
+}
+
+static void
+fanout_removed (GssFanout * fanout, int fd, GssFanoutStatus status,
+    gpointer user_data)
+{
+  client_removed (NULL, fd, status, user_data);
+  client_fd_removed (NULL, fd, user_data);
 }
 
 static void
@@ -400,6 +521,7 @@ stream_resource (GssTransaction * t)
 {
   GssStream *stream = (GssStream *) t->resource->priv;
   GssConnection *connection;
+  SoupSocket *sock;
 
   if (!stream->program->enable_streaming
       || stream->program->state != GSS_PROGRAM_STATE_RUNNING) {
@@ -407,22 +529,23 @@ stream_resource (GssTransaction * t)
     return;
   }
 
+  /* what is sent can be more than the nominal bitrates, in bursts */
   if (t->server->metrics->n_clients >= t->server->max_connections ||
-      t->server->metrics->bitrate + stream->bitrate >=
-      t->server->max_rate * 8000) {
+      MAX (t->server->metrics->bitrate, t->server->metrics->egress_rate) +
+      stream->bitrate >= t->server->max_rate * 8000) {
     GST_DEBUG ("n_clients %d max_connections %d\n",
         t->server->metrics->n_clients, t->server->max_connections);
-    GST_DEBUG ("current bitrate %" G_GINT64_FORMAT " bitrate %d max_bitrate %d"
-        "\n", t->server->metrics->bitrate, stream->bitrate,
+    GST_DEBUG ("current bitrate %" G_GINT64_FORMAT " egress %" G_GINT64_FORMAT
+        " bitrate %d max_bitrate %d\n", t->server->metrics->bitrate,
+        t->server->metrics->egress_rate, stream->bitrate,
         t->server->max_rate * 8000);
     soup_message_set_status (t->msg, SOUP_STATUS_SERVICE_UNAVAILABLE);
     return;
   }
 
-  connection = g_malloc0 (sizeof (GssConnection));
-  connection->msg = t->msg;
-  connection->client = t->client;
-  connection->stream = stream;
+  sock = soup_client_context_get_socket (t->client);
+  connection = gss_connection_new (stream, soup_socket_get_fd (sock), sock,
+      soup_client_context_get_host (t->client));
 
   soup_message_set_status (t->msg, SOUP_STATUS_OK);
 
@@ -435,42 +558,60 @@ stream_resource (GssTransaction * t)
       connection);
 }
 
+/* Registers the connection and hands its fd to the sink, or to the
+ * fan-out */
+static void
+gss_stream_add_connection (GssStream * stream, GssConnection * connection)
+{
+  gss_server_add_connection (GSS_OBJECT_SERVER (stream->program),
+      connection);
+
+  if (stream->fanout) {
+    gss_fanout_add (stream->fanout, connection->fd);
+  } else {
+    g_signal_emit_by_name (stream->sink, "add", connection->fd);
+  }
+}
+
+/* For fds other than HTTP clients.  The callback is called once the sink
+ * has let go of the fd. */
 void
 gss_stream_add_fd (GssStream * stream, int fd,
     void (*callback) (GssStream * stream, int fd, void *priv), void *priv)
 {
-  g_return_if_fail (fd < GSS_STREAM_MAX_FDS);
+  GssConnection *connection;
 
-  gss_stream_fd_table[fd].callback = callback;
-  gss_stream_fd_table[fd].priv = priv;
+  connection = gss_connection_new (stream, fd, NULL, NULL);
+  connection->callback = callback;
+  connection->priv = priv;
 
-  g_signal_emit_by_name (stream->sink, "add", fd);
+  gss_stream_add_connection (stream, connection);
 }
 
+/* An HTTP client, counted in the metrics until it is removed */
 static void
-msg_wrote_headers (SoupMessage * msg, void *user_data)
+gss_stream_add_client (GssStream * stream, GssConnection * connection)
 {
-  GssConnection *connection = user_data;
-  SoupSocket *sock;
-  int fd;
+  gss_stream_add_connection (stream, connection);
 
-  sock = soup_client_context_get_socket (connection->client);
-  fd = soup_socket_get_fd (sock);
-
-  if (connection->stream->sink) {
-    GssStream *stream = connection->stream;
+  gss_metrics_add_client (stream->metrics, stream->bitrate);
+  gss_metrics_add_client (stream->program->metrics, stream->bitrate);
+  gss_metrics_add_client (GSS_OBJECT_SERVER (stream->program)->metrics,
+      stream->bitrate);
+}
 
-    gss_stream_add_fd (stream, fd, NULL, sock);
+static void
+msg_wrote_headers (SoupMessage * msg, void *user_data)
+{
+  GssConnection *connection = user_data;
+  GssStream *stream = connection->stream;
 
-    gss_metrics_add_client (stream->metrics, stream->bitrate);
-    gss_metrics_add_client (stream->program->metrics, stream->bitrate);
-    gss_metrics_add_client (GSS_OBJECT_SERVER (stream->program)->metrics,
-        stream->bitrate);
+  if (stream->sink) {
+    gss_stream_add_client (stream, connection);
   } else {
-    soup_socket_disconnect (sock);
+    soup_socket_disconnect (connection->socket);
+    gss_connection_free (connection);
   }
-
-  g_free (connection);
 }
 
 GssStream *
@@ -552,9 +693,98 @@ gss_stream_remove_resources (GssStream * stream)
         stream->playlist_resource->location);
 }
 
+/* Takes the buffers away from the sink, after the HLS segmenter has
+ * seen them */
+#if GST_CHECK_VERSION(1,0,0)
+static GstPadProbeReturn
+fanout_probe_callback (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  GssStream *stream = GSS_STREAM (user_data);
+
+  gss_fanout_push (stream->fanout, GST_PAD_PROBE_INFO_BUFFER (info));
+
+  return GST_PAD_PROBE_DROP;
+}
+#else
+static gboolean
+fanout_data_probe_callback (GstPad * pad, GstMiniObject * mo,
+    gpointer user_data)
+{
+  GssStream *stream = (GssStream *) user_data;
+
+  if (GST_IS_BUFFER (mo)) {
+    gss_fanout_push (stream->fanout, GST_BUFFER (mo));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+#endif
+
+static void
+gss_stream_add_fanout (GssStream * stream, GssFanoutFlags flags)
+{
+  GstPad *pad;
+
+  stream->fanout = gss_fanout_new (stream->fanout_shards, flags,
+      fanout_removed, stream);
+  if (stream->fanout == NULL)
+    return;
+
+  /* the sink never gets a buffer to preroll with */
+  g_object_set (stream->sink, "async", FALSE, NULL);
+
+  pad = gst_element_get_static_pad (stream->sink, "sink");
+#if GST_CHECK_VERSION(1,0,0)
+  stream->fanout_probe = gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      fanout_probe_callback, stream, NULL);
+#else
+  stream->fanout_probe = gst_pad_add_data_probe (pad,
+      G_CALLBACK (fanout_data_probe_callback), stream);
+#endif
+  gst_object_unref (pad);
+}
+
+static void
+gss_stream_remove_fanout (GssStream * stream)
+{
+  GstPad *pad;
+
+  pad = gst_element_get_static_pad (stream->sink, "sink");
+#if GST_CHECK_VERSION(1,0,0)
+  gst_pad_remove_probe (pad, stream->fanout_probe);
+#else
+  gst_pad_remove_data_probe (pad, stream->fanout_probe);
+#endif
+  /* waits for a buffer that is being pushed */
+  GST_PAD_STREAM_LOCK (pad);
+  GST_PAD_STREAM_UNLOCK (pad);
+  gst_object_unref (pad);
+
+  gss_fanout_free (stream->fanout);
+  stream->fanout = NULL;
+  stream->fanout_probe = 0;
+}
+
 void
 gss_stream_set_sink (GssStream * stream, GstElement * sink)
 {
+  GssServer *server = gss_stream_get_server (stream);
+
+  if (stream->sink) {
+    /* Its pipeline is about to be stopped, which waits for the
+     * streaming thread, and removing the fan-out below waits for the
+     * buffer being pushed.  So from now on, neither the segmenter nor
+     * the fan-out producer may wait for the main loop or the shards. */
+    g_atomic_int_set (&stream->hls.flushing, TRUE);
+    if (stream->fanout) {
+      gss_fanout_set_flushing (stream->fanout);
+    }
+  }
+  if (stream->fanout) {
+    gss_stream_remove_fanout (stream);
+  }
   if (stream->sink) {
     g_object_unref (stream->sink);
   }
@@ -567,8 +797,99 @@ gss_stream_set_sink (GssStream * stream, GstElement * sink)
     g_signal_connect (stream->sink, "client-fd-removed",
         G_CALLBACK (client_fd_removed), stream);
     if (stream->type == GSS_STREAM_TYPE_M2TS_H264BASE_AAC ||
-        stream->type == GSS_STREAM_TYPE_M2TS_H264MAIN_AAC) {
+        stream->type == GSS_STREAM_TYPE_M2TS_H264MAIN_AAC ||
+        stream->type == GSS_STREAM_TYPE_FMP4_H264_AAC) {
       gss_stream_add_hls (stream);
     }
+    /* after the segmenter's probe, which needs to see the buffers */
+    if (server && (server->enable_fanout || stream->fanout_zero_copy)) {
+      GssFanoutFlags flags = 0;
+
+      if (server->enable_io_uring)
+        flags |= GSS_FANOUT_FLAG_IO_URING;
+      if (stream->fanout_zero_copy)
+        flags |= GSS_FANOUT_FLAG_ZERO_COPY;
+      gss_stream_add_fanout (stream, flags);
+    }
+    gss_stream_apply_delivery_profile (stream);
+  }
+}
+
+/* The stream's profile, else the program's, else the default one.
+ * NULL if the stream is not on a server. */
+GssDeliveryProfile *
+gss_stream_get_delivery_profile (GssStream * stream)
+{
+  GssServer *server = gss_stream_get_server (stream);
+  GssDeliveryProfile *profile = NULL;
+
+  if (server == NULL)
+    return NULL;
+
+  if (stream->delivery_profile && stream->delivery_profile[0]) {
+    profile = gss_server_get_delivery_profile (server,
+        stream->delivery_profile);
+  }
+  if (profile == NULL && stream->program->delivery_profile) {
+    profile = gss_server_get_delivery_profile (server,
+        stream->program->delivery_profile);
+  }
+  if (profile == NULL) {
+    profile = gss_server_get_delivery_profile (server,
+        GSS_DELIVERY_PROFILE_DEFAULT);
+  }
+
+  return profile;
+}
+
+/* Sets up the sink, or the fan-out, for the stream's delivery profile */
+void
+gss_stream_apply_delivery_profile (GssStream * stream)
+{
+  GssDeliveryProfile *profile;
+
+  if (stream->sink == NULL)
+    return;
+  profile = gss_stream_get_delivery_profile (stream);
+  if (profile == NULL)
+    return;
+
+  gss_delivery_profile_apply (profile, stream->sink);
+  /* multifdsink only knows the most recent keyframe, deeper GOP caches
+   * keep the profile's sync method */
+  if (stream->gop_cache == 0) {
+    gst_util_set_object_arg (G_OBJECT (stream->sink), "sync-method",
+        "next-keyframe");
+  } else if (stream->gop_cache == 1) {
+    gst_util_set_object_arg (G_OBJECT (stream->sink), "sync-method",
+        "latest-keyframe");
+  }
+  if (stream->fanout) {
+    gss_fanout_set_gop_cache (stream->fanout, stream->gop_cache >= 0 ?
+        stream->gop_cache : profile->gop_cache);
+  }
+}
+
+/* How the delivery profile works out for viewers: the average time to
+ * first frame (us, -1 if the sink does not tell) and the share of
+ * clients that fell behind and were moved forward or dropped */
+void
+gss_stream_get_delivery_stats (GssStream * stream, gint64 * start_time,
+    double *stall_rate)
+{
+  guint64 n_stalls = stream->metrics->n_stalls;
+
+  *start_time = -1;
+  if (stream->fanout) {
+    guint64 n_started;
+
+    gss_fanout_get_start_stats (stream->fanout, &n_started, start_time,
+        NULL);
+    if (n_started == 0)
+      *start_time = -1;
+    n_stalls += gss_fanout_get_n_recovered (stream->fanout);
   }
+
+  *stall_rate = stream->metrics->total_clients ?
+      (double) n_stalls / stream->metrics->total_clients : 0.0;
 }
@@ -47,8 +47,13 @@ G_BEGIN_DECLS
   (G_TYPE_CHECK_CLASS_TYPE((klass),GSS_TYPE_STREAM))
 
 
+/* number of most recent segments kept in memory */
 #define GSS_STREAM_HLS_CHUNKS 20
 
+/* segments are not cut any shorter, which bounds the number of them in
+ * the playlist window */
+#define GSS_STREAM_HLS_MIN_DURATION (GST_SECOND / 2)
+
 typedef enum {
   GSS_STREAM_TYPE_UNKNOWN,
   GSS_STREAM_TYPE_OGG_THEORA_VORBIS,
@@ -56,14 +61,58 @@ typedef enum {
   GSS_STREAM_TYPE_M2TS_H264BASE_AAC,
   GSS_STREAM_TYPE_M2TS_H264MAIN_AAC,
   GSS_STREAM_TYPE_FLV_H264BASE_AAC,
-  GSS_STREAM_TYPE_OGG_THEORA_OPUS
+  GSS_STREAM_TYPE_OGG_THEORA_OPUS,
+  GSS_STREAM_TYPE_FMP4_H264_AAC
 } GssStreamType;
 
 struct _GssHLSSegment {
+  GssStream *stream;
   int index;
-  SoupBuffer *buffer;
+  GList *buffers; /* SoupBuffers wrapping the muxer's GstBuffers, or NULL
+                     after being spilled to the segment store */
+  gsize size;
+  guint64 store_offset;
+  gboolean published; /* FALSE if the slot is empty */
+  GstClockTime duration;
+  GstClockTime start; /* on the DASH timeline */
+  gsize entry_length; /* length of its entry in the playlist */
+  GPtrArray *parts; /* GssHLSPart, only kept for the last few segments */
+  GssHLSKey *key; /* NULL if not encrypted */
+  GArray *iframes; /* GssHLSIFrame, NULL for fMP4 and encrypted segments */
+  gsize iframe_entry_length; /* length of its entries in the I-frame
+                                playlist */
+  gboolean cached; /* buffers accounted in the segment cache */
+  gboolean cold; /* out of the live window, in the cache's LRU list */
+  GList lru_link;
+};
+
+/* IDR access unit in a segment, an entry in the I-frame playlist */
+struct _GssHLSIFrame {
+  gsize offset;
+  gsize size;
+  GstClockTime time; /* from the start of the segment */
+};
+
+/* AES-128 key, shared by the segments of one key rotation period */
+struct _GssHLSKey {
+  GssStream *stream;
+  int refcount;
+  int period;
+  int first_msn; /* first segment encrypted with it */
+  guint8 data[16];
   char *location;
-  int duration;
+};
+
+/* LL-HLS partial segment */
+struct _GssHLSPart {
+  GssStream *stream;
+  int msn; /* media sequence number of the parent segment */
+  int index;
+  GList *buffers; /* SoupBuffers, NULL until the part is complete */
+  gsize size;
+  GstClockTime duration;
+  gboolean independent;
+  GList *waiters; /* blocked requests for a part that is not complete yet */
 };
 
 struct _GssStream {
@@ -74,6 +123,10 @@ struct _GssStream {
   int width;
   int height;
   int bitrate;
+  int fanout_shards;
+  gboolean fanout_zero_copy;
+  int gop_cache; /* GOPs sent to new clients, -1 for the profile's */
+  char *delivery_profile; /* name, empty for the program's */
 
   GssProgram *program;
   GssMetrics *metrics;
@@ -86,6 +139,8 @@ struct _GssStream {
   GstElement *pipeline;
   GstElement *src;
   GstElement *sink;
+  GssFanout *fanout; /* serves clients instead of the sink, if enabled */
+  gulong fanout_probe;
   int program_id;
   gboolean is_hls;
 
@@ -95,10 +150,75 @@ struct _GssStream {
   /* HLS */
   GstAdapter *adapter;
   int n_chunks;
-  GssHLSSegment chunks[GSS_STREAM_HLS_CHUNKS];
+  GssHLSSegment *chunks;
+  int max_chunks;
   struct {
+    GssSegmentStore *store; /* DVR segments older than the in-memory ones */
+    GssSegmentCache *cache; /* the server's, accounts in-memory segments */
     gboolean need_index_update;
-    SoupBuffer *index_buffer; /* contents of current index file */
+    /* the index file is header + playlist + tail */
+    SoupBuffer *index_header;
+    GssPlaylist *playlist; /* segment entries, window_first to playlist_end */
+    SoupBuffer *index_tail; /* entries with LL-HLS parts, hints */
+    char *playlist_base_url;
+    int window_first; /* first segment in the index */
+    int window_end; /* segments up to here are counted in window_duration */
+    int playlist_end;
+    GstClockTime window_duration;
+    int target_duration; /* longest segment so far, in seconds */
+    GstClockTime timeline; /* start of the next segment, for DASH */
+    guint32 epoch; /* random, part of segment URLs and ETags */
+    char *segment_prefix; /* location of segments, up to the sequence number */
+    int index_version; /* bumped whenever the index changes */
+
+    /* where key URIs end, for adding the session to them */
+    gssize header_key_end; /* in index_header, or -1 */
+    GArray *key_ends; /* guint64, in the playlist, counted like these: */
+    guint64 playlist_appended; /* bytes ever appended to it */
+    guint64 playlist_dropped; /* bytes ever dropped from its front */
+
+    /* I-frame playlist, header + iframe_playlist */
+    SoupBuffer *iframe_header;
+    GssPlaylist *iframe_playlist; /* window_first to iframe_end */
+    int iframe_end;
+    GArray *iframes; /* of the segment about to be published */
+    int iframe_bandwidth; /* peak, in bits per second */
+    int iframe_bandwidth_listed; /* in the variant playlist */
+
+    /* LL-HLS */
+    GstClockTime part_target; /* 0 if partial segments are disabled */
+    GPtrArray *parts; /* parts of the segment being collected */
+    GssHLSPart *next_part; /* advertised as preload hint */
+    GList *waiters; /* blocked playlist reloads */
+
+    GssHLSKey *key; /* most recent key */
+
+    /* fMP4 */
+    SoupBuffer *init_segment; /* most recent initialization segment */
+    int init_version; /* bumped with each new one, part of its location */
+
+    GssQueue *queue; /* cut segments and parts, to the main loop */
+    volatile gint flushing; /* the pipeline is being stopped */
+    GssBufferPool *pool; /* the server's, for encrypted segments */
+
+    /* segment being collected, streaming thread only */
+    GssTsScanner *scanner;
+    GssMp4Scanner *mp4_scanner; /* instead of scanner for fMP4 */
+    gboolean have_key_fragment; /* fMP4 media before it is dropped */
+    guint64 segment_offset; /* scanner offset of the segment start */
+    GArray *segment_iframes;
+    guint64 segment_pts; /* PTS of the IDR access unit it starts with */
+    GstClockTime segment_start;
+    GstClockTime segment_end;
+    gsize segment_size; /* bytes already sent off as parts */
+    GstClockTime part_start;
+    gboolean part_independent;
+    gboolean encrypt;
+    int key_rotation; /* segments per key, 0 for a single key */
+    int n_segments; /* segments cut so far */
+    int key_period;
+    guint8 key_data[16];
+    int n_dropped; /* segments and parts dropped while flushing */
 
     gboolean at_eos; /* true if sliding window is at the end of the stream */
   } hls;
@@ -117,24 +237,6 @@ struct _GssStreamClass {
 
 };
 
-struct _GssConnection {
-  SoupMessage *msg;
-  SoupClientContext *client;
-  GssStream *stream;
-  GssProgram *program;
-};
-
-
-/* internal */
-#define GSS_STREAM_MAX_FDS 65536
-typedef struct _FDInfo FDInfo;
-struct _FDInfo {
-  void (*callback) (GssStream *stream, int fd, void *priv);
-  void *priv;
-};
-FDInfo gss_stream_fd_table[GSS_STREAM_MAX_FDS];
-/* end internal */
-
 
 GType gss_stream_get_type (void);
 GType gss_stream_type_get_type (void);
@@ -142,6 +244,10 @@ GType gss_stream_type_get_type (void);
 void gss_stream_set_type (GssStream *stream, int type);
 
 void gss_stream_add_hls (GssStream *stream);
+void gss_stream_free_hls (GssStream *stream);
+gboolean gss_hls_segment_is_available (GssStream *stream,
+    GssHLSSegment *segment);
+void gss_hls_segment_evict (GssStream *stream, GssHLSSegment *segment);
 GssStream * gss_stream_new (int type, int width, int height, int bitrate);
 void gss_stream_get_stats (GssStream *stream, guint64 *n_bytes_in,
     guint64 *n_bytes_out);
@@ -151,6 +257,10 @@ const char * gss_stream_type_get_ext (int type);
 const char * gss_stream_type_get_content_type (int type);
 
 void gss_stream_set_sink (GssStream * stream, GstElement * sink);
+GssDeliveryProfile * gss_stream_get_delivery_profile (GssStream *stream);
+void gss_stream_apply_delivery_profile (GssStream *stream);
+void gss_stream_get_delivery_stats (GssStream *stream, gint64 *start_time,
+    double *stall_rate);
 void gss_stream_remove_resources (GssStream *stream);
 void gss_stream_add_resources (GssStream *stream);
 
@@ -57,19 +57,146 @@ gss_transaction_error (GssTransaction * t, const char *message)
   soup_message_set_status (t->msg, SOUP_STATUS_BAD_REQUEST);
 }
 
-static gboolean
-unpause (gpointer priv)
+/* Adds an ETag header for the entity about to be sent.  Returns TRUE,
+ * having set the status to 304 Not Modified, if the client already has
+ * it, in which case nothing else needs to be done. */
+gboolean
+gss_transaction_check_etag (GssTransaction * t, const char *etag)
 {
-  GssTransaction *t = (GssTransaction *) priv;
-
-  soup_server_unpause_message (t->soupserver, t->msg);
-  g_free (t);
+  const char *inm;
+  char **tags;
+  gboolean match = FALSE;
+  int i;
+
+  soup_message_headers_replace (t->msg->response_headers, "ETag", etag);
+
+  inm = soup_message_headers_get_list (t->msg->request_headers,
+      "If-None-Match");
+  if (inm == NULL)
+    return FALSE;
+
+  tags = g_strsplit (inm, ",", 0);
+  for (i = 0; tags[i] && !match; i++) {
+    const char *tag = g_strstrip (tags[i]);
+
+    if (g_str_has_prefix (tag, "W/"))
+      tag += 2;
+    match = (strcmp (tag, etag) == 0 || strcmp (tag, "*") == 0);
+  }
+  g_strfreev (tags);
+
+  if (match) {
+    soup_message_set_status (t->msg, SOUP_STATUS_NOT_MODIFIED);
+  }
+  return match;
+}
 
-  return FALSE;
+/* Range requests, for resources that know the length of what they are
+ * about to send.  Sets the status to 200 OK, or to 206 Partial Content
+ * if the request asked for a single satisfiable range, and returns the
+ * bytes to send in *offset and *length.  Requests for several ranges get
+ * the whole entity, and so do requests with an If-Range that doesn't
+ * match the ETag already set.  Returns FALSE, having set the status to
+ * 416 Range Not Satisfiable, if there is nothing to send. */
+gboolean
+gss_transaction_get_range (GssTransaction * t, goffset size,
+    goffset * offset, goffset * length)
+{
+  SoupMessageHeaders *headers = t->msg->request_headers;
+  const char *if_range;
+  SoupRange *ranges;
+  int n_ranges;
+
+  soup_message_headers_replace (t->msg->response_headers, "Accept-Ranges",
+      "bytes");
+
+  *offset = 0;
+  *length = size;
+
+  if_range = soup_message_headers_get_one (headers, "If-Range");
+  if (if_range && g_strcmp0 (if_range,
+          soup_message_headers_get_one (t->msg->response_headers,
+              "ETag")) != 0) {
+    /* changed since, or a date, and there is no Last-Modified */
+    soup_message_set_status (t->msg, SOUP_STATUS_OK);
+    return TRUE;
+  }
+
+  if (!soup_message_headers_get_ranges (headers, size, &ranges, &n_ranges)) {
+    soup_message_set_status (t->msg, SOUP_STATUS_OK);
+    return TRUE;
+  }
+
+  if (n_ranges != 1) {
+    soup_message_set_status (t->msg, SOUP_STATUS_OK);
+  } else if (ranges[0].start >= size || ranges[0].start > ranges[0].end) {
+    char *s;
+
+    s = g_strdup_printf ("bytes */%" G_GINT64_FORMAT, (gint64) size);
+    soup_message_headers_replace (t->msg->response_headers, "Content-Range",
+        s);
+    g_free (s);
+    soup_message_set_status (t->msg,
+        SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE);
+    soup_message_headers_free_ranges (headers, ranges);
+    return FALSE;
+  } else {
+    *offset = ranges[0].start;
+    *length = MIN (ranges[0].end, size - 1) - ranges[0].start + 1;
+    soup_message_headers_set_content_range (t->msg->response_headers,
+        *offset, *offset + *length - 1, size);
+    soup_message_set_status (t->msg, SOUP_STATUS_PARTIAL_CONTENT);
+  }
+  soup_message_headers_free_ranges (headers, ranges);
+
+  return TRUE;
 }
 
+/* Sends an entity made of a list of SoupBuffers, or the range of it
+ * that was asked for.  Only references to the data are taken. */
 void
-gss_transaction_delay (GssTransaction * t, int msec)
+gss_transaction_send_buffers (GssTransaction * t, GList * buffers)
+{
+  goffset size = 0;
+  goffset offset;
+  goffset length;
+  GList *g;
+
+  for (g = buffers; g; g = g_list_next (g)) {
+    size += ((SoupBuffer *) g->data)->length;
+  }
+
+  if (!gss_transaction_get_range (t, size, &offset, &length))
+    return;
+
+  for (g = buffers; g && length > 0; g = g_list_next (g)) {
+    SoupBuffer *buffer = (SoupBuffer *) g->data;
+    SoupBuffer *sub;
+    gsize n;
+
+    if (offset >= (goffset) buffer->length) {
+      offset -= buffer->length;
+      continue;
+    }
+
+    n = MIN (buffer->length - offset, length);
+    if (offset == 0 && n == buffer->length) {
+      soup_message_body_append_buffer (t->msg->response_body, buffer);
+    } else {
+      sub = soup_buffer_new_subbuffer (buffer, offset, n);
+      soup_message_body_append_buffer (t->msg->response_body, sub);
+      soup_buffer_free (sub);
+    }
+    offset = 0;
+    length -= n;
+  }
+}
+
+/* Pauses the message and returns a copy of the transaction that stays
+ * valid after the resource callback returns.  The query and path of the
+ * copy are not valid anymore, so look at them before pausing. */
+GssTransaction *
+gss_transaction_pause (GssTransaction * t)
 {
   GssTransaction *new_t;
 
@@ -77,7 +204,31 @@ gss_transaction_delay (GssTransaction * t, int msec)
 
   new_t = g_malloc0 (sizeof (GssTransaction));
   memcpy (new_t, t, sizeof (GssTransaction));
+  new_t->query = NULL;
+  new_t->path = NULL;
 
   soup_server_pause_message (t->soupserver, t->msg);
-  g_timeout_add (msec, unpause, new_t);
+
+  return new_t;
+}
+
+void
+gss_transaction_resume (GssTransaction * t)
+{
+  soup_server_unpause_message (t->soupserver, t->msg);
+  g_free (t);
+}
+
+static gboolean
+unpause (gpointer priv)
+{
+  gss_transaction_resume ((GssTransaction *) priv);
+
+  return FALSE;
+}
+
+void
+gss_transaction_delay (GssTransaction * t, int msec)
+{
+  g_timeout_add (msec, unpause, gss_transaction_pause (t));
 }
@@ -47,6 +47,12 @@ struct _GssTransaction {
 void gss_transaction_redirect (GssTransaction * t, const char *target);
 void gss_transaction_error (GssTransaction * t, const char *message);
 void gss_transaction_delay (GssTransaction *t, int msec);
+gboolean gss_transaction_check_etag (GssTransaction *t, const char *etag);
+gboolean gss_transaction_get_range (GssTransaction *t, goffset size,
+    goffset *offset, goffset *length);
+void gss_transaction_send_buffers (GssTransaction *t, GList *buffers);
+GssTransaction * gss_transaction_pause (GssTransaction *t);
+void gss_transaction_resume (GssTransaction *t);
 
 
 G_END_DECLS
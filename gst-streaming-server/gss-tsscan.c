@@ -0,0 +1,479 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#include "config.h"
+
+#include "gss-server.h"
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define GSS_TS_X86 1
+#include <immintrin.h>
+#endif
+
+
+/* Finding the sync byte after a loss, and start codes in PES payloads,
+ * boils down to looking for a single byte value. */
+
+static gsize
+gss_ts_find_byte_c (const guint8 * data, gsize size, guint8 byte)
+{
+  const guint8 *p;
+
+  p = memchr (data, byte, size);
+  return p ? (gsize) (p - data) : size;
+}
+
+#ifdef GSS_TS_X86
+__attribute__ ((target ("sse2")))
+static gsize
+gss_ts_find_byte_sse2 (const guint8 * data, gsize size, guint8 byte)
+{
+  __m128i needle = _mm_set1_epi8 (byte);
+  gsize i;
+
+  for (i = 0; i + 16 <= size; i += 16) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (data + i));
+    int mask = _mm_movemask_epi8 (_mm_cmpeq_epi8 (v, needle));
+
+    if (mask)
+      return i + __builtin_ctz (mask);
+  }
+  for (; i < size; i++) {
+    if (data[i] == byte)
+      return i;
+  }
+  return size;
+}
+
+__attribute__ ((target ("avx2")))
+static gsize
+gss_ts_find_byte_avx2 (const guint8 * data, gsize size, guint8 byte)
+{
+  __m256i needle = _mm256_set1_epi8 (byte);
+  gsize i;
+
+  for (i = 0; i + 32 <= size; i += 32) {
+    __m256i v = _mm256_loadu_si256 ((const __m256i *) (data + i));
+    unsigned int mask = _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (v, needle));
+
+    if (mask)
+      return i + __builtin_ctz (mask);
+  }
+  for (; i < size; i++) {
+    if (data[i] == byte)
+      return i;
+  }
+  return size;
+}
+#endif
+
+static gsize (*gss_ts_find_byte_impl) (const guint8 * data, gsize size,
+    guint8 byte);
+
+static void
+gss_ts_find_byte_init (void)
+{
+#ifdef GSS_TS_X86
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("avx2")) {
+    gss_ts_find_byte_impl = gss_ts_find_byte_avx2;
+  } else if (__builtin_cpu_supports ("sse2")) {
+    gss_ts_find_byte_impl = gss_ts_find_byte_sse2;
+  } else {
+    gss_ts_find_byte_impl = gss_ts_find_byte_c;
+  }
+#else
+  gss_ts_find_byte_impl = gss_ts_find_byte_c;
+#endif
+}
+
+/* Returns the index of the first occurrence of byte, or size if there
+ * is none. */
+gsize
+gss_ts_find_byte (const guint8 * data, gsize size, guint8 byte)
+{
+  if (G_UNLIKELY (gss_ts_find_byte_impl == NULL)) {
+    gss_ts_find_byte_init ();
+  }
+  return gss_ts_find_byte_impl (data, size, byte);
+}
+
+
+GssTsScanner *
+gss_ts_scanner_new (void)
+{
+  GssTsScanner *scanner;
+
+  if (gss_ts_find_byte_impl == NULL) {
+    gss_ts_find_byte_init ();
+  }
+
+  scanner = g_new0 (GssTsScanner, 1);
+  scanner->pmt_pid = -1;
+  scanner->video_pid = -1;
+  scanner->au_pts = GSS_TS_NO_PTS;
+  scanner->iframes = g_array_new (FALSE, FALSE, sizeof (GssTsIFrame));
+
+  return scanner;
+}
+
+void
+gss_ts_scanner_free (GssTsScanner * scanner)
+{
+  g_array_free (scanner->iframes, TRUE);
+  g_free (scanner);
+}
+
+gboolean
+gss_ts_scanner_au_pending (GssTsScanner * scanner)
+{
+  return scanner->au_pending || scanner->psi_pending;
+}
+
+/* Returns how many of the IDR access units at the start of
+ * scanner->iframes end at or before offset end, and so belong to a
+ * segment that is cut there */
+guint
+gss_ts_scanner_count_iframes (GssTsScanner * scanner, guint64 end)
+{
+  guint i;
+
+  for (i = 0; i < scanner->iframes->len; i++) {
+    GssTsIFrame *f = &g_array_index (scanner->iframes, GssTsIFrame, i);
+
+    if (f->offset + f->size > end)
+      break;
+  }
+  return i;
+}
+
+static void
+gss_ts_scanner_parse_pat (GssTsScanner * scanner, const guint8 * data,
+    int size)
+{
+  const guint8 *s;
+  int section_length;
+  int end;
+  int i;
+
+  if (size < 1 || 1 + data[0] + 8 > size)
+    return;
+  s = data + 1 + data[0];
+  size -= 1 + data[0];
+  if (s[0] != 0x00)
+    return;
+
+  section_length = ((s[1] & 0x0f) << 8) | s[2];
+  end = MIN (3 + section_length - 4, size);
+  for (i = 8; i + 4 <= end; i += 4) {
+    int program_number = (s[i] << 8) | s[i + 1];
+
+    if (program_number != 0) {
+      scanner->pmt_pid = ((s[i + 2] & 0x1f) << 8) | s[i + 3];
+      return;
+    }
+  }
+}
+
+static void
+gss_ts_scanner_parse_pmt (GssTsScanner * scanner, const guint8 * data,
+    int size)
+{
+  const guint8 *s;
+  int section_length;
+  int end;
+  int i;
+
+  if (size < 1 || 1 + data[0] + 12 > size)
+    return;
+  s = data + 1 + data[0];
+  size -= 1 + data[0];
+  if (s[0] != 0x02)
+    return;
+
+  section_length = ((s[1] & 0x0f) << 8) | s[2];
+  end = MIN (3 + section_length - 4, size);
+  i = 12 + (((s[10] & 0x0f) << 8) | s[11]);
+  while (i + 5 <= end) {
+    int stream_type = s[i];
+    int pid = ((s[i + 1] & 0x1f) << 8) | s[i + 2];
+
+    if (stream_type == 0x1b) {
+      /* H.264 */
+      scanner->video_pid = pid;
+      return;
+    }
+    i += 5 + (((s[i + 3] & 0x0f) << 8) | s[i + 4]);
+  }
+}
+
+static void
+gss_ts_scanner_found_idr (GssTsScanner * scanner)
+{
+  if (!scanner->found_idr) {
+    scanner->found_idr = TRUE;
+    scanner->idr_offset = scanner->au_offset;
+    scanner->idr_pts = scanner->au_pts;
+  }
+  scanner->au_pending = FALSE;
+  scanner->au_is_idr = TRUE;
+}
+
+static void
+gss_ts_scanner_nal (GssTsScanner * scanner, int nal_type)
+{
+  if (nal_type == 5) {
+    gss_ts_scanner_found_idr (scanner);
+  } else if (nal_type == 1) {
+    /* non-IDR slice, nothing more to learn from this access unit */
+    scanner->au_pending = FALSE;
+  }
+}
+
+/* Looks for 00 00 01 start codes, which may be split across packets,
+ * until the first slice of the access unit tells whether it is IDR. */
+static void
+gss_ts_scanner_parse_es (GssTsScanner * scanner, const guint8 * data,
+    int size)
+{
+  int i = 0;
+
+  if (size <= 0)
+    return;
+
+  if (scanner->want_nal_header) {
+    scanner->want_nal_header = FALSE;
+    gss_ts_scanner_nal (scanner, data[0] & 0x1f);
+  }
+
+  while (scanner->au_pending && i < size) {
+    guint8 b1, b2;
+
+    i += gss_ts_find_byte (data + i, size - i, 0x01);
+    if (i >= size)
+      break;
+
+    b1 = (i >= 1) ? data[i - 1] : scanner->nal_history[1];
+    b2 = (i >= 2) ? data[i - 2] : (i == 1 ? scanner->nal_history[1] :
+        scanner->nal_history[0]);
+    if (b1 == 0 && b2 == 0) {
+      if (i + 1 < size) {
+        gss_ts_scanner_nal (scanner, data[i + 1] & 0x1f);
+      } else {
+        scanner->want_nal_header = TRUE;
+      }
+    }
+    i++;
+  }
+
+  if (size >= 2) {
+    scanner->nal_history[0] = data[size - 2];
+    scanner->nal_history[1] = data[size - 1];
+  } else {
+    scanner->nal_history[0] = scanner->nal_history[1];
+    scanner->nal_history[1] = data[0];
+  }
+}
+
+static void
+gss_ts_scanner_parse_pes (GssTsScanner * scanner, const guint8 * data,
+    int size, guint64 offset, gboolean random_access)
+{
+  int header_length;
+
+  if (scanner->au_is_idr) {
+    GssTsIFrame iframe;
+
+    iframe.offset = scanner->au_offset;
+    iframe.size = offset - scanner->au_offset;
+    iframe.pts = scanner->au_pts;
+    g_array_append_val (scanner->iframes, iframe);
+  }
+
+  scanner->au_pending = TRUE;
+  scanner->au_is_idr = FALSE;
+  scanner->au_offset = scanner->psi_pending ? scanner->psi_offset : offset;
+  scanner->psi_pending = FALSE;
+  scanner->au_pts = GSS_TS_NO_PTS;
+  scanner->want_nal_header = FALSE;
+  scanner->nal_history[0] = 0xff;
+  scanner->nal_history[1] = 0xff;
+
+  if (size < 9 || data[0] != 0 || data[1] != 0 || data[2] != 1) {
+    scanner->au_pending = FALSE;
+    return;
+  }
+
+  header_length = 9 + data[8];
+  if ((data[7] & 0x80) && size >= 14) {
+    scanner->au_pts = ((guint64) ((data[9] >> 1) & 7) << 30) |
+        (data[10] << 22) | ((data[11] >> 1) << 15) |
+        (data[12] << 7) | (data[13] >> 1);
+  }
+
+  if (random_access) {
+    /* muxer already told us */
+    gss_ts_scanner_found_idr (scanner);
+    return;
+  }
+
+  if (header_length < size) {
+    gss_ts_scanner_parse_es (scanner, data + header_length,
+        size - header_length);
+  }
+}
+
+static void
+gss_ts_scanner_packet (GssTsScanner * scanner, const guint8 * p,
+    guint64 offset)
+{
+  int pid;
+  int afc;
+  int start = 4;
+  gboolean pusi;
+  gboolean random_access = FALSE;
+
+  scanner->n_packets++;
+
+  if (p[1] & 0x80) {
+    /* transport error */
+    return;
+  }
+
+  pid = ((p[1] & 0x1f) << 8) | p[2];
+  pusi = (p[1] & 0x40) != 0;
+  afc = (p[3] >> 4) & 3;
+
+  if (afc & 2) {
+    if (p[4] > 0) {
+      random_access = (p[5] & 0x40) != 0;
+    }
+    start = 5 + p[4];
+  }
+  if (!(afc & 1) || start >= GSS_TS_PACKET_SIZE)
+    return;
+
+  if (pid == scanner->video_pid) {
+    if (pusi) {
+      gss_ts_scanner_parse_pes (scanner, p + start,
+          GSS_TS_PACKET_SIZE - start, offset, random_access);
+    } else {
+      scanner->psi_pending = FALSE;
+      if (scanner->au_pending) {
+        gss_ts_scanner_parse_es (scanner, p + start,
+            GSS_TS_PACKET_SIZE - start);
+      }
+    }
+  } else if (pid == 0) {
+    if (pusi) {
+      if (!scanner->psi_pending) {
+        scanner->psi_pending = TRUE;
+        scanner->psi_offset = offset;
+      }
+      gss_ts_scanner_parse_pat (scanner, p + start,
+          GSS_TS_PACKET_SIZE - start);
+    }
+  } else if (pid == scanner->pmt_pid) {
+    if (pusi) {
+      gss_ts_scanner_parse_pmt (scanner, p + start,
+          GSS_TS_PACKET_SIZE - start);
+    }
+  }
+}
+
+/* Scans the next chunk of the stream.  Returns TRUE if it completed the
+ * detection of an IDR access unit, in which case idr_offset is set to
+ * the offset where that access unit starts (which may be in an earlier
+ * chunk) and idr_pts to its PTS, or GSS_TS_NO_PTS.  Completed IDR access
+ * units are added to scanner->iframes. */
+gboolean
+gss_ts_scanner_push (GssTsScanner * scanner, const guint8 * data, gsize size,
+    guint64 * idr_offset, guint64 * idr_pts)
+{
+  gsize pos = 0;
+
+  scanner->found_idr = FALSE;
+
+  if (scanner->n_partial > 0) {
+    int n = MIN (GSS_TS_PACKET_SIZE - scanner->n_partial, size);
+
+    memcpy (scanner->partial + scanner->n_partial, data, n);
+    scanner->n_partial += n;
+    pos = n;
+    if (scanner->n_partial == GSS_TS_PACKET_SIZE) {
+      gss_ts_scanner_packet (scanner, scanner->partial,
+          scanner->offset + n - GSS_TS_PACKET_SIZE);
+      scanner->n_partial = 0;
+    }
+  }
+
+  while (pos < size) {
+    if (!scanner->in_sync || data[pos] != 0x47) {
+      if (scanner->in_sync) {
+        GST_DEBUG ("lost sync at offset %" G_GUINT64_FORMAT,
+            scanner->offset + pos);
+        scanner->n_resyncs++;
+        scanner->in_sync = FALSE;
+        scanner->au_pending = FALSE;
+        scanner->au_is_idr = FALSE;
+        scanner->psi_pending = FALSE;
+      }
+
+      /* a sync byte followed by two more, a packet apart */
+      while (pos < size) {
+        pos += gss_ts_find_byte (data + pos, size - pos, 0x47);
+        if ((pos + GSS_TS_PACKET_SIZE < size &&
+                data[pos + GSS_TS_PACKET_SIZE] != 0x47) ||
+            (pos + 2 * GSS_TS_PACKET_SIZE < size &&
+                data[pos + 2 * GSS_TS_PACKET_SIZE] != 0x47)) {
+          pos++;
+          continue;
+        }
+        break;
+      }
+      if (pos >= size)
+        break;
+      scanner->in_sync = TRUE;
+    }
+
+    if (pos + GSS_TS_PACKET_SIZE > size) {
+      scanner->n_partial = size - pos;
+      memcpy (scanner->partial, data + pos, scanner->n_partial);
+      break;
+    }
+
+    gss_ts_scanner_packet (scanner, data + pos, scanner->offset + pos);
+    pos += GSS_TS_PACKET_SIZE;
+  }
+
+  scanner->offset += size;
+
+  if (scanner->found_idr) {
+    if (idr_offset)
+      *idr_offset = scanner->idr_offset;
+    if (idr_pts)
+      *idr_pts = scanner->idr_pts;
+  }
+
+  return scanner->found_idr;
+}
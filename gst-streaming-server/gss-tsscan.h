@@ -0,0 +1,94 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+
+#ifndef _GSS_TSSCAN_H
+#define _GSS_TSSCAN_H
+
+#include "gss-config.h"
+#include "gss-types.h"
+
+G_BEGIN_DECLS
+
+#define GSS_TS_PACKET_SIZE 188
+#define GSS_TS_NO_PTS G_MAXUINT64
+
+/* A complete IDR access unit, from the PAT/PMT ahead of it (if any) up
+ * to the start of the next video access unit */
+struct _GssTsIFrame {
+  guint64 offset;
+  guint64 size;
+  guint64 pts;
+};
+
+/* Walks the packets of an MPEG transport stream as it goes through the
+ * segmenter, looking for the start of H.264 IDR access units.  Byte
+ * offsets are counted from the first byte ever pushed.  Access units
+ * start at the PAT and PMT directly ahead of them, so that segments
+ * cut there can be decoded on their own. */
+struct _GssTsScanner {
+  guint64 offset; /* bytes pushed so far */
+
+  /* packet straddling two pushes */
+  guint8 partial[GSS_TS_PACKET_SIZE];
+  int n_partial;
+  gboolean in_sync;
+
+  int pmt_pid;
+  int video_pid;
+
+  /* PAT seen, but no video since */
+  gboolean psi_pending;
+  guint64 psi_offset;
+
+  /* video access unit being parsed */
+  gboolean au_pending; /* started, but no slice seen yet */
+  guint64 au_offset; /* offset of the packet starting the PES */
+  guint64 au_pts;
+  gboolean au_is_idr;
+  guint8 nal_history[2]; /* last payload bytes, for split start codes */
+  gboolean want_nal_header;
+
+  /* IDR access unit found by the current push */
+  gboolean found_idr;
+  guint64 idr_offset;
+  guint64 idr_pts;
+
+  /* IDR access units completed so far, GssTsIFrame, in stream order;
+   * the caller removes the ones it has used */
+  GArray *iframes;
+
+  guint64 n_packets;
+  guint64 n_resyncs;
+};
+
+GssTsScanner * gss_ts_scanner_new (void);
+void gss_ts_scanner_free (GssTsScanner *scanner);
+gboolean gss_ts_scanner_push (GssTsScanner *scanner, const guint8 *data,
+    gsize size, guint64 *idr_offset, guint64 *idr_pts);
+gboolean gss_ts_scanner_au_pending (GssTsScanner *scanner);
+guint gss_ts_scanner_count_iframes (GssTsScanner *scanner, guint64 end);
+gsize gss_ts_find_byte (const guint8 *data, gsize size, guint8 byte);
+
+G_END_DECLS
+
+#endif
+
@@ -34,9 +34,24 @@ typedef struct _GssStream GssStream;
 typedef struct _GssServer GssServer;
 typedef struct _GssServerClass GssServerClass;
 typedef struct _GssConnection GssConnection;
+typedef struct _GssDeliveryProfile GssDeliveryProfile;
+typedef struct _GssFanout GssFanout;
 typedef struct _GssHLSSegment GssHLSSegment;
+typedef struct _GssHLSPart GssHLSPart;
+typedef struct _GssHLSKey GssHLSKey;
 typedef struct _GssRtspStream GssRtspStream;
 typedef struct _GssMetrics GssMetrics;
+typedef struct _GssSegmentStore GssSegmentStore;
+typedef struct _GssSegmentCache GssSegmentCache;
+typedef struct _GssTsScanner GssTsScanner;
+typedef struct _GssTsIFrame GssTsIFrame;
+typedef struct _GssHLSIFrame GssHLSIFrame;
+typedef struct _GssPlaylist GssPlaylist;
+typedef struct _GssAesCbc GssAesCbc;
+typedef struct _GssBufferPool GssBufferPool;
+typedef struct _GssQueue GssQueue;
+typedef struct _GssUring GssUring;
+typedef struct _GssMp4Scanner GssMp4Scanner;
 typedef struct _GssResource GssResource;
 typedef struct _GssSession GssSession;
 typedef struct _GssTransaction GssTransaction;
@@ -0,0 +1,324 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include "config.h"
+
+#include "gss-server.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+#include <sys/mman.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+/* completions can pile up while a batch of sends is submitted */
+#define CQ_FACTOR 4
+
+static int
+io_uring_setup (guint entries, struct io_uring_params *params)
+{
+  return syscall (__NR_io_uring_setup, entries, params);
+}
+
+static int
+io_uring_enter (int fd, guint to_submit, guint min_complete, guint flags,
+    const void *arg, gsize arg_size)
+{
+  return syscall (__NR_io_uring_enter, fd, to_submit, min_complete, flags,
+      arg, arg_size);
+}
+
+static int
+io_uring_register (int fd, guint opcode, const void *arg, guint nr_args)
+{
+  return syscall (__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+GssUring *
+gss_uring_new (guint entries)
+{
+  struct io_uring_params params;
+  GssUring *uring;
+  guint8 *sq;
+  guint8 *cq;
+  guint i;
+
+  memset (&params, 0, sizeof (params));
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = entries * CQ_FACTOR;
+
+  uring = g_new0 (GssUring, 1);
+  uring->fd = io_uring_setup (entries, &params);
+  if (uring->fd < 0) {
+    GST_DEBUG ("io_uring_setup: %s", g_strerror (errno));
+    g_free (uring);
+    return NULL;
+  }
+  /* needs to keep every completion and to wait with a timeout */
+  if (!(params.features & IORING_FEAT_NODROP) ||
+      !(params.features & IORING_FEAT_EXT_ARG)) {
+    GST_DEBUG ("io_uring is too old, features 0x%x", params.features);
+    close (uring->fd);
+    g_free (uring);
+    return NULL;
+  }
+
+  uring->sq_ring_size = params.sq_off.array +
+      params.sq_entries * sizeof (guint);
+  uring->cq_ring_size = params.cq_off.cqes +
+      params.cq_entries * sizeof (struct io_uring_cqe);
+  uring->sqes_size = params.sq_entries * sizeof (struct io_uring_sqe);
+
+  uring->sq_ring = mmap (NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+  uring->cq_ring = mmap (NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+  uring->sqes = mmap (NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+  if (uring->sq_ring == MAP_FAILED || uring->cq_ring == MAP_FAILED ||
+      uring->sqes == MAP_FAILED) {
+    GST_ERROR ("mmap: %s", g_strerror (errno));
+    gss_uring_free (uring);
+    return NULL;
+  }
+
+  sq = uring->sq_ring;
+  uring->sq_head = (guint *) (sq + params.sq_off.head);
+  uring->sq_tail = (guint *) (sq + params.sq_off.tail);
+  uring->sq_mask = *(guint *) (sq + params.sq_off.ring_mask);
+  uring->sq_array = (guint *) (sq + params.sq_off.array);
+  uring->sqe_tail = *uring->sq_tail;
+  /* submission entries are used in order */
+  for (i = 0; i <= uring->sq_mask; i++) {
+    uring->sq_array[i] = i;
+  }
+
+  cq = uring->cq_ring;
+  uring->cq_head = (guint *) (cq + params.cq_off.head);
+  uring->cq_tail = (guint *) (cq + params.cq_off.tail);
+  uring->cq_mask = *(guint *) (cq + params.cq_off.ring_mask);
+  uring->cqes = (struct io_uring_cqe *) (cq + params.cq_off.cqes);
+
+  return uring;
+}
+
+void
+gss_uring_free (GssUring * uring)
+{
+  if (uring->sq_ring && uring->sq_ring != MAP_FAILED)
+    munmap (uring->sq_ring, uring->sq_ring_size);
+  if (uring->cq_ring && uring->cq_ring != MAP_FAILED)
+    munmap (uring->cq_ring, uring->cq_ring_size);
+  if (uring->sqes && uring->sqes != MAP_FAILED)
+    munmap (uring->sqes, uring->sqes_size);
+  close (uring->fd);
+  g_free (uring);
+}
+
+/* Returns a cleared entry, or NULL if the submission queue is full and
+ * needs to be submitted first */
+struct io_uring_sqe *
+gss_uring_get_sqe (GssUring * uring)
+{
+  guint head = (guint) g_atomic_int_get ((gint *) uring->sq_head);
+  struct io_uring_sqe *sqe;
+
+  if (uring->sqe_tail - head > uring->sq_mask)
+    return NULL;
+
+  sqe = &uring->sqes[uring->sqe_tail & uring->sq_mask];
+  memset (sqe, 0, sizeof (*sqe));
+  uring->sqe_tail++;
+
+  return sqe;
+}
+
+/* Number of entries gss_uring_get_sqe() can return before submitting */
+guint
+gss_uring_sq_space (GssUring * uring)
+{
+  guint head = (guint) g_atomic_int_get ((gint *) uring->sq_head);
+
+  return uring->sq_mask + 1 - (uring->sqe_tail - head);
+}
+
+/* Submits the entries filled in so far and waits until there are at
+ * least wait_nr completions, or for timeout_ms if that is not
+ * negative.  Returns the number of entries submitted, or -errno.
+ * -EBUSY means the completion queue needs to be emptied first. */
+int
+gss_uring_submit (GssUring * uring, guint wait_nr, int timeout_ms)
+{
+  struct io_uring_getevents_arg arg;
+  struct __kernel_timespec ts;
+  guint flags = 0;
+  guint to_submit;
+  int ret;
+
+  /* publishes the entries, g_atomic_int_set() is a full barrier */
+  g_atomic_int_set ((gint *) uring->sq_tail, (gint) uring->sqe_tail);
+  to_submit = uring->sqe_tail -
+      (guint) g_atomic_int_get ((gint *) uring->sq_head);
+
+  if (to_submit == 0 && wait_nr == 0)
+    return 0;
+
+  memset (&arg, 0, sizeof (arg));
+  if (wait_nr > 0) {
+    flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    arg.sigmask_sz = _NSIG / 8;
+    if (timeout_ms >= 0) {
+      ts.tv_sec = timeout_ms / 1000;
+      ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+      arg.ts = (guint64) (gsize) & ts;
+    }
+  }
+
+  ret = io_uring_enter (uring->fd, to_submit, wait_nr, flags,
+      wait_nr > 0 ? &arg : NULL, wait_nr > 0 ? sizeof (arg) : 0);
+  if (ret < 0) {
+    if (errno == ETIME || errno == EINTR)
+      return 0;
+    return -errno;
+  }
+
+  return ret;
+}
+
+/* Returns the oldest completion, or NULL if there are none */
+struct io_uring_cqe *
+gss_uring_peek_cqe (GssUring * uring)
+{
+  guint head = *uring->cq_head;
+
+  if (head == (guint) g_atomic_int_get ((gint *) uring->cq_tail))
+    return NULL;
+
+  return &uring->cqes[head & uring->cq_mask];
+}
+
+/* Lets the kernel reuse the completion returned by
+ * gss_uring_peek_cqe() */
+void
+gss_uring_cqe_seen (GssUring * uring)
+{
+  g_atomic_int_set ((gint *) uring->cq_head, (gint) (*uring->cq_head + 1));
+}
+
+/* Registers an empty table of n_files files, to be filled in with
+ * gss_uring_update_file() */
+gboolean
+gss_uring_register_files (GssUring * uring, int n_files)
+{
+  int *fds;
+  int ret;
+  int i;
+
+  fds = g_new (int, n_files);
+  for (i = 0; i < n_files; i++) {
+    fds[i] = -1;
+  }
+  ret = io_uring_register (uring->fd, IORING_REGISTER_FILES, fds, n_files);
+  g_free (fds);
+  if (ret < 0) {
+    GST_DEBUG ("registering files: %s", g_strerror (errno));
+    return FALSE;
+  }
+  uring->n_files = n_files;
+
+  return TRUE;
+}
+
+/* Puts fd at index of the registered file table, or clears it if fd
+ * is -1.  Requests already submitted keep the file they were given. */
+gboolean
+gss_uring_update_file (GssUring * uring, int index, int fd)
+{
+  struct io_uring_files_update update;
+
+  memset (&update, 0, sizeof (update));
+  update.offset = index;
+  update.fds = (guint64) (gsize) & fd;
+
+  return io_uring_register (uring->fd, IORING_REGISTER_FILES_UPDATE,
+      &update, 1) == 1;
+}
+
+#else
+
+GssUring *
+gss_uring_new (guint entries)
+{
+  return NULL;
+}
+
+void
+gss_uring_free (GssUring * uring)
+{
+}
+
+struct io_uring_sqe *
+gss_uring_get_sqe (GssUring * uring)
+{
+  return NULL;
+}
+
+guint
+gss_uring_sq_space (GssUring * uring)
+{
+  return 0;
+}
+
+int
+gss_uring_submit (GssUring * uring, guint wait_nr, int timeout_ms)
+{
+  return -1;
+}
+
+struct io_uring_cqe *
+gss_uring_peek_cqe (GssUring * uring)
+{
+  return NULL;
+}
+
+void
+gss_uring_cqe_seen (GssUring * uring)
+{
+}
+
+gboolean
+gss_uring_register_files (GssUring * uring, int n_files)
+{
+  return FALSE;
+}
+
+gboolean
+gss_uring_update_file (GssUring * uring, int index, int fd)
+{
+  return FALSE;
+}
+
+#endif
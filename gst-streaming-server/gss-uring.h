@@ -0,0 +1,79 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+#ifndef _GSS_URING_H
+#define _GSS_URING_H
+
+#include "gss-config.h"
+#include "gss-types.h"
+
+G_BEGIN_DECLS
+
+/* Minimal io_uring instance, used by one thread.  Submission entries
+ * are filled in with gss_uring_get_sqe() and handed to the kernel in
+ * one batch by gss_uring_submit(), which can also wait for
+ * completions.  gss_uring_new() returns NULL if the kernel does not
+ * have io_uring, has it disabled, or is older than 5.11, so callers
+ * can fall back to something else. */
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+struct _GssUring {
+  int fd;
+
+  /* submission queue, shared with the kernel */
+  guint *sq_head;
+  guint *sq_tail;
+  guint sq_mask;
+  guint *sq_array;
+  struct io_uring_sqe *sqes;
+  guint sqe_tail; /* entries before this are filled in */
+
+  /* completion queue, shared with the kernel */
+  guint *cq_head;
+  guint *cq_tail;
+  guint cq_mask;
+  struct io_uring_cqe *cqes;
+
+  gpointer sq_ring;
+  gsize sq_ring_size;
+  gpointer cq_ring;
+  gsize cq_ring_size;
+  gsize sqes_size;
+
+  int n_files; /* size of the registered file table */
+};
+
+GssUring * gss_uring_new (guint entries);
+void gss_uring_free (GssUring *uring);
+struct io_uring_sqe * gss_uring_get_sqe (GssUring *uring);
+guint gss_uring_sq_space (GssUring *uring);
+int gss_uring_submit (GssUring *uring, guint wait_nr, int timeout_ms);
+struct io_uring_cqe * gss_uring_peek_cqe (GssUring *uring);
+void gss_uring_cqe_seen (GssUring *uring);
+gboolean gss_uring_register_files (GssUring *uring, int n_files);
+gboolean gss_uring_update_file (GssUring *uring, int index, int fd);
+
+G_END_DECLS
+
+#endif
+
@@ -27,7 +27,10 @@
 #include "gss-content.h"
 #include "gss-vod.h"
 
+#include <errno.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 static void vod_resource_chunked (GssTransaction * transaction);
@@ -45,6 +48,7 @@ struct _GssVOD
   GstElement *sink;
 
   int fd;
+  goffset remaining; /* bytes of the range still to be read */
 };
 
 
@@ -54,20 +58,39 @@ struct _GssVOD
 static void
 vod_wrote_chunk (SoupMessage * msg, GssVOD * vod)
 {
+  SoupBuffer *buffer;
   char *chunk;
   int len;
 
-  chunk = g_malloc (SIZE);
-  len = read (vod->fd, chunk, 65536);
-  if (len < 0) {
-    GST_ERROR ("read error");
-  }
-  if (len == 0) {
+  if (vod->remaining == 0) {
     soup_message_body_complete (msg->response_body);
     return;
   }
 
-  soup_message_body_append (msg->response_body, SOUP_MEMORY_TAKE, chunk, len);
+  chunk = gss_buffer_pool_alloc (vod->server->buffer_pool, SIZE);
+  do {
+    len = read (vod->fd, chunk, MIN (SIZE, vod->remaining));
+  } while (len < 0 && errno == EINTR);
+  if (len <= 0) {
+    /* Completing the body now would send fewer bytes than the
+     * Content-Length promised, so drop the connection instead and let
+     * the client see the response was cut short.  "finished" frees
+     * vod once libsoup notices. */
+    if (len < 0) {
+      GST_ERROR ("read error: %s", g_strerror (errno));
+    } else {
+      GST_ERROR ("archive file ended %" G_GINT64_FORMAT " bytes early",
+          (gint64) vod->remaining);
+    }
+    gss_buffer_pool_release (chunk);
+    soup_socket_disconnect (soup_client_context_get_socket (vod->client));
+    return;
+  }
+  vod->remaining -= len;
+
+  buffer = gss_buffer_pool_soup_buffer_new (chunk, len);
+  soup_message_body_append_buffer (msg->response_body, buffer);
+  soup_buffer_free (buffer);
 }
 
 static void
@@ -82,8 +105,8 @@ vod_resource_chunked (GssTransaction * t)
 {
   GssProgram *program = (GssProgram *) t->resource->priv;
   GssVOD *vod;
-  char *chunk;
-  int len;
+  struct stat st;
+  goffset offset;
   char *s;
 
   vod = g_malloc0 (sizeof (GssVOD));
@@ -103,23 +126,29 @@ vod_resource_chunked (GssTransaction * t)
   }
   g_free (s);
 
-  soup_message_set_status (t->msg, SOUP_STATUS_OK);
-
-  soup_message_headers_set_encoding (t->msg->response_headers,
-      SOUP_ENCODING_CHUNKED);
-
-  chunk = g_malloc (SIZE);
-  len = read (vod->fd, chunk, 65536);
-  if (len < 0) {
-    GST_ERROR_OBJECT (program, "read error");
+  /* the file is read piecewise, from where the range starts */
+  if (fstat (vod->fd, &st) < 0 ||
+      !gss_transaction_get_range (t, st.st_size, &offset, &vod->remaining) ||
+      (offset > 0 && lseek (vod->fd, offset, SEEK_SET) != offset)) {
+    if (t->msg->status_code != SOUP_STATUS_REQUESTED_RANGE_NOT_SATISFIABLE) {
+      GST_ERROR_OBJECT (program, "failed to stat or seek archive file");
+      soup_message_set_status (t->msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+    }
+    close (vod->fd);
+    g_free (vod);
+    return;
   }
 
-  soup_message_body_append (t->msg->response_body, SOUP_MEMORY_TAKE, chunk,
-      len);
+  soup_message_headers_set_encoding (t->msg->response_headers,
+      SOUP_ENCODING_CONTENT_LENGTH);
+  soup_message_headers_set_content_length (t->msg->response_headers,
+      vod->remaining);
 
   g_signal_connect (t->msg, "wrote-chunk", G_CALLBACK (vod_wrote_chunk), vod);
   g_signal_connect (t->msg, "finished", G_CALLBACK (vod_finished), vod);
 
+  vod_wrote_chunk (t->msg, vod);
+
 }
 
 void
@@ -0,0 +1,139 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gst-streaming-server/gss-server.h"
+
+#include <string.h>
+
+#define PMT_PID 0x100
+#define VIDEO_PID 0x101
+
+static const guint8 pat[] = {
+  0x00, 0x00, 0xb0, 0x0d, 0x00, 0x01, 0xc1, 0x00, 0x00,
+  0x00, 0x01, 0xe1, 0x00, 0x00, 0x00, 0x00, 0x00
+};
+
+static const guint8 pmt[] = {
+  0x00, 0x02, 0xb0, 0x12, 0x00, 0x01, 0xc1, 0x00, 0x00,
+  0xe1, 0x01, 0xf0, 0x00, 0x1b, 0xe1, 0x01, 0xf0, 0x00,
+  0x00, 0x00, 0x00, 0x00
+};
+
+/* PES header with a PTS, then an access unit delimiter and the start
+ * of the first slice */
+static const guint8 pes[] = {
+  0x00, 0x00, 0x01, 0xe0, 0x00, 0x00, 0x80, 0x80, 0x05,
+  0x21, 0x00, 0x01, 0x00, 0x01,
+  0x00, 0x00, 0x00, 0x01, 0x09, 0xf0, 0x00, 0x00, 0x00, 0x01
+};
+
+static guint8 *
+add_packet (guint8 * p, int pid, const guint8 * payload, int size)
+{
+  memset (p, 0xff, GSS_TS_PACKET_SIZE);
+  p[0] = 0x47;
+  p[1] = 0x40 | (pid >> 8);
+  p[2] = pid & 0xff;
+  p[3] = 0x10;
+  memcpy (p + 4, payload, size);
+
+  return p + GSS_TS_PACKET_SIZE;
+}
+
+static guint8 *
+add_access_unit (guint8 * p, gboolean idr)
+{
+  guint8 payload[sizeof (pes) + 1];
+
+  if (idr) {
+    p = add_packet (p, 0, pat, sizeof (pat));
+    p = add_packet (p, PMT_PID, pmt, sizeof (pmt));
+  }
+  memcpy (payload, pes, sizeof (pes));
+  payload[sizeof (pes)] = idr ? 0x65 : 0x41;
+
+  return add_packet (p, VIDEO_PID, payload, sizeof (payload));
+}
+
+/* The segmenter cuts where an IDR access unit starts, which here is in
+ * the middle of the second buffer.  That IDR access unit is completed
+ * by the same buffer, but belongs to the next segment. */
+static void
+test_cut_in_buffer (void)
+{
+  GssTsScanner *scanner;
+  guint8 data[8 * GSS_TS_PACKET_SIZE];
+  guint8 *p;
+  GssTsIFrame *f;
+  guint64 idr_offset;
+  guint64 idr_pts;
+  gsize size;
+
+  scanner = gss_ts_scanner_new ();
+
+  p = add_access_unit (data, TRUE);
+  size = p - data;
+  g_assert (gss_ts_scanner_push (scanner, data, size, &idr_offset,
+          &idr_pts));
+  g_assert_cmpuint (idr_offset, ==, 0);
+  g_assert_cmpuint (idr_pts, ==, 0);
+  g_assert_cmpuint (scanner->iframes->len, ==, 0);
+
+  p = add_access_unit (data, FALSE);
+  p = add_access_unit (p, TRUE);
+  p = add_access_unit (p, FALSE);
+  g_assert (gss_ts_scanner_push (scanner, data, p - data, &idr_offset,
+          NULL));
+  g_assert_cmpuint (idr_offset, ==, size + GSS_TS_PACKET_SIZE);
+  g_assert_cmpuint (scanner->iframes->len, ==, 2);
+
+  /* only the first one is in the segment that ends at the cut */
+  g_assert_cmpuint (gss_ts_scanner_count_iframes (scanner, idr_offset), ==,
+      1);
+  f = &g_array_index (scanner->iframes, GssTsIFrame, 0);
+  g_assert_cmpuint (f->offset, ==, 0);
+  g_assert_cmpuint (f->size, ==, size);
+  g_array_remove_range (scanner->iframes, 0, 1);
+
+  f = &g_array_index (scanner->iframes, GssTsIFrame, 0);
+  g_assert_cmpuint (f->offset, ==, idr_offset);
+  g_assert_cmpuint (f->size, ==, 3 * GSS_TS_PACKET_SIZE);
+  g_assert_cmpuint (gss_ts_scanner_count_iframes (scanner, idr_offset), ==,
+      0);
+  g_assert_cmpuint (gss_ts_scanner_count_iframes (scanner, G_MAXUINT64), ==,
+      1);
+
+  gss_ts_scanner_free (scanner);
+}
+
+int
+main (int argc, char *argv[])
+{
+  gst_init (&argc, &argv);
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/tsscan/cut-in-buffer", test_cut_in_buffer);
+
+  return g_test_run ();
+}
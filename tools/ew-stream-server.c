@@ -137,6 +137,7 @@ main (int argc, char *argv[])
 {
   GError *error = NULL;
   GOptionContext *context;
+  GList *g;
   int i;
 
 #if !GLIB_CHECK_VERSION (2, 31, 0)
@@ -187,6 +188,11 @@ main (int argc, char *argv[])
   gss_config_attach (G_OBJECT (manager));
   gss_manager_add_resources (manager, server);
 
+  for (g = server->delivery_profiles; g; g = g_list_next (g)) {
+    gss_config_attach (G_OBJECT (g->data));
+    gss_delivery_profile_add_resources (g->data, server);
+  }
+
   for (i = 0; i < 1; i++) {
     char *key;
 
@@ -0,0 +1,842 @@
+/* GStreamer Streaming Server
+ * Copyright (C) 2009-2012 Entropy Wave Inc <info@entropywave.com>
+ * Copyright (C) 2009-2012 David Schleef <ds@schleef.org>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+
+/* Microbenchmarks for the performance sensitive parts of the server.
+ *
+ *   gss-bench tsscan     MPEG-TS scanner throughput
+ *   gss-bench aes        HLS segment encryption throughput
+ *   gss-bench fanout     Live stream clients per egress core
+ *   gss-bench gop        Time to first frame for joining clients
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gst-streaming-server/gss-server.h"
+
+#include <string.h>
+#include <stdlib.h>
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H)
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#define GETTEXT_PACKAGE "gss-bench"
+
+static int size_mb = 256;
+static int iterations = 4;
+static int n_clients = 1000;
+static int bitrate = 4000;
+static int duration = 10;
+static int n_shards = 1;
+static gboolean io_uring = FALSE;
+static gboolean zero_copy = FALSE;
+static int gop_cache = 1;
+static int pacing = 0;
+
+static GOptionEntry entries[] = {
+  {"size", 's', 0, G_OPTION_ARG_INT, &size_mb, "Amount of test data (MB)",
+      NULL},
+  {"iterations", 'i', 0, G_OPTION_ARG_INT, &iterations,
+      "Number of passes over the test data", NULL},
+  {"clients", 'c', 0, G_OPTION_ARG_INT, &n_clients,
+      "Number of clients (fanout)", NULL},
+  {"bitrate", 'b', 0, G_OPTION_ARG_INT, &bitrate,
+      "Stream bitrate (kbps, fanout)", NULL},
+  {"duration", 'd', 0, G_OPTION_ARG_INT, &duration,
+      "Length of the stream (s, fanout)", NULL},
+  {"shards", 'k', 0, G_OPTION_ARG_INT, &n_shards,
+      "Egress threads, 0 for one per core (fanout)", NULL},
+  {"io-uring", 'u', 0, G_OPTION_ARG_NONE, &io_uring,
+      "Send with io_uring if the kernel has it (fanout)", NULL},
+  {"zero-copy", 'z', 0, G_OPTION_ARG_NONE, &zero_copy,
+      "Send with sendfile() from a staging file (fanout)", NULL},
+  {"gop-cache", 'g', 0, G_OPTION_ARG_INT, &gop_cache,
+      "GOPs new clients start back, 0 for the next keyframe (gop)", NULL},
+  {"pacing", 'p', 0, G_OPTION_ARG_INT, &pacing,
+      "Client rate in percent of the bitrate, 0 for unpaced (burst)", NULL},
+
+  {NULL}
+
+};
+
+typedef struct _Benchmark Benchmark;
+struct _Benchmark
+{
+  const char *name;
+  void (*func) (void);
+  const char *description;
+};
+
+
+/* Synthetic transport stream: PAT/PMT, an H.264 video PID with an IDR
+ * access unit every 60 frames and an audio PID.  Random access
+ * indicators are deliberately not set, so the scanner has to look at
+ * the NAL units. */
+
+#define BENCH_PMT_PID 0x1000
+#define BENCH_VIDEO_PID 0x100
+#define BENCH_AUDIO_PID 0x101
+
+typedef struct _TsWriter TsWriter;
+struct _TsWriter
+{
+  guint8 *data;
+  gsize size;
+  gsize offset;
+  int cc[0x2000];
+};
+
+static gboolean
+ts_writer_packet (TsWriter * w, int pid, gboolean pusi, const guint8 * payload,
+    int len)
+{
+  guint8 *p;
+  int stuffing;
+
+  if (w->offset + 188 > w->size)
+    return FALSE;
+
+  p = w->data + w->offset;
+  len = MIN (len, 184);
+  stuffing = 184 - len;
+
+  p[0] = 0x47;
+  p[1] = (pusi ? 0x40 : 0) | (pid >> 8);
+  p[2] = pid & 0xff;
+  p[3] = (stuffing ? 0x30 : 0x10) | (w->cc[pid]++ & 0xf);
+  if (stuffing) {
+    p[4] = stuffing - 1;
+    if (stuffing > 1) {
+      p[5] = 0;
+      memset (p + 6, 0xff, stuffing - 2);
+    }
+  }
+  memcpy (p + 4 + stuffing, payload, len);
+  w->offset += 188;
+
+  return TRUE;
+}
+
+static gboolean
+ts_writer_psi (TsWriter * w)
+{
+  static const guint8 pat[] = {
+    0x00, 0x00, 0xb0, 0x0d, 0x00, 0x01, 0xc1, 0x00, 0x00,
+    0x00, 0x01, 0xf0, 0x00, 0x00, 0x00, 0x00, 0x00
+  };
+  static const guint8 pmt[] = {
+    0x00, 0x02, 0xb0, 0x17, 0x00, 0x01, 0xc1, 0x00, 0x00,
+    0xe1, 0x00, 0xf0, 0x00,
+    0x1b, 0xe1, 0x00, 0xf0, 0x00,
+    0x0f, 0xe1, 0x01, 0xf0, 0x00,
+    0x00, 0x00, 0x00, 0x00
+  };
+
+  return ts_writer_packet (w, 0, TRUE, pat, sizeof (pat)) &&
+      ts_writer_packet (w, BENCH_PMT_PID, TRUE, pmt, sizeof (pmt));
+}
+
+static gboolean
+ts_writer_pes (TsWriter * w, int pid, guint64 pts, const guint8 * es, int len)
+{
+  guint8 header[14];
+  guint8 payload[184];
+  int n;
+
+  header[0] = 0;
+  header[1] = 0;
+  header[2] = 1;
+  header[3] = (pid == BENCH_VIDEO_PID) ? 0xe0 : 0xc0;
+  header[4] = 0;
+  header[5] = 0;
+  header[6] = 0x80;
+  header[7] = 0x80;
+  header[8] = 5;
+  header[9] = 0x21 | ((pts >> 29) & 0x0e);
+  header[10] = pts >> 22;
+  header[11] = 0x01 | ((pts >> 14) & 0xfe);
+  header[12] = pts >> 7;
+  header[13] = 0x01 | ((pts << 1) & 0xfe);
+
+  memcpy (payload, header, 14);
+  n = MIN (len, 184 - 14);
+  memcpy (payload + 14, es, n);
+  if (!ts_writer_packet (w, pid, TRUE, payload, 14 + n))
+    return FALSE;
+
+  while (n < len) {
+    int m = MIN (len - n, 184);
+
+    if (!ts_writer_packet (w, pid, FALSE, es + n, m))
+      return FALSE;
+    n += m;
+  }
+
+  return TRUE;
+}
+
+static int
+ts_generate (guint8 * data, gsize size)
+{
+  static const guint8 idr_prefix[] = {
+    0, 0, 0, 1, 0x09, 0x10,
+    0, 0, 0, 1, 0x67, 0x42, 0xc0, 0x1e,
+    0, 0, 0, 1, 0x68, 0xce, 0x3c, 0x80,
+    0, 0, 0, 1, 0x65
+  };
+  static const guint8 slice_prefix[] = {
+    0, 0, 0, 1, 0x09, 0x30,
+    0, 0, 0, 1, 0x41
+  };
+  TsWriter *w;
+  guint8 *es;
+  int frame;
+  int n_idr = 0;
+
+  w = g_new0 (TsWriter, 1);
+  w->data = data;
+  w->size = size;
+
+  /* slice data without emulated start codes */
+  es = g_malloc (40000);
+  for (frame = 0; frame < 40000; frame++) {
+    es[frame] = g_random_int_range (1, 256);
+  }
+
+  for (frame = 0;; frame++) {
+    guint64 pts = 90000 + frame * 3003;
+    gboolean idr = (frame % 60) == 0;
+    int len = idr ? 40000 : 4000;
+
+    if (frame % 10 == 0 && !ts_writer_psi (w))
+      break;
+
+    if (idr) {
+      memcpy (es, idr_prefix, sizeof (idr_prefix));
+    } else {
+      memcpy (es, slice_prefix, sizeof (slice_prefix));
+    }
+    if (!ts_writer_pes (w, BENCH_VIDEO_PID, pts, es, len))
+      break;
+    if (idr)
+      n_idr++;
+
+    if (!ts_writer_pes (w, BENCH_AUDIO_PID, pts, es + 1000, 400))
+      break;
+  }
+
+  /* pad with null packets */
+  while (ts_writer_packet (w, 0x1fff, FALSE, es, 184));
+
+  g_free (es);
+  g_free (w);
+
+  return n_idr;
+}
+
+static void
+bench_tsscan (void)
+{
+  gsize size = (gsize) size_mb * 1024 * 1024;
+  guint8 *data;
+  gint64 start, elapsed;
+  int expected;
+  int found = 0;
+  int n_iframes = 0;
+  int i;
+
+  size -= size % 188;
+  data = g_malloc (size);
+  expected = ts_generate (data, size);
+
+  start = g_get_monotonic_time ();
+  for (i = 0; i < iterations; i++) {
+    GssTsScanner *scanner;
+    gsize offset;
+
+    scanner = gss_ts_scanner_new ();
+    /* the muxer typically hands out 7 packets at a time */
+    for (offset = 0; offset < size; offset += 188 * 7) {
+      if (gss_ts_scanner_push (scanner, data + offset,
+              MIN (188 * 7, size - offset), NULL, NULL)) {
+        found++;
+      }
+      n_iframes += scanner->iframes->len;
+      g_array_set_size (scanner->iframes, 0);
+    }
+    gss_ts_scanner_free (scanner);
+  }
+  elapsed = g_get_monotonic_time () - start;
+
+  g_print ("tsscan: %d MB x %d in %.3f s: %.2f GB/s per core\n",
+      size_mb, iterations, elapsed / 1e6,
+      ((double) size * iterations / (1 << 30)) / (elapsed / 1e6));
+  g_print ("tsscan: found %d of %d IDR access units, %d complete\n", found,
+      expected * iterations, n_iframes);
+
+  g_free (data);
+}
+
+/* Encrypts the data the way the segmenter does, in muxer sized pieces,
+ * once with each AES implementation available. */
+static void
+bench_aes (void)
+{
+  gsize size = (gsize) size_mb * 1024 * 1024;
+  guint8 key[16];
+  guint8 iv[16];
+  guint8 *data;
+  guint8 *dest;
+  int pass;
+
+  data = g_malloc (size);
+  dest = g_malloc (size + GSS_AES_BLOCK_SIZE);
+  ts_generate (data, size - size % 188);
+  memset (key, 0x5a, sizeof (key));
+  memset (iv, 0, sizeof (iv));
+
+  for (pass = 0; pass < 2; pass++) {
+    gboolean accelerated;
+    gint64 start, elapsed;
+    int i;
+
+    accelerated = gss_aes_set_accelerated (pass == 0);
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < iterations; i++) {
+      GssAesCbc cbc;
+      gsize offset;
+      gsize n = 0;
+
+      gss_aes_cbc_init (&cbc, key, iv);
+      for (offset = 0; offset < size; offset += 188 * 7) {
+        n += gss_aes_cbc_encrypt (&cbc, dest + n, data + offset,
+            MIN (188 * 7, size - offset));
+      }
+      gss_aes_cbc_finish (&cbc, dest + n);
+    }
+    elapsed = g_get_monotonic_time () - start;
+
+    g_print ("aes: %s: %d MB x %d in %.3f s: %.1f MB/s per core\n",
+        accelerated ? "AES-NI" : "portable", size_mb, iterations,
+        elapsed / 1e6, ((double) size * iterations / (1 << 20)) /
+        (elapsed / 1e6));
+
+    /* without AES-NI, the first pass measured the portable code */
+    if (pass == 0 && !accelerated)
+      break;
+  }
+  gss_aes_set_accelerated (TRUE);
+
+  g_free (dest);
+  g_free (data);
+}
+
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H)
+typedef struct _FanoutDrain FanoutDrain;
+struct _FanoutDrain
+{
+  int epoll_fd;
+  volatile gint running;
+  guint64 bytes;
+};
+
+/* Reads everything the clients get, so the sockets keep draining */
+static gpointer
+fanout_drain_thread (gpointer data)
+{
+  FanoutDrain *drain = data;
+  struct epoll_event events[256];
+  guint8 *buffer;
+
+  buffer = g_malloc (65536);
+  while (g_atomic_int_get (&drain->running)) {
+    int n;
+    int i;
+
+    n = epoll_wait (drain->epoll_fd, events, G_N_ELEMENTS (events), 100);
+    for (i = 0; i < n; i++) {
+      gssize len;
+
+      while ((len = read (events[i].data.fd, buffer, 65536)) > 0) {
+        drain->bytes += len;
+      }
+    }
+  }
+  g_free (buffer);
+
+  return NULL;
+}
+
+/* Connects a client to the fanout over a socket pair, the drain reads
+ * the other end */
+static void
+fanout_add_client (GssFanout * fanout, FanoutDrain * drain, int *fds)
+{
+  struct epoll_event event;
+
+  if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) < 0) {
+    g_print ("fanout: socketpair failed\n");
+    exit (1);
+  }
+  memset (&event, 0, sizeof (event));
+  event.events = EPOLLIN | EPOLLET;
+  event.data.fd = fds[0];
+  epoll_ctl (drain->epoll_fd, EPOLL_CTL_ADD, fds[0], &event);
+  gss_fanout_add (fanout, fds[1]);
+}
+
+/* Raises the fd limit, each client takes a socket pair and a
+ * duplicate */
+static void
+fanout_limit_clients (void)
+{
+  struct rlimit rl;
+
+  if (getrlimit (RLIMIT_NOFILE, &rl) == 0) {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit (RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < (rlim_t) n_clients * 3 + 64) {
+      n_clients = (rl.rlim_cur - 64) / 3;
+      g_print ("fanout: limited to %d clients by RLIMIT_NOFILE\n", n_clients);
+    }
+  }
+}
+
+static GstBuffer *
+fanout_buffer_new (guint8 * data, gsize size, gboolean keyframe)
+{
+  GstBuffer *buffer;
+
+#if GST_CHECK_VERSION(1,0,0)
+  buffer = gst_buffer_new_wrapped_full (0, data, size, 0, size, NULL, NULL);
+#else
+  buffer = gst_buffer_new ();
+  GST_BUFFER_DATA (buffer) = data;
+  GST_BUFFER_SIZE (buffer) = size;
+#endif
+  if (!keyframe) {
+    GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+  }
+
+  return buffer;
+}
+
+/* Sends a live stream to clients on Unix domain sockets, at the given
+ * bitrate, and measures how much CPU the egress threads use.
+ * The stream is fed in muxer sized buffers, 10 ms worth at a time. */
+static void
+bench_fanout (void)
+{
+  gsize size = (gsize) bitrate * 1000 / 8 * duration;
+  gsize chunk = 188 * 7;
+  gsize per_tick = (gsize) bitrate * 1000 / 8 / 100;
+  FanoutDrain drain = { 0 };
+  GssFanout *fanout;
+  GThread *thread;
+  guint8 *data;
+  int *fds;
+  gint64 start, elapsed;
+  guint64 bytes_sent, n_writes;
+  guint64 n_syscalls = 0;
+  gint64 cpu_time;
+  gsize offset;
+  GssFanoutFlags flags = 0;
+  const char *engine;
+  int fanout_shards;
+  int i;
+
+  gst_init (NULL, NULL);
+  fanout_limit_clients ();
+
+  size -= size % chunk;
+  data = g_malloc (size);
+  ts_generate (data, size);
+
+  if (io_uring)
+    flags |= GSS_FANOUT_FLAG_IO_URING;
+  if (zero_copy)
+    flags |= GSS_FANOUT_FLAG_ZERO_COPY;
+  fanout = gss_fanout_new (n_shards, flags, NULL, NULL);
+  if (fanout == NULL) {
+    g_print ("fanout: failed to start\n");
+    g_free (data);
+    return;
+  }
+
+  drain.epoll_fd = epoll_create (n_clients);
+  drain.running = TRUE;
+  fds = g_new (int, n_clients * 2);
+  for (i = 0; i < n_clients; i++) {
+    fanout_add_client (fanout, &drain, fds + i * 2);
+  }
+#if GLIB_CHECK_VERSION(2,32,0)
+  thread = g_thread_new ("drain", fanout_drain_thread, &drain);
+#else
+  thread = g_thread_create (fanout_drain_thread, &drain, TRUE, NULL);
+#endif
+
+  start = g_get_monotonic_time ();
+  for (offset = 0; offset < size; offset += chunk) {
+    GstBuffer *buffer;
+    gint64 due;
+
+    /* a keyframe every two seconds */
+    buffer = fanout_buffer_new (data + offset, chunk,
+        offset % (per_tick * 200) < chunk);
+    gss_fanout_push (fanout, buffer);
+    gst_buffer_unref (buffer);
+
+    due = start + (gint64) (offset / per_tick) * 10000;
+    if (due > g_get_monotonic_time ()) {
+      g_usleep (due - g_get_monotonic_time ());
+    }
+  }
+  /* let the clients catch up */
+  g_usleep (G_USEC_PER_SEC / 2);
+  elapsed = g_get_monotonic_time () - start;
+
+  gss_fanout_get_stats (fanout, NULL, &bytes_sent, &n_writes, &cpu_time);
+  fanout_shards = fanout->n_shards;
+  if (fanout->stage_fd >= 0) {
+    engine = "zero-copy";
+  } else {
+    engine = fanout->shards[0]->uring ? "io_uring" : "epoll";
+  }
+  for (i = 0; i < fanout->n_shards; i++) {
+    n_syscalls += fanout->shards[i]->n_syscalls;
+  }
+  gss_fanout_free (fanout);
+  g_atomic_int_set (&drain.running, FALSE);
+  g_thread_join (thread);
+
+  g_print ("fanout: %d clients at %d kbps for %.1f s: %d %s egress "
+      "threads at %.1f%% of a core\n", n_clients, bitrate, elapsed / 1e6,
+      fanout_shards, engine, 100.0 * cpu_time / (elapsed * 1000.0));
+  g_print ("fanout: %.1f MB/s, %.1f kB per write, %.1f writes per system "
+      "call, %.0f clients per core\n",
+      (double) bytes_sent / (1 << 20) / (elapsed / 1e6),
+      n_writes ? (double) bytes_sent / n_writes / 1024 : 0.0,
+      n_syscalls ? (double) n_writes / n_syscalls : 0.0,
+      cpu_time ? n_clients * (elapsed * 1000.0) / cpu_time : 0.0);
+  /* core seconds per Gbit, the same as cores per Gbit/s */
+  g_print ("fanout: %.3f CPU seconds per Gbit sent\n",
+      bytes_sent ? cpu_time / 1e9 / (bytes_sent * 8 / 1e9) : 0.0);
+  g_print ("fanout: clients got %.1f%% of the stream\n",
+      100.0 * drain.bytes / ((double) size * n_clients));
+
+  for (i = 0; i < n_clients * 2; i++) {
+    close (fds[i]);
+  }
+  close (drain.epoll_fd);
+  g_free (fds);
+  g_free (data);
+}
+
+/* Clients join a live stream with a keyframe every two seconds, evenly
+ * spread over its length, and the time until each has the headers and
+ * its first keyframe is measured */
+static void
+bench_gop (void)
+{
+  gsize size = (gsize) bitrate * 1000 / 8 * duration;
+  gsize chunk = 188 * 7;
+  gsize per_tick = (gsize) bitrate * 1000 / 8 / 100;
+  guint8 header[188 * 2];
+  FanoutDrain drain = { 0 };
+  GssFanout *fanout;
+  GstBuffer *buffer;
+  GThread *thread;
+  guint8 *data;
+  int *fds;
+  gint64 start;
+  guint64 n_started;
+  gint64 avg_time, max_time;
+  guint64 bytes_sent;
+  gsize offset;
+  int n_joined = 0;
+  int i;
+
+  gst_init (NULL, NULL);
+  fanout_limit_clients ();
+
+  size -= size % chunk;
+  data = g_malloc (size);
+  ts_generate (data, size);
+  memcpy (header, data, sizeof (header));
+
+  fanout = gss_fanout_new (n_shards, 0, NULL, NULL);
+  if (fanout == NULL) {
+    g_print ("gop: failed to start\n");
+    g_free (data);
+    return;
+  }
+  gss_fanout_set_gop_cache (fanout, gop_cache);
+
+  drain.epoll_fd = epoll_create (n_clients);
+  drain.running = TRUE;
+  fds = g_new (int, n_clients * 2);
+#if GLIB_CHECK_VERSION(2,32,0)
+  thread = g_thread_new ("drain", fanout_drain_thread, &drain);
+#else
+  thread = g_thread_create (fanout_drain_thread, &drain, TRUE, NULL);
+#endif
+
+  /* PAT and PMT, as the stream headers */
+  buffer = fanout_buffer_new (header, sizeof (header), FALSE);
+  GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_HEADER);
+  gss_fanout_push (fanout, buffer);
+  gst_buffer_unref (buffer);
+
+  start = g_get_monotonic_time ();
+  for (offset = 0; offset < size; offset += chunk) {
+    gint64 due;
+
+    while (n_joined < n_clients &&
+        (guint64) n_joined * size <= (guint64) offset * n_clients) {
+      fanout_add_client (fanout, &drain, fds + n_joined * 2);
+      n_joined++;
+    }
+
+    buffer = fanout_buffer_new (data + offset, chunk,
+        offset % (per_tick * 200) < chunk);
+    gss_fanout_push (fanout, buffer);
+    gst_buffer_unref (buffer);
+
+    due = start + (gint64) (offset / per_tick) * 10000;
+    if (due > g_get_monotonic_time ()) {
+      g_usleep (due - g_get_monotonic_time ());
+    }
+  }
+  g_usleep (G_USEC_PER_SEC / 2);
+
+  gss_fanout_get_start_stats (fanout, &n_started, &avg_time, &max_time);
+  gss_fanout_get_stats (fanout, NULL, &bytes_sent, NULL, NULL);
+  gss_fanout_free (fanout);
+  g_atomic_int_set (&drain.running, FALSE);
+  g_thread_join (thread);
+
+  g_print ("gop: %d of %d clients started with a GOP cache of %d, "
+      "keyframes every 2.0 s\n", (int) n_started, n_joined, gop_cache);
+  g_print ("gop: time to first frame %.1f ms on average, %.1f ms at most\n",
+      avg_time / 1000.0, max_time / 1000.0);
+  g_print ("gop: %.1f kB sent per client\n",
+      n_joined ? (double) bytes_sent / n_joined / 1024 : 0.0);
+
+  for (i = 0; i < n_joined * 2; i++) {
+    close (fds[i]);
+  }
+  close (drain.epoll_fd);
+  g_free (fds);
+  g_free (data);
+}
+
+/* All clients join at once, as when a popular program restarts, after
+ * the stream has run for two GOPs, which they get from the GOP cache.
+ * The egress is sampled every 100 ms, with the clients paced at the
+ * given percentage of the bitrate or not at all. */
+static void
+bench_burst (void)
+{
+  gsize size = (gsize) bitrate * 1000 / 8 * duration;
+  gsize chunk = 188 * 7;
+  gsize per_tick = (gsize) bitrate * 1000 / 8 / 100;
+  gsize lead = per_tick * 400;
+  guint8 header[188 * 2];
+  FanoutDrain drain = { 0 };
+  GssFanout *fanout;
+  GstBuffer *buffer;
+  GThread *thread;
+  guint8 *data;
+  int *fds;
+  gint64 start, window_start;
+  guint64 window_bytes = 0;
+  guint64 n_started;
+  gint64 avg_time, max_time;
+  double peak = 0;
+  gsize offset;
+  int i;
+
+  gst_init (NULL, NULL);
+  fanout_limit_clients ();
+
+  size -= size % chunk;
+  lead -= lead % chunk;
+  if (lead >= size) {
+    g_print ("burst: needs a duration of more than 4 s\n");
+    return;
+  }
+  data = g_malloc (size);
+  ts_generate (data, size);
+  memcpy (header, data, sizeof (header));
+
+  fanout = gss_fanout_new (n_shards, io_uring ? GSS_FANOUT_FLAG_IO_URING : 0,
+      NULL, NULL);
+  if (fanout == NULL) {
+    g_print ("burst: failed to start\n");
+    g_free (data);
+    return;
+  }
+  gss_fanout_set_gop_cache (fanout, 2);
+
+  drain.epoll_fd = epoll_create (n_clients);
+  drain.running = TRUE;
+  fds = g_new (int, n_clients * 2);
+#if GLIB_CHECK_VERSION(2,32,0)
+  thread = g_thread_new ("drain", fanout_drain_thread, &drain);
+#else
+  thread = g_thread_create (fanout_drain_thread, &drain, TRUE, NULL);
+#endif
+
+  buffer = fanout_buffer_new (header, sizeof (header), FALSE);
+  GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_HEADER);
+  gss_fanout_push (fanout, buffer);
+  gst_buffer_unref (buffer);
+
+  /* the clients are not there yet, so this goes as fast as it can */
+  for (offset = 0; offset < lead; offset += chunk) {
+    buffer = fanout_buffer_new (data + offset, chunk,
+        offset % (per_tick * 200) < chunk);
+    gss_fanout_push (fanout, buffer);
+    gst_buffer_unref (buffer);
+  }
+
+  for (i = 0; i < n_clients; i++) {
+    fanout_add_client (fanout, &drain, fds + i * 2);
+    if (pacing > 0) {
+      gss_fanout_set_client_rate (fanout, fds[i * 2 + 1],
+          (gint64) bitrate * 1000 / 8 * pacing / 100);
+    }
+  }
+
+  start = g_get_monotonic_time () - (gint64) (lead / per_tick) * 10000;
+  window_start = g_get_monotonic_time ();
+  for (; offset < size; offset += chunk) {
+    gint64 due;
+    gint64 now;
+
+    buffer = fanout_buffer_new (data + offset, chunk,
+        offset % (per_tick * 200) < chunk);
+    gss_fanout_push (fanout, buffer);
+    gst_buffer_unref (buffer);
+
+    due = start + (gint64) (offset / per_tick) * 10000;
+    if (due > g_get_monotonic_time ()) {
+      g_usleep (due - g_get_monotonic_time ());
+    }
+
+    now = g_get_monotonic_time ();
+    if (now - window_start >= G_USEC_PER_SEC / 10) {
+      guint64 bytes = drain.bytes;
+
+      peak = MAX (peak, (double) (bytes - window_bytes) / (now -
+              window_start));
+      window_bytes = bytes;
+      window_start = now;
+    }
+  }
+  g_usleep (G_USEC_PER_SEC / 2);
+
+  gss_fanout_get_start_stats (fanout, &n_started, &avg_time, &max_time);
+  gss_fanout_free (fanout);
+  g_atomic_int_set (&drain.running, FALSE);
+  g_thread_join (thread);
+
+  if (pacing > 0) {
+    g_print ("burst: %d clients joined at once, paced at %d%% of %d kbps\n",
+        n_clients, pacing, bitrate);
+  } else {
+    g_print ("burst: %d clients joined at once, unpaced, at %d kbps\n",
+        n_clients, bitrate);
+  }
+  /* bytes per us are MB/s */
+  g_print ("burst: peak egress %.1f MB/s over 100 ms, %.1f MB/s for the "
+      "stream itself\n", peak, (double) bitrate * n_clients / 8000);
+  g_print ("burst: %d clients got their first frame after %.1f ms on "
+      "average, %.1f ms at most\n", (int) n_started, avg_time / 1000.0,
+      max_time / 1000.0);
+  g_print ("burst: %.1f kB sent per client\n",
+      (double) drain.bytes / n_clients / 1024);
+
+  for (i = 0; i < n_clients * 2; i++) {
+    close (fds[i]);
+  }
+  close (drain.epoll_fd);
+  g_free (fds);
+  g_free (data);
+}
+#endif
+
+
+static const Benchmark benchmarks[] = {
+  {"tsscan", bench_tsscan, "MPEG-TS scanner throughput"},
+  {"aes", bench_aes, "HLS segment encryption throughput"},
+#if defined(HAVE_SYS_EPOLL_H) && defined(HAVE_SYS_EVENTFD_H)
+  {"fanout", bench_fanout, "Live stream clients per egress core"},
+  {"gop", bench_gop, "Time to first frame for joining clients"},
+  {"burst", bench_burst, "Peak egress when all clients join at once"},
+#endif
+};
+
+int
+main (int argc, char *argv[])
+{
+  GError *error = NULL;
+  GOptionContext *context;
+  gboolean ran = FALSE;
+  int i, j;
+
+  context = g_option_context_new ("[BENCHMARK...] - Streaming Server "
+      "microbenchmarks");
+  g_option_context_add_main_entries (context, entries, GETTEXT_PACKAGE);
+  if (!g_option_context_parse (context, &argc, &argv, &error)) {
+    g_print ("option parsing failed: %s\n", error->message);
+    exit (1);
+  }
+  g_option_context_free (context);
+
+  for (i = 0; i < G_N_ELEMENTS (benchmarks); i++) {
+    gboolean run = (argc < 2);
+
+    for (j = 1; j < argc; j++) {
+      if (strcmp (argv[j], benchmarks[i].name) == 0)
+        run = TRUE;
+    }
+    if (run) {
+      benchmarks[i].func ();
+      ran = TRUE;
+    }
+  }
+
+  if (!ran) {
+    g_print ("available benchmarks:\n");
+    for (i = 0; i < G_N_ELEMENTS (benchmarks); i++) {
+      g_print ("  %-12s %s\n", benchmarks[i].name, benchmarks[i].description);
+    }
+    exit (1);
+  }
+
+  return 0;
+}
@@ -475,6 +475,7 @@ gss_vts_stop (GssProgram * program)
 {
   GssVts *vts = GSS_VTS (program);
 
+  gss_stream_set_sink (GSS_STREAM (vts->stream), NULL);
   gst_element_set_state (vts->pipeline, GST_STATE_NULL);
 }
 